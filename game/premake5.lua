@@ -47,4 +47,9 @@ project (workspaceName)
 
     link_raylib()
 
+    -- Lockstep sessions talk over sockets, see src/sockets.cpp
+    filter "system:windows"
+        links {"ws2_32"}
+    filter {}
+
 -- To link to a lib use link_to("LIB_FOLDER_NAME")
\ No newline at end of file
@@ -0,0 +1,664 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Autosave
+*
+*   Saves the world in the background every few seconds without holding up the simulation.
+*   Each round the simulation thread copies out only the chunks that changed since the last
+*   round: packed chunks copy their blob, the rest what the packed format keeps of each cell.
+*   That is a few KB per chunk, the encoding, compression and disk writes all happen on a
+*   writer thread. A round is only started once the writer finished the last one.
+*
+*   On disk an autosave is a world file plus a journal next to it, <path>.log:
+*     header       u32 magic "PPJL", u32 generation of the world file it goes with
+*     chunk        u32 magic "PPJC", u32 round, i32 cx, cy, u32 size, u32 packed size,
+*                  u8 codec, u8 awake, u8 padding[2], u32 checksum of the data, then the data
+*     commit       u32 magic "PPJR", u32 round, u32 random state, u32 tick, u32 chunk count,
+*                  u32 checksum of the fields before it
+*   The first round writes the whole world file. Later rounds append their chunks, flush them
+*   to the disk and only then append and flush the commit, so a crash at any point leaves a
+*   round either whole or missing. Loading the world file replays every committed round and
+*   ignores whatever follows the last commit.
+*
+*   Once the journal outgrows the world file it is compacted: the newest copy of every chunk
+*   goes into a new world file under a new generation, written to <path>.tmp, flushed and
+*   renamed over the old one. The old journal no longer matches it and is ignored until it
+*   is started over, so the two never disagree.
+*
+*   Moving the streaming window or loading a world starts over with a whole world file.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define JOURNAL_MAGIC 0x4C4A5050        // "PPJL" read as a little endian u32
+#define RECORD_CHUNK 0x434A5050         // "PPJC"
+#define RECORD_COMMIT 0x524A5050        // "PPJR"
+#define COMPACT_MIN_BYTES (4 * 1024 * 1024)     // Journals never get compacted below this
+
+typedef struct journal_header_t {
+    unsigned int magic;
+    unsigned int generation;
+} journal_header_t;
+
+typedef struct journal_chunk_t {
+    unsigned int magic;
+    unsigned int round;
+    int cx;
+    int cy;
+    unsigned int size;
+    unsigned int packedSize;
+    unsigned char codec;
+    unsigned char awake;
+    unsigned char padding[2];
+    unsigned int checksum;
+} journal_chunk_t;
+
+typedef struct journal_commit_t {
+    unsigned int magic;
+    unsigned int round;
+    unsigned int randomState;
+    unsigned int tick;
+    unsigned int count;
+    unsigned int checksum;
+} journal_commit_t;
+
+// A chunk as the simulation left it, a copy of its packed blob or of its cells. Neither is
+// set for an empty chunk
+typedef struct captured_chunk_t {
+    int cx;
+    int cy;
+    chunk_blob_t blob;
+    chunk_cell_t* cells;
+    bool awake;
+} captured_chunk_t;
+
+typedef struct autosave_round_t {
+    captured_chunk_t* chunks;
+    int count;
+    bool full;                          // Every chunk, written as a new world file
+    world_file_info_t info;
+} autosave_round_t;
+
+// Where the newest copy of a chunk is, in the world file or in the journal
+typedef struct chunk_location_t {
+    world_chunk_entry_t entry;
+    bool inJournal;
+} chunk_location_t;
+
+typedef struct stored_files_t {
+    FILE* world;
+    FILE* journal;
+} stored_files_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static char savePath[256] = { 0 };
+static char journalPath[260] = { 0 };
+static char tempPath[260] = { 0 };
+static float interval = 0.0f;
+static bool enabled = false;
+static std::atomic<bool> needFull(true);        // Set by either side, cleared by the simulation
+
+// Simulation thread only
+static double nextRound = 0.0;
+static unsigned int changeStamp = 0;
+static int savedOriginX = 0;
+static int savedOriginY = 0;
+
+// Handed to the writer, guarded by writerMutex until writing is set
+static std::thread writer;
+static std::mutex writerMutex;
+static std::condition_variable writerWake;
+static autosave_round_t pending = { 0 };
+static std::atomic<bool> writing(false);
+static bool stopping = false;
+
+// Writer thread only
+static chunk_location_t* locations = NULL;
+static captured_chunk_t** roundChunks = NULL;   // Chunks of a full round by chunk index
+static FILE* journal = NULL;
+static unsigned long long worldBytes = 0;
+static unsigned long long journalBytes = 0;
+static unsigned int generation = 0;
+static unsigned int roundNumber = 0;
+static world_file_info_t savedInfo = { 0 };
+static unsigned char* lz = NULL;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool CaptureRound(particle_t** grid);
+static void WriterLoop(void);
+static void WriteWorld(autosave_round_t* round);
+static void WriteJournal(autosave_round_t* round);
+static void CompactJournal(void);
+static bool StartJournal(void);
+static void FreeRound(autosave_round_t* round);
+static world_chunk_t RoundChunk(int cx, int cy, void* user);
+static world_chunk_t StoredChunk(int cx, int cy, void* user);
+static bool ReplaceFile(const char* from, const char* to);
+static void SeekFile(FILE* file, unsigned long long offset);
+static unsigned int NextGeneration(void);
+static unsigned int Checksum(const void* data, size_t size);
+
+//----------------------------------------------------------------------------------
+// Autosave Functions Definition
+//----------------------------------------------------------------------------------
+
+// The first round comes one interval in and writes the whole world
+void InitAutosave(const char* path, float intervalSeconds) {
+    snprintf(savePath, sizeof(savePath), "%s", path);
+    snprintf(journalPath, sizeof(journalPath), "%s.log", savePath);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", savePath);
+    interval = intervalSeconds;
+
+    // Carry on from the generation already on disk, so a stale journal never matches
+    FILE* file = fopen(savePath, "rb");
+    if (file != NULL) {
+        world_header_t header = { 0 };
+        if (fread(&header, sizeof(header), 1, file) == 1) generation = header.generation;
+        fclose(file);
+    }
+
+    locations = (chunk_location_t*) calloc(sim->chunksX * sim->chunksY, sizeof(chunk_location_t));
+    roundChunks = (captured_chunk_t**) calloc(sim->chunksX * sim->chunksY, sizeof(captured_chunk_t*));
+    lz = (unsigned char*) malloc(LZ_MAX_BYTES(CHUNK_MAX_BYTES));
+
+    nextRound = GetTime() + interval;
+    needFull = true;
+    stopping = false;
+    enabled = true;
+    writer = std::thread(WriterLoop);
+}
+
+// Simulation thread, right after a snapshot was captured so the change stamps line up.
+// True when a round went to the writer
+bool UpdateAutosave(particle_t** grid) {
+    if (!enabled || GetTime() < nextRound) return false;
+
+    // A round still being written holds this one off until it is done
+    if (writing.load(std::memory_order_acquire)) return false;
+
+    nextRound = GetTime() + interval;
+    return CaptureRound(grid);
+}
+
+// The world was replaced as a whole, the next round writes all of it
+void RestartAutosave(void) {
+    needFull = true;
+}
+
+// Apply the committed rounds of the journal that goes with the world file at path. Called
+// by LoadWorldFile once the file itself is loaded
+bool ReplayAutosave(particle_t** grid, const char* path, unsigned int fileGeneration) {
+    char logPath[260];
+    snprintf(logPath, sizeof(logPath), "%s.log", path);
+
+    FILE* file = fopen(logPath, "rb");
+    if (file == NULL) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char* data = (unsigned char*) malloc(size > 0 ? size : 1);
+    bool read = (size > 0 && fread(data, 1, size, file) == (size_t)size);
+    fclose(file);
+
+    journal_header_t header = { 0 };
+    if (read && (size_t)size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC || header.generation != fileGeneration) {
+        // Written for an older world file, which the current one already includes
+        free(data);
+        return false;
+    }
+
+    // Find where the last whole round ends, anything after it was cut off by a crash
+    size_t at = sizeof(header), committed = at;
+    journal_commit_t last = { 0 };
+    unsigned int round = 0;
+    unsigned int count = 0;
+    while (at + 4 <= (size_t)size) {
+        unsigned int magic;
+        memcpy(&magic, data + at, 4);
+
+        if (magic == RECORD_CHUNK && at + sizeof(journal_chunk_t) <= (size_t)size) {
+            journal_chunk_t record;
+            memcpy(&record, data + at, sizeof(record));
+            const unsigned char* chunkData = data + at + sizeof(record);
+
+            if (at + sizeof(record) + record.size > (size_t)size || record.packedSize > CHUNK_MAX_BYTES ||
+                record.codec > CODEC_LZ || (record.codec == CODEC_PACKED && record.size != record.packedSize) ||
+                record.cx < 0 || record.cy < 0 || record.cx >= sim->chunksX || record.cy >= sim->chunksY ||
+                (count > 0 && record.round != round) || record.checksum != Checksum(chunkData, record.size)) break;
+
+            round = record.round;
+            count++;
+            at += sizeof(record) + record.size;
+        }
+        else if (magic == RECORD_COMMIT && at + sizeof(journal_commit_t) <= (size_t)size) {
+            journal_commit_t commit;
+            memcpy(&commit, data + at, sizeof(commit));
+            if (commit.count != count || (count > 0 && commit.round != round) ||
+                commit.checksum != Checksum(&commit, offsetof(journal_commit_t, checksum))) break;
+
+            last = commit;
+            count = 0;
+            at += sizeof(commit);
+            committed = at;
+        }
+        else {
+            break;
+        }
+    }
+
+    int applied = 0;
+    for (at = sizeof(header); at < committed;) {
+        unsigned int magic;
+        memcpy(&magic, data + at, 4);
+        if (magic == RECORD_COMMIT) {
+            at += sizeof(journal_commit_t);
+            continue;
+        }
+
+        journal_chunk_t record;
+        memcpy(&record, data + at, sizeof(record));
+        const unsigned char* chunkData = data + at + sizeof(record);
+        at += sizeof(record) + record.size;
+
+        DiscardChunk(grid, record.cx, record.cy);
+        if (record.codec != CODEC_EMPTY) {
+            chunk_blob_t blob = { (unsigned char*) malloc(record.packedSize), (int)record.packedSize, 0 };
+            if (record.codec == CODEC_LZ) blob.size = DecompressLz(chunkData, record.size, blob.data, record.packedSize);
+            else memcpy(blob.data, chunkData, record.size);
+
+            if (blob.size <= 0 || !AdoptPackedChunk(grid, record.cx, record.cy, blob, false)) free(blob.data);
+        }
+        if (record.awake) WakeCell(record.cx * CHUNK_SIZE + 1, record.cy * CHUNK_SIZE + 1);
+        applied++;
+    }
+
+    if (committed > sizeof(header)) {
+        sim->frameCounter = last.tick;
+        sim->randomState = last.randomState;
+    }
+    free(data);
+
+    TraceLog(LOG_INFO, "AUTOSAVE: Replayed %i chunks from %s", applied, logPath);
+    return true;
+}
+
+// Saves what changed one last time and waits for it to reach the disk. Call once the
+// simulation stopped, while the grid is still there
+void UnloadAutosave(particle_t** grid) {
+    if (!enabled) return;
+
+    while (writing.load(std::memory_order_acquire)) std::this_thread::yield();
+    CaptureRound(grid);
+
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        stopping = true;
+    }
+    writerWake.notify_one();
+    writer.join();
+
+    if (journal != NULL) fclose(journal);
+    journal = NULL;
+    free(locations);
+    free(roundChunks);
+    free(lz);
+    locations = NULL;
+    roundChunks = NULL;
+    lz = NULL;
+    enabled = false;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Copy out the chunks that changed since the last round and hand them to the writer, false
+// when none did
+static bool CaptureRound(particle_t** grid) {
+    if (sim->chunkOriginX != savedOriginX || sim->chunkOriginY != savedOriginY) needFull = true;
+
+    autosave_round_t round = { 0 };
+    round.full = needFull.exchange(false);
+    round.info = { sim->chunkOriginX, sim->chunkOriginY, sim->randomState, sim->frameCounter, 0 };
+    round.chunks = (captured_chunk_t*) malloc(sim->chunksX * sim->chunksY * sizeof(captured_chunk_t));
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            if (!round.full && !ChunkChangedSince(cx, cy, changeStamp)) continue;
+
+            captured_chunk_t* chunk = &round.chunks[round.count++];
+            memset(chunk, 0, sizeof(captured_chunk_t));
+            chunk->cx = cx;
+            chunk->cy = cy;
+            chunk->awake = IsChunkAwake(cx, cy);
+
+            const chunk_blob_t* packed = GetPackedChunk(cx, cy);
+            if (packed != NULL) {
+                chunk->blob.data = (unsigned char*) malloc(packed->size);
+                chunk->blob.size = packed->size;
+                memcpy(chunk->blob.data, packed->data, packed->size);
+                continue;
+            }
+
+            chunk->cells = (chunk_cell_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t));
+            GatherChunk(grid, cx, cy, chunk->cells);
+
+            bool empty = true;
+            for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE && empty; i++) empty = (chunk->cells[i].mat == NOTHING);
+            if (empty) {
+                free(chunk->cells);
+                chunk->cells = NULL;
+            }
+        }
+    }
+
+    changeStamp = GetChangeStamp();
+    savedOriginX = sim->chunkOriginX;
+    savedOriginY = sim->chunkOriginY;
+
+    if (round.count == 0) {
+        FreeRound(&round);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        pending = round;
+        writing.store(true, std::memory_order_release);
+    }
+    writerWake.notify_one();
+    return true;
+}
+
+static void WriterLoop(void) {
+    while (true) {
+        autosave_round_t round;
+        {
+            std::unique_lock<std::mutex> lock(writerMutex);
+            writerWake.wait(lock, [] { return stopping || writing.load(); });
+            if (!writing.load()) break;
+            round = pending;
+        }
+
+        if (round.full) WriteWorld(&round);
+        else WriteJournal(&round);
+        FreeRound(&round);
+        writing.store(false, std::memory_order_release);
+    }
+}
+
+// A new world file from a full round, followed by a new journal for it
+static void WriteWorld(autosave_round_t* round) {
+    memset(roundChunks, 0, sim->chunksX * sim->chunksY * sizeof(captured_chunk_t*));
+    for (int n = 0; n < round->count; n++) {
+        roundChunks[round->chunks[n].cy * sim->chunksX + round->chunks[n].cx] = &round->chunks[n];
+    }
+
+    if (journal != NULL) fclose(journal);
+    journal = NULL;
+
+    world_file_info_t info = round->info;
+    info.generation = NextGeneration();
+    world_chunk_entry_t* directory = (world_chunk_entry_t*) malloc(sim->chunksX * sim->chunksY * sizeof(world_chunk_entry_t));
+
+    bool ok = WriteWorldFile(tempPath, &info, RoundChunk, NULL, true, directory) && ReplaceFile(tempPath, savePath);
+    if (ok) {
+        worldBytes = sizeof(world_header_t) + (unsigned long long)sim->chunksX * sim->chunksY * sizeof(world_chunk_entry_t);
+        for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+            locations[c].entry = directory[c];
+            locations[c].inJournal = false;
+            worldBytes += directory[c].size;
+        }
+        savedInfo = info;
+        ok = StartJournal();
+    }
+    free(directory);
+
+    if (!ok) {
+        TraceLog(LOG_WARNING, "AUTOSAVE: Could not write %s", savePath);
+        needFull = true;
+    }
+}
+
+// Append a round to the journal, the commit only goes in once its chunks are on the disk
+static void WriteJournal(autosave_round_t* round) {
+    if (journal == NULL) {
+        needFull = true;
+        return;
+    }
+
+    roundNumber++;
+    world_chunk_entry_t* entries = (world_chunk_entry_t*) calloc(round->count, sizeof(world_chunk_entry_t));
+    unsigned long long at = journalBytes;
+
+    for (int n = 0; n < round->count; n++) {
+        captured_chunk_t* chunk = &round->chunks[n];
+        chunk_blob_t blob = chunk->blob;
+        if (chunk->cells != NULL) blob = EncodeCells(chunk->cells);
+
+        journal_chunk_t record = { 0 };
+        record.magic = RECORD_CHUNK;
+        record.round = roundNumber;
+        record.cx = chunk->cx;
+        record.cy = chunk->cy;
+        record.awake = chunk->awake;
+
+        const unsigned char* data = NULL;
+        if (blob.data != NULL && !IsEmptyBlob(blob)) {
+            data = blob.data;
+            record.codec = CODEC_PACKED;
+            record.size = blob.size;
+            record.packedSize = blob.size;
+
+            int lzSize = CompressLz(blob.data, blob.size, lz);
+            if (lzSize < blob.size) {
+                data = lz;
+                record.codec = CODEC_LZ;
+                record.size = lzSize;
+            }
+        }
+        record.checksum = Checksum(data, record.size);
+
+        fwrite(&record, sizeof(record), 1, journal);
+        if (record.size > 0) fwrite(data, 1, record.size, journal);
+        if (chunk->cells != NULL) free(blob.data);
+
+        entries[n].offset = at + sizeof(record);
+        entries[n].size = record.size;
+        entries[n].packedSize = record.packedSize;
+        entries[n].codec = record.codec;
+        entries[n].awake = record.awake;
+        at += sizeof(record) + record.size;
+    }
+    bool ok = SyncWorldFile(journal);
+
+    journal_commit_t commit = { 0 };
+    commit.magic = RECORD_COMMIT;
+    commit.round = roundNumber;
+    commit.randomState = round->info.randomState;
+    commit.tick = round->info.tick;
+    commit.count = round->count;
+    commit.checksum = Checksum(&commit, offsetof(journal_commit_t, checksum));
+    if (ok) {
+        fwrite(&commit, sizeof(commit), 1, journal);
+        ok = SyncWorldFile(journal);
+    }
+
+    if (ok) {
+        for (int n = 0; n < round->count; n++) {
+            chunk_location_t* location = &locations[round->chunks[n].cy * sim->chunksX + round->chunks[n].cx];
+            location->entry = entries[n];
+            location->inJournal = true;
+        }
+        journalBytes = at + sizeof(commit);
+        savedInfo.randomState = round->info.randomState;
+        savedInfo.tick = round->info.tick;
+    }
+    free(entries);
+
+    if (!ok) {
+        // Whatever half of the round made it in is never committed, start over from scratch
+        TraceLog(LOG_WARNING, "AUTOSAVE: Could not write %s", journalPath);
+        fclose(journal);
+        journal = NULL;
+        needFull = true;
+        return;
+    }
+
+    unsigned long long limit = (worldBytes > COMPACT_MIN_BYTES) ? worldBytes : COMPACT_MIN_BYTES;
+    if (journalBytes > limit) CompactJournal();
+}
+
+// Fold the journal into a new world file, read back from the two files on disk
+static void CompactJournal(void) {
+    fclose(journal);
+    journal = NULL;
+
+    stored_files_t files = { fopen(savePath, "rb"), fopen(journalPath, "rb") };
+    world_file_info_t info = savedInfo;
+    info.generation = NextGeneration();
+    world_chunk_entry_t* directory = (world_chunk_entry_t*) malloc(sim->chunksX * sim->chunksY * sizeof(world_chunk_entry_t));
+
+    bool ok = files.world != NULL && files.journal != NULL && WriteWorldFile(tempPath, &info, StoredChunk, &files, true, directory);
+    if (files.world != NULL) fclose(files.world);
+    if (files.journal != NULL) fclose(files.journal);
+    ok = ok && ReplaceFile(tempPath, savePath);
+
+    if (ok) {
+        worldBytes = sizeof(world_header_t) + (unsigned long long)sim->chunksX * sim->chunksY * sizeof(world_chunk_entry_t);
+        for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+            locations[c].entry = directory[c];
+            locations[c].inJournal = false;
+            worldBytes += directory[c].size;
+        }
+        savedInfo = info;
+        ok = StartJournal();
+    }
+    free(directory);
+
+    if (!ok) {
+        TraceLog(LOG_WARNING, "AUTOSAVE: Could not compact %s", savePath);
+        needFull = true;
+    }
+}
+
+// Truncate the journal and stamp it with the generation of the world file now on disk
+static bool StartJournal(void) {
+    journal = fopen(journalPath, "wb");
+    if (journal == NULL) return false;
+
+    journal_header_t header = { JOURNAL_MAGIC, generation };
+    fwrite(&header, sizeof(header), 1, journal);
+    journalBytes = sizeof(header);
+    roundNumber = 0;
+
+    if (SyncWorldFile(journal)) return true;
+    fclose(journal);
+    journal = NULL;
+    return false;
+}
+
+static void FreeRound(autosave_round_t* round) {
+    for (int n = 0; n < round->count; n++) {
+        free(round->chunks[n].blob.data);
+        free(round->chunks[n].cells);
+    }
+    free(round->chunks);
+    round->chunks = NULL;
+    round->count = 0;
+}
+
+// Chunks of a full round, encoded here on the writer thread
+static world_chunk_t RoundChunk(int cx, int cy, void*) {
+    world_chunk_t out = { 0 };
+    const captured_chunk_t* chunk = roundChunks[cy * sim->chunksX + cx];
+    if (chunk == NULL) return out;
+
+    out.awake = chunk->awake;
+    if (chunk->cells != NULL) {
+        out.blob = EncodeCells(chunk->cells);
+        out.owned = true;
+    }
+    else {
+        out.blob = chunk->blob;
+    }
+    return out;
+}
+
+// Newest copy of a chunk, from the world file or the journal
+static world_chunk_t StoredChunk(int cx, int cy, void* user) {
+    stored_files_t* files = (stored_files_t*)user;
+    const world_chunk_entry_t* entry = &locations[cy * sim->chunksX + cx].entry;
+    world_chunk_t out = { 0 };
+    out.awake = entry->awake;
+    if (entry->codec == CODEC_EMPTY) return out;
+
+    FILE* file = locations[cy * sim->chunksX + cx].inJournal ? files->journal : files->world;
+    unsigned char* data = (unsigned char*) malloc(entry->size);
+    SeekFile(file, entry->offset);
+    if (fread(data, 1, entry->size, file) != entry->size) {
+        free(data);
+        return out;
+    }
+
+    out.blob.data = data;
+    out.blob.size = entry->size;
+    out.owned = true;
+    if (entry->codec == CODEC_LZ) {
+        out.blob.data = (unsigned char*) malloc(entry->packedSize);
+        out.blob.size = DecompressLz(data, entry->size, out.blob.data, entry->packedSize);
+        free(data);
+        if (out.blob.size <= 0) {
+            free(out.blob.data);
+            out.blob.data = NULL;
+            out.owned = false;
+        }
+    }
+    return out;
+}
+
+// rename only replaces an existing file on POSIX, Windows needs it out of the way first
+static bool ReplaceFile(const char* from, const char* to) {
+#if defined(_WIN32)
+    remove(to);
+#endif
+    return rename(from, to) == 0;
+}
+
+static void SeekFile(FILE* file, unsigned long long offset) {
+#if defined(_WIN32)
+    _fseeki64(file, (long long)offset, SEEK_SET);
+#else
+    fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static unsigned int NextGeneration(void) {
+    generation++;
+    if (generation == 0) generation = 1;
+    return generation;
+}
+
+// FNV-1a, catches records that were only partly written
+static unsigned int Checksum(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,314 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Batch runner
+*
+*   Runs many short worlds with different material settings and collects what happened in
+*   each as one CSV row, for tuning materials without watching every run.
+*
+*   Every run gets a sim_world_t of its own, material table included, and runs on one of the
+*   runner's threads, one per core: it loads its world, applies its changes to the material
+*   table and ticks without a window until the world settles or runs out of ticks. Worlds
+*   share nothing, so each keeps its passes on its own thread instead of the worker pool.
+*   Rows are written in the order of the sweep file.
+*
+*   Sweep file, one run per line, # starts a comment:
+*       <name> [world=<file>] [size=<w>x<h>] [ticks=<n>] [<material>.<field>=<value> ...]
+*   e.g. "wet_sand world=dunes.ppw ticks=1800 sand.maxY=4 water.modX=20"
+*   Worlds loaded from a file take its size, the others size or BATCH_DEFAULT_SIZE.
+*
+*   Rows: run, status, ticks run, whether it settled, seconds until it did, seconds from
+*   the first fire to the last, particles left, particles of each material, wall seconds.
+*   Seconds are simulated ones, ticks of BATCH_DT.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#define BATCH_DT (1.0f / 60.0f)
+#define BATCH_DEFAULT_TICKS 3600
+#define BATCH_DEFAULT_SIZE 512
+#define BATCH_LINE_MAX 1024
+
+typedef struct batch_run_t {
+    std::string name;
+    std::string world;
+    std::string size;
+    int ticks;
+    std::vector<std::string> settings;
+} batch_run_t;
+
+// Material fields a run can change, the rest decide how a material behaves at all
+typedef struct material_field_t {
+    const char* name;
+    size_t offset;
+    bool integer;
+} material_field_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static const material_field_t materialFields[] = {
+    { "modX", offsetof(mat_prop_t, modX), false },
+    { "modY", offsetof(mat_prop_t, modY), false },
+    { "maxX", offsetof(mat_prop_t, maxX), false },
+    { "maxY", offsetof(mat_prop_t, maxY), false },
+    { "flammableProbability", offsetof(mat_prop_t, flammableProbability), true },
+    { "initLifeTime", offsetof(mat_prop_t, initLifeTime), false },
+    { "heatTarget", offsetof(mat_prop_t, heatTarget), false },
+    { "heatRate", offsetof(mat_prop_t, heatRate), false },
+    { "hotTemperature", offsetof(mat_prop_t, hotTemperature), false },
+    { "coldTemperature", offsetof(mat_prop_t, coldTemperature), false },
+};
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool ReadSweep(const char* path, std::vector<batch_run_t>* runs);
+static std::string RunWorld(const batch_run_t* run);
+static std::string TickRun(particle_t** grid, int maxTicks);
+static int CountFire(particle_t** grid);
+
+//----------------------------------------------------------------------------------
+// Batch Functions Definition
+//----------------------------------------------------------------------------------
+
+// Change one field of one material, "sand.maxY=4". False when there is no such field or
+// anything follows the value
+bool SetMaterialValue(const char* setting) {
+    char material[32], field[32];
+    float value;
+    int end = 0;
+    if (sscanf(setting, "%31[^.].%31[^=]=%f%n", material, field, &value, &end) != 3 || setting[end] != '\0') {
+        TraceLog(LOG_WARNING, "BATCH: %s isn't <material>.<field>=<value>", setting);
+        return false;
+    }
+
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        if (strcmp(material, materialNames[m]) != 0) continue;
+
+        for (const material_field_t& f : materialFields) {
+            if (strcmp(field, f.name) != 0) continue;
+            unsigned char* prop = (unsigned char*)&sim->props[m] + f.offset;
+            if (f.integer) *(int*)prop = (int)value;
+            else *(float*)prop = value;
+            return true;
+        }
+    }
+    TraceLog(LOG_WARNING, "BATCH: No material setting %s", setting);
+    return false;
+}
+
+// Every run of the sweep file, jobs at a time (0 for one per core), rows written to outPath
+int RunBatch(const char* sweepPath, const char* outPath, int jobs) {
+    std::vector<batch_run_t> runs;
+    if (!ReadSweep(sweepPath, &runs)) return 1;
+
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        TraceLog(LOG_WARNING, "BATCH: Couldn't write %s", outPath);
+        return 1;
+    }
+
+    if (jobs <= 0) jobs = (int)std::thread::hardware_concurrency();
+    if (jobs <= 0) jobs = 1;
+    if (jobs > (int)runs.size()) jobs = (int)runs.size();
+    TraceLog(LOG_INFO, "BATCH: %d runs from %s, %d at a time", (int)runs.size(), sweepPath, jobs);
+
+    // Threads only share the next run to take, each writes its own rows
+    std::vector<std::string> rows(runs.size());
+    std::atomic<int> next(0), done(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int j = 0; j < jobs; j++) {
+        threads.emplace_back([&]() {
+            int n;
+            while ((n = next.fetch_add(1)) < (int)runs.size()) {
+                auto runStart = std::chrono::steady_clock::now();
+                std::string result = RunWorld(&runs[n]);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+                // A failed run has no columns of its own, its wall time still lines up
+                std::string columns = result;
+                if (result.empty()) columns.assign(MATERIAL_COUNT + 3, ',');
+                std::string settings;
+                for (const std::string& s : runs[n].settings) settings += (settings.empty() ? "" : " ") + s;
+                char wall[32];
+                snprintf(wall, sizeof(wall), "%.2f", seconds);
+                rows[n] = runs[n].name + "," + (result.empty() ? "failed" : "ok") + "," + columns + "," + wall + ",\"" + settings + "\"";
+                TraceLog(LOG_INFO, "BATCH: %d / %d - %s %s in %.2f s", done.fetch_add(1) + 1, (int)runs.size(),
+                         runs[n].name.c_str(), result.empty() ? "failed" : "done", seconds);
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    fprintf(out, "run,status,ticks,settled,settle_seconds,burn_seconds,particles");
+    for (int m = 1; m < MATERIAL_COUNT; m++) fprintf(out, ",%s", materialNames[m]);
+    fprintf(out, ",wall_seconds,settings\n");
+
+    for (const std::string& row : rows) fprintf(out, "%s\n", row.c_str());
+    fclose(out);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TraceLog(LOG_INFO, "BATCH: Wrote %d rows to %s in %.2f s", (int)rows.size(), outPath, seconds);
+    return 0;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static bool ReadSweep(const char* path, std::vector<batch_run_t>* runs) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "BATCH: Couldn't open %s", path);
+        return false;
+    }
+
+    char line[BATCH_LINE_MAX];
+    int number = 0;
+    bool valid = true;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        batch_run_t run = { "", "", "", BATCH_DEFAULT_TICKS, {} };
+        for (char* token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+            // The settings column of the row is quoted
+            if (strchr(token, '"') != NULL) {
+                TraceLog(LOG_WARNING, "BATCH: %s:%d has a quote in it", path, number);
+                valid = false;
+            }
+            else if (run.name.empty()) run.name = token;
+            else if (strncmp(token, "world=", 6) == 0) run.world = token + 6;
+            else if (strncmp(token, "size=", 5) == 0) run.size = token + 5;
+            else if (strncmp(token, "ticks=", 6) == 0) run.ticks = atoi(token + 6);
+            else if (strchr(token, '.') != NULL && strchr(token, '=') != NULL) run.settings.push_back(token);
+            else {
+                TraceLog(LOG_WARNING, "BATCH: %s:%d doesn't know %s", path, number, token);
+                valid = false;
+            }
+        }
+        if (!run.world.empty() && !FileExists(run.world.c_str())) {
+            TraceLog(LOG_WARNING, "BATCH: %s:%d needs %s, which isn't there", path, number, run.world.c_str());
+            valid = false;
+        }
+        if (!run.name.empty()) runs->push_back(run);
+    }
+    fclose(file);
+
+    if (valid && runs->empty()) TraceLog(LOG_WARNING, "BATCH: No runs in %s", path);
+    return valid && !runs->empty();
+}
+
+// One run in a world of its own on the calling thread, the columns of its row or empty when
+// it couldn't start. World files only load with the material table they were saved with,
+// so the run's changes to it come once the world is in
+static std::string RunWorld(const batch_run_t* run) {
+    int width = BATCH_DEFAULT_SIZE, height = BATCH_DEFAULT_SIZE;
+    if (!run->world.empty()) PeekWorldFile(run->world.c_str(), &width, &height);
+    else if (!run->size.empty()) sscanf(run->size.c_str(), "%dx%d", &width, &height);
+
+    sim_world_t world = DefaultWorld();
+    world.useLod = false;
+    world.useWorkers = false;
+    sim = &world;
+
+    InitWorld(width, height);
+    particle_t** grid = (particle_t**) calloc(STRIDE * HEIGHT, sizeof(particle_t*));
+    InitTemperature();
+    InitGasField();
+    InitLiquidPressure();
+    InitMargolus();
+    InitDoubleBuffer();
+    InitCompression();
+
+    bool ready = run->world.empty() || LoadWorldFile(grid, run->world.c_str());
+    for (size_t n = 0; ready && n < run->settings.size(); n++) ready = SetMaterialValue(run->settings[n].c_str());
+    InitMoveTables();
+
+    std::string columns = ready ? TickRun(grid, run->ticks) : "";
+
+    ClearGrid(grid);
+    UnloadTemperature();
+    UnloadGasField();
+    UnloadLiquidPressure();
+    UnloadMargolus();
+    UnloadDoubleBuffer();
+    UnloadWorldFile();
+    UnloadCompression();
+    free(grid);
+    UnloadWorld();
+
+    sim = &mainWorld;
+    return columns;
+}
+
+// Tick until the world settles or maxTicks ran: ticks run, whether it settled, seconds until
+// it did, seconds from the first fire to the last, particles left and those of each material
+static std::string TickRun(particle_t** grid, int maxTicks) {
+    Rectangle view = { 0, 0, (float)WIDTH, (float)HEIGHT };
+    int ticks = 0, settledTick = -1, firstFire = -1, lastFire = -1;
+
+    while (ticks < maxTicks) {
+        TickWorld(grid, view, BATCH_DT);
+        ticks++;
+
+        if (CountFire(grid) > 0) {
+            if (firstFire < 0) firstFire = ticks;
+            lastFire = ticks;
+        }
+        if (CountAwakeChunks() == 0) {
+            settledTick = ticks;
+            break;
+        }
+    }
+
+    // Packed chunks point at a placeholder of their material, so every cell counts
+    long long counts[MATERIAL_COUNT] = { 0 };
+    long long particles = 0;
+    for (int y = 0; y < HEIGHT; y++) {
+        particle_t** row = grid + GetIndex(0, y);
+        for (int x = 0; x < WIDTH; x++) {
+            if (row[x] == NULL) continue;
+            counts[row[x]->mat]++;
+            particles++;
+        }
+    }
+
+    char columns[BATCH_LINE_MAX];
+    int length = snprintf(columns, sizeof(columns), "%d,%d,", ticks, settledTick >= 0 ? 1 : 0);
+    if (settledTick >= 0) length += snprintf(columns + length, sizeof(columns) - length, "%.3f", settledTick * BATCH_DT);
+    length += snprintf(columns + length, sizeof(columns) - length, ",%.3f,%lld",
+                       (firstFire >= 0) ? (lastFire - firstFire + 1) * BATCH_DT : 0.0f, particles);
+    for (int m = 1; m < MATERIAL_COUNT; m++) length += snprintf(columns + length, sizeof(columns) - length, ",%lld", counts[m]);
+    return columns;
+}
+
+// Fire keeps its chunk awake while it burns, so it's only looked for in awake chunks
+static int CountFire(particle_t** grid) {
+    int count = 0;
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            if (!sim->chunkAwake[cy * sim->chunksX + cx]) continue;
+            for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+                particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    if (row[x] != NULL && row[x]->mat == FIRE) count++;
+                }
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,556 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Chunk compression
+*
+*   Settled regions of a big world are mostly whole chunks of stone, sand or nothing, and
+*   every particle in them costs a heap allocation that nobody touches. Once a chunk and all
+*   of its neighbours have been asleep for PACK_AFTER_TICKS ticks, its particles are encoded
+*   into a packed blob and freed. The grid keeps pointing at one shared placeholder particle
+*   per material, so anything reading the chunk still sees the right materials.
+*
+*   A packed chunk is unpacked again before anything can change it:
+*     - when it or one of its neighbours wakes, at the start of the tick
+*     - when it comes into view, since placeholders only carry the base colour
+*     - before the temperature field transitions one of its cells
+*   Writes into empty cells of a packed chunk need no care, unpacking only replaces cells
+*   that still hold a placeholder.
+*
+*   Chunks loaded from a world file arrive packed. Their blobs can be borrowed from the
+*   mapped file, those are never freed here and are copied before the file goes away.
+*
+*   Packed format, shared with the chunk store on disk (see streaming.cpp):
+*     u32 magic "PPCK", u8 version, u8 flags, u8 padding[2]
+*     per row: runs of (u8 length, u8 material) adding up to CHUNK_SIZE cells
+*     per non empty cell in row order, left out entirely when flags has CHUNK_PLAIN:
+*       u8 shade, the offset from the base colour on all three channels, or SHADE_RAW
+*       followed by u8 r, g, b, a. Then f32 lifeTime for decaying materials
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define CHUNK_MAGIC 0x4B435050          // "PPCK" read as a little endian u32
+#define CHUNK_VERSION 2
+#define CHUNK_PLAIN 1                   // Every cell has the base colour and no lifetime
+#define SHADE_RAW 0x80
+
+#define PACK_AFTER_TICKS 600            // Ten seconds asleep, neighbours included
+#define PACK_PER_TICK 4                 // Spreads packing out so it never shows up as a spike
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+// Kept per world, see sim_world_t
+typedef struct compression_t {
+    chunk_blob_t* packedBlobs;
+    unsigned char* chunkBorrowed;       // Blob points into a loaded world file
+    unsigned short* chunkQuiet;         // Ticks the chunk has been asleep and out of view
+    int* chunkParticles;                // Particle count, valid while the chunk sleeps
+    particle_t placeholders[MATERIAL_COUNT];
+    int packedChunks;
+    size_t packedBytes;
+} compression_t;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool PackChunk(particle_t** grid, int cx, int cy);
+static bool CheckRuns(const unsigned char* data, int size);
+static void ReleaseBlob(int c);
+static int CountParticles(particle_t** grid, int cx, int cy);
+static bool NeighboursAsleep(int cx, int cy);
+
+//----------------------------------------------------------------------------------
+// Compression Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitCompression(void) {
+    compression_t* compression = (compression_t*) calloc(1, sizeof(compression_t));
+    sim->compression = compression;
+    sim->chunkPacked = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    compression->packedBlobs = (chunk_blob_t*) calloc(sim->chunksX * sim->chunksY, sizeof(chunk_blob_t));
+    compression->chunkBorrowed = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    compression->chunkQuiet = (unsigned short*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned short));
+    compression->chunkParticles = (int*) calloc(sim->chunksX * sim->chunksY, sizeof(int));
+
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        compression->placeholders[m] = { 0 };
+        compression->placeholders[m].mat = (particle_mat_t)m;
+        compression->placeholders[m].color = sim->props[m].initialColor;
+        compression->placeholders[m].lifeTime = sim->props[m].initLifeTime;
+    }
+}
+
+void UnloadCompression(void) {
+    compression_t* compression = sim->compression;
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) ReleaseBlob(c);
+    free(sim->chunkPacked);
+    free(compression->packedBlobs);
+    free(compression->chunkBorrowed);
+    free(compression->chunkQuiet);
+    free(compression->chunkParticles);
+    free(compression);
+    sim->chunkPacked = NULL;
+    sim->compression = NULL;
+}
+
+// Call right after BeginWorldTick, before anything runs on the grid
+void UpdateCompression(particle_t** grid) {
+    compression_t* compression = sim->compression;
+    int packs = 0;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+
+            if (sim->chunkAwake[c]) {
+                compression->chunkQuiet[c] = 0;
+
+                // Particles can cross into a neighbour during the tick, so those go dense too
+                for (int ny = cy - 1; ny <= cy + 1; ny++) {
+                    for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                        if (nx < 0 || nx >= sim->chunksX || ny < 0 || ny >= sim->chunksY) continue;
+                        if (sim->chunkPacked[ny * sim->chunksX + nx]) UnpackChunk(grid, nx, ny);
+                    }
+                }
+                continue;
+            }
+
+            // Nothing moves in a sleeping chunk, so a count taken as it falls asleep stays right
+            if (compression->chunkQuiet[c] == 0) compression->chunkParticles[c] = CountParticles(grid, cx, cy);
+            if (compression->chunkQuiet[c] < PACK_AFTER_TICKS) {
+                compression->chunkQuiet[c]++;
+                continue;
+            }
+
+            if (sim->chunkPacked[c] || compression->chunkParticles[c] == 0 || packs >= PACK_PER_TICK || !NeighboursAsleep(cx, cy)) continue;
+
+            // Chunks that don't pack well are left alone for another while
+            if (!PackChunk(grid, cx, cy)) compression->chunkQuiet[c] = 1;
+            packs++;
+        }
+    }
+}
+
+void UnpackChunk(particle_t** grid, int cx, int cy) {
+    compression_t* compression = sim->compression;
+    int c = cy * sim->chunksX + cx;
+    if (!sim->chunkPacked[c]) return;
+
+    DecodeChunk(grid, cx, cy, compression->packedBlobs[c].data, compression->packedBlobs[c].size);
+
+    compression->packedBytes -= compression->packedBlobs[c].size;
+    compression->packedChunks--;
+    ReleaseBlob(c);
+    sim->chunkPacked[c] = 0;
+}
+
+// Unpack everything in the cell rectangle and keep it from being packed again for a while
+void UnpackRegion(particle_t** grid, int x0, int y0, int x1, int y1) {
+    compression_t* compression = sim->compression;
+    for (int cy = y0 >> CHUNK_SHIFT; cy <= (y1 - 1) >> CHUNK_SHIFT; cy++) {
+        for (int cx = x0 >> CHUNK_SHIFT; cx <= (x1 - 1) >> CHUNK_SHIFT; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (sim->chunkPacked[c]) UnpackChunk(grid, cx, cy);
+            if (compression->chunkQuiet[c] > 1) compression->chunkQuiet[c] = 1;
+        }
+    }
+}
+
+// The streamed window moved, chunks leaving it have been unpacked already
+void ShiftCompression(int dcx, int dcy) {
+    compression_t* compression = sim->compression;
+    unsigned short quiet = 0;
+    ShiftCells(sim->chunkPacked, sizeof(unsigned char), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, NULL);
+    ShiftCells(compression->packedBlobs, sizeof(chunk_blob_t), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, NULL);
+    ShiftCells(compression->chunkBorrowed, sizeof(unsigned char), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, NULL);
+    ShiftCells(compression->chunkQuiet, sizeof(unsigned short), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &quiet);
+    ShiftCells(compression->chunkParticles, sizeof(int), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, NULL);
+}
+
+// Awake chunks are counted on the spot, so this is cheap as long as most of the world sleeps
+memory_stats_t GetMemoryStats(particle_t** grid) {
+    compression_t* compression = sim->compression;
+    memory_stats_t stats = { 0 };
+    stats.gridBytes = (size_t)STRIDE * HEIGHT * sizeof(particle_t*);
+    stats.packedBytes = compression->packedBytes;
+    stats.packedChunks = compression->packedChunks;
+
+    size_t particles = 0;
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (sim->chunkPacked[c]) continue;
+            particles += (sim->chunkAwake[c] || compression->chunkQuiet[c] == 0) ? CountParticles(grid, cx, cy) : compression->chunkParticles[c];
+        }
+    }
+    stats.particleBytes = particles * sizeof(particle_t);
+
+    return stats;
+}
+
+chunk_blob_t EncodeChunk(particle_t** grid, int cx, int cy) {
+    chunk_cell_t cells[CHUNK_SIZE * CHUNK_SIZE];
+    GatherChunk(grid, cx, cy, cells);
+    return EncodeCells(cells);
+}
+
+// Copy out what the packed format keeps of every cell, a cheap snapshot of the chunk that
+// can be encoded later on any thread. Packed chunks come out as their blob, with whatever
+// was written into their empty cells since on top
+void GatherChunk(particle_t** grid, int cx, int cy, chunk_cell_t* cells) {
+    compression_t* compression = sim->compression;
+    int c = cy * sim->chunksX + cx;
+    bool packed = sim->chunkPacked[c] && DecodeCells(compression->packedBlobs[c].data, compression->packedBlobs[c].size, cells);
+
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, cy * CHUNK_SIZE + y);
+        chunk_cell_t* out = cells + y * CHUNK_SIZE;
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            particle_t* p = row[x];
+            if (packed && IsPlaceholder(p)) continue;
+            if (p == NULL) {
+                out[x].mat = NOTHING;
+                continue;
+            }
+            out[x].mat = (unsigned char)p->mat;
+            out[x].color = p->color;
+            out[x].lifeTime = p->lifeTime;
+        }
+    }
+}
+
+// Touches nothing but the cells, safe on any thread
+chunk_blob_t EncodeCells(const chunk_cell_t* cells) {
+    unsigned char* data = (unsigned char*) malloc(CHUNK_MAX_BYTES);
+    unsigned int magic = CHUNK_MAGIC;
+    int size = 0;
+
+    memcpy(data, &magic, 4);
+    data[4] = CHUNK_VERSION;
+    data[5] = CHUNK_PLAIN;
+    data[6] = data[7] = 0;
+    size = 8;
+
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        const chunk_cell_t* row = cells + y * CHUNK_SIZE;
+        int x = 0;
+        while (x < CHUNK_SIZE) {
+            int mat = row[x].mat;
+            int run = 1;
+            while (x + run < CHUNK_SIZE && run < 255 && row[x + run].mat == mat) run++;
+
+            data[size++] = (unsigned char)run;
+            data[size++] = (unsigned char)mat;
+            x += run;
+        }
+    }
+
+    int runsEnd = size;
+    for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+        const chunk_cell_t* cell = &cells[i];
+        if (cell->mat == NOTHING) continue;
+
+        // CreateParticle scrambles all three channels by the same amount
+        Color base = sim->props[cell->mat].initialColor;
+        unsigned char shade = (unsigned char)(cell->color.r - base.r);
+        bool shaded = (unsigned char)(base.g + shade) == cell->color.g && (unsigned char)(base.b + shade) == cell->color.b &&
+                      cell->color.a == base.a && shade != SHADE_RAW;
+
+        data[size++] = shaded ? shade : SHADE_RAW;
+        if (!shaded) {
+            memcpy(data + size, &cell->color, 4);
+            size += 4;
+        }
+        if (sim->props[cell->mat].decaying) {
+            memcpy(data + size, &cell->lifeTime, 4);
+            size += 4;
+        }
+        if (!shaded || shade != 0 || sim->props[cell->mat].decaying) data[5] = 0;
+    }
+    if (data[5] & CHUNK_PLAIN) size = runsEnd;
+
+    chunk_blob_t blob = { (unsigned char*) realloc(data, size), size, 0 };
+    return blob;
+}
+
+// The other way around, every cell of the blob without touching the grid. Empty cells are
+// zeroed whole so cells compare with memcmp
+bool DecodeCells(const unsigned char* data, int size, chunk_cell_t* cells) {
+    if (!CheckRuns(data, size)) return false;
+
+    bool plain = (data[5] & CHUNK_PLAIN) != 0;
+    int runs = 8;
+    int i = 0;
+    while (i < CHUNK_SIZE * CHUNK_SIZE) {
+        int run = data[runs], mat = data[runs + 1];
+        runs += 2;
+        for (int end = i + run; i < end; i++) {
+            memset(&cells[i], 0, sizeof(chunk_cell_t));
+            cells[i].mat = (unsigned char)mat;
+            if (mat == NOTHING) continue;
+            cells[i].color = sim->props[mat].initialColor;
+            cells[i].lifeTime = sim->props[mat].initLifeTime;
+        }
+    }
+    if (plain) return true;
+
+    // Per cell data follows the runs, in the same order
+    int next = runs;
+    for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+        chunk_cell_t* cell = &cells[i];
+        if (cell->mat == NOTHING) continue;
+
+        if (next + 1 > size) return false;
+        unsigned char shade = data[next++];
+        if (shade == SHADE_RAW) {
+            if (next + 4 > size) return false;
+            memcpy(&cell->color, data + next, 4);
+            next += 4;
+        }
+        else {
+            cell->color.r += shade;
+            cell->color.g += shade;
+            cell->color.b += shade;
+        }
+        if (sim->props[cell->mat].decaying) {
+            if (next + 4 > size) return false;
+            memcpy(&cell->lifeTime, data + next, 4);
+            next += 4;
+        }
+    }
+    return true;
+}
+
+// Cells the blob marks as filled get a new particle, unless something other than a
+// placeholder has taken their place since the chunk was packed
+bool DecodeChunk(particle_t** grid, int cx, int cy, const unsigned char* data, int size) {
+    if (!CheckRuns(data, size)) return false;
+
+    bool plain = (data[5] & CHUNK_PLAIN) != 0;
+    int cells = 8;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; cells += 2) x += data[cells];
+    }
+
+    // Runs and per cell data are read side by side, cells points past the last run
+    int runs = 8;
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        int x = 0;
+        while (x < CHUNK_SIZE) {
+            int run = data[runs];
+            particle_mat_t mat = (particle_mat_t)data[runs + 1];
+            runs += 2;
+
+            for (int end = x + run; x < end; x++) {
+                if (mat == NOTHING) continue;
+
+                Color color = sim->props[mat].initialColor;
+                float lifeTime = sim->props[mat].initLifeTime;
+                if (!plain) {
+                    if (cells + 1 > size) return false;
+                    unsigned char shade = data[cells++];
+                    if (shade == SHADE_RAW) {
+                        if (cells + 4 > size) return false;
+                        memcpy(&color, data + cells, 4);
+                        cells += 4;
+                    }
+                    else {
+                        color.r += shade;
+                        color.g += shade;
+                        color.b += shade;
+                    }
+                    if (sim->props[mat].decaying) {
+                        if (cells + 4 > size) return false;
+                        memcpy(&lifeTime, data + cells, 4);
+                        cells += 4;
+                    }
+                }
+
+                if (row[x] != NULL && !IsPlaceholder(row[x])) continue;
+
+                particle_t* p = CreateParticle(mat);
+                p->color = color;
+                p->lifeTime = lifeTime;
+                row[x] = p;
+            }
+        }
+    }
+    return true;
+}
+
+// The blob of a packed chunk, NULL when the chunk holds real particles
+const chunk_blob_t* GetPackedChunk(int cx, int cy) {
+    int c = cy * sim->chunksX + cx;
+    return sim->chunkPacked[c] ? &sim->compression->packedBlobs[c] : NULL;
+}
+
+// Whether a blob can be adopted, to check chunks before the world they replace is cleared
+bool IsValidBlob(chunk_blob_t blob) {
+    return blob.data != NULL && CheckRuns(blob.data, blob.size);
+}
+
+// Shared stand-in for a packed cell, never freed. Anything else in a packed chunk was
+// written into one of its empty cells and is a real particle
+bool IsPlaceholder(const particle_t* p) {
+    return p != NULL && p == &sim->compression->placeholders[p->mat];
+}
+
+// Ticks the chunk has been asleep, up to the PACK_AFTER_TICKS it takes to be packed
+int GetChunkQuiet(int cx, int cy) {
+    return sim->compression->chunkQuiet[cy * sim->chunksX + cx];
+}
+
+// Install a blob as a packed chunk, the cells get placeholders and nothing is allocated.
+// The chunk has to be empty. Borrowed blobs stay owned by the caller
+bool AdoptPackedChunk(particle_t** grid, int cx, int cy, chunk_blob_t blob, bool borrowed) {
+    compression_t* compression = sim->compression;
+    int c = cy * sim->chunksX + cx;
+    if (!CheckRuns(blob.data, blob.size)) return false;
+
+    int count = 0;
+    int runs = 8;
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        for (int x = 0; x < CHUNK_SIZE; runs += 2) {
+            int run = blob.data[runs], mat = blob.data[runs + 1];
+            for (int end = x + run; x < end; x++) row[x] = (mat != NOTHING) ? &compression->placeholders[mat] : NULL;
+            if (mat != NOTHING) count += run;
+        }
+    }
+
+    compression->packedBlobs[c] = blob;
+    compression->chunkBorrowed[c] = borrowed;
+    compression->packedBytes += blob.size;
+    compression->packedChunks++;
+    sim->chunkPacked[c] = 1;
+    compression->chunkQuiet[c] = PACK_AFTER_TICKS;
+    compression->chunkParticles[c] = count;
+    return true;
+}
+
+// Empty the chunk whether it is packed or not, for a chunk about to be replaced
+void DiscardChunk(particle_t** grid, int cx, int cy) {
+    compression_t* compression = sim->compression;
+    int c = cy * sim->chunksX + cx;
+    bool packed = sim->chunkPacked[c];
+    if (packed) {
+        compression->packedBytes -= compression->packedBlobs[c].size;
+        compression->packedChunks--;
+        ReleaseBlob(c);
+        sim->chunkPacked[c] = 0;
+    }
+
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            if (row[x] != NULL && !IsPlaceholder(row[x])) free(row[x]);
+            row[x] = NULL;
+        }
+    }
+    compression->chunkQuiet[c] = 0;
+}
+
+// Copy every borrowed blob, call before the memory they point into goes away
+void OwnBorrowedChunks(void) {
+    compression_t* compression = sim->compression;
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if (!compression->chunkBorrowed[c]) continue;
+        unsigned char* data = (unsigned char*) malloc(compression->packedBlobs[c].size);
+        memcpy(data, compression->packedBlobs[c].data, compression->packedBlobs[c].size);
+        compression->packedBlobs[c].data = data;
+        compression->chunkBorrowed[c] = 0;
+    }
+}
+
+// Forget every packed chunk, the grid cells pointing at placeholders have to be cleared too
+void ClearPackedChunks(void) {
+    compression_t* compression = sim->compression;
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) ReleaseBlob(c);
+    memset(sim->chunkPacked, 0, sim->chunksX * sim->chunksY);
+    memset(compression->chunkQuiet, 0, sim->chunksX * sim->chunksY * sizeof(unsigned short));
+    memset(compression->chunkParticles, 0, sim->chunksX * sim->chunksY * sizeof(int));
+    compression->packedChunks = 0;
+    compression->packedBytes = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static bool PackChunk(particle_t** grid, int cx, int cy) {
+    compression_t* compression = sim->compression;
+    int c = cy * sim->chunksX + cx;
+    chunk_blob_t blob = EncodeChunk(grid, cx, cy);
+
+    // Worth it only when the blob is a small fraction of the particles it replaces
+    if ((size_t)blob.size * 4 > compression->chunkParticles[c] * sizeof(particle_t)) {
+        free(blob.data);
+        return false;
+    }
+
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            if (row[x] == NULL) continue;
+            particle_mat_t mat = row[x]->mat;
+            free(row[x]);
+            row[x] = &compression->placeholders[mat];
+        }
+    }
+
+    compression->packedBlobs[c] = blob;
+    compression->packedBytes += blob.size;
+    compression->packedChunks++;
+    sim->chunkPacked[c] = 1;
+    return true;
+}
+
+static int CountParticles(particle_t** grid, int cx, int cy) {
+    int count = 0;
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        for (int x = 0; x < CHUNK_SIZE; x++) count += (row[x] != NULL);
+    }
+    return count;
+}
+
+// Header and material runs of a packed blob are whole and in range
+static bool CheckRuns(const unsigned char* data, int size) {
+    unsigned int magic = 0;
+    if (size < 8) return false;
+    memcpy(&magic, data, 4);
+    if (magic != CHUNK_MAGIC || data[4] != CHUNK_VERSION) return false;
+
+    int runs = 8;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; ) {
+            if (runs + 2 > size) return false;
+            int run = data[runs], mat = data[runs + 1];
+            runs += 2;
+            if (run == 0 || x + run > CHUNK_SIZE || mat >= MATERIAL_COUNT) return false;
+            x += run;
+        }
+    }
+    return true;
+}
+
+static void ReleaseBlob(int c) {
+    compression_t* compression = sim->compression;
+    if (!compression->chunkBorrowed[c]) free(compression->packedBlobs[c].data);
+    compression->packedBlobs[c] = { 0 };
+    compression->chunkBorrowed[c] = 0;
+}
+
+static bool NeighboursAsleep(int cx, int cy) {
+    for (int ny = cy - 1; ny <= cy + 1; ny++) {
+        for (int nx = cx - 1; nx <= cx + 1; nx++) {
+            if (nx < 0 || nx >= sim->chunksX || ny < 0 || ny >= sim->chunksY) continue;
+            if (sim->chunkAwake[ny * sim->chunksX + nx]) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,263 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Double buffered backend
+*
+*   Alternative to the in place sweep where a tick only ever reads the state the previous
+*   tick left and writes the next state into a second grid. Nothing depends on scan order,
+*   so rows are split across threads and any split gives the same result.
+*
+*   Every move swaps a cell with a lighter one next to it. Empty space counts as heavier
+*   than gas, so gas rising is empty space sinking through it. A tick runs in three passes
+*   over the previous state:
+*     - Intent: every cell in a running chunk picks the lighter neighbour it would swap
+*       with: straight down, then a diagonal, then sideways for liquids
+*     - Resolve: every cell that isn't moving itself accepts one of the cells aiming at it.
+*       Straight down wins over the diagonals, the diagonals over sideways moves, and a hash
+*       of position and tick breaks ties between the two sides
+*     - Write: accepted pairs swap into the next grid, everything else is copied as is
+*   A cell that lost stays where it is. The next grid then replaces the chunks it covers.
+*
+*   Only movement is modelled, as in the Margolus backend. The field modules run after it
+*   the same way they do after the sweep.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+
+// Cell weights, a cell only swaps with a lighter neighbour
+#define WEIGHT_GAS 0
+#define WEIGHT_EMPTY 1
+#define WEIGHT_LIQUID 2
+#define WEIGHT_POWDER 3
+#define WEIGHT_STATIC 4             // Never moves, never moved into
+
+typedef enum move_dir_t {
+    DIR_NONE,
+    DIR_DOWN,
+    DIR_DOWN_LEFT,
+    DIR_DOWN_RIGHT,
+    DIR_LEFT,
+    DIR_RIGHT,
+} move_dir_t;
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+// Kept per world, see sim_world_t
+typedef struct double_buffer_t {
+    particle_t** next;
+    unsigned char* intent;              // Move each cell wants, all DIR_NONE between ticks
+    unsigned char* accepted;            // Move each cell accepted into itself
+    unsigned char* chunkTouched;        // Running chunks and their neighbours
+    unsigned char weight[MATERIAL_COUNT];
+    unsigned int tick;
+} double_buffer_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static const int moveX[6] = { 0, 0, -1, 1, -1, 1 };
+static const int moveY[6] = { 0, 1, 1, 1, 0, 0 };
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void IntentRows(int firstRow, int lastRow, int worker, void* user);
+static void ResolveRows(int firstRow, int lastRow, int worker, void* user);
+static void WriteRows(int firstRow, int lastRow, int worker, void* user);
+static int Weight(particle_t** grid, int x, int y);
+static bool PickSide(int x, int y);
+
+//----------------------------------------------------------------------------------
+// Double Buffer Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitDoubleBuffer(void) {
+    double_buffer_t* buffer = (double_buffer_t*) calloc(1, sizeof(double_buffer_t));
+    sim->doubleBuffer = buffer;
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        switch (sim->props[m].type) {
+        case SOLID: buffer->weight[m] = WEIGHT_POWDER; break;
+        case LIQUID: buffer->weight[m] = WEIGHT_LIQUID; break;
+        case GAS: buffer->weight[m] = WEIGHT_GAS; break;
+        default: buffer->weight[m] = WEIGHT_STATIC; break;
+        }
+    }
+
+    buffer->next = (particle_t**) calloc(STRIDE * HEIGHT, sizeof(particle_t*));
+    buffer->intent = (unsigned char*) calloc(STRIDE * HEIGHT, sizeof(unsigned char));
+    buffer->accepted = (unsigned char*) calloc(STRIDE * HEIGHT, sizeof(unsigned char));
+    buffer->chunkTouched = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+}
+
+void UnloadDoubleBuffer(void) {
+    double_buffer_t* buffer = sim->doubleBuffer;
+    free(buffer->next);
+    free(buffer->intent);
+    free(buffer->accepted);
+    free(buffer->chunkTouched);
+    free(buffer);
+    sim->doubleBuffer = NULL;
+}
+
+void UpdateDoubleBuffer(particle_t** grid) {
+    double_buffer_t* buffer = sim->doubleBuffer;
+    // Moves reach one cell past a running chunk, so its neighbours take part in every pass
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            bool touched = false;
+            for (int j = cy - 1; j <= cy + 1 && !touched; j++) {
+                for (int i = cx - 1; i <= cx + 1 && !touched; i++) {
+                    if (i >= 0 && j >= 0 && i < sim->chunksX && j < sim->chunksY && sim->chunkRun[j * sim->chunksX + i]) touched = true;
+                }
+            }
+            buffer->chunkTouched[cy * sim->chunksX + cx] = touched;
+        }
+    }
+
+    // Each pass only writes the rows it was given, the worker pool splits them
+    RunParallel(HEIGHT, IntentRows, grid);
+    RunParallel(HEIGHT, ResolveRows, NULL);
+    RunParallel(HEIGHT, WriteRows, grid);
+
+    // The next grid takes over, cells that changed wake their chunks
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if (!buffer->chunkTouched[c]) continue;
+        int cx = c % sim->chunksX, cy = c / sim->chunksX;
+
+        for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+            int i = GetIndex(cx * CHUNK_SIZE, y);
+            memset(buffer->intent + i, DIR_NONE, CHUNK_SIZE);
+
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                if (grid[i + x] == buffer->next[i + x]) continue;
+                grid[i + x] = buffer->next[i + x];
+                WakeCell(cx * CHUNK_SIZE + x, y);
+            }
+        }
+    }
+
+    buffer->tick++;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void IntentRows(int firstRow, int lastRow, int, void* user) {
+    particle_t** grid = (particle_t**)user;
+    for (int y = firstRow; y < lastRow; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            if (!IsCellRunning(x, y)) {
+                x |= CHUNK_SIZE - 1;
+                continue;
+            }
+
+            int w = Weight(grid, x, y);
+            if (w == WEIGHT_STATIC || w == WEIGHT_GAS) continue;
+
+            // Empty space can only swap with gas, anything heavier with anything lighter
+            int dir = DIR_NONE;
+            if (Weight(grid, x, y + 1) < w) {
+                dir = DIR_DOWN;
+            }
+            else {
+                bool left = Weight(grid, x - 1, y + 1) < w;
+                bool right = Weight(grid, x + 1, y + 1) < w;
+                if (left && right) dir = PickSide(x, y) ? DIR_DOWN_LEFT : DIR_DOWN_RIGHT;
+                else if (left) dir = DIR_DOWN_LEFT;
+                else if (right) dir = DIR_DOWN_RIGHT;
+                else if (w != WEIGHT_POWDER) {
+                    // Liquids spread sideways, and empty space next to gas spreads it out
+                    left = Weight(grid, x - 1, y) < w;
+                    right = Weight(grid, x + 1, y) < w;
+                    if (left && right) dir = PickSide(x, y) ? DIR_LEFT : DIR_RIGHT;
+                    else if (left) dir = DIR_LEFT;
+                    else if (right) dir = DIR_RIGHT;
+                }
+            }
+            sim->doubleBuffer->intent[GetIndex(x, y)] = (unsigned char)dir;
+        }
+    }
+}
+
+// Pick which of the cells aiming at each cell gets to swap with it
+static void ResolveRows(int firstRow, int lastRow, int, void*) {
+    double_buffer_t* buffer = sim->doubleBuffer;
+    for (int y = firstRow; y < lastRow; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            int c = (y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT);
+            if (!buffer->chunkTouched[c]) {
+                x |= CHUNK_SIZE - 1;
+                continue;
+            }
+
+            int i = GetIndex(x, y);
+            int dir = DIR_NONE;
+
+            // Only cells staying put take anyone in, so every cell ends up in one swap at most
+            if (buffer->intent[i] == DIR_NONE) {
+                bool above = y > 0 && buffer->intent[i - STRIDE] == DIR_DOWN;
+                bool fromLeft = y > 0 && x > 0 && buffer->intent[i - STRIDE - 1] == DIR_DOWN_RIGHT;
+                bool fromRight = y > 0 && x < WIDTH - 1 && buffer->intent[i - STRIDE + 1] == DIR_DOWN_LEFT;
+
+                if (above) {
+                    dir = DIR_DOWN;
+                }
+                else if (fromLeft || fromRight) {
+                    dir = (fromLeft && (!fromRight || PickSide(x, y))) ? DIR_DOWN_RIGHT : DIR_DOWN_LEFT;
+                }
+                else {
+                    fromLeft = x > 0 && buffer->intent[i - 1] == DIR_RIGHT;
+                    fromRight = x < WIDTH - 1 && buffer->intent[i + 1] == DIR_LEFT;
+                    if (fromLeft || fromRight) dir = (fromLeft && (!fromRight || PickSide(x, y))) ? DIR_RIGHT : DIR_LEFT;
+                }
+            }
+            buffer->accepted[i] = (unsigned char)dir;
+        }
+    }
+}
+
+static void WriteRows(int firstRow, int lastRow, int, void* user) {
+    double_buffer_t* buffer = sim->doubleBuffer;
+    particle_t** grid = (particle_t**)user;
+    for (int y = firstRow; y < lastRow; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            int c = (y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT);
+            if (!buffer->chunkTouched[c]) {
+                x |= CHUNK_SIZE - 1;
+                continue;
+            }
+
+            int i = GetIndex(x, y);
+            int in = buffer->accepted[i], out = buffer->intent[i];
+
+            if (in != DIR_NONE) {
+                // Whatever aimed here moves in
+                buffer->next[i] = grid[GetIndex(x - moveX[in], y - moveY[in])];
+            }
+            else if (out != DIR_NONE && buffer->accepted[GetIndex(x + moveX[out], y + moveY[out])] == out) {
+                // The swap went through, the lighter cell comes up here
+                buffer->next[i] = grid[GetIndex(x + moveX[out], y + moveY[out])];
+            }
+            else {
+                buffer->next[i] = grid[i];
+            }
+        }
+    }
+}
+
+// Outside the world counts as static, so nothing leaves it
+static int Weight(particle_t** grid, int x, int y) {
+    if (!withinBounds(x, y)) return WEIGHT_STATIC;
+    particle_t* p = grid[GetIndex(x, y)];
+    return (p != NULL) ? sim->doubleBuffer->weight[p->mat] : WEIGHT_EMPTY;
+}
+
+// Cheap integer hash of the cell and tick, the same whichever thread asks
+static bool PickSide(int x, int y) {
+    unsigned int h = (unsigned int)(x * 73856093) ^ (unsigned int)(y * 19349663) ^ (sim->doubleBuffer->tick * 83492791u);
+    return ((h >> 7) & 1) != 0;
+}
@@ -0,0 +1,378 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Edit buffer
+*
+*   Every change to the world that doesn't come from the simulation itself is queued as an
+*   edit and applied between ticks, so the brush, scripts and replays all go through the same
+*   few shapes:
+*     - EDIT_LINE      cells within radius of the segment from x0, y0 to x1, y1, a capsule
+*     - EDIT_CIRCLE    disc of radius cells around x0, y0
+*     - EDIT_RECT      rectangle with corners x0, y0 and x1, y1, both included
+*     - EDIT_FLOOD     cells connected to x0, y0 that hold the same material as it
+*   Every cell of the shape whose material is in the targets mask becomes mat. A mat of
+*   NOTHING erases, EDIT_EMPTY on its own fills without overwriting anything, and any other
+*   mask replaces the materials in it. A density below 1 sprays: each cell is written with
+*   that chance, picked by a hash of the cell and the edit's seed so a replayed edit writes
+*   the same cells.
+*
+*   Shapes are rasterized into row spans, a capsule as one span per row however long the
+*   stroke, so a brush stroke costs its area. The spans are cut at chunk borders and sorted by
+*   chunk, and every touched chunk is then checkpointed for undo, unpacked, written and woken
+*   once. Edits keep their order: spans in one chunk are applied in the order their edits
+*   were queued, and a flood fill applies everything queued before it first, since its shape
+*   depends on them. Cells that already hold a particle are reset in place instead of being
+*   reallocated.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+
+#define FLOOD_MAX_CELLS (1 << 22)       // A flood fill stops growing after this many cells
+
+typedef struct edit_span_t {
+    int chunk;
+    int order;                          // Queue position of the edit the span belongs to
+    int y;
+    int x0;
+    int x1;                             // Excluded
+} edit_span_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static edit_t* edits = NULL;
+static int editCount = 0;
+static int editCapacity = 0;
+
+static edit_span_t* spans = NULL;
+static int spanCount = 0;
+static int spanCapacity = 0;
+
+// Flood fill scratch, one bit per cell of every chunk the fill has reached
+static unsigned char** floodVisited = NULL;
+static int* floodStack = NULL;
+static int floodStackCapacity = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void AddSpan(int order, int y, int x0, int x1);
+static void AddCapsule(int order, int x0, int y0, int x1, int y1, int radius);
+static void AddThinLine(int order, int x0, int y0, int x1, int y1);
+static bool Sprayed(int x, int y, unsigned int seed, unsigned int threshold);
+static void RasterizeEdit(const edit_t* edit, int order);
+static void RasterizeFlood(particle_t** grid, const edit_t* edit, int order);
+static bool FloodVisit(particle_t** grid, int x, int y, particle_mat_t mat);
+static void PushFlood(int* count, int i);
+static void FlushSpans(particle_t** grid);
+static int CompareSpans(const void* a, const void* b);
+static particle_mat_t CellMaterial(particle_t** grid, int x, int y);
+
+//----------------------------------------------------------------------------------
+// Edit Buffer Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitEdits(void) {
+    floodVisited = (unsigned char**) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char*));
+}
+
+void UnloadEdits(void) {
+    free(edits);
+    free(spans);
+    free(floodVisited);
+    free(floodStack);
+    edits = NULL;
+    spans = NULL;
+    floodVisited = NULL;
+    floodStack = NULL;
+    editCount = editCapacity = 0;
+    spanCount = spanCapacity = 0;
+    floodStackCapacity = 0;
+}
+
+// Positions are in window cells, the edit waits for the next ApplyEdits
+void QueueEdit(const edit_t* edit) {
+    if (editCount == editCapacity) {
+        editCapacity = (editCapacity > 0) ? editCapacity * 2 : 64;
+        edits = (edit_t*) realloc(edits, editCapacity * sizeof(edit_t));
+    }
+    edits[editCount++] = *edit;
+}
+
+// Apply every queued edit in order, call between ticks
+void ApplyEdits(particle_t** grid) {
+    if (editCount == 0) return;
+
+    for (int n = 0; n < editCount; n++) {
+        if (edits[n].type == EDIT_FLOOD) {
+            FlushSpans(grid);
+            RasterizeFlood(grid, &edits[n], n);
+        }
+        else {
+            RasterizeEdit(&edits[n], n);
+        }
+    }
+    FlushSpans(grid);
+    editCount = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Clip a span of row y to the world and cut it at chunk borders
+static void AddSpan(int order, int y, int x0, int x1) {
+    if (y < 0 || y >= HEIGHT) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 > WIDTH) x1 = WIDTH;
+
+    while (x0 < x1) {
+        int end = (x0 | (CHUNK_SIZE - 1)) + 1;
+        if (end > x1) end = x1;
+
+        if (spanCount == spanCapacity) {
+            spanCapacity = (spanCapacity > 0) ? spanCapacity * 2 : 256;
+            spans = (edit_span_t*) realloc(spans, spanCapacity * sizeof(edit_span_t));
+        }
+        spans[spanCount++] = { (y >> CHUNK_SHIFT) * sim->chunksX + (x0 >> CHUNK_SHIFT), order, y, x0, end };
+        x0 = end;
+    }
+}
+
+// Cells within radius of the segment, one span per row. The capsule is convex, so each row
+// of it is a single run reaching as far as the furthest of its two end discs and the band
+// between them
+static void AddCapsule(int order, int x0, int y0, int x1, int y1, int radius) {
+    double dx = x1 - x0, dy = y1 - y0;
+    double length = sqrt(dx * dx + dy * dy);
+    int top = ((y0 < y1) ? y0 : y1) - radius;
+    int bottom = ((y0 > y1) ? y0 : y1) + radius;
+
+    for (int y = top; y <= bottom; y++) {
+        double lo = INFINITY, hi = -INFINITY;
+
+        for (int end = 0; end < 2; end++) {
+            int ex = end ? x1 : x0, ey = end ? y1 : y0;
+            int oy = y - ey;
+            if (abs(oy) > radius) continue;
+            double half = sqrt((double)(radius * radius - oy * oy));
+            lo = fmin(lo, ex - half);
+            hi = fmax(hi, ex + half);
+        }
+
+        // The band is where the point projects inside the segment and lies within radius of
+        // it, both of which bound x linearly on a given row
+        if (length > 0.0) {
+            double bandLo = -INFINITY, bandHi = INFINITY;
+            double along = (y - y0) * dy, across = (y - y0) * dx;
+            double bounds[2][3] = {
+                { dx, x0 * dx - along, x0 * dx - along + length * length },
+                { dy, x0 * dy + across - radius * length, x0 * dy + across + radius * length },
+            };
+            for (int b = 0; b < 2; b++) {
+                double k = bounds[b][0], from = bounds[b][1], to = bounds[b][2];
+                if (k > 0.0) { bandLo = fmax(bandLo, from / k); bandHi = fmin(bandHi, to / k); }
+                else if (k < 0.0) { bandLo = fmax(bandLo, to / k); bandHi = fmin(bandHi, from / k); }
+                else if (from > 0.0 || to < 0.0) bandHi = -INFINITY;
+            }
+            if (bandLo <= bandHi) {
+                lo = fmin(lo, bandLo);
+                hi = fmax(hi, bandHi);
+            }
+        }
+
+        if (lo <= hi) AddSpan(order, y, (int)ceil(lo - 1e-6), (int)floor(hi + 1e-6) + 1);
+    }
+}
+
+// Bresenham for strokes without a radius, cells next to each other on a row share a span
+static void AddThinLine(int order, int x0, int y0, int x1, int y1) {
+    int x = x0, y = y0;
+    int dx = abs(x1 - x), sx = (x < x1) ? 1 : -1;
+    int dy = -abs(y1 - y), sy = (y < y1) ? 1 : -1;
+    int err = dx + dy;
+    int runStart = x, runEnd = x, runY = y;
+
+    while (true) {
+        int e2 = 2 * err;
+        bool last = (x == x1 && y == y1);
+        if (!last && e2 >= dy) { err += dy; x += sx; }
+        if (!last && e2 <= dx) { err += dx; y += sy; }
+
+        if (last || y != runY) {
+            AddSpan(order, runY, (runStart < runEnd) ? runStart : runEnd, ((runStart > runEnd) ? runStart : runEnd) + 1);
+            if (last) break;
+            runStart = x;
+            runY = y;
+        }
+        runEnd = x;
+    }
+}
+
+static void RasterizeEdit(const edit_t* edit, int order) {
+    switch (edit->type) {
+    case EDIT_LINE:
+        if (edit->radius > 0) AddCapsule(order, edit->x0, edit->y0, edit->x1, edit->y1, edit->radius);
+        else AddThinLine(order, edit->x0, edit->y0, edit->x1, edit->y1);
+        break;
+    case EDIT_CIRCLE:
+        AddCapsule(order, edit->x0, edit->y0, edit->x0, edit->y0, edit->radius);
+        break;
+    case EDIT_RECT: {
+        int x0 = (edit->x0 < edit->x1) ? edit->x0 : edit->x1;
+        int x1 = (edit->x0 < edit->x1) ? edit->x1 : edit->x0;
+        int y0 = (edit->y0 < edit->y1) ? edit->y0 : edit->y1;
+        int y1 = (edit->y0 < edit->y1) ? edit->y1 : edit->y0;
+        for (int y = y0; y <= y1; y++) AddSpan(order, y, x0, x1 + 1);
+    } break;
+    default:
+        break;
+    }
+}
+
+// Scanline fill over the grid as it is now, every run of matching cells becomes one span
+static void RasterizeFlood(particle_t** grid, const edit_t* edit, int order) {
+    if (!withinBounds(edit->x0, edit->y0)) return;
+    particle_mat_t mat = CellMaterial(grid, edit->x0, edit->y0);
+    if (!(edit->targets & (1u << mat)) || mat == edit->mat) return;
+
+    int cells = 0;
+    int stackCount = 0;
+    PushFlood(&stackCount, GetIndex(edit->x0, edit->y0));
+
+    while (stackCount > 0 && cells < FLOOD_MAX_CELLS) {
+        int i = floodStack[--stackCount];
+        int x = i & (STRIDE - 1), y = i >> sim->shift;
+        if (!FloodVisit(grid, x, y, mat)) continue;
+
+        int x0 = x, x1 = x + 1;
+        while (FloodVisit(grid, x0 - 1, y, mat)) x0--;
+        while (FloodVisit(grid, x1, y, mat)) x1++;
+        AddSpan(order, y, x0, x1);
+        cells += x1 - x0;
+
+        // Seed the start of every matching run above and below
+        for (int ny = y - 1; ny <= y + 1; ny += 2) {
+            if (ny < 0 || ny >= HEIGHT) continue;
+            bool inRun = false;
+            for (int nx = x0; nx < x1; nx++) {
+                bool match = CellMaterial(grid, nx, ny) == mat;
+                if (match && !inRun) PushFlood(&stackCount, GetIndex(nx, ny));
+                inRun = match;
+            }
+        }
+    }
+
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        free(floodVisited[c]);
+        floodVisited[c] = NULL;
+    }
+}
+
+// Mark x, y as part of the fill, false when it is outside, already in or doesn't match
+static bool FloodVisit(particle_t** grid, int x, int y, particle_mat_t mat) {
+    if (!withinBounds(x, y) || CellMaterial(grid, x, y) != mat) return false;
+
+    int c = (y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT);
+    if (floodVisited[c] == NULL) floodVisited[c] = (unsigned char*) calloc(CHUNK_SIZE * CHUNK_SIZE / 8, 1);
+
+    int bit = (y & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (x & (CHUNK_SIZE - 1));
+    if (floodVisited[c][bit >> 3] & (1 << (bit & 7))) return false;
+    floodVisited[c][bit >> 3] |= (unsigned char)(1 << (bit & 7));
+    return true;
+}
+
+static void PushFlood(int* count, int i) {
+    if (*count == floodStackCapacity) {
+        floodStackCapacity = (floodStackCapacity > 0) ? floodStackCapacity * 2 : 1024;
+        floodStack = (int*) realloc(floodStack, floodStackCapacity * sizeof(int));
+    }
+    floodStack[(*count)++] = i;
+}
+
+// Write every span chunk by chunk, each chunk is unpacked and woken once
+static void FlushSpans(particle_t** grid) {
+    if (spanCount == 0) return;
+    qsort(spans, spanCount, sizeof(edit_span_t), CompareSpans);
+
+    for (int first = 0; first < spanCount;) {
+        int c = spans[first].chunk;
+        int cx = c % sim->chunksX, cy = c / sim->chunksX;
+        int last = first;
+        while (last < spanCount && spans[last].chunk == c) last++;
+
+        CheckpointChunk(grid, cx, cy);
+        UnpackChunk(grid, cx, cy);
+
+        int minX = WIDTH, minY = HEIGHT, maxX = -1, maxY = -1;
+        for (int n = first; n < last; n++) {
+            const edit_span_t* span = &spans[n];
+            const edit_t* edit = &edits[span->order];
+            particle_t** row = grid + GetIndex(0, span->y);
+            bool spray = edit->density < 1.0f;
+            unsigned int threshold = spray ? (unsigned int)(fmaxf(edit->density, 0.0f) * 4294967295.0f) : 0;
+
+            for (int x = span->x0; x < span->x1; x++) {
+                particle_t* p = row[x];
+                particle_mat_t mat = (p != NULL) ? p->mat : NOTHING;
+                if (!(edit->targets & (1u << mat)) || mat == edit->mat) continue;
+                if (spray && !Sprayed(x, span->y, edit->seed, threshold)) continue;
+
+                if (edit->mat == NOTHING) {
+                    free(p);
+                    row[x] = NULL;
+                }
+                else if (p != NULL) {
+                    InitParticle(p, edit->mat);
+                }
+                else {
+                    row[x] = CreateParticle(edit->mat);
+                }
+
+                if (x < minX) minX = x;
+                if (x > maxX) maxX = x;
+                if (span->y < minY) minY = span->y;
+                if (span->y > maxY) maxY = span->y;
+            }
+        }
+
+        // The corners of what changed wake the chunk and any neighbour it touches
+        if (maxX >= 0) {
+            WakeCell(minX, minY);
+            WakeCell(maxX, minY);
+            WakeCell(minX, maxY);
+            WakeCell(maxX, maxY);
+        }
+        first = last;
+    }
+    spanCount = 0;
+}
+
+// By chunk, then by edit so overlapping edits apply in queue order, then by position
+static int CompareSpans(const void* a, const void* b) {
+    const edit_span_t* sa = (const edit_span_t*)a;
+    const edit_span_t* sb = (const edit_span_t*)b;
+    if (sa->chunk != sb->chunk) return sa->chunk - sb->chunk;
+    if (sa->order != sb->order) return sa->order - sb->order;
+    if (sa->y != sb->y) return sa->y - sb->y;
+    return sa->x0 - sb->x0;
+}
+
+// Integer hash of the cell in world coordinates, so it doesn't depend on the window
+static bool Sprayed(int x, int y, unsigned int seed, unsigned int threshold) {
+    unsigned int h = (unsigned int)(x + sim->chunkOriginX * CHUNK_SIZE) * 0x9E3779B1u;
+    h ^= (unsigned int)(y + sim->chunkOriginY * CHUNK_SIZE) * 0x85EBCA77u;
+    h ^= seed * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h < threshold;
+}
+
+static particle_mat_t CellMaterial(particle_t** grid, int x, int y) {
+    particle_t* p = grid[GetIndex(x, y)];
+    return (p != NULL) ? p->mat : NOTHING;
+}
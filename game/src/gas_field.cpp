@@ -0,0 +1,293 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Gas density field
+*
+*   Smoke kept as a coarse density/velocity grid instead of one particle per pixel. The field
+*   is advected semi-Lagrangianly, pushed up by buoyancy and slowly dissipated, so its cost
+*   does not depend on how much smoke a fire produces.
+*
+*   Coupling with the particle grid happens once per tick:
+*     - SMOKE particles inside completely open cells are absorbed into the field
+*     - Field density inside cells shared with solids or liquids is handed back as SMOKE
+*       particles, so smoke still collides with terrain at pixel resolution
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "raymath.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define GAS_CELL (sim->gasField->gasCell)
+#define GAS_MAX_SIZE 256        // Larger worlds get coarser cells so the field stays this size
+#define GAS_WIDTH (WIDTH / GAS_CELL)
+#define GAS_HEIGHT (HEIGHT / GAS_CELL)
+#define GAS_CELL_AREA (GAS_CELL * GAS_CELL)
+
+#define GAS_BUOYANCY 6.0f       // Upward acceleration per unit of density, in cells/s^2
+#define GAS_DRAG 1.5f           // Velocity damping per second
+#define GAS_DISSIPATION 0.25f   // Density lost per second
+#define GAS_MAX_SPEED 30.0f     // Cells per second
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+// Kept per world, see sim_world_t
+typedef struct gas_field_t {
+    int gasCell;                        // Particles per field cell along each axis
+    float* density;
+    float* densityNext;
+    float* velX;
+    float* velY;
+    float* velXNext;
+    float* velYNext;
+    unsigned short* occupied;           // Non gas particles inside each field cell
+} gas_field_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+// Render thread only, for the main world
+static Texture2D gasTexture = { 0 };
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void AbsorbParticles(particle_t** grid);
+static void ApplyForces(float dt);
+static void Advect(float dt);
+static void ReleaseParticles(particle_t** grid);
+static float Sample(const float* field, float x, float y);
+
+//----------------------------------------------------------------------------------
+// Gas Field Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitGasField(void) {
+    gas_field_t* gas = (gas_field_t*) calloc(1, sizeof(gas_field_t));
+    sim->gasField = gas;
+    int size = (WIDTH > HEIGHT) ? WIDTH : HEIGHT;
+    gas->gasCell = 4;
+    while (size / gas->gasCell > GAS_MAX_SIZE) gas->gasCell *= 2;
+
+    int count = GAS_WIDTH * GAS_HEIGHT;
+
+    gas->density = (float*) calloc(count, sizeof(float));
+    gas->densityNext = (float*) calloc(count, sizeof(float));
+    gas->velX = (float*) calloc(count, sizeof(float));
+    gas->velY = (float*) calloc(count, sizeof(float));
+    gas->velXNext = (float*) calloc(count, sizeof(float));
+    gas->velYNext = (float*) calloc(count, sizeof(float));
+    gas->occupied = (unsigned short*) calloc(count, sizeof(unsigned short));
+}
+
+// Clear the field, for when the world under it was replaced
+void ResetGasField(void) {
+    gas_field_t* gas = sim->gasField;
+    int count = GAS_WIDTH * GAS_HEIGHT;
+    memset(gas->density, 0, count * sizeof(float));
+    memset(gas->densityNext, 0, count * sizeof(float));
+    memset(gas->velX, 0, count * sizeof(float));
+    memset(gas->velY, 0, count * sizeof(float));
+    memset(gas->velXNext, 0, count * sizeof(float));
+    memset(gas->velYNext, 0, count * sizeof(float));
+    memset(gas->occupied, 0, count * sizeof(unsigned short));
+}
+
+void UnloadGasField(void) {
+    gas_field_t* gas = sim->gasField;
+    if (sim == &mainWorld && gasTexture.id != 0) {
+        UnloadTexture(gasTexture);
+        gasTexture = { 0 };
+    }
+    free(gas->density);
+    free(gas->densityNext);
+    free(gas->velX);
+    free(gas->velY);
+    free(gas->velXNext);
+    free(gas->velYNext);
+    free(gas->occupied);
+    free(gas);
+    sim->gasField = NULL;
+}
+
+void AddGasDensity(int x, int y, float amount) {
+    if (!withinBounds(x, y)) return;
+    sim->gasField->density[(y / GAS_CELL) * GAS_WIDTH + x / GAS_CELL] += amount;
+}
+
+// Follow a window shift of dx, dy particles, smoke that leaves the window is dropped
+void ShiftGasField(int dx, int dy) {
+    gas_field_t* gas = sim->gasField;
+    int gx = dx / GAS_CELL, gy = dy / GAS_CELL;
+
+    ShiftCells(gas->density, sizeof(float), GAS_WIDTH, GAS_HEIGHT, GAS_WIDTH, gx, gy, NULL);
+    ShiftCells(gas->velX, sizeof(float), GAS_WIDTH, GAS_HEIGHT, GAS_WIDTH, gx, gy, NULL);
+    ShiftCells(gas->velY, sizeof(float), GAS_WIDTH, GAS_HEIGHT, GAS_WIDTH, gx, gy, NULL);
+    ShiftCells(gas->occupied, sizeof(unsigned short), GAS_WIDTH, GAS_HEIGHT, GAS_WIDTH, gx, gy, NULL);
+}
+
+void UpdateGasField(particle_t** grid, float dt) {
+    AbsorbParticles(grid);
+    ApplyForces(dt);
+    Advect(dt);
+    ReleaseParticles(grid);
+}
+
+int GetGasFieldCells(void) {
+    return GAS_WIDTH * GAS_HEIGHT;
+}
+
+// Colour the field into pixels, GetGasFieldCells of them, for the render thread to draw
+void CaptureGasField(Color* pixels) {
+    Color smoke = sim->props[SMOKE].initialColor;
+
+    for (int i = 0; i < GAS_WIDTH * GAS_HEIGHT; i++) {
+        float alpha = Clamp(sim->gasField->density[i] / GAS_CELL_AREA, 0.0f, 1.0f);
+        pixels[i] = { smoke.r, smoke.g, smoke.b, (unsigned char)(alpha * smoke.a) };
+    }
+}
+
+// Draw captured pixels over whatever texture mode is active, scaled to world size
+void DrawGasField(const Color* pixels) {
+    // Made on the first draw, so worlds that are never drawn don't need a window
+    if (gasTexture.id == 0) {
+        Image image = { (void*) pixels, GAS_WIDTH, GAS_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        gasTexture = LoadTextureFromImage(image);
+        SetTextureFilter(gasTexture, TEXTURE_FILTER_BILINEAR);
+    }
+    UpdateTexture(gasTexture, pixels);
+
+    DrawTexturePro(gasTexture,
+                   {0, 0, (float)GAS_WIDTH, (float)GAS_HEIGHT},
+                   {0, 0, (float)WIDTH, (float)HEIGHT},
+                   {0, 0}, 0.0f, WHITE);
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Count what blocks each cell and pull free floating smoke particles into the field.
+// Sleeping chunks have not changed, so their counts from the last pass still hold
+static void AbsorbParticles(particle_t** grid) {
+    gas_field_t* gas = sim->gasField;
+    for (int gy = 0; gy < GAS_HEIGHT; gy++) {
+        for (int gx = 0; gx < GAS_WIDTH; gx++) {
+            if (!IsCellAwake(gx * GAS_CELL, gy * GAS_CELL)) continue;
+
+            int blocked = 0, smoke = 0;
+
+            for (int sy = 0; sy < GAS_CELL; sy++) {
+                for (int sx = 0; sx < GAS_CELL; sx++) {
+                    particle_t* p = grid[GetIndex(gx * GAS_CELL + sx, gy * GAS_CELL + sy)];
+                    if (p == NULL) continue;
+                    if (sim->props[p->mat].type != GAS) blocked++;
+                    else if (p->mat == SMOKE) smoke++;
+                }
+            }
+
+            int gi = gy * GAS_WIDTH + gx;
+            gas->occupied[gi] = blocked;
+
+            if (blocked == 0 && smoke > 0) {
+                for (int sy = 0; sy < GAS_CELL; sy++) {
+                    for (int sx = 0; sx < GAS_CELL; sx++) {
+                        int i = GetIndex(gx * GAS_CELL + sx, gy * GAS_CELL + sy);
+                        if (grid[i] != NULL && grid[i]->mat == SMOKE) {
+                            free(grid[i]);
+                            grid[i] = NULL;
+                            WakeCell(gx * GAS_CELL + sx, gy * GAS_CELL + sy);
+                        }
+                    }
+                }
+                gas->density[gi] += smoke;
+            }
+        }
+    }
+}
+
+static void ApplyForces(float dt) {
+    gas_field_t* gas = sim->gasField;
+    float drag = 1.0f / (1.0f + GAS_DRAG * dt);
+
+    for (int i = 0; i < GAS_WIDTH * GAS_HEIGHT; i++) {
+        if (gas->occupied[i] == GAS_CELL_AREA) {
+            gas->velX[i] = 0;
+            gas->velY[i] = 0;
+            continue;
+        }
+        // Denser smoke rises faster, capped so a single dense puff can't tunnel through walls
+        float lift = GAS_BUOYANCY * Clamp(gas->density[i] / GAS_CELL_AREA, 0.0f, 1.0f) + GAS_BUOYANCY * 0.25f;
+        gas->velY[i] = Clamp((gas->velY[i] - lift * dt) * drag, -GAS_MAX_SPEED, GAS_MAX_SPEED);
+        gas->velX[i] = Clamp(gas->velX[i] * drag, -GAS_MAX_SPEED, GAS_MAX_SPEED);
+    }
+}
+
+// Semi-Lagrangian step, every cell looks back along its velocity and samples the old field
+static void Advect(float dt) {
+    gas_field_t* gas = sim->gasField;
+    float keep = 1.0f / (1.0f + GAS_DISSIPATION * dt);
+
+    for (int y = 0; y < GAS_HEIGHT; y++) {
+        for (int x = 0; x < GAS_WIDTH; x++) {
+            int i = y * GAS_WIDTH + x;
+
+            if (gas->occupied[i] == GAS_CELL_AREA) {
+                gas->densityNext[i] = 0;
+                gas->velXNext[i] = 0;
+                gas->velYNext[i] = 0;
+                continue;
+            }
+
+            float px = x - gas->velX[i] * dt;
+            float py = y - gas->velY[i] * dt;
+
+            gas->densityNext[i] = Sample(gas->density, px, py) * keep;
+            gas->velXNext[i] = Sample(gas->velX, px, py);
+            gas->velYNext[i] = Sample(gas->velY, px, py);
+        }
+    }
+
+    float* tmp = gas->density; gas->density = gas->densityNext; gas->densityNext = tmp;
+    tmp = gas->velX; gas->velX = gas->velXNext; gas->velXNext = tmp;
+    tmp = gas->velY; gas->velY = gas->velYNext; gas->velYNext = tmp;
+}
+
+// Cells that share space with solids or liquids give their smoke back as particles
+static void ReleaseParticles(particle_t** grid) {
+    gas_field_t* gas = sim->gasField;
+    for (int gy = 0; gy < GAS_HEIGHT; gy++) {
+        for (int gx = 0; gx < GAS_WIDTH; gx++) {
+            int gi = gy * GAS_WIDTH + gx;
+            if (gas->occupied[gi] == 0 || gas->density[gi] < 1.0f) continue;
+
+            for (int sy = 0; sy < GAS_CELL && gas->density[gi] >= 1.0f; sy++) {
+                for (int sx = 0; sx < GAS_CELL && gas->density[gi] >= 1.0f; sx++) {
+                    int i = GetIndex(gx * GAS_CELL + sx, gy * GAS_CELL + sy);
+                    if (grid[i] == NULL) {
+                        grid[i] = CreateParticle(SMOKE);
+                        gas->density[gi] -= 1.0f;
+                        WakeCell(gx * GAS_CELL + sx, gy * GAS_CELL + sy);
+                    }
+                }
+            }
+
+            // Whatever did not fit had nowhere to go
+            if (gas->occupied[gi] == GAS_CELL_AREA) gas->density[gi] = 0;
+        }
+    }
+}
+
+static float Sample(const float* field, float x, float y) {
+    x = Clamp(x, 0.0f, GAS_WIDTH - 1.001f);
+    y = Clamp(y, 0.0f, GAS_HEIGHT - 1.001f);
+
+    int x0 = (int)x, y0 = (int)y;
+    float fx = x - x0, fy = y - y0;
+    const float* row = field + y0 * GAS_WIDTH + x0;
+
+    float top = row[0] + fx * (row[1] - row[0]);
+    float bottom = row[GAS_WIDTH] + fx * (row[GAS_WIDTH + 1] - row[GAS_WIDTH]);
+    return top + fy * (bottom - top);
+}
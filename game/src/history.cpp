@@ -0,0 +1,345 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Undo history
+*
+*   Undo and redo for edits, at the cost of the chunks they touch. Each stroke opens a
+*   checkpoint, and the first time an edit is about to write a chunk the checkpoint keeps an
+*   image of that chunk in the packed format of compression.cpp: a copy of the blob when the
+*   chunk is packed already, encoded from its particles otherwise. A few KB per chunk, and
+*   nothing for the rest of the world.
+*
+*   Images are shared and counted. Each chunk remembers the last image taken of it, and a
+*   chunk that hasn't changed since, or encodes to the same bytes, reuses that image instead
+*   of keeping another, so redoing and undoing the same stroke back and forth or touching a
+*   chunk without changing it costs nothing more.
+*
+*   Undo swaps the chunks of the newest checkpoint back to their images, keeping what they
+*   held as a redo checkpoint. A chunk is restored by installing its image as a packed chunk,
+*   which only writes the cell pointers, and waking it. What the chunk held isn't encoded or
+*   freed on the way out: its particles are handed to the redo image as they are, and redo
+*   hands them straight back, so both directions cost a few microseconds per chunk. Edits
+*   after an undo drop the redo checkpoints. The oldest checkpoints are dropped once the
+*   images in use pass HISTORY_MAX_BYTES.
+*
+*   Only the cells come back, the temperature and gas fields carry on as they are. Chunks
+*   that streamed out of the window since are left alone.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+#include <deque>
+
+#define HISTORY_MAX_BYTES (64 * 1024 * 1024)
+
+// A chunk as it was, shared by every checkpoint that holds it. Images handed the particles
+// of a chunk keep its cells instead of a blob and belong to a single checkpoint
+typedef struct chunk_image_t {
+    chunk_blob_t blob;
+    particle_t** cells;
+    size_t bytes;
+    int refs;
+} chunk_image_t;
+
+// Chunks are kept by world chunk, so they still line up after the window moved
+typedef struct history_chunk_t {
+    int wx;
+    int wy;
+    chunk_image_t* image;
+} history_chunk_t;
+
+typedef struct checkpoint_t {
+    history_chunk_t* chunks;
+    int count;
+    int capacity;
+    unsigned int serial;
+} checkpoint_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static std::deque<checkpoint_t> undoStack;
+static std::deque<checkpoint_t> redoStack;
+static bool recording = false;          // The newest undo checkpoint takes chunks
+static unsigned int serial = 0;
+static size_t historyBytes = 0;
+
+// Per window chunk
+static unsigned int* recordedIn = NULL;     // Serial of the checkpoint that last took the chunk
+static chunk_image_t** latest = NULL;       // Last image taken or restored
+static unsigned int* latestStamp = NULL;
+static int historyOriginX = 0;
+static int historyOriginY = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void SyncOrigin(void);
+static chunk_image_t* TakeImage(particle_t** grid, int cx, int cy);
+static chunk_image_t* DetachImage(particle_t** grid, int cx, int cy);
+static void RestoreImage(particle_t** grid, int cx, int cy, chunk_image_t* image);
+static void SetLatest(int c, chunk_image_t* image);
+static void AddChunk(checkpoint_t* checkpoint, int wx, int wy, chunk_image_t* image);
+static void SwapCheckpoint(particle_t** grid, checkpoint_t* from, checkpoint_t* to);
+static void FreeCheckpoint(checkpoint_t* checkpoint);
+static void ReleaseImage(chunk_image_t* image);
+static void TrimHistory(void);
+
+//----------------------------------------------------------------------------------
+// Undo History Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitHistory(void) {
+    recordedIn = (unsigned int*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned int));
+    latest = (chunk_image_t**) calloc(sim->chunksX * sim->chunksY, sizeof(chunk_image_t*));
+    latestStamp = (unsigned int*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned int));
+    historyOriginX = sim->chunkOriginX;
+    historyOriginY = sim->chunkOriginY;
+}
+
+void UnloadHistory(void) {
+    ClearHistory();
+    free(recordedIn);
+    free(latest);
+    free(latestStamp);
+    recordedIn = NULL;
+    latest = NULL;
+    latestStamp = NULL;
+}
+
+// Start a new step of history, edits from here on undo together. Call with no edits queued
+void BeginCheckpoint(void) {
+    recording = true;
+    if (!undoStack.empty() && undoStack.back().count == 0) return;
+
+    checkpoint_t checkpoint = { 0 };
+    checkpoint.serial = ++serial;
+    undoStack.push_back(checkpoint);
+}
+
+// An edit is about to write the chunk, keep what it holds now unless this checkpoint has
+// it already. Edits outside of a checkpoint can't be undone
+void CheckpointChunk(particle_t** grid, int cx, int cy) {
+    if (!recording) return;
+    SyncOrigin();
+
+    checkpoint_t* checkpoint = &undoStack.back();
+    int c = cy * sim->chunksX + cx;
+    if (recordedIn[c] == checkpoint->serial) return;
+    recordedIn[c] = checkpoint->serial;
+
+    // A new change, whatever was undone can't be redone on top of it
+    while (!redoStack.empty()) {
+        FreeCheckpoint(&redoStack.back());
+        redoStack.pop_back();
+    }
+
+    AddChunk(checkpoint, cx + sim->chunkOriginX, cy + sim->chunkOriginY, TakeImage(grid, cx, cy));
+    TrimHistory();
+}
+
+// Put the chunks of the newest checkpoint back. False when there is nothing to undo
+bool UndoCheckpoint(particle_t** grid) {
+    recording = false;
+    while (!undoStack.empty() && undoStack.back().count == 0) undoStack.pop_back();
+    if (undoStack.empty()) return false;
+
+    checkpoint_t redo = { 0 };
+    redo.serial = ++serial;
+    SwapCheckpoint(grid, &undoStack.back(), &redo);
+    FreeCheckpoint(&undoStack.back());
+    undoStack.pop_back();
+    redoStack.push_back(redo);
+    return true;
+}
+
+bool RedoCheckpoint(particle_t** grid) {
+    recording = false;
+    if (redoStack.empty()) return false;
+
+    checkpoint_t undo = { 0 };
+    undo.serial = ++serial;
+    SwapCheckpoint(grid, &redoStack.back(), &undo);
+    FreeCheckpoint(&redoStack.back());
+    redoStack.pop_back();
+    undoStack.push_back(undo);
+    return true;
+}
+
+// Forget everything, for when the whole world was replaced
+void ClearHistory(void) {
+    for (checkpoint_t& checkpoint : undoStack) FreeCheckpoint(&checkpoint);
+    for (checkpoint_t& checkpoint : redoStack) FreeCheckpoint(&checkpoint);
+    undoStack.clear();
+    redoStack.clear();
+    recording = false;
+
+    if (latest != NULL) {
+        for (int c = 0; c < sim->chunksX * sim->chunksY; c++) SetLatest(c, NULL);
+        memset(recordedIn, 0, sim->chunksX * sim->chunksY * sizeof(unsigned int));
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// The per chunk arrays are by window chunk, they go stale once the window moves
+static void SyncOrigin(void) {
+    if (sim->chunkOriginX == historyOriginX && sim->chunkOriginY == historyOriginY) return;
+
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) SetLatest(c, NULL);
+    memset(recordedIn, 0, sim->chunksX * sim->chunksY * sizeof(unsigned int));
+    historyOriginX = sim->chunkOriginX;
+    historyOriginY = sim->chunkOriginY;
+}
+
+static chunk_image_t* TakeImage(particle_t** grid, int cx, int cy) {
+    int c = cy * sim->chunksX + cx;
+    chunk_image_t* image = latest[c];
+
+    if (image == NULL || ChunkChangedSince(cx, cy, latestStamp[c])) {
+        const chunk_blob_t* packed = GetPackedChunk(cx, cy);
+        chunk_blob_t blob = { 0 };
+        if (packed != NULL) {
+            blob.data = (unsigned char*) malloc(packed->size);
+            blob.size = packed->size;
+            memcpy(blob.data, packed->data, packed->size);
+        }
+        else {
+            blob = EncodeChunk(grid, cx, cy);
+        }
+
+        if (image != NULL && image->blob.size == blob.size && memcmp(image->blob.data, blob.data, blob.size) == 0) {
+            free(blob.data);
+        }
+        else {
+            image = (chunk_image_t*) calloc(1, sizeof(chunk_image_t));
+            image->blob = blob;
+            image->bytes = blob.size;
+            historyBytes += image->bytes;
+            SetLatest(c, image);
+        }
+    }
+
+    latestStamp[c] = GetChangeStamp();
+    image->refs++;
+    return image;
+}
+
+// Take the particles of a chunk about to be restored instead of copying them. Packed chunks
+// only have a blob to copy
+static chunk_image_t* DetachImage(particle_t** grid, int cx, int cy) {
+    if (GetPackedChunk(cx, cy) != NULL) return TakeImage(grid, cx, cy);
+
+    chunk_image_t* image = (chunk_image_t*) calloc(1, sizeof(chunk_image_t));
+    image->cells = (particle_t**) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(particle_t*));
+    image->bytes = CHUNK_SIZE * CHUNK_SIZE * sizeof(particle_t*);
+    image->refs = 1;
+
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, cy * CHUNK_SIZE + y);
+        particle_t** out = image->cells + y * CHUNK_SIZE;
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            out[x] = row[x];
+            if (row[x] != NULL) image->bytes += sizeof(particle_t);
+            row[x] = NULL;
+        }
+    }
+    historyBytes += image->bytes;
+    return image;
+}
+
+// The chunk becomes a packed chunk holding the image, particles come back once it runs.
+// An image holding particles hands them back and is left empty
+static void RestoreImage(particle_t** grid, int cx, int cy, chunk_image_t* image) {
+    DiscardChunk(grid, cx, cy);
+
+    if (image->cells != NULL) {
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            memcpy(grid + GetIndex(cx * CHUNK_SIZE, cy * CHUNK_SIZE + y), image->cells + y * CHUNK_SIZE, CHUNK_SIZE * sizeof(particle_t*));
+        }
+        free(image->cells);
+        image->cells = NULL;
+        historyBytes -= image->bytes;
+        image->bytes = 0;
+    }
+    else {
+        chunk_blob_t blob = { (unsigned char*) malloc(image->blob.size), image->blob.size, 0 };
+        memcpy(blob.data, image->blob.data, blob.size);
+        if (!AdoptPackedChunk(grid, cx, cy, blob, false)) free(blob.data);
+    }
+
+    // The corners wake the chunk and its neighbours, whatever borders it may react
+    int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+    WakeCell(x0, y0);
+    WakeCell(x0 + CHUNK_SIZE - 1, y0);
+    WakeCell(x0, y0 + CHUNK_SIZE - 1);
+    WakeCell(x0 + CHUNK_SIZE - 1, y0 + CHUNK_SIZE - 1);
+
+    if (image->blob.data != NULL) {
+        SetLatest(cy * sim->chunksX + cx, image);
+        latestStamp[cy * sim->chunksX + cx] = GetChangeStamp();
+    }
+}
+
+static void SetLatest(int c, chunk_image_t* image) {
+    if (image != NULL) image->refs++;
+    if (latest[c] != NULL) ReleaseImage(latest[c]);
+    latest[c] = image;
+}
+
+static void AddChunk(checkpoint_t* checkpoint, int wx, int wy, chunk_image_t* image) {
+    if (checkpoint->count == checkpoint->capacity) {
+        checkpoint->capacity = (checkpoint->capacity > 0) ? checkpoint->capacity * 2 : 16;
+        checkpoint->chunks = (history_chunk_t*) realloc(checkpoint->chunks, checkpoint->capacity * sizeof(history_chunk_t));
+    }
+    checkpoint->chunks[checkpoint->count++] = { wx, wy, image };
+}
+
+// Restore every chunk of from, newest first so the image taken first wins, keeping what
+// the chunks held in to
+static void SwapCheckpoint(particle_t** grid, checkpoint_t* from, checkpoint_t* to) {
+    SyncOrigin();
+
+    for (int n = from->count - 1; n >= 0; n--) {
+        const history_chunk_t* chunk = &from->chunks[n];
+        int cx = chunk->wx - sim->chunkOriginX, cy = chunk->wy - sim->chunkOriginY;
+        if (cx < 0 || cy < 0 || cx >= sim->chunksX || cy >= sim->chunksY) continue;
+
+        int c = cy * sim->chunksX + cx;
+        if (recordedIn[c] != to->serial) {
+            recordedIn[c] = to->serial;
+            AddChunk(to, chunk->wx, chunk->wy, DetachImage(grid, cx, cy));
+        }
+        RestoreImage(grid, cx, cy, chunk->image);
+    }
+}
+
+static void FreeCheckpoint(checkpoint_t* checkpoint) {
+    for (int n = 0; n < checkpoint->count; n++) ReleaseImage(checkpoint->chunks[n].image);
+    free(checkpoint->chunks);
+    checkpoint->chunks = NULL;
+    checkpoint->count = checkpoint->capacity = 0;
+}
+
+static void ReleaseImage(chunk_image_t* image) {
+    if (--image->refs > 0) return;
+
+    if (image->cells != NULL) {
+        for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) free(image->cells[i]);
+        free(image->cells);
+    }
+    historyBytes -= image->bytes;
+    free(image->blob.data);
+    free(image);
+}
+
+// Drop the oldest checkpoints until the images fit, never the one being recorded
+static void TrimHistory(void) {
+    while (historyBytes > HISTORY_MAX_BYTES && undoStack.size() > 1) {
+        FreeCheckpoint(&undoStack.front());
+        undoStack.pop_front();
+    }
+}
@@ -0,0 +1,339 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World images
+*
+*   Turns an image into a world and a world back into an image. Each pixel becomes the
+*   material of the nearest colour in the palette, pixels more than half transparent are
+*   left empty. A palette file has a colour and a material on each line, as many colours
+*   to a material as needed:
+*
+*       # r   g   b   material
+*       0     0   0   nothing
+*       194 178 128   sand
+*       90   90  90   stone
+*
+*   Without one every material stands for its own colour. Exports write the first palette
+*   colour of each material, so an exported image imports as the same materials.
+*
+*   Imports never create a particle. Rows of chunks are split across the worker pool, which
+*   maps pixels through a table of the nearest material to every colour and packs each chunk
+*   with EncodeCells, then the chunks are installed as packed chunks the way a world file loads.
+*   Cells only become particles where the simulation unpacks them.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define PALETTE_MAX 256
+#define PALETTE_LINE_MAX 256
+#define IMAGE_PATH_MAX 512
+#define NEAREST_BITS 6                  // Kept of each channel for the nearest material table
+#define NEAREST_SIZE (1 << (3 * NEAREST_BITS))
+#define OPAQUE_ALPHA 128                // Below it a pixel is empty
+
+// What the worker pool passes to ImportChunkRows and ExportRows
+typedef struct import_job_t {
+    Image image;
+    chunk_blob_t* blobs;
+    unsigned char* awake;
+} import_job_t;
+
+typedef struct export_job_t {
+    particle_t** grid;
+    Color* pixels;
+} export_job_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static Color paletteColors[PALETTE_MAX];
+static unsigned char paletteMats[PALETTE_MAX];
+static int paletteCount = 0;
+static unsigned char* nearest = NULL;   // Material for every colour, NEAREST_BITS a channel
+static Color exportColors[MATERIAL_COUNT];
+static bool exportListed[MATERIAL_COUNT];
+
+// PeekWorldImage decodes the image once for the import that follows it
+static Image peeked = { 0 };
+static char peekedPath[IMAGE_PATH_MAX] = "";
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool ReadPalette(const char* path);
+static void BuildNearest(void);
+static inline int NearestKey(Color color);
+static bool TakeImage(const char* path, Image* image);
+static void ImportChunkRows(int firstRow, int lastRow, int worker, void* user);
+static void ExportRows(int firstRow, int lastRow, int worker, void* user);
+
+//----------------------------------------------------------------------------------
+// World Image Functions Definition
+//----------------------------------------------------------------------------------
+
+// Palette from the file, or a colour for each material when path is NULL or can't be read
+void InitWorldImage(const char* palettePath) {
+    if (palettePath == NULL || !ReadPalette(palettePath)) {
+        paletteCount = 0;
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            paletteColors[paletteCount] = sim->props[m].initialColor;
+            paletteMats[paletteCount++] = (unsigned char)m;
+        }
+    }
+
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        exportColors[m] = (m == NOTHING) ? BLANK : sim->props[m].initialColor;
+        exportListed[m] = false;
+    }
+    for (int p = 0; p < paletteCount; p++) {
+        if (exportListed[paletteMats[p]]) continue;
+        exportColors[paletteMats[p]] = paletteColors[p];
+        exportListed[paletteMats[p]] = true;
+    }
+
+    if (nearest == NULL) nearest = (unsigned char*) malloc(NEAREST_SIZE);
+    BuildNearest();
+}
+
+// Size of the world an image makes, whole chunks covering it, so the world can be created to
+// match before importing it
+bool PeekWorldImage(const char* path, int* width, int* height) {
+    if (peeked.data != NULL) UnloadImage(peeked);
+    peeked = LoadImage(path);
+    if (peeked.data == NULL || strlen(path) >= sizeof(peekedPath)) {
+        TraceLog(LOG_WARNING, "IMAGE: Could not read %s", path);
+        if (peeked.data != NULL) UnloadImage(peeked);
+        peeked.data = NULL;
+        return false;
+    }
+    strcpy(peekedPath, path);
+
+    *width = (peeked.width + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    *height = (peeked.height + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    return true;
+}
+
+// Replace the world with the image, from the top left cell. Whatever of the image doesn't fit
+// is left out and whatever of the world it doesn't cover is left empty
+bool ImportWorldImage(particle_t** grid, const char* path) {
+    Image image = { 0 };
+    if (!TakeImage(path, &image)) return false;
+    double start = GetTime();
+
+    UnloadWorldFile();
+    ClearGrid(grid);
+
+    int chunkCount = sim->chunksX * sim->chunksY;
+    chunk_blob_t* blobs = (chunk_blob_t*) calloc(chunkCount, sizeof(chunk_blob_t));
+    unsigned char* awake = (unsigned char*) calloc(chunkCount, 1);
+
+    import_job_t job = { image, blobs, awake };
+    RunParallel(sim->chunksY, ImportChunkRows, &job);
+
+    // Installing touches the packed chunk lists, one chunk after another
+    for (int c = 0; c < chunkCount; c++) {
+        if (blobs[c].data == NULL) continue;
+
+        int cx = c % sim->chunksX, cy = c / sim->chunksX;
+        if (!AdoptPackedChunk(grid, cx, cy, blobs[c], false)) {
+            free(blobs[c].data);
+            continue;
+        }
+        if (awake[c]) WakeCell(cx * CHUNK_SIZE + 1, cy * CHUNK_SIZE + 1);
+    }
+
+    if (image.width > WIDTH || image.height > HEIGHT) {
+        TraceLog(LOG_WARNING, "IMAGE: %s is %ix%i, the world only %ix%i", path, image.width, image.height, WIDTH, HEIGHT);
+    }
+    TraceLog(LOG_INFO, "IMAGE: Imported %s (%ix%i) in %.0f ms", path, image.width, image.height, (GetTime() - start) * 1000.0);
+
+    free(blobs);
+    free(awake);
+    UnloadImage(image);
+    return true;
+}
+
+// Write the world as an image, a palette colour for each material
+bool ExportWorldImage(particle_t** grid, const char* path) {
+    Image image = GenImageColor(WIDTH, HEIGHT, BLANK);
+
+    export_job_t job = { grid, (Color*)image.data };
+    RunParallel(HEIGHT, ExportRows, &job);
+
+    bool ok = ExportImage(image, path);
+    UnloadImage(image);
+
+    if (ok) TraceLog(LOG_INFO, "IMAGE: Exported %s", path);
+    else TraceLog(LOG_WARNING, "IMAGE: Failed writing %s", path);
+    return ok;
+}
+
+void UnloadWorldImage(void) {
+    if (peeked.data != NULL) UnloadImage(peeked);
+    peeked.data = NULL;
+    free(nearest);
+    nearest = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static bool ReadPalette(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "IMAGE: Couldn't open palette %s", path);
+        return false;
+    }
+
+    char line[PALETTE_LINE_MAX];
+    int number = 0;
+    paletteCount = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        int r, g, b;
+        char material[PALETTE_LINE_MAX];
+        int fields = sscanf(line, "%d %d %d %255s", &r, &g, &b, material);
+        if (fields <= 0) continue;
+
+        int mat = -1;
+        for (int m = 0; m < MATERIAL_COUNT && fields == 4; m++) {
+            if (strcmp(material, materialNames[m]) == 0) mat = m;
+        }
+        if (mat < 0 || r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
+            TraceLog(LOG_WARNING, "IMAGE: %s:%d isn't a colour and a material", path, number);
+            continue;
+        }
+        if (paletteCount == PALETTE_MAX) {
+            TraceLog(LOG_WARNING, "IMAGE: %s has more than %d colours", path, PALETTE_MAX);
+            break;
+        }
+        paletteColors[paletteCount] = { (unsigned char)r, (unsigned char)g, (unsigned char)b, 255 };
+        paletteMats[paletteCount++] = (unsigned char)mat;
+    }
+    fclose(file);
+
+    if (paletteCount == 0) TraceLog(LOG_WARNING, "IMAGE: No colours in palette %s", path);
+    return paletteCount > 0;
+}
+
+// Nearest palette colour to the middle of every box of colours sharing a key, then every
+// palette colour gets its own box so colours taken straight from the palette always match
+static void BuildNearest(void) {
+    int shift = 8 - NEAREST_BITS;
+    for (int key = 0; key < NEAREST_SIZE; key++) {
+        int r = ((key >> (2 * NEAREST_BITS)) << shift) + (1 << shift) / 2;
+        int g = (((key >> NEAREST_BITS) & ((1 << NEAREST_BITS) - 1)) << shift) + (1 << shift) / 2;
+        int b = ((key & ((1 << NEAREST_BITS) - 1)) << shift) + (1 << shift) / 2;
+
+        int best = 0, bestDistance = 0x7fffffff;
+        for (int p = 0; p < paletteCount; p++) {
+            int dr = r - paletteColors[p].r, dg = g - paletteColors[p].g, db = b - paletteColors[p].b;
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance) {
+                best = p;
+                bestDistance = distance;
+            }
+        }
+        nearest[key] = paletteMats[best];
+    }
+
+    // Backwards, so the first of two palette colours sharing a box keeps it
+    for (int p = paletteCount - 1; p >= 0; p--) nearest[NearestKey(paletteColors[p])] = paletteMats[p];
+}
+
+static inline int NearestKey(Color color) {
+    int shift = 8 - NEAREST_BITS;
+    return ((color.r >> shift) << (2 * NEAREST_BITS)) | ((color.g >> shift) << NEAREST_BITS) | (color.b >> shift);
+}
+
+// The image PeekWorldImage already read, or the file read now, as 8 bit RGBA
+static bool TakeImage(const char* path, Image* image) {
+    if (peeked.data != NULL && strcmp(path, peekedPath) == 0) {
+        *image = peeked;
+        peeked.data = NULL;
+    }
+    else {
+        *image = LoadImage(path);
+    }
+    if (image->data == NULL) {
+        TraceLog(LOG_WARNING, "IMAGE: Could not read %s", path);
+        return false;
+    }
+    ImageFormat(image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    return true;
+}
+
+// Pack chunk rows firstRow to lastRow of the image, an empty chunk gets no blob
+static void ImportChunkRows(int firstRow, int lastRow, int, void* user) {
+    const import_job_t* job = (const import_job_t*)user;
+    Image image = job->image;
+    chunk_blob_t* blobs = job->blobs;
+    unsigned char* awake = job->awake;
+    chunk_cell_t* cells = (chunk_cell_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t));
+    const Color* pixels = (const Color*)image.data;
+
+    for (int cy = firstRow; cy < lastRow; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+            int count = 0;
+            bool moves = false;
+
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                chunk_cell_t* row = cells + y * CHUNK_SIZE;
+                int width = (y0 + y < image.height) ? image.width - x0 : 0;
+                if (width > CHUNK_SIZE) width = CHUNK_SIZE;
+                if (width < 0) width = 0;
+
+                const Color* pixel = pixels + (size_t)(y0 + y) * image.width + x0;
+                for (int x = 0; x < width; x++) row[x].mat = (pixel[x].a < OPAQUE_ALPHA) ? (unsigned char)NOTHING : nearest[NearestKey(pixel[x])];
+                for (int x = width; x < CHUNK_SIZE; x++) row[x].mat = NOTHING;
+
+                // As InitParticle would make them, the scrambled shade hashed from the cell
+                // instead of drawn from the random state, which stays as it was
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    int mat = row[x].mat;
+                    if (mat == NOTHING) continue;
+                    count++;
+
+                    row[x].color = sim->props[mat].initialColor;
+                    if ((sim->props[mat].type == SOLID_STUCK || sim->props[mat].type == SOLID) && mat != FIRE) {
+                        unsigned int hash = (unsigned int)(x0 + x) * 73856093u ^ (unsigned int)(y0 + y) * 19349663u;
+                        hash = (hash ^ (hash >> 15)) * 2246822519u;
+                        hash ^= hash >> 13;
+                        unsigned char shade = (unsigned char)(-10 + (int)(hash % 20));
+                        row[x].color.r += shade;
+                        row[x].color.g += shade;
+                        row[x].color.b += shade;
+                    }
+                    row[x].lifeTime = sim->props[mat].decaying ? sim->props[mat].initLifeTime : 0.0f;
+                    if (sim->props[mat].type != SOLID_STUCK || sim->props[mat].decaying) moves = true;
+                }
+            }
+
+            if (count == 0) continue;
+            int c = cy * sim->chunksX + cx;
+            blobs[c] = EncodeCells(cells);
+            awake[c] = moves;
+        }
+    }
+    free(cells);
+}
+
+// Packed chunks point at placeholders, their material is there without unpacking anything
+static void ExportRows(int firstRow, int lastRow, int, void* user) {
+    const export_job_t* job = (const export_job_t*)user;
+    particle_t** grid = job->grid;
+    Color* pixels = job->pixels;
+    for (int y = firstRow; y < lastRow; y++) {
+        particle_t** row = grid + GetIndex(0, y);
+        Color* pixel = pixels + (size_t)y * WIDTH;
+        for (int x = 0; x < WIDTH; x++) pixel[x] = exportColors[(row[x] != NULL) ? row[x]->mat : NOTHING];
+    }
+}
@@ -0,0 +1,216 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Hydrostatic liquid solver
+*
+*   Levels large bodies of passive liquid (water and oil) without walking particles across
+*   the surface one step at a time. Every tick each connected body of one liquid is labelled
+*   with a flood fill. Hydrostatic pressure at a resting cell next to the body is the height
+*   of the body's highest free surface above it, so while the highest surface sits more than
+*   a cell above the lowest open spot, particles are moved from the top of the body to it.
+*
+*   Coupling with the particle behaviour:
+*     - Interior liquid particles are not swept at all, the solver owns them
+*     - Free surface particles keep their normal behaviour (splashes, drops, flow over edges)
+*     - Only empty cells resting on something can receive liquid, so falling streams and
+*       different liquids meeting each other are left to the particle path
+*     - Packed chunks (see compression.cpp) count as walls until they are unpacked
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+
+#define PRESSURE_MIN_BODY 64        // Smaller puddles are left to the particle path
+#define PRESSURE_RATE 128           // One transfer per this many body cells per tick
+#define PRESSURE_INTERVAL 2         // Ticks between solver passes, transfers are batched up
+#define PRESSURE_INITIAL_CAPACITY 65536
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct pressure_cell_t {
+    int index;
+    int y;
+} pressure_cell_t;
+
+// Kept per world, see sim_world_t
+typedef struct liquid_pressure_t {
+    unsigned int* visited;              // Stamp of the last pass that reached a cell
+    unsigned int stamp;
+    unsigned int ticks;
+    int* queue;
+    pressure_cell_t* tops;              // Body cells with nothing above them
+    pressure_cell_t* opens;             // Empty resting cells beside the body
+    int capacity;                       // Entries in each of queue, tops and opens
+    int rowTop;                         // Only tops and opens in these rows take part
+    int rowBottom;
+} liquid_pressure_t;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void LevelBody(particle_t** grid, int seed);
+static void Grow(void);
+static int CompareHighest(const void* a, const void* b);
+static int CompareLowest(const void* a, const void* b);
+
+//----------------------------------------------------------------------------------
+// Liquid Pressure Functions Definition
+//----------------------------------------------------------------------------------
+
+// The work lists start small and grow with the largest body seen, big worlds are mostly dry
+void InitLiquidPressure(void) {
+    liquid_pressure_t* pressure = (liquid_pressure_t*) calloc(1, sizeof(liquid_pressure_t));
+    sim->liquidPressure = pressure;
+    pressure->visited = (unsigned int*) calloc(STRIDE * HEIGHT, sizeof(unsigned int));
+    Grow();
+    pressure->rowTop = 0;
+    pressure->rowBottom = HEIGHT;
+}
+
+// Rows outside the range still join bodies but never give or receive liquid, partition.cpp
+// keeps the solver off rows another process owns this tick
+void LimitLiquidPressure(int top, int bottom) {
+    liquid_pressure_t* pressure = sim->liquidPressure;
+    pressure->rowTop = top;
+    pressure->rowBottom = bottom;
+}
+
+void UnloadLiquidPressure(void) {
+    liquid_pressure_t* pressure = sim->liquidPressure;
+    free(pressure->visited);
+    free(pressure->queue);
+    free(pressure->tops);
+    free(pressure->opens);
+    free(pressure);
+    sim->liquidPressure = NULL;
+}
+
+// Passive liquids only, lava keeps reacting with its surroundings particle by particle
+bool IsPressureLiquid(particle_mat_t mat) {
+    return sim->props[mat].type == LIQUID && !sim->props[mat].acting;
+}
+
+// A liquid particle with no free neighbour is left to the solver
+bool IsInteriorLiquid(particle_t** grid, int x, int y) {
+    if (x <= 0 || x >= WIDTH - 1 || y <= 0 || y >= HEIGHT - 1) return false;
+
+    int i = GetIndex(x, y);
+    particle_mat_t mat = grid[i]->mat;
+    const int offsets[4] = { -STRIDE, STRIDE, -1, 1 };
+
+    for (int n = 0; n < 4; n++) {
+        particle_t* q = grid[i + offsets[n]];
+        if (q == NULL || sim->props[q->mat].type == GAS) return false;
+        if (sim->props[q->mat].type == LIQUID && q->mat != mat) return false;
+    }
+    return true;
+}
+
+void UpdateLiquidPressure(particle_t** grid) {
+    liquid_pressure_t* pressure = sim->liquidPressure;
+    if (pressure->ticks++ % PRESSURE_INTERVAL != 0) return;
+
+    // Each stamp value marks cells for one pass, so the array never needs clearing
+    pressure->stamp += 2;
+    if (pressure->stamp == 0) pressure->stamp = 2;
+
+    // Bodies are seeded from awake chunks only, a body that is asleep everywhere is level
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            if (!sim->chunkAwake[cy * sim->chunksX + cx]) continue;
+
+            for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+                for (int x = cx * CHUNK_SIZE; x < (cx + 1) * CHUNK_SIZE; x++) {
+                    int i = GetIndex(x, y);
+                    if (grid[i] != NULL && pressure->visited[i] != pressure->stamp && IsPressureLiquid(grid[i]->mat)) {
+                        LevelBody(grid, i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void LevelBody(particle_t** grid, int seed) {
+    liquid_pressure_t* pressure = sim->liquidPressure;
+    particle_mat_t mat = grid[seed]->mat;
+    int head = 0, tail = 0, topCount = 0, openCount = 0;
+
+    pressure->queue[tail++] = seed;
+    pressure->visited[seed] = pressure->stamp;
+
+    while (head < tail) {
+        // A cell adds at most four entries to any of the lists below
+        if (tail + 4 > pressure->capacity || topCount + 4 > pressure->capacity || openCount + 4 > pressure->capacity) Grow();
+
+        int i = pressure->queue[head++];
+        int x = i & (STRIDE - 1), y = i >> sim->shift;
+
+        if (y > 0 && grid[i - STRIDE] == NULL && y >= pressure->rowTop && y < pressure->rowBottom) {
+            pressure->tops[topCount++] = { i, y };
+        }
+
+        const int dx[4] = { -1, 1, 0, 0 };
+        const int dy[4] = { 0, 0, -1, 1 };
+        for (int n = 0; n < 4; n++) {
+            int nx = x + dx[n], ny = y + dy[n];
+            if (!withinBounds(nx, ny) || IsCellPacked(nx, ny)) continue;
+
+            int j = GetIndex(nx, ny);
+            particle_t* q = grid[j];
+
+            if (q != NULL) {
+                if (q->mat == mat && pressure->visited[j] != pressure->stamp) {
+                    pressure->visited[j] = pressure->stamp;
+                    pressure->queue[tail++] = j;
+                }
+            }
+            // Sideways into a resting spot, stamp + 1 keeps an open cell from being listed twice
+            else if (dy[n] == 0 && pressure->visited[j] != pressure->stamp + 1 && ny >= pressure->rowTop && ny < pressure->rowBottom && (ny == HEIGHT - 1 || grid[j + STRIDE] != NULL)) {
+                pressure->visited[j] = pressure->stamp + 1;
+                pressure->opens[openCount++] = { j, ny };
+            }
+        }
+    }
+
+    if (tail < PRESSURE_MIN_BODY || topCount == 0 || openCount == 0) return;
+
+    qsort(pressure->tops, topCount, sizeof(pressure_cell_t), CompareHighest);
+    qsort(pressure->opens, openCount, sizeof(pressure_cell_t), CompareLowest);
+
+    int budget = (1 + tail / PRESSURE_RATE) * PRESSURE_INTERVAL;
+    for (int n = 0; n < budget && n < topCount && n < openCount; n++) {
+        // Stop once the remaining surface is within a cell of the lowest opening
+        if (pressure->tops[n].y + 1 >= pressure->opens[n].y) break;
+
+        particle_t* p = grid[pressure->tops[n].index];
+        p->velocity = { 0, 0 };
+        p->hasBeenUpdated = true;
+        grid[pressure->opens[n].index] = p;
+        grid[pressure->tops[n].index] = NULL;
+
+        WakeCell(pressure->tops[n].index & (STRIDE - 1), pressure->tops[n].y);
+        WakeCell(pressure->opens[n].index & (STRIDE - 1), pressure->opens[n].y);
+    }
+}
+
+static void Grow(void) {
+    liquid_pressure_t* pressure = sim->liquidPressure;
+    pressure->capacity = (pressure->capacity == 0) ? PRESSURE_INITIAL_CAPACITY : pressure->capacity * 2;
+    pressure->queue = (int*) realloc(pressure->queue, pressure->capacity * sizeof(int));
+    pressure->tops = (pressure_cell_t*) realloc(pressure->tops, pressure->capacity * sizeof(pressure_cell_t));
+    pressure->opens = (pressure_cell_t*) realloc(pressure->opens, pressure->capacity * sizeof(pressure_cell_t));
+}
+
+static int CompareHighest(const void* a, const void* b) {
+    return ((const pressure_cell_t*)a)->y - ((const pressure_cell_t*)b)->y;
+}
+
+static int CompareLowest(const void* a, const void* b) {
+    return ((const pressure_cell_t*)b)->y - ((const pressure_cell_t*)a)->y;
+}
@@ -0,0 +1,889 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Lockstep
+*
+*   Several players share one world, each running all of it on their own machine. Only the
+*   commands that change the world go over the network, stamped with the tick they apply
+*   on, so the traffic is a few bytes per tick per player whatever the size of the world.
+*   This leans on the simulation being deterministic, the same way replay.cpp does.
+*
+*   One player hosts, everyone else connects to it and the host passes on what each of them
+*   sends. It starts everyone off with its world file and settings, so all of them begin
+*   from the same bytes. Commands made during tick T are stamped for tick T + inputDelay,
+*   giving them that many ticks to arrive before anyone needs them. A tick runs once the
+*   commands of every player are in for it, applied in player order. Until then the
+*   simulation waits, and a player that fell behind runs a few ticks per frame to catch up.
+*
+*   Every LOCKSTEP_HASH_TICKS ticks each player sends the hash of its world along with its
+*   commands. The hash of every chunk is kept and only the chunks that changed are hashed
+*   again, so this costs little more than the hashing of what moved. When a hash differs
+*   from its own, the host has everyone send their chunk hashes as of one tick, and then
+*   sends the chunks that differ, as it holds them, along with its random state. Every
+*   player, the host included, installs them on the same tick. The hashes sent for this
+*   take in when each chunk sleeps and gets packed as well, a chunk that holds the same
+*   cells but wakes at another tick would part ways again. Only the cells go over, the
+*   temperature and gas fields carry on as they are.
+*
+*   The view has to stay out of the simulation for this to hold, so lockstep turns off the
+*   level of detail and the frame budget, and the render snapshot draws packed chunks from
+*   their blob instead of unpacking them. Ticks are a fixed length, pausing and fast
+*   forwarding do nothing, and undo and rewind go back for everyone. Loads, recordings and
+*   streaming are off, saves only write the local copy.
+*
+*   Messages are a u32 length and a type byte, then:
+*     WELCOME: u8 player, u8 players, u8 inputDelay, i32 width, i32 height, f32 rewind
+*              seconds, sim settings, u32 world file bytes. WORLD messages with the file follow
+*     INPUT: u8 player, u32 tick, u8 has hash, u32 hash of tick - inputDelay, then commands
+*     CHUNK_HASHES: u32 tick, then a u32 hash per chunk, only sent to the host
+*     LEFT: u8 player, u32 first tick without its commands
+*   Commands are written as in replay.cpp, and the host has two more of its own:
+*     CHUNK_HASHES: everyone sends their chunk hashes as of this tick
+*     RESYNC: u32 random state, u32 chunks, then per chunk u32 index, u32 packed bytes,
+*             u32 bytes that follow, the packed chunk or less when it is LZ compressed
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "sockets.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <deque>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#define LOCKSTEP_HASH_TICKS 6           // Ticks between world hashes
+#define LOCKSTEP_MAX_AHEAD 600          // Ticks past the current one commands are kept for
+#define LOCKSTEP_CATCH_UP 8             // Most ticks a frame runs when behind
+#define HASH_HISTORY 1024               // Ticks of its own hashes the host keeps
+#define MESSAGE_MAX_BYTES (16 * 1024 * 1024)
+#define WORLD_PIECE_BYTES (256 * 1024)
+#define RATE_SECONDS 1.0
+
+#define CONTROL_CHUNK_HASHES 0x40
+#define CONTROL_RESYNC 0x41
+
+typedef enum lockstep_message_t {
+    MESSAGE_WELCOME = 1,
+    MESSAGE_WORLD,
+    MESSAGE_INPUT,
+    MESSAGE_CHUNK_HASHES,
+    MESSAGE_LEFT,
+} lockstep_message_t;
+
+// Bytes are sent and received as they fit, whole messages are taken from in
+typedef struct peer_t {
+    net_socket_t socket;
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    size_t outSent;
+    bool connected;
+} peer_t;
+
+typedef struct tick_input_t {
+    unsigned int tick;
+    unsigned int have;                  // A bit per player whose commands are in
+    std::vector<unsigned char> commands[LOCKSTEP_MAX_PLAYERS];
+} tick_input_t;
+
+typedef struct hash_check_t {
+    int player;
+    unsigned int tick;
+    unsigned int hash;
+} hash_check_t;
+
+typedef struct chunk_report_t {
+    int player;
+    unsigned int tick;
+    std::vector<unsigned int> hashes;
+} chunk_report_t;
+
+//----------------------------------------------------------------------------------
+// Global Variables Definition
+//----------------------------------------------------------------------------------
+bool useLockstep = false;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static particle_t** lockGrid = NULL;
+static bool isHost = false;
+static int playerId = 0;
+static int playerCount = 1;
+static int inputDelay = LOCKSTEP_DEFAULT_DELAY;
+static net_socket_t listener = INVALID_NET_SOCKET;
+static bool socketsReady = false;
+
+// By player on the host, where peer 0 is unused. Peer 0 is the host everywhere else
+static peer_t peers[LOCKSTEP_MAX_PLAYERS];
+static unsigned int lastInput[LOCKSTEP_MAX_PLAYERS];    // Newest tick with commands from each player
+static unsigned int leftFrom[LOCKSTEP_MAX_PLAYERS];     // First tick each player has no commands for
+
+static unsigned int lockTick = 0;                       // Ticks run since the session started
+static std::deque<tick_input_t> inputs;                 // From lockTick + 1 on
+static int readPlayer = 0;                              // Where NextLockstepCommand is in the first one
+static size_t readPos = 0;
+static std::vector<unsigned char> localCommands;        // Made since the last tick
+static std::vector<unsigned char> hostCommands;         // Host only, go out ahead of localCommands
+
+static unsigned int* chunkHashes = NULL;
+static unsigned int hashStamp = 0;
+
+// Host only
+static unsigned int ownHashes[HASH_HISTORY];
+static unsigned int ownHashTicks[HASH_HISTORY];
+static std::vector<hash_check_t> pendingChecks;         // Hashes for ticks not run here yet
+static std::vector<chunk_report_t> pendingReports;
+static bool checking[LOCKSTEP_MAX_PLAYERS];             // Waiting for the chunk hashes of a player
+static bool requestQueued = false;
+static unsigned int checkTick = 0;                      // Of the last chunk hash request, 0 before one
+static std::vector<unsigned int> checkHashes;           // The host's own as of checkTick
+static unsigned int syncedFrom = 0;                     // Hashes before the last resync don't count
+
+static lockstep_stats_t stats = { 0 };
+static unsigned long long bytesIn = 0;
+static unsigned long long bytesOut = 0;
+static double rateStart = 0.0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void StartSession(particle_t** grid);
+static void HandleMessage(int p, unsigned char type, const unsigned char* data, int size);
+static void StoreInput(int player, unsigned int tick, const unsigned char* data, int size);
+static bool TickReady(size_t index);
+static unsigned int HashLockstepWorld(void);
+static void ReportChunkHashes(std::vector<unsigned int>* hashes);
+static void CheckHash(int player, unsigned int tick, unsigned int hash);
+static void CompareChunkHashes(int player, const std::vector<unsigned int>* hashes);
+static void SendChunkHashes(void);
+static void ApplyResync(const unsigned char* data, int size);
+static void QueueMessage(int p, unsigned char type, const void* data, int size);
+static void Broadcast(unsigned char type, const void* data, int size, int except);
+static void Flush(int p);
+static void Receive(int p);
+static bool TakeMessage(int p, unsigned char* type, std::vector<unsigned char>* payload);
+static bool WaitForMessage(int p, unsigned char* type, std::vector<unsigned char>* payload);
+static void DropPeer(int p);
+static void Put(std::vector<unsigned char>* out, const void* data, size_t size);
+
+//----------------------------------------------------------------------------------
+// Lockstep Functions Definition
+//----------------------------------------------------------------------------------
+
+// Wait for players - 1 others to connect on port and start everyone off with this world.
+// Blocks until they all did
+bool HostLockstep(particle_t** grid, int port, int players, int delay, float rewindSeconds) {
+    if (players < 2 || players > LOCKSTEP_MAX_PLAYERS || !InitSockets()) return false;
+    socketsReady = true;
+
+    listener = ListenSocket(port);
+    if (listener == INVALID_NET_SOCKET) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Could not listen on port %d", port);
+        return false;
+    }
+
+    isHost = true;
+    playerId = 0;
+    playerCount = players;
+    inputDelay = (delay < 1) ? 1 : (delay > 255) ? 255 : delay;
+    TraceLog(LOG_INFO, "LOCKSTEP: Waiting for %d players on port %d", players - 1, port);
+
+    for (int p = 1; p < players; p++) {
+        peers[p] = peer_t();
+        while ((peers[p].socket = AcceptSocket(listener)) == INVALID_NET_SOCKET) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        peers[p].connected = true;
+        TraceLog(LOG_INFO, "LOCKSTEP: Player %d joined", p);
+    }
+
+    // Everyone, the host included, starts from the world as the file holds it
+    const char* path = TextFormat("lockstep_%d.ppw", port);
+    int fileSize = 0;
+    unsigned char* file = NULL;
+    if (SaveWorldFile(grid, path, true) && LoadWorldFile(grid, path)) file = LoadFileData(path, &fileSize);
+    remove(path);
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Could not write the world to send");
+        UnloadLockstep();
+        return false;
+    }
+
+    sim->useLod = false;
+    sim->frameBudget = 0.0f;
+    sim_settings_t settings = { sim->useTemperature, sim->useGasField, sim->useLiquidPressure, sim->backend, sim->useLod, sim->frameBudget };
+
+    for (int p = 1; p < players; p++) {
+        std::vector<unsigned char> welcome;
+        unsigned char ids[3] = { (unsigned char)p, (unsigned char)players, (unsigned char)inputDelay };
+        unsigned int bytes = (unsigned int)fileSize;
+        Put(&welcome, ids, sizeof(ids));
+        Put(&welcome, &sim->width, sizeof(int));
+        Put(&welcome, &sim->height, sizeof(int));
+        Put(&welcome, &rewindSeconds, sizeof(float));
+        Put(&welcome, &settings, sizeof(settings));
+        Put(&welcome, &bytes, sizeof(bytes));
+        QueueMessage(p, MESSAGE_WELCOME, welcome.data(), (int)welcome.size());
+
+        for (int at = 0; at < fileSize; at += WORLD_PIECE_BYTES) {
+            int piece = (fileSize - at < WORLD_PIECE_BYTES) ? fileSize - at : WORLD_PIECE_BYTES;
+            QueueMessage(p, MESSAGE_WORLD, file + at, piece);
+        }
+    }
+    UnloadFileData(file);
+
+    // Nobody can start before they have the world
+    for (bool sending = true; sending; ) {
+        sending = false;
+        for (int p = 1; p < players; p++) {
+            Flush(p);
+            if (peers[p].connected && !peers[p].out.empty()) sending = true;
+        }
+        if (sending) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    StartSession(grid);
+    TraceLog(LOG_INFO, "LOCKSTEP: Hosting %d players, %d ticks of input delay", players, inputDelay);
+    return true;
+}
+
+// Connect to a host at address:port and wait for it to start, before the world is set up.
+// Blocks until the host sent the size of the world
+bool ConnectLockstep(const char* address, lockstep_info_t* info) {
+    char host[256];
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL || colon - address >= (int)sizeof(host) || !InitSockets()) return false;
+    socketsReady = true;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    peers[0] = peer_t();
+    peers[0].socket = ConnectSocket(host, atoi(colon + 1));
+    if (peers[0].socket == INVALID_NET_SOCKET) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Could not connect to %s", address);
+        return false;
+    }
+    peers[0].connected = true;
+    TraceLog(LOG_INFO, "LOCKSTEP: Connected to %s, waiting for the host to start", address);
+
+    unsigned char type;
+    std::vector<unsigned char> welcome;
+    sim_settings_t settings;
+    unsigned int bytes;
+    int size = 3 + 2 * sizeof(int) + sizeof(float) + sizeof(settings) + sizeof(bytes);
+    if (!WaitForMessage(0, &type, &welcome) || type != MESSAGE_WELCOME || (int)welcome.size() != size) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: The host went away before starting");
+        UnloadLockstep();
+        return false;
+    }
+
+    const unsigned char* at = welcome.data();
+    playerId = at[0];
+    playerCount = at[1];
+    inputDelay = at[2];
+    at += 3;
+    memcpy(&info->width, at, sizeof(int));
+    memcpy(&info->height, at + sizeof(int), sizeof(int));
+    memcpy(&info->rewindSeconds, at + 2 * sizeof(int), sizeof(float));
+    memcpy(&settings, at + 2 * sizeof(int) + sizeof(float), sizeof(settings));
+    memcpy(&bytes, at + 2 * sizeof(int) + sizeof(float) + sizeof(settings), sizeof(bytes));
+    info->player = playerId;
+    info->players = playerCount;
+    info->worldBytes = bytes;
+
+    sim->useTemperature = settings.useTemperature;
+    sim->useGasField = settings.useGasField;
+    sim->useLiquidPressure = settings.useLiquidPressure;
+    sim->backend = settings.backend;
+    sim->useLod = false;
+    sim->frameBudget = 0.0f;
+
+    isHost = false;
+    return true;
+}
+
+// Load the world the host sends, once the world is set up to the size ConnectLockstep gave
+bool JoinLockstep(particle_t** grid, const lockstep_info_t* info) {
+    unsigned char* file = (unsigned char*) malloc(info->worldBytes ? info->worldBytes : 1);
+    unsigned int received = 0;
+
+    while (received < info->worldBytes) {
+        unsigned char type;
+        std::vector<unsigned char> piece;
+        if (!WaitForMessage(0, &type, &piece) || type != MESSAGE_WORLD || received + piece.size() > info->worldBytes) break;
+        memcpy(file + received, piece.data(), piece.size());
+        received += (unsigned int)piece.size();
+    }
+
+    const char* path = TextFormat("lockstep_player_%d.ppw", playerId);
+    bool loaded = received == info->worldBytes && SaveFileData(path, file, (int)received) && LoadWorldFile(grid, path);
+    remove(path);
+    free(file);
+
+    if (!loaded) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Could not load the world from the host");
+        UnloadLockstep();
+        return false;
+    }
+
+    StartSession(grid);
+    TraceLog(LOG_INFO, "LOCKSTEP: Joined as player %d of %d, %d ticks of input delay", playerId, playerCount, inputDelay);
+    return true;
+}
+
+// Simulation thread. A command made here, sent out with the next tick. Saves are applied
+// locally by the caller
+void QueueLockstepCommand(const sim_command_t* command) {
+    if (command->type == SIM_LOAD) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Worlds can't be loaded in a shared session");
+        free(command->file.path);
+        return;
+    }
+
+    sim_command_t shared = *command;
+    if (shared.type == SIM_SETTINGS) {
+        shared.settings.useLod = false;
+        shared.settings.frameBudget = 0.0f;
+    }
+
+    unsigned char encoded[SIM_COMMAND_MAX_BYTES];
+    Put(&localCommands, encoded, WriteSimCommand(&shared, encoded));
+}
+
+// Simulation thread. Send and receive whatever the sockets take, as often as possible
+void UpdateLockstep(void) {
+    if (!useLockstep) return;
+
+    // Messages are handled as they come, so the host passes them on right away
+    int first = isHost ? 1 : 0, last = isHost ? playerCount : 1;
+    for (int p = first; p < last; p++) {
+        if (!peers[p].connected) continue;
+        Receive(p);
+
+        unsigned char type;
+        std::vector<unsigned char> payload;
+        while (peers[p].connected && TakeMessage(p, &type, &payload)) {
+            HandleMessage(p, type, payload.data(), (int)payload.size());
+        }
+    }
+    for (int p = first; p < last; p++) Flush(p);
+
+    if (!isHost && !peers[0].connected) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Lost the host at tick %u, carrying on alone", lockTick);
+        UnloadLockstep();
+    }
+}
+
+// Simulation thread. How many ticks to run this frame, 0 while commands are missing
+int LockstepTicksDue(void) {
+    size_t ready = 0;
+    while (ready < LOCKSTEP_CATCH_UP && TickReady(ready)) ready++;
+
+    if (ready == 0) {
+        stats.stalls++;
+        return 0;
+    }
+
+    // Commands stamped further ahead than this player's own mean the others ran more ticks
+    int behind = 0;
+    for (int p = 0; p < playerCount; p++) {
+        if (p == playerId || leftFrom[p] != 0) continue;
+        int ahead = (int)(lastInput[p] - lastInput[playerId]);
+        if (ahead > behind) behind = ahead;
+    }
+    return (1 + behind < (int)ready) ? 1 + behind : (int)ready;
+}
+
+// Simulation thread. The next command of the tick about to run, every player's in player
+// order. False once there are no more
+bool NextLockstepCommand(sim_command_t* command) {
+    if (inputs.empty()) return false;
+    tick_input_t* input = &inputs.front();
+
+    for (; readPlayer < playerCount; readPlayer++, readPos = 0) {
+        const std::vector<unsigned char>* data = &input->commands[readPlayer];
+
+        while (readPos < data->size()) {
+            const unsigned char* at = data->data() + readPos;
+            int left = (int)(data->size() - readPos);
+
+            if (at[0] == CONTROL_CHUNK_HASHES && readPlayer == 0) {
+                readPos++;
+                SendChunkHashes();
+                continue;
+            }
+            if (at[0] == CONTROL_RESYNC && readPlayer == 0 && left >= 5) {
+                unsigned int size;
+                memcpy(&size, at + 1, sizeof(size));
+                if (size > (unsigned int)(left - 5)) break;
+                ApplyResync(at + 5, (int)size);
+                readPos += 5 + size;
+                continue;
+            }
+
+            int used = ReadSimCommand(at, left, command);
+            if (used == 0) break;
+            readPos += used;
+
+            // Only this player's own loads are dropped before they are sent
+            if (command->type == SIM_LOAD) {
+                free(command->file.path);
+                continue;
+            }
+            command->originX = sim->chunkOriginX;
+            command->originY = sim->chunkOriginY;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Simulation thread. After every tick, sends the commands made since for inputDelay ticks on
+void EndLockstepTick(void) {
+    lockTick++;
+    inputs.pop_front();
+    readPlayer = 0;
+    readPos = 0;
+
+    unsigned char hasHash = (lockTick % LOCKSTEP_HASH_TICKS == 0);
+    unsigned int hash = hasHash ? HashLockstepWorld() : 0;
+
+    if (isHost && hasHash) {
+        ownHashes[lockTick % HASH_HISTORY] = hash;
+        ownHashTicks[lockTick % HASH_HISTORY] = lockTick;
+
+        std::vector<hash_check_t> due;
+        for (size_t n = 0; n < pendingChecks.size(); ) {
+            if (pendingChecks[n].tick <= lockTick) {
+                due.push_back(pendingChecks[n]);
+                pendingChecks.erase(pendingChecks.begin() + n);
+            }
+            else n++;
+        }
+        for (size_t n = 0; n < due.size(); n++) CheckHash(due[n].player, due[n].tick, due[n].hash);
+    }
+
+    std::vector<unsigned char> message;
+    unsigned char player = (unsigned char)playerId;
+    unsigned int tick = lockTick + inputDelay;
+    Put(&message, &player, 1);
+    Put(&message, &tick, sizeof(tick));
+    Put(&message, &hasHash, 1);
+    Put(&message, &hash, sizeof(hash));
+    size_t header = message.size();
+    Put(&message, hostCommands.data(), hostCommands.size());
+    Put(&message, localCommands.data(), localCommands.size());
+    hostCommands.clear();
+    localCommands.clear();
+
+    StoreInput(playerId, tick, message.data() + header, (int)(message.size() - header));
+    if (isHost) Broadcast(MESSAGE_INPUT, message.data(), (int)message.size(), 0);
+    else QueueMessage(0, MESSAGE_INPUT, message.data(), (int)message.size());
+
+    stats.tick = lockTick;
+}
+
+lockstep_stats_t GetLockstepStats(void) {
+    double now = GetTime();
+    if (now - rateStart >= RATE_SECONDS) {
+        stats.inKBps = (float)(bytesIn / 1024.0 / (now - rateStart));
+        stats.outKBps = (float)(bytesOut / 1024.0 / (now - rateStart));
+        bytesIn = 0;
+        bytesOut = 0;
+        rateStart = now;
+    }
+    stats.active = useLockstep;
+    return stats;
+}
+
+// Closes every connection, the world carries on as it is
+void UnloadLockstep(void) {
+    for (int p = 0; p < LOCKSTEP_MAX_PLAYERS; p++) {
+        if (peers[p].connected) CloseSocket(peers[p].socket);
+        peers[p] = peer_t();
+    }
+    CloseSocket(listener);
+    listener = INVALID_NET_SOCKET;
+    if (socketsReady) UnloadSockets();
+    socketsReady = false;
+
+    free(chunkHashes);
+    chunkHashes = NULL;
+    inputs.clear();
+    localCommands.clear();
+    hostCommands.clear();
+    pendingChecks.clear();
+    pendingReports.clear();
+    checkHashes.clear();
+    useLockstep = false;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Everyone has the same world, the first inputDelay ticks run without commands
+static void StartSession(particle_t** grid) {
+    lockGrid = grid;
+    lockTick = 0;
+    inputs.clear();
+    for (int t = 1; t <= inputDelay; t++) {
+        tick_input_t input;
+        input.tick = t;
+        input.have = (1u << playerCount) - 1;
+        inputs.push_back(input);
+    }
+    for (int p = 0; p < LOCKSTEP_MAX_PLAYERS; p++) {
+        lastInput[p] = inputDelay;
+        leftFrom[p] = 0;
+        checking[p] = false;
+    }
+    readPlayer = 0;
+    readPos = 0;
+
+    chunkHashes = (unsigned int*) malloc(sim->chunksX * sim->chunksY * sizeof(unsigned int));
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) chunkHashes[cy * sim->chunksX + cx] = HashChunk(grid, cx, cy);
+    }
+    hashStamp = GetChangeStamp();
+    memset(ownHashTicks, 0, sizeof(ownHashTicks));
+
+    stats = { 0 };
+    stats.player = playerId;
+    stats.players = playerCount;
+    stats.inputDelay = inputDelay;
+    bytesIn = 0;
+    bytesOut = 0;
+    rateStart = GetTime();
+    useLockstep = true;
+}
+
+static void HandleMessage(int p, unsigned char type, const unsigned char* data, int size) {
+    switch (type) {
+    case MESSAGE_INPUT: {
+        if (size < 10) break;
+        int player = isHost ? p : data[0];
+        unsigned int tick, hash;
+        memcpy(&tick, data + 1, sizeof(tick));
+        memcpy(&hash, data + 6, sizeof(hash));
+        if (player >= playerCount) break;
+
+        StoreInput(player, tick, data + 10, size - 10);
+        if (!isHost) break;
+
+        // Passed on as it came, with the player it came from
+        std::vector<unsigned char> relay(data, data + size);
+        relay[0] = (unsigned char)player;
+        Broadcast(MESSAGE_INPUT, relay.data(), (int)relay.size(), player);
+        if (data[5]) CheckHash(player, tick - inputDelay, hash);
+    } break;
+    case MESSAGE_CHUNK_HASHES: {
+        if (!isHost || size != (int)(sizeof(unsigned int) * (1 + sim->chunksX * sim->chunksY))) break;
+        chunk_report_t report;
+        report.player = p;
+        memcpy(&report.tick, data, sizeof(unsigned int));
+        report.hashes.resize(sim->chunksX * sim->chunksY);
+        memcpy(report.hashes.data(), data + sizeof(unsigned int), sim->chunksX * sim->chunksY * sizeof(unsigned int));
+
+        if (report.tick == checkTick) CompareChunkHashes(p, &report.hashes);
+        else if (report.tick > checkTick) pendingReports.push_back(report);
+    } break;
+    case MESSAGE_LEFT: {
+        if (size < 5 || data[0] >= playerCount) break;
+        memcpy(&leftFrom[data[0]], data + 1, sizeof(unsigned int));
+        TraceLog(LOG_INFO, "LOCKSTEP: Player %d left at tick %u", data[0], leftFrom[data[0]]);
+    } break;
+    default:
+        break;
+    }
+}
+
+static void StoreInput(int player, unsigned int tick, const unsigned char* data, int size) {
+    if (tick <= lockTick || tick - lockTick > LOCKSTEP_MAX_AHEAD) return;
+    if (tick > lastInput[player]) lastInput[player] = tick;
+
+    size_t index = tick - lockTick - 1;
+    while (inputs.size() <= index) {
+        tick_input_t input;
+        input.tick = lockTick + 1 + (unsigned int)inputs.size();
+        input.have = 0;
+        inputs.push_back(input);
+    }
+    inputs[index].commands[player].assign(data, data + size);
+    inputs[index].have |= 1u << player;
+}
+
+// Players that left count as having sent nothing
+static bool TickReady(size_t index) {
+    if (index >= inputs.size()) return false;
+    const tick_input_t* input = &inputs[index];
+    for (int p = 0; p < playerCount; p++) {
+        if (!(input->have & (1u << p)) && (leftFrom[p] == 0 || input->tick < leftFrom[p])) return false;
+    }
+    return true;
+}
+
+// Chunks that may have changed since the last hash are hashed again
+static unsigned int HashLockstepWorld(void) {
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            if (ChunkChangedSince(cx, cy, hashStamp)) chunkHashes[cy * sim->chunksX + cx] = HashChunk(lockGrid, cx, cy);
+        }
+    }
+    hashStamp = GetChangeStamp();
+    return CombineChunkHashes(chunkHashes);
+}
+
+// Host only. A player's hash for a tick against the host's own
+static void CheckHash(int player, unsigned int tick, unsigned int hash) {
+    if (tick < syncedFrom || checking[player]) return;
+    if (tick > lockTick) {
+        pendingChecks.push_back({ player, tick, hash });
+        return;
+    }
+
+    // Too old to tell
+    if (ownHashTicks[tick % HASH_HISTORY] != tick || ownHashes[tick % HASH_HISTORY] == hash) return;
+
+    stats.desyncs++;
+    checking[player] = true;
+    TraceLog(LOG_WARNING, "LOCKSTEP: Player %d is out of sync at tick %u", player, tick);
+
+    if (!requestQueued) {
+        hostCommands.push_back(CONTROL_CHUNK_HASHES);
+        requestQueued = true;
+    }
+}
+
+// Host only. Send the chunks a player holds differently, as the host holds them now
+static void CompareChunkHashes(int player, const std::vector<unsigned int>* hashes) {
+    std::vector<unsigned char> resync;
+    unsigned int count = 0;
+    Put(&resync, &sim->randomState, sizeof(sim->randomState));
+    Put(&resync, &count, sizeof(count));
+
+    // What differs can spread to the neighbours before the resync lands, so those go too
+    std::vector<unsigned char> resend(sim->chunksX * sim->chunksY, 0);
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if ((*hashes)[c] == checkHashes[c]) continue;
+        int cx = c % sim->chunksX, cy = c / sim->chunksX;
+        for (int ny = cy - 1; ny <= cy + 1; ny++) {
+            for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                if (nx >= 0 && nx < sim->chunksX && ny >= 0 && ny < sim->chunksY) resend[ny * sim->chunksX + nx] = 1;
+            }
+        }
+    }
+
+    unsigned char* lz = (unsigned char*) malloc(LZ_MAX_BYTES(CHUNK_MAX_BYTES));
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if (!resend[c]) continue;
+
+        chunk_blob_t blob = EncodeChunk(lockGrid, c % sim->chunksX, c / sim->chunksX);
+        int packed = CompressLz(blob.data, blob.size, lz);
+        bool compressed = packed > 0 && packed < blob.size;
+        unsigned int index = (unsigned int)c, size = (unsigned int)blob.size;
+        unsigned int stored = compressed ? (unsigned int)packed : size;
+        Put(&resync, &index, sizeof(index));
+        Put(&resync, &size, sizeof(size));
+        Put(&resync, &stored, sizeof(stored));
+        Put(&resync, compressed ? lz : blob.data, stored);
+        free(blob.data);
+        count++;
+    }
+    free(lz);
+    memcpy(resync.data() + sizeof(unsigned int), &count, sizeof(count));
+
+    unsigned int size = (unsigned int)resync.size();
+    hostCommands.push_back(CONTROL_RESYNC);
+    Put(&hostCommands, &size, sizeof(size));
+    Put(&hostCommands, resync.data(), resync.size());
+
+    TraceLog(LOG_INFO, "LOCKSTEP: Resending %u chunks to player %d (%u bytes)", count, player, size);
+}
+
+// Everyone, when the host asks. The chunk hashes as of the end of the last tick
+static void SendChunkHashes(void) {
+    unsigned int tick = lockTick + 1;
+
+    if (isHost) {
+        checkTick = tick;
+        ReportChunkHashes(&checkHashes);
+        requestQueued = false;
+
+        for (size_t n = 0; n < pendingReports.size(); ) {
+            if (pendingReports[n].tick <= checkTick) {
+                if (pendingReports[n].tick == checkTick) CompareChunkHashes(pendingReports[n].player, &pendingReports[n].hashes);
+                pendingReports.erase(pendingReports.begin() + n);
+            }
+            else n++;
+        }
+        return;
+    }
+
+    std::vector<unsigned int> hashes;
+    ReportChunkHashes(&hashes);
+    std::vector<unsigned char> message;
+    Put(&message, &tick, sizeof(tick));
+    Put(&message, hashes.data(), hashes.size() * sizeof(unsigned int));
+    QueueMessage(0, MESSAGE_CHUNK_HASHES, message.data(), (int)message.size());
+}
+
+// The cells of every chunk, and what decides when it runs, sleeps and gets packed next.
+// Those change in sleeping chunks too, so they are only taken in here
+static void ReportChunkHashes(std::vector<unsigned int>* hashes) {
+    HashLockstepWorld();
+    hashes->resize(sim->chunksX * sim->chunksY);
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+            unsigned int hash = (chunkHashes[c] ^ GetChunkActivity(cx, cy)) * 16777619u;
+            hash = (hash ^ (unsigned int)GetChunkQuiet(cx, cy)) * 16777619u;
+            (*hashes)[c] = (hash ^ sim->chunkPacked[c]) * 16777619u;
+        }
+    }
+}
+
+// Everyone, on the same tick. The chunks become packed chunks holding what the host sent
+static void ApplyResync(const unsigned char* data, int size) {
+    unsigned int state, count;
+    if (size < 8) return;
+    memcpy(&state, data, sizeof(state));
+    memcpy(&count, data + 4, sizeof(count));
+    int at = 8;
+
+    for (unsigned int n = 0; n < count && at + 12 <= size; n++) {
+        unsigned int index, packedSize, stored;
+        memcpy(&index, data + at, sizeof(index));
+        memcpy(&packedSize, data + at + 4, sizeof(packedSize));
+        memcpy(&stored, data + at + 8, sizeof(stored));
+        at += 12;
+        if (index >= (unsigned int)(sim->chunksX * sim->chunksY) || packedSize > CHUNK_MAX_BYTES || stored > (unsigned int)(size - at)) break;
+
+        chunk_blob_t blob = { (unsigned char*) malloc(packedSize), (int)packedSize, 0 };
+        if (stored == packedSize) memcpy(blob.data, data + at, stored);
+        else if (DecompressLz(data + at, (int)stored, blob.data, (int)packedSize) != (int)packedSize) {
+            free(blob.data);
+            break;
+        }
+        at += stored;
+
+        int cx = index % sim->chunksX, cy = index / sim->chunksX;
+        DiscardChunk(lockGrid, cx, cy);
+        if (IsEmptyBlob(blob) || !AdoptPackedChunk(lockGrid, cx, cy, blob, false)) free(blob.data);
+
+        // The corners wake the chunk and its neighbours, whatever borders it may react
+        int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+        WakeCell(x0, y0);
+        WakeCell(x0 + CHUNK_SIZE - 1, y0);
+        WakeCell(x0, y0 + CHUNK_SIZE - 1);
+        WakeCell(x0 + CHUNK_SIZE - 1, y0 + CHUNK_SIZE - 1);
+        stats.resyncedChunks++;
+    }
+    sim->randomState = state;
+
+    if (isHost) {
+        syncedFrom = lockTick + 1;
+        for (int p = 0; p < playerCount; p++) checking[p] = false;
+    }
+}
+
+// Host to a player, or anyone to the host when p is 0
+static void QueueMessage(int p, unsigned char type, const void* data, int size) {
+    if (!peers[p].connected) return;
+    unsigned int length = (unsigned int)size + 1;
+    Put(&peers[p].out, &length, sizeof(length));
+    Put(&peers[p].out, &type, 1);
+    Put(&peers[p].out, data, size);
+    bytesOut += sizeof(length) + length;
+    Flush(p);
+}
+
+// Host only, to every player but except
+static void Broadcast(unsigned char type, const void* data, int size, int except) {
+    for (int p = 1; p < playerCount; p++) {
+        if (p != except) QueueMessage(p, type, data, size);
+    }
+}
+
+static void Flush(int p) {
+    peer_t* peer = &peers[p];
+    while (peer->connected && peer->outSent < peer->out.size()) {
+        int sent = SendSocket(peer->socket, peer->out.data() + peer->outSent, (int)(peer->out.size() - peer->outSent));
+        if (sent < 0) DropPeer(p);
+        if (sent <= 0) break;
+        peer->outSent += sent;
+    }
+    if (peer->outSent == peer->out.size()) {
+        peer->out.clear();
+        peer->outSent = 0;
+    }
+}
+
+static void Receive(int p) {
+    unsigned char buffer[64 * 1024];
+    while (peers[p].connected) {
+        int received = ReceiveSocket(peers[p].socket, buffer, sizeof(buffer));
+        if (received < 0) DropPeer(p);
+        if (received <= 0) break;
+        peers[p].in.insert(peers[p].in.end(), buffer, buffer + received);
+        bytesIn += received;
+    }
+}
+
+// The oldest whole message received from p, false until one is in
+static bool TakeMessage(int p, unsigned char* type, std::vector<unsigned char>* payload) {
+    std::vector<unsigned char>* in = &peers[p].in;
+    unsigned int length;
+    if (in->size() < sizeof(length)) return false;
+    memcpy(&length, in->data(), sizeof(length));
+
+    if (length == 0 || length > MESSAGE_MAX_BYTES) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Dropping a connection that sent a broken message");
+        DropPeer(p);
+        return false;
+    }
+    if (in->size() < sizeof(length) + length) return false;
+
+    *type = (*in)[sizeof(length)];
+    payload->assign(in->begin() + sizeof(length) + 1, in->begin() + sizeof(length) + length);
+    in->erase(in->begin(), in->begin() + sizeof(length) + length);
+    return true;
+}
+
+// Blocks, only while a session starts
+static bool WaitForMessage(int p, unsigned char* type, std::vector<unsigned char>* payload) {
+    while (peers[p].connected) {
+        if (TakeMessage(p, type, payload)) return true;
+        Receive(p);
+        Flush(p);
+        if (peers[p].in.size() < sizeof(unsigned int)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// The host tells everyone else which tick a player that left stops at
+static void DropPeer(int p) {
+    if (!peers[p].connected) return;
+    CloseSocket(peers[p].socket);
+    peers[p].connected = false;
+    peers[p].in.clear();
+    peers[p].out.clear();
+    peers[p].outSent = 0;
+    if (!isHost || !useLockstep) return;
+
+    leftFrom[p] = lastInput[p] + 1;
+    checking[p] = false;
+    TraceLog(LOG_INFO, "LOCKSTEP: Player %d left at tick %u", p, leftFrom[p]);
+
+    unsigned char left[5] = { (unsigned char)p };
+    memcpy(left + 1, &leftFrom[p], sizeof(unsigned int));
+    Broadcast(MESSAGE_LEFT, left, sizeof(left), p);
+}
+
+static void Put(std::vector<unsigned char>* out, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    out->insert(out->end(), bytes, bytes + size);
+}
@@ -0,0 +1,249 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Margolus block backend
+*
+*   Alternative simulation backend for very large worlds. The grid is cut into 2x2 blocks,
+*   offset by one cell on every other step, and each block is rewritten as a whole through a
+*   precomputed transition table. Blocks never overlap within a step, so there is no scan
+*   order to depend on and block rows are simply split across threads.
+*
+*   Only movement is modelled here: sand falls and piles, liquids fall and spread, gases
+*   rise and spread. Stuck materials never move. The field modules (temperature, gas,
+*   liquid pressure) run after this backend the same way they do after the sweep, and
+*   blocks lying entirely in chunks that don't run this tick are skipped the same way too.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+
+// Cell classes, ordered by weight so a heavier class sinks through a lighter one
+#define CLASS_GAS 0
+#define CLASS_EMPTY 1
+#define CLASS_LIQUID 2
+#define CLASS_POWDER 3
+#define CLASS_STATIC 4
+#define CLASS_COUNT 5
+
+#define BLOCK_KEYS (CLASS_COUNT * CLASS_COUNT * CLASS_COUNT * CLASS_COUNT)
+#define IDENTITY 0xE4               // Every cell keeps its own source: 3,2,1,0 packed in 2 bits
+#define SEGMENT_BLOCKS (CHUNK_SIZE / 2) // Blocks of a row classified together, a chunk wide
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+// Kept per world, see sim_world_t
+typedef struct margolus_t {
+    // Two tables, one per sideways bias, mapping a block key to the source of each cell
+    unsigned char transitions[2 * BLOCK_KEYS];
+    unsigned char cellClass[MATERIAL_COUNT];
+    unsigned int step;
+
+    // Per worker: classes of the two rows of a block row, the table index of every block and
+    // the chunks it woke, merged after the step so workers never write the same flags
+    unsigned char* scratch;
+    unsigned char* wakes;
+    int scratchWorkers;
+    int scratchChunks;
+    int scratchStride;
+} margolus_t;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static unsigned char BuildTransition(const int* c, int bias);
+static void UpdateBlockRows(int firstRow, int lastRow, int worker, void* user);
+static bool SegmentRunning(int segment, int y, int offset);
+static void SegmentIndices(const unsigned char* __restrict top, const unsigned char* __restrict bottom,
+                           unsigned short* __restrict index, int firstBlock, unsigned int rowHash);
+
+//----------------------------------------------------------------------------------
+// Margolus Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitMargolus(void) {
+    margolus_t* margolus = (margolus_t*) calloc(1, sizeof(margolus_t));
+    sim->margolus = margolus;
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        switch (sim->props[m].type) {
+        case SOLID: margolus->cellClass[m] = CLASS_POWDER; break;
+        case LIQUID: margolus->cellClass[m] = CLASS_LIQUID; break;
+        case GAS: margolus->cellClass[m] = CLASS_GAS; break;
+        default: margolus->cellClass[m] = CLASS_STATIC; break;
+        }
+    }
+
+    for (int key = 0; key < BLOCK_KEYS; key++) {
+        int c[4] = { key % 5, (key / 5) % 5, (key / 25) % 5, (key / 125) % 5 };
+        margolus->transitions[key] = BuildTransition(c, 0);
+        margolus->transitions[BLOCK_KEYS + key] = BuildTransition(c, 1);
+    }
+}
+
+void UnloadMargolus(void) {
+    margolus_t* margolus = sim->margolus;
+    free(margolus->scratch);
+    free(margolus->wakes);
+    free(margolus);
+    sim->margolus = NULL;
+}
+
+void UpdateMargolus(particle_t** grid) {
+    margolus_t* margolus = sim->margolus;
+    int offset = margolus->step & 1;
+    int blockRows = (HEIGHT - offset) / 2;
+    int chunkCount = sim->chunksX * sim->chunksY;
+
+    int workers = GetWorkerCount();
+    // Two rows of classes with a segment of room past the end, then a u16 table index per
+    // block, as many again
+    int stride = (WIDTH + CHUNK_SIZE) * 3;
+    if (margolus->scratchWorkers != workers || margolus->scratchChunks != chunkCount || margolus->scratchStride != stride) {
+        margolus->scratchStride = stride;
+        free(margolus->scratch);
+        margolus->scratch = (unsigned char*) calloc(workers, margolus->scratchStride);
+        margolus->wakes = (unsigned char*) realloc(margolus->wakes, (size_t)workers * chunkCount);
+        margolus->scratchWorkers = workers;
+        margolus->scratchChunks = chunkCount;
+    }
+    memset(margolus->wakes, 0, (size_t)workers * chunkCount);
+
+    RunParallel(blockRows, UpdateBlockRows, grid);
+    for (int w = 0; w < workers; w++) MergeWakes(margolus->wakes + (size_t)w * chunkCount);
+
+    margolus->step++;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Each block row goes in three passes a chunk wide segment at a time. Classifying follows a
+// pointer per cell and stays scalar. Keys, biases and table indices are plain arithmetic on
+// byte arrays, written as straight loops the compiler vectorizes. Only the blocks whose
+// transition isn't the identity are then rewritten one by one
+static void UpdateBlockRows(int firstRow, int lastRow, int worker, void* user) {
+    margolus_t* margolus = sim->margolus;
+    particle_t** grid = (particle_t**)user;
+    int offset = margolus->step & 1;
+    int blocks = (WIDTH - offset) / 2;
+    int segments = (blocks + SEGMENT_BLOCKS - 1) / SEGMENT_BLOCKS;
+
+    unsigned char* top = margolus->scratch + (size_t)worker * margolus->scratchStride;
+    unsigned char* bottom = top + WIDTH + CHUNK_SIZE;
+    unsigned short* index = (unsigned short*)(bottom + WIDTH + CHUNK_SIZE);
+    unsigned char* wake = margolus->wakes + (size_t)worker * sim->chunksX * sim->chunksY;
+
+    for (int row = firstRow; row < lastRow; row++) {
+        int y = offset + row * 2;
+        particle_t** upper = grid + GetIndex(0, y);
+        particle_t** lower = upper + STRIDE;
+        unsigned int rowHash = (unsigned int)y * 19349663u ^ (margolus->step * 83492791u);
+
+        for (int s = 0; s < segments; s++) {
+            if (!SegmentRunning(s, y, offset)) continue;
+            int b0 = s * SEGMENT_BLOCKS;
+            int b1 = (b0 + SEGMENT_BLOCKS < blocks) ? b0 + SEGMENT_BLOCKS : blocks;
+            int x0 = offset + b0 * 2, x1 = offset + b1 * 2;
+
+            for (int x = x0; x < x1; x++) {
+                top[x] = (upper[x] != NULL) ? margolus->cellClass[upper[x]->mat] : (unsigned char)CLASS_EMPTY;
+                bottom[x] = (lower[x] != NULL) ? margolus->cellClass[lower[x]->mat] : (unsigned char)CLASS_EMPTY;
+            }
+
+            SegmentIndices(top + x0, bottom + x0, index + b0, b0, rowHash);
+
+            for (int b = b0; b < b1; b++) {
+                unsigned char perm = margolus->transitions[index[b]];
+                if (perm == IDENTITY) continue;
+
+                // A block on a chunk border runs when any chunk it touches runs
+                int x = offset + b * 2;
+                if (!IsCellRunning(x, y) && !IsCellRunning(x + 1, y + 1) && !IsCellRunning(x + 1, y) && !IsCellRunning(x, y + 1)) continue;
+
+                particle_t* cells[4] = { upper[x], upper[x + 1], lower[x], lower[x + 1] };
+                upper[x] = cells[perm & 3];
+                upper[x + 1] = cells[(perm >> 2) & 3];
+                lower[x] = cells[(perm >> 4) & 3];
+                lower[x + 1] = cells[(perm >> 6) & 3];
+
+                WakeCellIn(wake, x, y);
+                WakeCellIn(wake, x + 1, y + 1);
+            }
+        }
+    }
+}
+
+// Table index of every block of a segment, its key and its sideways bias. Always a whole
+// segment, the rows have room past the end, so the loop has a constant count and vectorizes.
+// Cheap integer hash picks the bias, no shared RNG between threads
+static void SegmentIndices(const unsigned char* __restrict top, const unsigned char* __restrict bottom,
+                           unsigned short* __restrict index, int firstBlock, unsigned int rowHash) {
+    for (int k = 0; k < SEGMENT_BLOCKS; k++) {
+        unsigned int h = (unsigned int)(firstBlock + k) * 73856093u ^ rowHash;
+        unsigned int key = top[2 * k] + 5 * top[2 * k + 1] + 25 * bottom[2 * k] + 125 * bottom[2 * k + 1];
+        index[k] = (unsigned short)(key + ((h >> 7) & 1) * BLOCK_KEYS);
+    }
+}
+
+// Whether any chunk under a segment of a block row runs, a superset of its blocks that do
+static bool SegmentRunning(int segment, int y, int offset) {
+    int cy0 = y >> CHUNK_SHIFT, cy1 = (y + 1 < HEIGHT) ? (y + 1) >> CHUNK_SHIFT : cy0;
+    int cx0 = segment, cx1 = (offset && segment + 1 < sim->chunksX) ? segment + 1 : segment;
+
+    for (int cx = cx0; cx <= cx1; cx++) {
+        if (sim->chunkRun[cy0 * sim->chunksX + cx] || sim->chunkRun[cy1 * sim->chunksX + cx]) return true;
+    }
+    return false;
+}
+
+// Cells are numbered 0 top-left, 1 top-right, 2 bottom-left, 3 bottom-right
+static unsigned char BuildTransition(const int* c, int bias) {
+    int src[4] = { 0, 1, 2, 3 };
+    int cls[4] = { c[0], c[1], c[2], c[3] };
+    bool moved[4] = { false, false, false, false };
+
+    // Swap two cells when the upper one is heavier and neither is stuck
+    auto trySwap = [&](int upper, int lower) {
+        if (moved[upper] || moved[lower]) return;
+        if (cls[upper] == CLASS_STATIC || cls[lower] == CLASS_STATIC) return;
+        if (cls[upper] <= cls[lower]) return;
+
+        int s = src[upper]; src[upper] = src[lower]; src[lower] = s;
+        int k = cls[upper]; cls[upper] = cls[lower]; cls[lower] = k;
+        moved[upper] = moved[lower] = true;
+    };
+
+    // Straight falls (and rises for gas)
+    trySwap(0, 2);
+    trySwap(1, 3);
+
+    // Diagonal slides, the bias decides which side gets the first chance
+    if (bias) {
+        trySwap(1, 2);
+        trySwap(0, 3);
+    }
+    else {
+        trySwap(0, 3);
+        trySwap(1, 2);
+    }
+
+    // Whatever did not move spreads sideways: liquids into anything lighter, gases into empty
+    // space. Alternating block offsets turn the swaps into a random walk along each row
+    for (int left = 0; left <= 2; left += 2) {
+        int right = left + 1;
+        if (moved[left] || moved[right]) continue;
+
+        int heavy = (cls[left] > cls[right]) ? cls[left] : cls[right];
+        int light = (cls[left] > cls[right]) ? cls[right] : cls[left];
+        bool spreads = (heavy == CLASS_LIQUID && light < CLASS_LIQUID) || (heavy == CLASS_EMPTY && light == CLASS_GAS);
+
+        // Bottom row spreads every step, the top row only on the biased half so drops still fall
+        if (spreads && (left == 2 || bias)) {
+            int s = src[left]; src[left] = src[right]; src[right] = s;
+        }
+    }
+
+    return (unsigned char)(src[0] | (src[1] << 2) | (src[2] << 4) | (src[3] << 6));
+}
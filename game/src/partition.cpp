@@ -0,0 +1,1015 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Partition
+*
+*   Splits a world too big for one process into horizontal slabs of whole chunk rows, each
+*   run by a worker process of its own, with a coordinator that hands out the slabs and
+*   shows the world. Workers load their slab straight from the world file the coordinator
+*   names, so the whole world never has to be in one place. Worker k listens on the
+*   coordinator's port + 1 + k and connects to worker k - 1, neighbours talk directly.
+*
+*   A worker's world is its slab with a chunk of halo above and below, where there is a
+*   neighbour. The PARTITION_HALO_ROWS rows of the halo next to the slab hold ghosts, copies
+*   of the neighbour's rows along the edge. Ghosts are flagged as updated every tick so they
+*   never move by themselves, but particles of the slab can still swap with them, react with
+*   them or move into the halo. After every tick each halo cell that doesn't hold the ghost
+*   it was given goes to the neighbour as a crossing, along with the material the ghost had:
+*     - when the neighbour's cell still holds that material, the crossing takes its place,
+*       which is how a swap with a ghost or a reaction with it lands on the other side
+*     - when it doesn't, the crossing is a conflict and is turned down, and the ghost that
+*       came into the slab for it is dropped again so nothing is doubled
+*     - crossings into cells that had no ghost go into the nearest free cell of the column,
+*       further into the neighbour's slab. With no free cell within PLACE_SEARCH_ROWS they
+*       are sent back, and are lost only when there is no room on either side
+*   Whatever is in the halo is then dropped. Once the crossings are in, neighbours swap
+*   their edge rows with the answers to each other's crossings and the ghosts are brought
+*   up to date. That is two round trips per tick over localhost sockets.
+*
+*   Conflicts are kept rare by taking turns at each edge: on even ticks the worker below an
+*   edge waits, on odd ticks the one above. The waiting worker flags its FROZEN_ROWS rows
+*   along that edge as updated, twice the reach of a tick, so nothing it moves can meet what
+*   the neighbour moves there. The liquid pressure solver ignores the flag and is kept off
+*   those rows with LimitLiquidPressure(). A particle can still burn or melt next to a ghost
+*   the neighbour changed, those count as conflicts and the boundary cells can come out
+*   slightly differently from a single process run. The temperature, gas and pressure
+*   fields end at the slab, nothing of them crosses.
+*
+*   The coordinator asks each worker for a frame whenever the last one is in. Frames are
+*   the material of one cell per square block, PARTITION_FRAME_MAX cells across at most,
+*   sent LZ compressed with the worker's time split per tick: the tick itself, and the
+*   crossings and halo exchange including the wait for slower neighbours.
+*
+*   Messages are a u32 length and a type byte, then:
+*     ASSIGN: u8 worker, u8 workers, i32 width, i32 height, i32 first chunk row, i32 chunk
+*             rows, i32 coordinator port, sim settings, u16 path bytes, world file path
+*     FRAME_REQUEST: nothing
+*     FRAME: frame header, u32 cells, then the materials of the rows, LZ compressed
+*     STOP: nothing
+*     CROSSINGS: u32 count, then a crossing_t each as it is in memory, both ends are the
+*                same build on the same machine
+*     EDGE: u32 turned down, u32 sent back, the indices of those crossings as u32, then
+*           u32 bytes and the PARTITION_HALO_ROWS rows along the edge nearest first, a
+*           material per cell, then colour and for decaying materials f32 lifeTime of each
+*           particle, LZ compressed
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "sockets.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#define PARTITION_REACH 10              // Furthest a particle gets in a tick, five steps of up to two rows
+#define PARTITION_HALO_ROWS 16          // Ghost rows along each edge, past the reach
+#define FROZEN_ROWS (2 * PARTITION_REACH)
+#define PARTITION_FRAME_MAX 1024        // Widest and tallest frame the coordinator gets
+#define PLACE_SEARCH_ROWS 16
+#define CONNECT_SECONDS 30.0
+#define MESSAGE_MAX_BYTES (64 * 1024 * 1024)
+
+#define SIDE_UP 0
+#define SIDE_DOWN 1
+
+#define LINK_COORDINATOR 0              // Links of a worker, the coordinator has one per worker
+#define LINK_UP 1
+#define LINK_DOWN 2
+
+typedef enum partition_message_t {
+    MESSAGE_ASSIGN = 1,
+    MESSAGE_FRAME_REQUEST,
+    MESSAGE_FRAME,
+    MESSAGE_STOP,
+    MESSAGE_CROSSINGS,
+    MESSAGE_EDGE,
+} partition_message_t;
+
+// Bytes are sent and received as they fit, whole messages are taken from in
+typedef struct link_t {
+    net_socket_t socket;
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    size_t outSent;
+    bool connected;
+} link_t;
+
+// A halo cell that changed, or a ghost cell as it is sent
+typedef struct crossing_t {
+    unsigned short x;
+    unsigned char distance;             // From the edge
+    unsigned char expect;               // Material of the ghost that was there
+    unsigned char mat;
+    Color color;
+    float lifeTime;
+    Vector2 velocity;
+} crossing_t;
+
+// A ghost that moved into the slab, index is its cell or -1 when it wasn't found
+typedef struct adopted_t {
+    particle_t* ghost;
+    int crossing;
+    int index;
+} adopted_t;
+
+typedef struct frame_header_t {
+    unsigned int tick;
+    float computeMs;
+    float exchangeMs;
+    float haloKBps;
+    unsigned int crossings;
+    unsigned int conflicts;
+    unsigned int lost;
+    int firstRow;                       // Of the frame
+    int rows;
+} frame_header_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static link_t links[PARTITION_MAX_WORKERS];
+static net_socket_t listener = INVALID_NET_SOCKET;
+static bool socketsReady = false;
+static int workerCount = 0;
+static int frameScale = 1;                              // Cells per frame pixel across
+
+// Coordinator only
+static Color* framePixels = NULL;
+static int frameWidth = 0;
+static int frameHeight = 0;
+static bool frameAsked[PARTITION_MAX_WORKERS];
+static partition_stats_t workerStats[PARTITION_MAX_WORKERS];
+
+// Worker only
+static particle_t** partGrid = NULL;
+static int workerId = 0;
+static int firstRow = 0;                                // Of the world, where local row 0 is
+static int slabRows = 0;
+static int haloRows[2];                                 // Above and below the slab, 0 at the world's edges
+static char coordinatorHost[256];
+static int coordinatorPort = 0;
+static char worldPath[SIM_PATH_MAX];
+static particle_t** ghosts[2];                          // As installed, by distance from the edge then x
+static unsigned char* ghostMats[2];
+static std::vector<crossing_t> sent[2];                 // This tick, for the answers
+static std::vector<adopted_t> adopted[2];
+static std::vector<unsigned int> rejected[2];           // Of the neighbour's crossings
+static std::vector<unsigned int> returned[2];
+static bool frameWanted = false;
+static bool stopped = false;
+
+static unsigned int workerTick = 0;
+static unsigned int crossings = 0;
+static unsigned int conflicts = 0;
+static unsigned int lost = 0;
+static double computeSeconds = 0.0, exchangeSeconds = 0.0;         // Since the last frame
+static double totalCompute = 0.0, totalExchange = 0.0;
+static unsigned int ticksSinceFrame = 0;
+static unsigned long long haloBytes = 0;
+static double rateStart = 0.0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool ConnectNeighbours(void);
+static void KeepEdgesUnpacked(void);
+static void FreezeEdge(int side, bool frozen);
+static bool ExchangeHalos(void);
+static void CollectCrossings(int side, std::vector<unsigned char>* out);
+static void ApplyCrossings(int side, const std::vector<unsigned char>* data);
+static void EncodeEdge(int side, std::vector<unsigned char>* out);
+static void InstallEdge(int side, const std::vector<unsigned char>* data);
+static bool PlaceCrossing(int side, const crossing_t* crossing, int y);
+static void SetCell(particle_t** cell, const crossing_t* content);
+static bool PollCoordinator(void);
+static void SendFrame(void);
+static void ReceiveFrame(int w, const std::vector<unsigned char>* data);
+static int CountSlabParticles(void);
+static int GhostRow(int side, int distance);
+static int EdgeRow(int side, int distance);
+static void QueueMessage(int l, unsigned char type, const void* data, int size);
+static void Flush(int l);
+static void Receive(int l);
+static bool TakeMessage(int l, unsigned char* type, std::vector<unsigned char>* payload);
+static bool WaitForMessage(int l, unsigned char* type, std::vector<unsigned char>* payload);
+static void DropLink(int l);
+static void Put(std::vector<unsigned char>* out, const void* data, size_t size);
+
+//----------------------------------------------------------------------------------
+// Partition Functions Definition
+//----------------------------------------------------------------------------------
+
+// Wait for every worker on port and give each its slab, world file is what they load or
+// NULL for an empty world. Blocks until all of them connected
+bool CoordinatePartition(int port, int workers, int width, int height, const char* worldFile) {
+    width = (width + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    height = (height + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    int chunkRows = height / CHUNK_SIZE;
+    int pathBytes = (worldFile != NULL) ? (int)strlen(worldFile) : 0;
+    if (workers < 1 || workers > PARTITION_MAX_WORKERS || workers > chunkRows || pathBytes >= SIM_PATH_MAX) {
+        TraceLog(LOG_WARNING, "PARTITION: %d workers can't share %d rows of chunks", workers, chunkRows);
+        return false;
+    }
+    if (!InitSockets()) return false;
+    socketsReady = true;
+
+    listener = ListenSocket(port);
+    if (listener == INVALID_NET_SOCKET) {
+        TraceLog(LOG_WARNING, "PARTITION: Could not listen on port %d", port);
+        return false;
+    }
+
+    workerCount = workers;
+    frameScale = 1;
+    while ((width + frameScale - 1) / frameScale > PARTITION_FRAME_MAX || (height + frameScale - 1) / frameScale > PARTITION_FRAME_MAX) frameScale++;
+    frameWidth = (width + frameScale - 1) / frameScale;
+    frameHeight = (height + frameScale - 1) / frameScale;
+    framePixels = (Color*) calloc(frameWidth * frameHeight, sizeof(Color));
+    TraceLog(LOG_INFO, "PARTITION: Waiting for %d workers on port %d", workers, port);
+
+    sim_settings_t settings = { sim->useTemperature, sim->useGasField, sim->useLiquidPressure, BACKEND_SWEEP, false, 0.0f };
+    for (int w = 0; w < workers; w++) {
+        links[w] = link_t();
+        while ((links[w].socket = AcceptSocket(listener)) == INVALID_NET_SOCKET) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        links[w].connected = true;
+
+        int first = chunkRows * w / workers, rows = chunkRows * (w + 1) / workers - first;
+        workerStats[w] = { 0 };
+        workerStats[w].connected = true;
+        workerStats[w].firstRow = first * CHUNK_SIZE;
+        workerStats[w].rows = rows * CHUNK_SIZE;
+        frameAsked[w] = false;
+
+        std::vector<unsigned char> assign;
+        unsigned char ids[2] = { (unsigned char)w, (unsigned char)workers };
+        unsigned short length = (unsigned short)pathBytes;
+        Put(&assign, ids, sizeof(ids));
+        Put(&assign, &width, sizeof(int));
+        Put(&assign, &height, sizeof(int));
+        Put(&assign, &first, sizeof(int));
+        Put(&assign, &rows, sizeof(int));
+        Put(&assign, &port, sizeof(int));
+        Put(&assign, &settings, sizeof(settings));
+        Put(&assign, &length, sizeof(length));
+        Put(&assign, worldFile, pathBytes);
+        QueueMessage(w, MESSAGE_ASSIGN, assign.data(), (int)assign.size());
+        TraceLog(LOG_INFO, "PARTITION: Worker %d runs rows %d to %d", w, first * CHUNK_SIZE, (first + rows) * CHUNK_SIZE);
+    }
+    return true;
+}
+
+// Coordinator, once per frame. Takes in the frames that arrived and asks for the next
+// ones, false once every worker is gone
+bool UpdateCoordinator(void) {
+    bool any = false;
+    for (int w = 0; w < workerCount; w++) {
+        Flush(w);
+        Receive(w);
+
+        unsigned char type;
+        std::vector<unsigned char> payload;
+        while (TakeMessage(w, &type, &payload)) {
+            if (type == MESSAGE_FRAME) ReceiveFrame(w, &payload);
+        }
+
+        workerStats[w].connected = links[w].connected;
+        if (!links[w].connected) continue;
+        any = true;
+        if (!frameAsked[w]) {
+            QueueMessage(w, MESSAGE_FRAME_REQUEST, NULL, 0);
+            frameAsked[w] = true;
+        }
+    }
+    return any;
+}
+
+// The whole world a pixel per frame block, as the workers last sent it
+const Color* GetPartitionFrame(int* width, int* height, int* scale) {
+    *width = frameWidth;
+    *height = frameHeight;
+    *scale = frameScale;
+    return framePixels;
+}
+
+int GetPartitionWorkers(void) {
+    return workerCount;
+}
+
+partition_stats_t GetPartitionStats(int worker) {
+    return workerStats[worker];
+}
+
+// Connect to the coordinator at address:port and wait for a slab, before the world is set
+// up. The world to create is the slab with its halos
+bool ConnectPartition(const char* address, partition_info_t* info) {
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL || colon - address >= (int)sizeof(coordinatorHost) || !InitSockets()) return false;
+    socketsReady = true;
+    memcpy(coordinatorHost, address, colon - address);
+    coordinatorHost[colon - address] = '\0';
+    coordinatorPort = atoi(colon + 1);
+
+    links[LINK_COORDINATOR] = link_t();
+    links[LINK_COORDINATOR].socket = ConnectSocket(coordinatorHost, coordinatorPort);
+    if (links[LINK_COORDINATOR].socket == INVALID_NET_SOCKET) {
+        TraceLog(LOG_WARNING, "PARTITION: Could not connect to %s", address);
+        return false;
+    }
+    links[LINK_COORDINATOR].connected = true;
+
+    unsigned char type;
+    std::vector<unsigned char> assign;
+    sim_settings_t settings;
+    int fixed = 2 + 5 * sizeof(int) + sizeof(settings) + sizeof(unsigned short);
+    if (!WaitForMessage(LINK_COORDINATOR, &type, &assign) || type != MESSAGE_ASSIGN || (int)assign.size() < fixed) {
+        TraceLog(LOG_WARNING, "PARTITION: The coordinator went away before handing out slabs");
+        UnloadPartition();
+        return false;
+    }
+
+    const unsigned char* at = assign.data();
+    int width, height, first, rows;
+    unsigned short length;
+    workerId = at[0];
+    workerCount = at[1];
+    at += 2;
+    memcpy(&width, at, sizeof(int));
+    memcpy(&height, at + sizeof(int), sizeof(int));
+    memcpy(&first, at + 2 * sizeof(int), sizeof(int));
+    memcpy(&rows, at + 3 * sizeof(int), sizeof(int));
+    at += 5 * sizeof(int);
+    memcpy(&settings, at, sizeof(settings));
+    memcpy(&length, at + sizeof(settings), sizeof(length));
+    if (fixed + length != (int)assign.size() || length >= SIM_PATH_MAX) {
+        UnloadPartition();
+        return false;
+    }
+    memcpy(worldPath, assign.data() + fixed, length);
+    worldPath[length] = '\0';
+
+    haloRows[SIDE_UP] = (workerId > 0) ? CHUNK_SIZE : 0;
+    haloRows[SIDE_DOWN] = (workerId < workerCount - 1) ? CHUNK_SIZE : 0;
+    slabRows = rows * CHUNK_SIZE;
+    firstRow = first * CHUNK_SIZE - haloRows[SIDE_UP];
+
+    info->worker = workerId;
+    info->workers = workerCount;
+    info->width = width;
+    info->height = slabRows + haloRows[SIDE_UP] + haloRows[SIDE_DOWN];
+    info->firstRow = firstRow;
+
+    // Ghosts only stay put under the sweep, and nothing but the whole slab is in view
+    sim->useTemperature = settings.useTemperature;
+    sim->useGasField = settings.useGasField;
+    sim->useLiquidPressure = settings.useLiquidPressure;
+    sim->backend = BACKEND_SWEEP;
+    sim->useLod = false;
+    sim->frameBudget = 0.0f;
+    return true;
+}
+
+// Load the slab and connect to the neighbours, once the world is set up to the size
+// ConnectPartition gave. Blocks until both neighbours are there
+bool JoinPartition(particle_t** grid) {
+    partGrid = grid;
+    if (worldPath[0] != '\0' && !LoadWorldRows(grid, worldPath, (firstRow + haloRows[SIDE_UP]) / CHUNK_SIZE,
+                                               haloRows[SIDE_UP] / CHUNK_SIZE, slabRows / CHUNK_SIZE)) {
+        TraceLog(LOG_WARNING, "PARTITION: Carrying on with an empty slab");
+    }
+
+    for (int side = 0; side < 2; side++) {
+        ghosts[side] = (particle_t**) calloc(PARTITION_HALO_ROWS * WIDTH, sizeof(particle_t*));
+        ghostMats[side] = (unsigned char*) calloc(PARTITION_HALO_ROWS * WIDTH, 1);
+    }
+
+    if (!ConnectNeighbours()) {
+        TraceLog(LOG_WARNING, "PARTITION: Could not reach the neighbouring workers");
+        return false;
+    }
+
+    // Ghosts are in place before the first tick
+    KeepEdgesUnpacked();
+    for (int side = 0; side < 2; side++) {
+        if (haloRows[side] == 0) continue;
+        std::vector<unsigned char> edge;
+        EncodeEdge(side, &edge);
+        QueueMessage(LINK_UP + side, MESSAGE_EDGE, edge.data(), (int)edge.size());
+    }
+    for (int side = 0; side < 2; side++) {
+        unsigned char type;
+        std::vector<unsigned char> edge;
+        if (haloRows[side] == 0) continue;
+        if (!WaitForMessage(LINK_UP + side, &type, &edge) || type != MESSAGE_EDGE) return false;
+        InstallEdge(side, &edge);
+    }
+
+    rateStart = GetTime();
+    TraceLog(LOG_INFO, "PARTITION: Worker %d of %d running rows %d to %d - %d particles", workerId, workerCount,
+             firstRow + haloRows[SIDE_UP], firstRow + haloRows[SIDE_UP] + slabRows, CountSlabParticles());
+    return true;
+}
+
+// Tick the slab until the coordinator stops or a neighbour goes away, dt is the time step
+void RunPartitionWorker(float dt) {
+    Rectangle view = { 0, 0, (float)WIDTH, (float)HEIGHT };
+
+    while (PollCoordinator()) {
+        KeepEdgesUnpacked();
+
+        // Neighbours take turns at each edge, the worker below it goes on even ticks
+        int waiting = (workerTick % 2 == 0) ? SIDE_DOWN : SIDE_UP;
+
+        // The pressure solver ignores the updated flag, so it's kept off the frozen rows and halos too
+        int top = haloRows[SIDE_UP], bottom = haloRows[SIDE_UP] + slabRows;
+        if (haloRows[waiting] > 0) {
+            if (waiting == SIDE_UP) top += FROZEN_ROWS;
+            else bottom -= FROZEN_ROWS;
+        }
+        LimitLiquidPressure(top, bottom);
+
+        double start = GetTime();
+        FreezeEdge(waiting, true);
+        TickWorld(partGrid, view, dt);
+        FreezeEdge(waiting, false);
+        double ticked = GetTime();
+        if (!ExchangeHalos()) break;
+        double exchanged = GetTime();
+
+        computeSeconds += ticked - start;
+        exchangeSeconds += exchanged - ticked;
+        ticksSinceFrame++;
+        workerTick++;
+
+        if (frameWanted) SendFrame();
+    }
+
+    totalCompute += computeSeconds;
+    totalExchange += exchangeSeconds;
+    double ticks = (workerTick > 0) ? workerTick : 1;
+    TraceLog(LOG_INFO, "PARTITION: Worker %d ran %u ticks - %.3f ms compute, %.3f ms exchange per tick - %u crossings, %u conflicts, %u lost - %d particles",
+             workerId, workerTick, totalCompute * 1000.0 / ticks, totalExchange * 1000.0 / ticks, crossings, conflicts, lost,
+             CountSlabParticles());
+}
+
+// Stops the workers when called on the coordinator, and closes every connection
+void UnloadPartition(void) {
+    for (int l = 0; l < PARTITION_MAX_WORKERS; l++) {
+        if (links[l].connected && partGrid == NULL) {
+            QueueMessage(l, MESSAGE_STOP, NULL, 0);
+            Flush(l);
+        }
+        if (links[l].connected) CloseSocket(links[l].socket);
+        links[l] = link_t();
+    }
+    CloseSocket(listener);
+    listener = INVALID_NET_SOCKET;
+    if (socketsReady) UnloadSockets();
+    socketsReady = false;
+
+    for (int side = 0; side < 2; side++) {
+        free(ghosts[side]);
+        free(ghostMats[side]);
+        ghosts[side] = NULL;
+        ghostMats[side] = NULL;
+    }
+    free(framePixels);
+    framePixels = NULL;
+    workerCount = 0;
+    partGrid = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Listen for the worker below, then connect to the one above, which may not listen yet
+static bool ConnectNeighbours(void) {
+    if (haloRows[SIDE_DOWN] > 0) {
+        listener = ListenSocket(coordinatorPort + 1 + workerId);
+        if (listener == INVALID_NET_SOCKET) return false;
+    }
+
+    double start = GetTime();
+    if (haloRows[SIDE_UP] > 0) {
+        links[LINK_UP] = link_t();
+        while ((links[LINK_UP].socket = ConnectSocket(coordinatorHost, coordinatorPort + workerId)) == INVALID_NET_SOCKET) {
+            if (GetTime() - start > CONNECT_SECONDS) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        links[LINK_UP].connected = true;
+    }
+    if (haloRows[SIDE_DOWN] > 0) {
+        links[LINK_DOWN] = link_t();
+        while ((links[LINK_DOWN].socket = AcceptSocket(listener)) == INVALID_NET_SOCKET) {
+            if (GetTime() - start > CONNECT_SECONDS) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        links[LINK_DOWN].connected = true;
+    }
+    return true;
+}
+
+// The halos and the chunks along the edges are read and written between ticks, so they are
+// never left packed
+static void KeepEdgesUnpacked(void) {
+    if (haloRows[SIDE_UP] > 0) UnpackRegion(partGrid, 0, 0, WIDTH, haloRows[SIDE_UP] + CHUNK_SIZE);
+    if (haloRows[SIDE_DOWN] > 0) UnpackRegion(partGrid, 0, HEIGHT - haloRows[SIDE_DOWN] - CHUNK_SIZE, WIDTH, HEIGHT);
+}
+
+// Particles along the edge on side sit out the tick while the neighbour has its turn. Nothing
+// from further in reaches the rows the neighbour can reach, so both sides never change the
+// same cells in one tick
+static void FreezeEdge(int side, bool frozen) {
+    if (haloRows[side] == 0) return;
+    for (int distance = 0; distance < FROZEN_ROWS; distance++) {
+        particle_t** row = partGrid + GetIndex(0, EdgeRow(side, distance));
+        for (int x = 0; x < WIDTH; x++) {
+            if (row[x] != NULL) row[x]->hasBeenUpdated = frozen;
+        }
+    }
+}
+
+// Crossings first, then the edges as they are once those are in, with the answers to the
+// crossings
+static bool ExchangeHalos(void) {
+    for (int round = 0; round < 2; round++) {
+        unsigned char wanted = (round == 0) ? MESSAGE_CROSSINGS : MESSAGE_EDGE;
+        for (int side = 0; side < 2; side++) {
+            if (haloRows[side] == 0) continue;
+            std::vector<unsigned char> out;
+            if (round == 0) CollectCrossings(side, &out);
+            else EncodeEdge(side, &out);
+            QueueMessage(LINK_UP + side, wanted, out.data(), (int)out.size());
+        }
+
+        bool have[2] = { haloRows[SIDE_UP] == 0, haloRows[SIDE_DOWN] == 0 };
+        while (!have[SIDE_UP] || !have[SIDE_DOWN]) {
+            for (int side = 0; side < 2; side++) {
+                if (have[side]) continue;
+                int l = LINK_UP + side;
+                Flush(l);
+                Receive(l);
+                if (!links[l].connected) return false;
+
+                unsigned char type;
+                std::vector<unsigned char> payload;
+                if (!TakeMessage(l, &type, &payload)) continue;
+                if (type != wanted) return false;
+                if (round == 0) ApplyCrossings(side, &payload);
+                else InstallEdge(side, &payload);
+                have[side] = true;
+            }
+            if (!have[SIDE_UP] || !have[SIDE_DOWN]) std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+// Everything in the halo on side that isn't the ghost put there, which is then cleared.
+// Ghosts that left for the slab are looked for along the edge, in case the neighbour turns
+// down the swap that brought them in
+static void CollectCrossings(int side, std::vector<unsigned char>* out) {
+    std::vector<crossing_t>* list = &sent[side];
+    list->clear();
+    adopted[side].clear();
+
+    int cy = (side == SIDE_UP) ? 0 : sim->chunksY - 1;
+    for (int distance = 0; distance < haloRows[side]; distance++) {
+        particle_t** row = partGrid + GetIndex(0, GhostRow(side, distance));
+
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            // Nothing changed in a chunk that neither ran nor was woken
+            if (!IsChunkAwake(cx, cy)) continue;
+
+            for (int x = cx * CHUNK_SIZE; x < (cx + 1) * CHUNK_SIZE; x++) {
+                particle_t* p = row[x];
+                int g = distance * WIDTH + x;
+                particle_t* ghost = (distance < PARTITION_HALO_ROWS) ? ghosts[side][g] : NULL;
+                unsigned char expect = (ghost != NULL) ? ghostMats[side][g] : (unsigned char)NOTHING;
+                if (p == ghost && (p == NULL || p->mat == expect)) continue;
+
+                crossing_t crossing = { 0 };
+                crossing.x = (unsigned short)x;
+                crossing.distance = (unsigned char)distance;
+                crossing.expect = expect;
+                crossing.mat = (p != NULL) ? (unsigned char)p->mat : (unsigned char)NOTHING;
+                if (p != NULL) {
+                    crossing.color = p->color;
+                    crossing.lifeTime = p->lifeTime;
+                    crossing.velocity = p->velocity;
+                    free(p);
+                    row[x] = NULL;
+                }
+                if (ghost != NULL && p != ghost) adopted[side].push_back({ ghost, (int)list->size(), -1 });
+                if (distance < PARTITION_HALO_ROWS) ghosts[side][g] = NULL;
+                list->push_back(crossing);
+            }
+        }
+    }
+
+    // Sorted by particle so every cell along the edge is one search
+    std::vector<adopted_t>* moved = &adopted[side];
+    if (!moved->empty()) {
+        std::sort(moved->begin(), moved->end(), [](const adopted_t& a, const adopted_t& b) { return a.ghost < b.ghost; });
+        for (int distance = 0; distance < PARTITION_HALO_ROWS; distance++) {
+            int index = GetIndex(0, EdgeRow(side, distance));
+            for (int x = 0; x < WIDTH; x++) {
+                particle_t* p = partGrid[index + x];
+                if (p == NULL) continue;
+                auto found = std::lower_bound(moved->begin(), moved->end(), p, [](const adopted_t& a, particle_t* b) { return a.ghost < b; });
+                if (found != moved->end() && found->ghost == p) found->index = index + x;
+            }
+        }
+    }
+
+    unsigned int count = (unsigned int)list->size();
+    Put(out, &count, sizeof(count));
+    Put(out, list->data(), count * sizeof(crossing_t));
+}
+
+// Take in the neighbour's crossings on side. The ones that found the cell changed and the
+// ones with nowhere to go are noted for the answer
+static void ApplyCrossings(int side, const std::vector<unsigned char>* data) {
+    rejected[side].clear();
+    returned[side].clear();
+
+    unsigned int count;
+    if (data->size() < sizeof(count)) return;
+    memcpy(&count, data->data(), sizeof(count));
+    if (data->size() != sizeof(count) + (size_t)count * sizeof(crossing_t)) return;
+    const unsigned char* at = data->data() + sizeof(count);
+
+    for (unsigned int n = 0; n < count; n++) {
+        crossing_t c;
+        memcpy(&c, at + n * sizeof(crossing_t), sizeof(c));
+        if (c.x >= WIDTH || c.mat >= MATERIAL_COUNT || c.distance >= slabRows) continue;
+
+        int y = EdgeRow(side, c.distance);
+        particle_t** cell = partGrid + GetIndex(c.x, y);
+        unsigned char have = (*cell != NULL) ? (unsigned char)(*cell)->mat : (unsigned char)NOTHING;
+
+        // In place of what the neighbour saw there
+        if (c.expect != NOTHING) {
+            if (have == c.expect) {
+                SetCell(cell, &c);
+                WakeCell(c.x, y);
+                crossings++;
+                continue;
+            }
+            conflicts++;
+            rejected[side].push_back(n);
+            if (c.mat == NOTHING) continue;
+        }
+
+        if (PlaceCrossing(side, &c, y)) crossings++;
+        else returned[side].push_back(n);
+    }
+}
+
+// Into the nearest free cell of the column from y on, away from the edge on side
+static bool PlaceCrossing(int side, const crossing_t* crossing, int y) {
+    int step = (side == SIDE_UP) ? 1 : -1;
+    int slabTop = haloRows[SIDE_UP], slabBottom = haloRows[SIDE_UP] + slabRows;
+
+    for (int t = 0; t < PLACE_SEARCH_ROWS; t++) {
+        int py = y + t * step;
+        if (py < slabTop || py >= slabBottom) break;
+        particle_t** cell = partGrid + GetIndex(crossing->x, py);
+        if (*cell != NULL) continue;
+
+        SetCell(cell, crossing);
+        WakeCell(crossing->x, py);
+        return true;
+    }
+    return false;
+}
+
+// The answers to the neighbour's crossings, then the rows along the edge on side as its
+// ghosts
+static void EncodeEdge(int side, std::vector<unsigned char>* out) {
+    static std::vector<unsigned char> raw;
+    raw.assign((size_t)PARTITION_HALO_ROWS * WIDTH, NOTHING);
+
+    for (int distance = 0; distance < PARTITION_HALO_ROWS; distance++) {
+        particle_t** row = partGrid + GetIndex(0, EdgeRow(side, distance));
+        for (int x = 0; x < WIDTH; x++) {
+            if (row[x] != NULL) raw[distance * WIDTH + x] = row[x]->mat;
+        }
+    }
+    for (int distance = 0; distance < PARTITION_HALO_ROWS; distance++) {
+        particle_t** row = partGrid + GetIndex(0, EdgeRow(side, distance));
+        for (int x = 0; x < WIDTH; x++) {
+            if (row[x] == NULL) continue;
+            Put(&raw, &row[x]->color, sizeof(Color));
+            if (sim->props[row[x]->mat].decaying) Put(&raw, &row[x]->lifeTime, sizeof(float));
+        }
+    }
+
+    unsigned int answers[2] = { (unsigned int)rejected[side].size(), (unsigned int)returned[side].size() };
+    Put(out, answers, sizeof(answers));
+    Put(out, rejected[side].data(), answers[0] * sizeof(unsigned int));
+    Put(out, returned[side].data(), answers[1] * sizeof(unsigned int));
+
+    unsigned int size = (unsigned int)raw.size();
+    size_t header = out->size();
+    out->resize(header + sizeof(size) + LZ_MAX_BYTES(size));
+    memcpy(out->data() + header, &size, sizeof(size));
+    int packed = CompressLz(raw.data(), (int)size, out->data() + header + sizeof(size));
+    out->resize(header + sizeof(size) + packed);
+}
+
+// Settle the crossings sent to side with the neighbour's answers, then bring the ghosts on
+// side up to date with its edge
+static void InstallEdge(int side, const std::vector<unsigned char>* data) {
+    static std::vector<unsigned char> raw;
+    unsigned int answers[2], size;
+    if (data->size() < sizeof(answers)) return;
+    memcpy(answers, data->data(), sizeof(answers));
+    size_t at = sizeof(answers) + ((size_t)answers[0] + answers[1]) * sizeof(unsigned int);
+    if (answers[0] > sent[side].size() || answers[1] > sent[side].size() || data->size() < at + sizeof(size)) return;
+
+    // A swap the neighbour turned down leaves its particle where it was, so the ghost that
+    // came in for it goes
+    const unsigned char* indices = data->data() + sizeof(answers);
+    for (unsigned int n = 0; n < answers[0]; n++) {
+        unsigned int crossing;
+        memcpy(&crossing, indices + n * sizeof(unsigned int), sizeof(crossing));
+        for (const adopted_t& moved : adopted[side]) {
+            if (moved.crossing != (int)crossing || moved.index < 0 || partGrid[moved.index] != moved.ghost) continue;
+            free(moved.ghost);
+            partGrid[moved.index] = NULL;
+            WakeCell(moved.index & (STRIDE - 1), moved.index >> sim->shift);
+        }
+    }
+
+    // Crossings with no room on the other side come back, as close to the edge as they fit
+    indices += answers[0] * sizeof(unsigned int);
+    for (unsigned int n = 0; n < answers[1]; n++) {
+        unsigned int crossing;
+        memcpy(&crossing, indices + n * sizeof(unsigned int), sizeof(crossing));
+        if (crossing >= sent[side].size() || !PlaceCrossing(side, &sent[side][crossing], EdgeRow(side, 0))) lost++;
+    }
+
+    memcpy(&size, data->data() + at, sizeof(size));
+    if (size > MESSAGE_MAX_BYTES) return;
+    raw.resize(size);
+    at += sizeof(size);
+    if (DecompressLz(data->data() + at, (int)(data->size() - at), raw.data(), (int)size) != (int)size) return;
+
+    int cells = PARTITION_HALO_ROWS * WIDTH;
+    size_t next = (size_t)cells;
+    for (int distance = 0; distance < PARTITION_HALO_ROWS; distance++) {
+        int y = GhostRow(side, distance);
+        particle_t** row = partGrid + GetIndex(0, y);
+
+        for (int x = 0; x < WIDTH; x++) {
+            int g = distance * WIDTH + x;
+            crossing_t ghost = { 0 };
+            ghost.mat = raw[g];
+            particle_t* p = row[x];
+
+            if (ghost.mat == NOTHING || ghost.mat >= MATERIAL_COUNT) {
+                if (p != NULL) {
+                    free(p);
+                    row[x] = NULL;
+                    WakeCell(x, y);
+                }
+                ghosts[side][g] = NULL;
+                continue;
+            }
+
+            ghost.lifeTime = sim->props[ghost.mat].initLifeTime;
+            if (next + sizeof(Color) > size) return;
+            memcpy(&ghost.color, &raw[next], sizeof(Color));
+            next += sizeof(Color);
+            if (sim->props[ghost.mat].decaying) {
+                if (next + sizeof(float) > size) return;
+                memcpy(&ghost.lifeTime, &raw[next], sizeof(float));
+                next += sizeof(float);
+            }
+
+            bool changed = (p == NULL || p->mat != ghost.mat || memcmp(&p->color, &ghost.color, sizeof(Color)) != 0);
+            SetCell(&row[x], &ghost);
+            row[x]->hasBeenUpdated = true;
+            ghosts[side][g] = row[x];
+            ghostMats[side][g] = ghost.mat;
+            if (changed) WakeCell(x, y);
+        }
+    }
+}
+
+// Write a particle into a cell, reusing the one there. NOTHING empties it
+static void SetCell(particle_t** cell, const crossing_t* content) {
+    if (content->mat == NOTHING) {
+        free(*cell);
+        *cell = NULL;
+        return;
+    }
+    if (*cell == NULL) *cell = CreateParticle((particle_mat_t)content->mat);
+
+    particle_t* p = *cell;
+    p->mat = (particle_mat_t)content->mat;
+    p->color = content->color;
+    p->lifeTime = content->lifeTime;
+    p->velocity = content->velocity;
+    p->hasBeenUpdated = false;
+    p->stuck = false;
+    p->xThreshold = 0.0f;
+    p->yThreshold = 0.0f;
+}
+
+// Worker, between ticks. False once the coordinator stopped or went away
+static bool PollCoordinator(void) {
+    Flush(LINK_COORDINATOR);
+    Receive(LINK_COORDINATOR);
+
+    unsigned char type;
+    std::vector<unsigned char> payload;
+    while (TakeMessage(LINK_COORDINATOR, &type, &payload)) {
+        if (type == MESSAGE_FRAME_REQUEST) frameWanted = true;
+        else if (type == MESSAGE_STOP) stopped = true;
+    }
+    return links[LINK_COORDINATOR].connected && !stopped;
+}
+
+// The slab's share of the frame, the cell in the middle of each block
+static void SendFrame(void) {
+    double now = GetTime();
+    frame_header_t header = { 0 };
+    header.tick = workerTick;
+    header.computeMs = (float)(computeSeconds * 1000.0 / ticksSinceFrame);
+    header.exchangeMs = (float)(exchangeSeconds * 1000.0 / ticksSinceFrame);
+    header.haloKBps = (now > rateStart) ? (float)(haloBytes / 1024.0 / (now - rateStart)) : 0.0f;
+    header.crossings = crossings;
+    header.conflicts = conflicts;
+    header.lost = lost;
+
+    // Frame rows whose block starts inside the slab
+    int top = firstRow + haloRows[SIDE_UP], bottom = top + slabRows;
+    header.firstRow = (top + frameScale - 1) / frameScale;
+    header.rows = (bottom + frameScale - 1) / frameScale - header.firstRow;
+    int width = (WIDTH + frameScale - 1) / frameScale;
+
+    static std::vector<unsigned char> raw;
+    raw.assign((size_t)width * header.rows, NOTHING);
+    for (int r = 0; r < header.rows; r++) {
+        int y = (header.firstRow + r) * frameScale + frameScale / 2;
+        if (y >= bottom) y = bottom - 1;
+        particle_t** row = partGrid + GetIndex(0, y - firstRow);
+        for (int c = 0; c < width; c++) {
+            int x = c * frameScale + frameScale / 2;
+            if (x >= WIDTH) x = WIDTH - 1;
+            if (row[x] != NULL) raw[r * width + c] = row[x]->mat;
+        }
+    }
+
+    unsigned int size = (unsigned int)raw.size();
+    std::vector<unsigned char> out(sizeof(header) + sizeof(size) + LZ_MAX_BYTES(size));
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + sizeof(header), &size, sizeof(size));
+    int packed = CompressLz(raw.data(), (int)size, out.data() + sizeof(header) + sizeof(size));
+    QueueMessage(LINK_COORDINATOR, MESSAGE_FRAME, out.data(), (int)(sizeof(header) + sizeof(size) + packed));
+
+    totalCompute += computeSeconds;
+    totalExchange += exchangeSeconds;
+    computeSeconds = 0.0;
+    exchangeSeconds = 0.0;
+    ticksSinceFrame = 0;
+    haloBytes = 0;
+    rateStart = now;
+    frameWanted = false;
+}
+
+static void ReceiveFrame(int w, const std::vector<unsigned char>* data) {
+    frame_header_t header;
+    unsigned int size;
+    frameAsked[w] = false;
+    if (data->size() < sizeof(header) + sizeof(size)) return;
+    memcpy(&header, data->data(), sizeof(header));
+    memcpy(&size, data->data() + sizeof(header), sizeof(size));
+    if (header.firstRow < 0 || header.rows < 0 || header.firstRow + header.rows > frameHeight ||
+        size != (unsigned int)(header.rows * frameWidth)) return;
+
+    static std::vector<unsigned char> raw;
+    raw.resize(size);
+    int offset = sizeof(header) + sizeof(size);
+    if (DecompressLz(data->data() + offset, (int)data->size() - offset, raw.data(), (int)size) != (int)size) return;
+
+    Color* pixels = framePixels + header.firstRow * frameWidth;
+    for (unsigned int n = 0; n < size; n++) {
+        pixels[n] = (raw[n] == NOTHING || raw[n] >= MATERIAL_COUNT) ? BLANK : sim->props[raw[n]].initialColor;
+    }
+
+    partition_stats_t* stats = &workerStats[w];
+    stats->tick = header.tick;
+    stats->computeMs = header.computeMs;
+    stats->exchangeMs = header.exchangeMs;
+    stats->haloKBps = header.haloKBps;
+    stats->crossings = header.crossings;
+    stats->conflicts = header.conflicts;
+    stats->lost = header.lost;
+}
+
+// Packed chunks point at placeholders, so they count without being unpacked
+static int CountSlabParticles(void) {
+    int count = 0;
+    for (int y = haloRows[SIDE_UP]; y < haloRows[SIDE_UP] + slabRows; y++) {
+        particle_t** row = partGrid + GetIndex(0, y);
+        for (int x = 0; x < WIDTH; x++) count += (row[x] != NULL);
+    }
+    return count;
+}
+
+// Local row of the halo row distance rows out from the slab on side
+static int GhostRow(int side, int distance) {
+    return (side == SIDE_UP) ? haloRows[SIDE_UP] - 1 - distance : haloRows[SIDE_UP] + slabRows + distance;
+}
+
+// Local row of the slab row distance rows in from its edge on side
+static int EdgeRow(int side, int distance) {
+    return (side == SIDE_UP) ? haloRows[SIDE_UP] + distance : haloRows[SIDE_UP] + slabRows - 1 - distance;
+}
+
+static void QueueMessage(int l, unsigned char type, const void* data, int size) {
+    if (!links[l].connected) return;
+    unsigned int length = (unsigned int)size + 1;
+    Put(&links[l].out, &length, sizeof(length));
+    Put(&links[l].out, &type, 1);
+    Put(&links[l].out, data, size);
+    if (l != LINK_COORDINATOR) haloBytes += sizeof(length) + length;
+    Flush(l);
+}
+
+static void Flush(int l) {
+    link_t* link = &links[l];
+    while (link->connected && link->outSent < link->out.size()) {
+        int sent = SendSocket(link->socket, link->out.data() + link->outSent, (int)(link->out.size() - link->outSent));
+        if (sent < 0) DropLink(l);
+        if (sent <= 0) break;
+        link->outSent += sent;
+    }
+    if (link->outSent == link->out.size()) {
+        link->out.clear();
+        link->outSent = 0;
+    }
+}
+
+static void Receive(int l) {
+    unsigned char buffer[64 * 1024];
+    while (links[l].connected) {
+        int received = ReceiveSocket(links[l].socket, buffer, sizeof(buffer));
+        if (received < 0) DropLink(l);
+        if (received <= 0) break;
+        links[l].in.insert(links[l].in.end(), buffer, buffer + received);
+    }
+}
+
+// The oldest whole message received on l, false until one is in
+static bool TakeMessage(int l, unsigned char* type, std::vector<unsigned char>* payload) {
+    std::vector<unsigned char>* in = &links[l].in;
+    unsigned int length;
+    if (in->size() < sizeof(length)) return false;
+    memcpy(&length, in->data(), sizeof(length));
+
+    if (length == 0 || length > MESSAGE_MAX_BYTES) {
+        TraceLog(LOG_WARNING, "PARTITION: Dropping a connection that sent a broken message");
+        DropLink(l);
+        return false;
+    }
+    if (in->size() < sizeof(length) + length) return false;
+
+    *type = (*in)[sizeof(length)];
+    payload->assign(in->begin() + sizeof(length) + 1, in->begin() + sizeof(length) + length);
+    in->erase(in->begin(), in->begin() + sizeof(length) + length);
+    return true;
+}
+
+// Blocks, only while the partition is set up
+static bool WaitForMessage(int l, unsigned char* type, std::vector<unsigned char>* payload) {
+    while (links[l].connected) {
+        if (TakeMessage(l, type, payload)) return true;
+        Receive(l);
+        Flush(l);
+        if (links[l].in.size() < sizeof(unsigned int)) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+static void DropLink(int l) {
+    if (!links[l].connected) return;
+    CloseSocket(links[l].socket);
+    links[l].connected = false;
+    links[l].in.clear();
+    links[l].out.clear();
+    links[l].outSent = 0;
+}
+
+static void Put(std::vector<unsigned char>* out, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    out->insert(out->end(), bytes, bytes + size);
+}
@@ -15,8 +15,10 @@
 #include "raylib.h"
 #include "raymath.h"
 #include "screens.h"    // NOTE: Declares global (extern) variables and screens functions
+#include "simulation.h" // NOTE: Declares particle types, material table and simulation modules
 #include "stdlib.h"
 #include "stdio.h"
+#include "string.h"
 
 #if defined(PLATFORM_WEB)
     #include <emscripten/emscripten.h>
@@ -27,71 +29,55 @@
     #define GLSL_VERSION            330
 #endif
 
-
-#define WIDTH 512
-#define HEIGHT 512
-
-typedef struct Vector2Int {
-    int x;
-    int y;
-} Vector2Int;
-
-typedef enum particle_state_t {
-    SOLID_STUCK,
-    SOLID,
-    LIQUID,
-    GAS,
-} particle_state_t;
-
-typedef enum particle_mat_t {
-    NOTHING,
-    SAND,
-    WATER,
-    SMOKE,
-    WOOD,
-    LAVA,
-    STONE,
-    FIRE,
-    OIL,
-} particle_mat_t;
-
-typedef struct mat_prop_t {
-    float modX;
-    float modY;
-    float maxX;
-    float maxY;
-    int flammableProbability;
-    float initLifeTime;
-    bool decaying;
-    bool acting;
-    bool flammable;
-    particle_state_t type;
-    Color initialColor;
-} mat_prop_t;
-
-static mat_prop_t props[9] = {
-    {0, 0, 0, 0, 0, 0, false, false, false, SOLID_STUCK, {0, 0, 0, 255}}, // Nothing
-    {2, 2, 2, 10, 0, 0, false, false, false, SOLID, {140, 103, 50, 255}}, // Sand
-    {30, 2, 10, 10, 50, 0, false, false, true, LIQUID, {0, 121, 241, 255}}, // Water
-    {2, 2, 5, 10, 0, 5, true, false, false, GAS, {60, 60, 60, 255}}, // Smoke
-    {0, 0, 0, 0, 10, 0, false, false, true, SOLID_STUCK, {76, 63, 47, 255}}, // Wood
-    {2, 2, 1.5, 3, 0, 0, false, true, false, LIQUID, {255, 101, 32, 255}}, // Lava
-    {0, 0, 0, 0, 0, 0, false, false, false, SOLID_STUCK, {100, 100, 100, 255}}, // Stone
-    {0, 0, 0, 0, 0, 1, true, true, false, SOLID_STUCK, {255, 180, 10, 255}}, // Fire
-    {2, 2, 10, 10, 50, 0, false, false, true, LIQUID, {40, 30, 21, 255}}, // Oil
+// Neighbourhood mask bits, set when the particle could move into that neighbour
+#define NB_DOWN_LEFT    0x01
+#define NB_DOWN         0x02
+#define NB_DOWN_RIGHT   0x04
+#define NB_LEFT         0x08
+#define NB_RIGHT        0x10
+
+typedef enum move_t {
+    MOVE_NONE,
+    MOVE_DOWN,
+    MOVE_DOWN_LEFT,
+    MOVE_DOWN_RIGHT,
+    MOVE_LEFT,
+    MOVE_RIGHT,
+    MOVE_BOTH_OPEN = 0x80,      // Flag, both sides were free and the current direction won
+} move_t;
+
+// What the brush may paint over
+typedef enum brush_policy_t {
+    BRUSH_FILL,                 // Empty cells only
+    BRUSH_REPLACE,              // Anything
+    BRUSH_REPLACE_SELECTED,     // The materials picked with ctrl and a number key
+} brush_policy_t;
+
+#define BRUSH_MAX_RADIUS 64
+#define REWIND_STEP_TICKS 60        // Page up and down, a second at 60 ticks per second
+#define FAST_FORWARD_MS 12.0f       // Of every frame spent ticking when fast forwarding as far as possible
+#define FIXED_DT (1.0f / 60.0f)     // Time step of recorded and shared sessions, whatever the frame rate
+#define MATERIAL_SETTINGS_MAX 32    // --set changes to the material table
+
+
+// Materials as the game starts, every world takes its own copy, see DefaultWorld
+static const mat_prop_t defaultProps[MATERIAL_COUNT] = {
+    {0, 0, 0, 0, 0, 0, false, false, false, SOLID_STUCK, {0, 0, 0, 255}, 20, 0.5f, 0, NOTHING, 0, NOTHING}, // Nothing
+    {2, 2, 2, 10, 0, 0, false, false, false, SOLID, {140, 103, 50, 255}, 20, 0.2f, 0, NOTHING, 0, NOTHING}, // Sand
+    {30, 2, 10, 10, 50, 0, false, false, true, LIQUID, {0, 121, 241, 255}, 20, 2.0f, 100, STEAM, 0, NOTHING}, // Water
+    {2, 2, 5, 10, 0, 5, true, false, false, GAS, {60, 60, 60, 255}, 20, 0.5f, 0, NOTHING, 0, NOTHING}, // Smoke
+    {0, 0, 0, 0, 10, 0, false, false, true, SOLID_STUCK, {76, 63, 47, 255}, 20, 0.2f, 250, FIRE, 0, NOTHING}, // Wood
+    {2, 2, 1.5, 3, 0, 0, false, true, false, LIQUID, {255, 101, 32, 255}, 1200, 10.0f, 0, NOTHING, 600, STONE}, // Lava
+    {0, 0, 0, 0, 0, 0, false, false, false, SOLID_STUCK, {100, 100, 100, 255}, 20, 0.1f, 0, NOTHING, 0, NOTHING}, // Stone
+    {0, 0, 0, 0, 0, 1, true, true, false, SOLID_STUCK, {255, 180, 10, 255}, 900, 60.0f, 0, NOTHING, 150, SMOKE}, // Fire
+    {2, 2, 10, 10, 50, 0, false, false, true, LIQUID, {40, 30, 21, 255}, 20, 0.2f, 200, FIRE, 0, NOTHING}, // Oil
+    {2, 2, 5, 10, 0, 3, true, false, false, GAS, {200, 200, 210, 255}, 20, 0.5f, 0, NOTHING, 0, NOTHING}, // Steam
 };
 
-typedef struct particle_t {
-    unsigned int id;
-    float lifeTime;
-    Vector2 velocity;
-    Color color;
-    bool hasBeenUpdated;
-    bool stuck;
-    particle_mat_t mat;
-    float xThreshold;
-    float yThreshold;
-} particle_t;
+// As materials are written in --set, sweep and palette files
+const char* materialNames[MATERIAL_COUNT] = {
+    "nothing", "sand", "water", "smoke", "wood", "lava", "stone", "fire", "oil", "steam",
+};
 
 //----------------------------------------------------------------------------------
 // Shared Variables Definition (global)
@@ -106,10 +92,35 @@ Sound fxCoin = { 0 };
 // Local Variables Definition (local to this module)
 //----------------------------------------------------------------------------------
 
-float gravity = 10.0;
-unsigned int frameCounter = 0;
-unsigned int updatedParticles = 0;
-unsigned int actuallyUpdatedParticles = 0;
+sim_world_t mainWorld = DefaultWorld();
+SIM_THREAD_LOCAL sim_world_t* sim = &mainWorld;
+
+// Materials on the number keys, one to nine
+static const particle_mat_t hotkeyMaterials[9] = { SAND, WATER, LAVA, WOOD, OIL, SMOKE, STONE, FIRE, STEAM };
+static const char* brushPolicyNames[3] = { "fill empty", "replace", "replace selected" };
+
+// Ticks per frame for each fast forward speed, 0 for as many as fit in FAST_FORWARD_MS
+static const int fastForwardTicks[4] = { 1, 8, 32, 0 };
+
+// Moves indexed by neighbourhood mask and direction (1 when moving left)
+static const unsigned char solidMoves[8][2] = {
+    { MOVE_NONE, MOVE_NONE },                                                   // Nothing free
+    { MOVE_DOWN_LEFT, MOVE_DOWN_LEFT },                                         // Down left
+    { MOVE_DOWN, MOVE_DOWN },                                                   // Down
+    { MOVE_DOWN, MOVE_DOWN },
+    { MOVE_DOWN_RIGHT, MOVE_DOWN_RIGHT },                                       // Down right
+    { MOVE_DOWN_RIGHT | MOVE_BOTH_OPEN, MOVE_DOWN_LEFT | MOVE_BOTH_OPEN },      // Both diagonals
+    { MOVE_DOWN, MOVE_DOWN },
+    { MOVE_DOWN, MOVE_DOWN },
+};
+
+// Sideways spread for liquids, indexed by the left and right bits of the mask
+static const unsigned char spreadMoves[4][2] = {
+    { MOVE_NONE, MOVE_NONE },
+    { MOVE_LEFT, MOVE_LEFT },
+    { MOVE_RIGHT, MOVE_RIGHT },
+    { MOVE_RIGHT | MOVE_BOTH_OPEN, MOVE_LEFT | MOVE_BOTH_OPEN },
+};
 
 //----------------------------------------------------------------------------------
 // Local Functions Declaration
@@ -118,28 +129,29 @@ unsigned int actuallyUpdatedParticles = 0;
 static float MinFloat(float a, float b);
 static float MaxFloat(float a, float b);
 
+static void UpdateParticle(particle_t** grid, int x, int y);
 static void UpdateSolidParticle(particle_t** grid, int x, int y);
 static void UpdateLiquidParticle(particle_t** grid, int x, int y);
 static void UpdateGasParticle(particle_t** grid, int x, int y);
-static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, int y);
+static void UpdateSolidStuckParticle(particle_t** grid, int x, int y);
 
-static particle_t* CreateParticle(particle_mat_t mat);
-static particle_t* GetParticle(particle_t* grid[HEIGHT * WIDTH], int x, int y);
-static int GetIndex(int x, int y);
-static void SwapParticles(particle_t* grid[HEIGHT * WIDTH], int x1, int y1, int x2, int y2);
+static void SwapParticles(particle_t** grid, int x1, int y1, int x2, int y2);
 static Vector2Int TranslateParticle(particle_t** grid, int x, int y, int x1, int y1);
 static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x, int y, int x1, int y1, mat_prop_t* mat);
-static void SpawnParticles(particle_t** grid, Vector2 from, Vector2 to, particle_mat_t material);
-static void FillGapsWithParticle(particle_t** grid, int x1, int y1, int x2, int y2, particle_mat_t material);
-
-float isSurroundedByType(particle_t* grid[WIDTH * HEIGHT], int x, int y, particle_mat_t mat);
+static void EmitSmoke(particle_t** grid, int x, int y);
+static void SubmitFileCommand(sim_command_type_t type, const char* path, bool compress, int originX, int originY);
+static void SubmitHistoryCommand(sim_command_type_t type, int originX, int originY);
+static int NeighbourMask(particle_t** grid, int x, int y, particle_state_t particleState, int wanted);
+static int RunCoordinator(int port, int workers, const char* worldFile, int width, int height, bool headless,
+                          int screenWidth, int screenHeight);
+
+float isSurroundedByType(particle_t** grid, int x, int y, particle_mat_t mat);
 bool CheckValidMove(particle_t** grid, int x, int y, particle_state_t particleState);
-bool withinBounds(int x, int y);
 
 //----------------------------------------------------------------------------------
 // Main entry point
 //----------------------------------------------------------------------------------
-int main(void)
+int main(int argc, char** argv)
 {
     // Initialization
     //---------------------------------------------------------
@@ -147,13 +159,238 @@ int main(void)
     int screenWidth = 1280;
     int screenHeight = 800;
 
-    SetConfigFlags(FLAG_BORDERLESS_WINDOWED_MODE | FLAG_WINDOW_RESIZABLE);
+    // World size from the command line, e.g. --world 4096x2048. With --stream <dir> the
+    // world becomes a window that follows the camera and pages chunks out to dir.
+    // --no-sim-thread runs the simulation between frames on this thread. --load <file> starts
+    // from a saved world, sized to match it, and F5 / F9 save and load that file.
+    // --autosave <file> saves the world to file in the background every --autosave-interval
+    // seconds, and picks up from it when it is there and nothing else is loaded.
+    // --rewind <seconds> keeps that much of the past to scrub back through.
+    // --record <file> records the session to file, --replay <file> plays one back in its
+    // place, and with --headless plays it as fast as it runs without drawing anything.
+    // --host <port> shares the world with --players <n> players in lockstep, who connect
+    // with --join <address:port>. --input-delay <ticks> is how far ahead commands are sent.
+    // --coordinate <port> splits the world into slabs for --workers <n> processes started
+    // with --worker <address:port>, and shows them, or only logs them with --headless.
+    // --share <name> publishes the world's materials in shared memory for other programs,
+    // see world_export.h, and --share-colors the colour of every cell as well.
+    // --set <material>.<field>=<value> changes a material, e.g. sand.maxY=4. --batch <file>
+    // runs the worlds of a sweep file --jobs <n> at a time and writes what happened in each
+    // to --batch-out <file>, see batch.cpp.
+    // --import <image> starts from an image, sized to match it, its colours turned into
+    // materials through --palette <file>, see image_file.cpp. F6 exports the world to
+    // --export <image>
+    int worldSizeX = 512, worldSizeY = 512;
+    const char* worldFile = "world.ppw";
+    bool loadWorld = false;
+    const char* importFile = NULL;
+    const char* paletteFile = NULL;
+    const char* exportFile = "world.png";
+    const char* autosaveFile = NULL;
+    float autosaveInterval = 30.0f;
+    float rewindSeconds = 0.0f;
+    const char* streamDirectory = NULL;
+    int streamBudget = 64;
+    bool simThread = true;
+    const char* recordFile = NULL;
+    const char* replayFile = NULL;
+    bool headless = false;
+    int hostPort = 0;
+    int players = 2;
+    int inputDelay = LOCKSTEP_DEFAULT_DELAY;
+    const char* joinAddress = NULL;
+    int coordinatePort = 0;
+    int workers = 2;
+    const char* workerAddress = NULL;
+    const char* shareName = NULL;
+    bool shareColors = false;
+    const char* batchFile = NULL;
+    const char* batchOut = "batch.csv";
+    int jobs = 0;
+    const char* materialSettings[MATERIAL_SETTINGS_MAX] = { 0 };
+    int materialSettingCount = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--no-sim-thread") == 0) {
+            simThread = false;
+        }
+        else if (strcmp(argv[a], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[a], "--share-colors") == 0) {
+            shareColors = true;
+        }
+        else if (a + 1 >= argc) {
+            break;
+        }
+        else if (strcmp(argv[a], "--world") == 0) {
+            sscanf(argv[a + 1], "%dx%d", &worldSizeX, &worldSizeY);
+        }
+        else if (strcmp(argv[a], "--stream") == 0) {
+            streamDirectory = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--stream-budget") == 0) {
+            streamBudget = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--sim-budget") == 0) {
+            sim->frameBudget = (float)atof(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--load") == 0) {
+            worldFile = argv[a + 1];
+            loadWorld = PeekWorldFile(worldFile, &worldSizeX, &worldSizeY);
+            importFile = NULL;
+        }
+        else if (strcmp(argv[a], "--import") == 0) {
+            importFile = PeekWorldImage(argv[a + 1], &worldSizeX, &worldSizeY) ? argv[a + 1] : NULL;
+            loadWorld = false;
+        }
+        else if (strcmp(argv[a], "--palette") == 0) {
+            paletteFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--export") == 0) {
+            exportFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--autosave") == 0) {
+            autosaveFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--autosave-interval") == 0) {
+            autosaveInterval = (float)atof(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--rewind") == 0) {
+            rewindSeconds = (float)atof(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--record") == 0) {
+            recordFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--replay") == 0) {
+            replayFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--host") == 0) {
+            hostPort = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--players") == 0) {
+            players = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--input-delay") == 0) {
+            inputDelay = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--join") == 0) {
+            joinAddress = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--coordinate") == 0) {
+            coordinatePort = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--workers") == 0) {
+            workers = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--worker") == 0) {
+            workerAddress = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--share") == 0) {
+            shareName = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--set") == 0 && materialSettingCount < MATERIAL_SETTINGS_MAX) {
+            materialSettings[materialSettingCount++] = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--batch") == 0) {
+            batchFile = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--batch-out") == 0) {
+            batchOut = argv[a + 1];
+        }
+        else if (strcmp(argv[a], "--jobs") == 0) {
+            jobs = atoi(argv[a + 1]);
+        }
+    }
+
+    // The coordinator holds no world of its own, only the frames the workers send
+    if (coordinatePort > 0) {
+        return RunCoordinator(coordinatePort, workers, loadWorld ? worldFile : NULL, worldSizeX, worldSizeY,
+                              headless, screenWidth, screenHeight);
+    }
+
+    // Batch runs are worlds of their own on threads of this process, no window
+    if (batchFile != NULL) {
+        return RunBatch(batchFile, batchOut, jobs);
+    }
+
+    // Saves made from here on go with the changed table
+    for (int n = 0; n < materialSettingCount; n++) SetMaterialValue(materialSettings[n]);
+
+    // A worker runs its slab and nothing else, out of sight
+    partition_info_t partitionInfo = { 0 };
+    if (workerAddress != NULL) {
+        if (!ConnectPartition(workerAddress, &partitionInfo)) return 1;
+        worldSizeX = partitionInfo.width;
+        worldSizeY = partitionInfo.height;
+        headless = true;
+        loadWorld = false;
+        autosaveFile = NULL;
+        rewindSeconds = 0.0f;
+        streamDirectory = NULL;
+        recordFile = NULL;
+        replayFile = NULL;
+        hostPort = 0;
+        joinAddress = NULL;
+        shareName = NULL;
+    }
+
+    // Everyone in a shared world runs it from the same commands, nothing else may change it
+    bool lockstep = hostPort > 0 || joinAddress != NULL;
+    if (lockstep && (replayFile != NULL || recordFile != NULL || streamDirectory != NULL)) {
+        TraceLog(LOG_WARNING, "LOCKSTEP: Recordings, replays and streaming don't work in shared worlds");
+        replayFile = NULL;
+        recordFile = NULL;
+        streamDirectory = NULL;
+    }
+
+    // Joining takes the world from the host, sized as the host's
+    lockstep_info_t lockstepInfo = { 0 };
+    if (joinAddress != NULL) {
+        if (!ConnectLockstep(joinAddress, &lockstepInfo)) return 1;
+        worldSizeX = lockstepInfo.width;
+        worldSizeY = lockstepInfo.height;
+        rewindSeconds = lockstepInfo.rewindSeconds;
+        loadWorld = false;
+        autosaveFile = NULL;
+        hostPort = 0;
+    }
+
+    // A replay brings its own world and is played the way it was recorded
+    replay_info_t replay = { 0 };
+    if (replayFile != NULL && OpenReplay(replayFile, &replay)) {
+        worldSizeX = replay.width;
+        worldSizeY = replay.height;
+        rewindSeconds = replay.rewindSeconds;
+        loadWorld = false;
+        autosaveFile = NULL;
+        streamDirectory = NULL;
+        recordFile = NULL;
+    }
+    else {
+        replayFile = NULL;
+    }
+    if (headless && replayFile == NULL && workerAddress == NULL) return 1;
+    if (headless) simThread = false;
+
+    // Streamed chunks live outside the recording, and the frame budget depends on how fast
+    // ticks run
+    if (recordFile != NULL && streamDirectory != NULL) {
+        TraceLog(LOG_WARNING, "REPLAY: Streamed worlds can't be recorded");
+        recordFile = NULL;
+    }
+    if (recordFile != NULL) sim->frameBudget = 0.0f;
+
+    bool resumeAutosave = !loadWorld && importFile == NULL && autosaveFile != NULL && FileExists(autosaveFile) &&
+                          PeekWorldFile(autosaveFile, &worldSizeX, &worldSizeY);
+    InitWorld(worldSizeX, worldSizeY);
+
+    SetConfigFlags(headless ? FLAG_WINDOW_HIDDEN : (FLAG_BORDERLESS_WINDOWED_MODE | FLAG_WINDOW_RESIZABLE));
     InitWindow(screenWidth, screenHeight, "PixelPhysics");
     SetWindowMinSize(screenWidth, screenHeight);
 
-    RenderTexture2D target = LoadRenderTexture(WIDTH, HEIGHT);
-    RenderTexture2D noBloom = LoadRenderTexture(WIDTH, HEIGHT);
-    RenderTexture2D bloomTarget = LoadRenderTexture(WIDTH, HEIGHT); // Texture for bloom shader
+    RenderTexture2D target = LoadRenderTexture(screenWidth, screenHeight);
+    RenderTexture2D noBloom = LoadRenderTexture(screenWidth, screenHeight);
+    RenderTexture2D bloomTarget = LoadRenderTexture(screenWidth, screenHeight); // Texture for bloom shader
  
     SetTextureFilter(target.texture, TEXTURE_FILTER_POINT | TEXTURE_WRAP_CLAMP);
     SetTextureFilter(bloomTarget.texture, TEXTURE_WRAP_CLAMP);
@@ -161,25 +398,67 @@ int main(void)
     InitAudioDevice();      // Initialize audio device
 
 	// Grid for storing particles
-	particle_t** grid = (particle_t **) malloc(HEIGHT * WIDTH * sizeof(particle_t *));
-    for (int i = 0; i < HEIGHT * WIDTH; i++) {
-        grid[i] = NULL;
+	particle_t** grid = (particle_t **) calloc(STRIDE * HEIGHT, sizeof(particle_t *));
+
+    InitMoveTables();
+    InitTemperature();
+    InitGasField();
+    InitLiquidPressure();
+    InitMargolus();
+    InitDoubleBuffer();
+    InitCompression();
+    InitEdits();
+    InitHistory();
+    InitRewind(rewindSeconds);
+    InitWorldImage(paletteFile);
+    if (streamDirectory != NULL) InitStreaming(streamDirectory, streamBudget);
+    if (loadWorld) LoadWorldFile(grid, worldFile);
+    if (importFile != NULL) ImportWorldImage(grid, importFile);
+    if (resumeAutosave) LoadWorldFile(grid, autosaveFile);
+    if (replayFile != NULL) StartReplay(grid);
+    if (recordFile != NULL && !StartRecording(grid, recordFile, rewindSeconds)) recordFile = NULL;
+    if (hostPort > 0 && !HostLockstep(grid, hostPort, players, inputDelay, rewindSeconds)) lockstep = false;
+    if (joinAddress != NULL && !JoinLockstep(grid, &lockstepInfo)) lockstep = false;
+    if (autosaveFile != NULL) InitAutosave(autosaveFile, autosaveInterval);
+    if (shareName != NULL) InitWorldExport(shareName, shareColors);
+    InitSimThread(grid, simThread);
+    if (workerAddress != NULL) {
+        if (JoinPartition(grid)) RunPartitionWorker(FIXED_DT);
     }
+    else if (headless) RunReplay();
 
     particle_mat_t currentMaterial = SAND;
     char* fpsText = (char *)malloc(100 * sizeof(char));
     bool doUpdate = false, continualUpdate = true;
+    int fastForward = 0;                    // Into fastForwardTicks
+    bool runUntilSettled = false;
+    unsigned int frameId = 0, settleFrameId = 0;
 
     Vector2 mousePosLastFrame = { 0,0 };
+    Vector2 rectangleStart = { 0, 0 };
+
+    int brushRadius = 4;
+    float brushDensity = 1.0f;
+    brush_policy_t brushPolicy = BRUSH_FILL;
+    unsigned int brushSelected = 0;         // Materials BRUSH_REPLACE_SELECTED paints over
+    unsigned int editSeed = 0;
+
+    // The simulation owns these once it runs, changes are sent over as commands
+    sim_settings_t settings = { sim->useTemperature, sim->useGasField, sim->useLiquidPressure, sim->backend, sim->useLod, sim->frameBudget };
+    float lastFrameBudget = (sim->frameBudget > 0.0f) ? sim->frameBudget : 8.0f;
+
+    // Window origin the camera and mouse positions are relative to, follows the snapshots
+    int viewOriginX = sim->chunkOriginX, viewOriginY = sim->chunkOriginY;
 
     Shader shader = LoadShader(0, TextFormat("resources/bloom.fs", GLSL_VERSION));
 
-    Rectangle player = { 0, 0, 20, 20 };
+    // Camera units are cells, start centered on the world and zoomed to fit small worlds
+    Rectangle player = { WIDTH / 2.0f - 20.0f, HEIGHT / 2.0f - 20.0f, 20, 20 };
 
     Camera2D camera = { 0 };
     camera.target = { player.x + 20.0f, player.y + 20.0f };
     camera.offset = { screenWidth / 2.0f, screenHeight / 2.0f };
-    camera.zoom = 1.0f;
+    camera.zoom = MaxFloat(1.0f, MinFloat((float)screenWidth / WIDTH, (float)screenHeight / HEIGHT));
     camera.rotation = 0.0f;
 
     // Setup and init first screen
@@ -191,151 +470,278 @@ int main(void)
     //--------------------------------------------------------------------------------------
 
     // Main game loop
-    while (!WindowShouldClose())    // Detect window close button or ESC key
+    while (!headless && !WindowShouldClose())    // Detect window close button or ESC key
     {
-        frameCounter = (frameCounter + 1) % INT_MAX;
         //float scale = MinFloat((float)GetScreenWidth() / WIDTH, (float)GetScreenHeight() / HEIGHT);
 
 		int maxX = GetScreenWidth();
 		int maxY = GetScreenHeight();
 
-		if (IsKeyPressed(KEY_ONE)) {
-            currentMaterial = SAND;
-		}
-		else if (IsKeyPressed(KEY_TWO)) {
-            currentMaterial = WATER;
-		}
-		else if (IsKeyPressed(KEY_SIX)) {
-            currentMaterial = SMOKE;
-		}
-		else if (IsKeyPressed(KEY_FOUR)) {
-            currentMaterial = WOOD;
-		}
-		else if (IsKeyPressed(KEY_THREE)) {
-            currentMaterial = LAVA;
+        // Number keys pick the material, with ctrl held they pick what the brush replaces
+        for (int n = 0; n < 9; n++) {
+            if (!IsKeyPressed(KEY_ONE + n)) continue;
+            if (IsKeyDown(KEY_LEFT_CONTROL)) brushSelected ^= 1u << hotkeyMaterials[n];
+            else currentMaterial = hotkeyMaterials[n];
         }
-        else if (IsKeyPressed(KEY_FIVE)) {
-            currentMaterial = OIL;
+
+        // Ctrl Z undoes the last stroke, ctrl Y or ctrl shift Z redoes it
+        if (IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_Z)) {
+            SubmitHistoryCommand(IsKeyDown(KEY_LEFT_SHIFT) ? SIM_REDO : SIM_UNDO, viewOriginX, viewOriginY);
         }
-        else if (IsKeyPressed(KEY_SEVEN)) {
-            currentMaterial = STONE;
+        if (IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_Y)) {
+            SubmitHistoryCommand(SIM_REDO, viewOriginX, viewOriginY);
         }
-        else if (IsKeyPressed(KEY_EIGHT)) {
-            currentMaterial = FIRE;
+
+        // Page up and down scrub a second back and forth through the rewind buffer, a tick with
+        // shift held, home and end jump to either end. Scrubbing pauses, enter runs on from there
+        int rewindTicks = 0;
+        int rewindStep = IsKeyDown(KEY_LEFT_SHIFT) ? 1 : REWIND_STEP_TICKS;
+        if (IsKeyPressed(KEY_PAGE_UP)) rewindTicks = -rewindStep;
+        if (IsKeyPressed(KEY_PAGE_DOWN)) rewindTicks = rewindStep;
+        if (IsKeyPressed(KEY_HOME)) rewindTicks = -INT_MAX;
+        if (IsKeyPressed(KEY_END)) rewindTicks = INT_MAX;
+        if (rewindTicks != 0 && rewindSeconds > 0.0f) {
+            continualUpdate = false;
+            runUntilSettled = false;
+            sim_command_t command = { SIM_REWIND, viewOriginX, viewOriginY };
+            command.rewindTicks = rewindTicks;
+            SubmitSimCommand(&command);
         }
 
+        // Brush radius on the brackets, spray density on minus and equals, P cycles what it
+        // paints over
+        if (IsKeyPressed(KEY_LEFT_BRACKET) && brushRadius > 0) brushRadius--;
+        if (IsKeyPressed(KEY_RIGHT_BRACKET) && brushRadius < BRUSH_MAX_RADIUS) brushRadius++;
+        if (IsKeyPressed(KEY_MINUS)) brushDensity = MaxFloat(brushDensity - 0.1f, 0.1f);
+        if (IsKeyPressed(KEY_EQUAL)) brushDensity = MinFloat(brushDensity + 0.1f, 1.0f);
+        if (IsKeyPressed(KEY_P)) brushPolicy = (brush_policy_t)((brushPolicy + 1) % (BRUSH_REPLACE_SELECTED + 1));
+
+        // Pan at the same on screen speed whatever the zoom
+        float pan = 1000 * GetFrameTime() / camera.zoom;
         if (IsKeyDown(KEY_LEFT)) {
-            player.x -= 1000 * GetFrameTime();
+            player.x -= pan;
         }
         if (IsKeyDown(KEY_RIGHT)) {
-            player.x += 1000 * GetFrameTime();
+            player.x += pan;
         }
         if (IsKeyDown(KEY_UP)) {
-            player.y -= 1000 * GetFrameTime();
+            player.y -= pan;
         }
         if (IsKeyDown(KEY_DOWN)) {
-            player.y += 1000 * GetFrameTime();
+            player.y += pan;
         }
 
+        camera.zoom = Clamp(camera.zoom * (1.0f + 0.1f * GetMouseWheelMove()), 0.5f, 16.0f);
+
+        // Streaming reads ahead along the camera's path
+        Vector2 focus = { player.x + 20.0f, player.y + 20.0f };
+        Vector2 focusVelocity = Vector2Scale(Vector2Subtract(focus, camera.target), 1.0f / MaxFloat(GetFrameTime(), 0.001f));
+
         // Update camera position based on player position
         camera.target = { player.x + 20.0f, player.y + 20.0f };
+        camera.offset = { maxX / 2.0f, maxY / 2.0f };
 
         if (IsKeyPressed(KEY_ENTER)) {
             continualUpdate = !continualUpdate;
         }
 
-        if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+        // Period cycles the fast forward speed, comma fast forwards until nothing moves
+        if (IsKeyPressed(KEY_PERIOD)) {
+            fastForward = (fastForward + 1) % 4;
+        }
+        if (IsKeyPressed(KEY_COMMA)) {
+            runUntilSettled = !runUntilSettled;
+            settleFrameId = frameId + 1;
+        }
+
+        sim_settings_t lastSettings = settings;
+
+        // Toggle between the temperature field and the old random neighbour probing
+        if (IsKeyPressed(KEY_T)) {
+            settings.useTemperature = !settings.useTemperature;
+        }
+
+        // Toggle between smoke as a density field and smoke as particles
+        if (IsKeyPressed(KEY_G)) {
+            settings.useGasField = !settings.useGasField;
+        }
+
+        // Toggle the hydrostatic solver for large bodies of water and oil
+        if (IsKeyPressed(KEY_L)) {
+            settings.useLiquidPressure = !settings.useLiquidPressure;
+        }
+
+        // Toggle reduced update rates for chunks away from the view
+        if (IsKeyPressed(KEY_D) && !lockstep) {
+            settings.useLod = !settings.useLod;
+        }
+
+        // Toggle the frame budget for the sweep, 8 ms unless one was given on the command line
+        if (IsKeyPressed(KEY_B) && recordFile == NULL && !lockstep) {
+            if (settings.frameBudget > 0.0f) {
+                lastFrameBudget = settings.frameBudget;
+                settings.frameBudget = 0.0f;
+            }
+            else {
+                settings.frameBudget = lastFrameBudget;
+            }
+        }
+
+        // Cycle through the sweep, the Margolus block backend and the double buffered backend
+        if (IsKeyPressed(KEY_M)) {
+            settings.backend = (sim_backend_t)((settings.backend + 1) % (BACKEND_DOUBLE_BUFFER + 1));
+        }
+
+        if (memcmp(&settings, &lastSettings, sizeof(sim_settings_t)) != 0) {
+            sim_command_t command = { SIM_SETTINGS, viewOriginX, viewOriginY };
+            command.settings = settings;
+            SubmitSimCommand(&command);
+        }
+
+        if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
             doUpdate = true;
         }
 
-		// Insert a sand particle wherever the mouse is pressed
-		Vector2 mouse = GetMousePosition();
-
-        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-            mousePosLastFrame = GetScreenToWorld2D(mouse, camera);
-            mousePosLastFrame.x = WIDTH * ((int)mousePosLastFrame.x) / GetScreenWidth();
-            mousePosLastFrame.y = HEIGHT * ((int)mousePosLastFrame.y) / GetScreenHeight();
-        }
-        else if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-            Vector2 nextPos = GetScreenToWorld2D(mouse, camera);
-            nextPos.x = WIDTH * ((int)nextPos.x) / GetScreenWidth();
-            nextPos.y = HEIGHT * ((int)nextPos.y) / GetScreenHeight();
-            //fprintf(stdout, "{%f:%f} -> {%f:%f}\n", mousePosLastFrame.x, mousePosLastFrame.y, nextPos.x, nextPos.y);
-            SpawnParticles(grid, mousePosLastFrame, nextPos, currentMaterial);
-            mousePosLastFrame = nextPos;
-        }
-
-        int start, end, step;
-        if (frameCounter % 2 == 0) { // Left to right on even frames
-			start = 0;
-			end = WIDTH;
-			step = 1;
-		} else { // Right to left on odd frames
-			start = WIDTH - 1;
-			end = -1;
-			step = -1;
-		}
+		// Paint with the left button and erase with the right one. Every frame the brush
+        // sweeps from where the mouse was to where it is, so fast strokes have no gaps
+		Vector2 mouse = GetScreenToWorld2D(GetMousePosition(), camera);
+        mouse = { floorf(mouse.x), floorf(mouse.y) };
 
-        if (doUpdate || continualUpdate) {
-            doUpdate = false;
-			for (int x = start; x != end; x += step) {
-				for (int y = HEIGHT - 1; y >= 0; y--) {
-					particle_t* p = GetParticle(grid, x, y);
-					if (p != NULL) {
-						switch (props[p->mat].type) {
-						case SOLID:
-							UpdateSolidParticle(grid, x, y);
-							break;
-						case LIQUID:
-							UpdateLiquidParticle(grid, x, y);
-							break;
-						case GAS:
-							UpdateGasParticle(grid, x, y);
-							break;
-						case SOLID_STUCK:
-							UpdateSolidStuckParticle(grid, x, y);
-							break;
-						}
-					}
-				}
-			}
+        if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) || IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
+            mousePosLastFrame = mouse;
+            SubmitHistoryCommand(SIM_CHECKPOINT, viewOriginX, viewOriginY);
+        }
+        if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+            //fprintf(stdout, "{%f:%f} -> {%f:%f}\n", mousePosLastFrame.x, mousePosLastFrame.y, mouse.x, mouse.y);
+            sim_command_t command = { SIM_EDIT, viewOriginX, viewOriginY };
+            command.edit = { EDIT_LINE, (int)mousePosLastFrame.x, (int)mousePosLastFrame.y, (int)mouse.x, (int)mouse.y, brushRadius };
+            command.edit.seed = editSeed++;
+
+            if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+                command.edit.mat = currentMaterial;
+                command.edit.density = brushDensity;
+                if (brushPolicy == BRUSH_FILL) command.edit.targets = EDIT_EMPTY;
+                else if (brushPolicy == BRUSH_REPLACE) command.edit.targets = EDIT_ANY;
+                else command.edit.targets = brushSelected;
+            }
+            else {
+                command.edit.mat = NOTHING;
+                command.edit.density = 1.0f;
+                command.edit.targets = (brushPolicy == BRUSH_REPLACE_SELECTED) ? brushSelected : EDIT_ANY;
+            }
+            SubmitSimCommand(&command);
+            mousePosLastFrame = mouse;
+        }
+
+        // Drag with the middle button to fill a rectangle
+        if (IsMouseButtonPressed(MOUSE_BUTTON_MIDDLE)) {
+            rectangleStart = mouse;
+        }
+        else if (IsMouseButtonReleased(MOUSE_BUTTON_MIDDLE)) {
+            SubmitHistoryCommand(SIM_CHECKPOINT, viewOriginX, viewOriginY);
+            sim_command_t command = { SIM_EDIT, viewOriginX, viewOriginY };
+            command.edit = { EDIT_RECT, (int)rectangleStart.x, (int)rectangleStart.y, (int)mouse.x, (int)mouse.y, 0, currentMaterial, EDIT_EMPTY, 1.0f };
+            SubmitSimCommand(&command);
+        }
+
+        // Swap the region under the cursor, everything connected holding the same material,
+        // for the current material
+        if (IsKeyPressed(KEY_F)) {
+            SubmitHistoryCommand(SIM_CHECKPOINT, viewOriginX, viewOriginY);
+            sim_command_t command = { SIM_EDIT, viewOriginX, viewOriginY };
+            command.edit = { EDIT_FLOOD, (int)mouse.x, (int)mouse.y, 0, 0, 0, currentMaterial, EDIT_ANY, 1.0f };
+            SubmitSimCommand(&command);
+        }
+
+        // F5 saves the world, compressed with shift held, F9 loads it back
+        if (IsKeyPressed(KEY_F5)) {
+            SubmitFileCommand(SIM_SAVE, worldFile, IsKeyDown(KEY_LEFT_SHIFT), viewOriginX, viewOriginY);
+        }
+        if (IsKeyPressed(KEY_F9)) {
+            SubmitFileCommand(SIM_LOAD, worldFile, false, viewOriginX, viewOriginY);
+        }
+
+        // F6 writes the world as an image, a palette colour for each material
+        if (IsKeyPressed(KEY_F6)) {
+            SubmitFileCommand(SIM_EXPORT, exportFile, false, viewOriginX, viewOriginY);
+        }
+
+        // Hand the camera to the simulation, it ticks while this frame is drawn
+        Vector2 viewMin = GetScreenToWorld2D({ 0, 0 }, camera);
+        Vector2 viewMax = GetScreenToWorld2D({ (float)maxX, (float)maxY }, camera);
+
+        sim_command_t frame = { SIM_FRAME, viewOriginX, viewOriginY };
+        frame.frame.view = { viewMin.x, viewMin.y, viewMax.x - viewMin.x, viewMax.y - viewMin.y };
+        frame.frame.focus = focus;
+        frame.frame.velocity = focusVelocity;
+        frame.frame.dt = (recordFile != NULL || lockstep) ? FIXED_DT : GetFrameTime();
+        frame.frame.id = ++frameId;
+        if (runUntilSettled) {
+            frame.frame.fastForwardMs = FAST_FORWARD_MS;
+            frame.frame.untilSettled = true;
+        }
+        else if (continualUpdate) {
+            frame.frame.ticks = fastForwardTicks[fastForward];
+            if (frame.frame.ticks == 0) frame.frame.fastForwardMs = FAST_FORWARD_MS;
+        }
+        else if (doUpdate) {
+            frame.frame.ticks = 1;
+        }
+        doUpdate = false;
+        SubmitSimCommand(&frame);
+
+        // Newest finished tick. When streaming moved the window everything in cells moves with it
+        const render_snapshot_t* snapshot = AcquireSnapshot();
+        if (snapshot != NULL && (snapshot->originX != viewOriginX || snapshot->originY != viewOriginY)) {
+            Vector2 shift = { (float)((snapshot->originX - viewOriginX) * CHUNK_SIZE), (float)((snapshot->originY - viewOriginY) * CHUNK_SIZE) };
+            player.x -= shift.x;
+            player.y -= shift.y;
+            mousePosLastFrame = Vector2Subtract(mousePosLastFrame, shift);
+            camera.target = Vector2Subtract(camera.target, shift);
+            viewOriginX = snapshot->originX;
+            viewOriginY = snapshot->originY;
+        }
+
+        // A replay shows what was recorded, the camera follows the view it was recorded with
+        if (snapshot != NULL && snapshot->replay.playing) {
+            camera.target = { snapshot->view.x + snapshot->view.width / 2.0f, snapshot->view.y + snapshot->view.height / 2.0f };
+            camera.zoom = Clamp(maxX / MaxFloat(snapshot->view.width, 1.0f), 0.5f, 16.0f);
+            player.x = camera.target.x - 20.0f;
+            player.y = camera.target.y - 20.0f;
+        }
+
+        // Settled once a snapshot taken after the request has nothing left awake
+        if (runUntilSettled && snapshot != NULL && snapshot->frameId >= settleFrameId && snapshot->awakeChunks == 0) {
+            runUntilSettled = false;
         }
 
         // Draw
         //----------------------------------------------------------------------------------
-        // Draw everything in the render texture, note this will not be rendered on screen, yet
+        // Render targets follow the window so the camera maps the same way in both
+        if (target.texture.width != maxX || target.texture.height != maxY) {
+            UnloadRenderTexture(target);
+            UnloadRenderTexture(noBloom);
+            UnloadRenderTexture(bloomTarget);
+            target = LoadRenderTexture(maxX, maxY);
+            noBloom = LoadRenderTexture(maxX, maxY);
+            bloomTarget = LoadRenderTexture(maxX, maxY);
+            SetTextureFilter(target.texture, TEXTURE_FILTER_POINT | TEXTURE_WRAP_CLAMP);
+            SetTextureFilter(bloomTarget.texture, TEXTURE_WRAP_CLAMP);
+        }
 
+        // Draw everything in the render texture, note this will not be rendered on screen, yet
         BeginTextureMode(target);
-			ClearBackground(BLACK);
-            int j = 0;
-            for (int i = 0; i < WIDTH * HEIGHT - 1; i++) {
-                if (i % WIDTH == 0) {
-                    j++;
-                }
-				particle_t* p = grid[i];
-				if (p != NULL) {
-				    p->hasBeenUpdated = false;
+            ClearBackground(RAYWHITE);
 
-					DrawPixel(i % WIDTH, j, p->color);
+            BeginMode2D(camera);
+                if (snapshot != NULL) {
+                    DrawWorld(snapshot);
 
-                    /*
-					if (p->stuck) {
-						DrawPixel(i % WIDTH, j, GREEN);
-					}
-					else {
-						if (p->velocity.x > 0) {
-							DrawPixel(i % WIDTH, j, RED);
-						}
-						else if (p->velocity.x < 0) {
-							DrawPixel(i % WIDTH, j, BLUE);
-						}
-						else {
-							DrawPixel(i % WIDTH, j, WHITE);
-						}
-					}
-                    */
+                    if (snapshot->gasField) {
+                        DrawGasField(snapshot->gasPixels);
+                    }
                 }
-            }
+            EndMode2D();
         EndTextureMode();
 
         BeginTextureMode(bloomTarget);
@@ -344,37 +750,76 @@ int main(void)
                 //DrawTextureRec(target.texture, (Rectangle){ 0, 0, (float)target.texture.width, (float)-target.texture.height }, (Vector2){ 0, 0 }, WHITE);
 				DrawTexturePro(target.texture,
 				   {0, 0, (float)target.texture.width, (float)target.texture.height}, // Use correct dimensions
-				   {0, 0, 1280, 800}, // Ensure it covers the full screen
+				   {0, 0, (float)bloomTarget.texture.width, (float)bloomTarget.texture.height}, // Ensure it covers the full screen
 				   {0, 0}, 0.0f, WHITE);
 			EndShaderMode();
 		EndTextureMode();
         
         int fps = GetFPS();
-        sprintf(fpsText, "%d - %d p - %d u\0", fps, updatedParticles, actuallyUpdatedParticles);
         BeginDrawing();
             ClearBackground(RAYWHITE);     // Clear screen background
 
-            BeginMode2D(camera);
-				/* DrawTexturePro(bloomTarget.texture,
-							   (Rectangle){0, 0, bloomTarget.texture.width, bloomTarget.texture.height},
-							   (Rectangle){0, 0, GetScreenWidth(), GetScreenHeight()},
-							   (Vector2){0, 0}, 0.0f, WHITE);
-							   */
+			/* DrawTexturePro(bloomTarget.texture,
+						   (Rectangle){0, 0, bloomTarget.texture.width, bloomTarget.texture.height},
+						   (Rectangle){0, 0, GetScreenWidth(), GetScreenHeight()},
+						   (Vector2){0, 0}, 0.0f, WHITE);
+						   */
 
-                
-				DrawTexturePro(target.texture,
-							   {0, 0, (float)target.texture.width, (float) - target.texture.height},
-							   {0, 0, (float)GetScreenWidth(), (float)GetScreenHeight() },
-							   {0, 0}, 0.0f, WHITE);
+			DrawTexturePro(target.texture,
+						   {0, 0, (float)target.texture.width, (float) - target.texture.height},
+						   {0, 0, (float)GetScreenWidth(), (float)GetScreenHeight() },
+						   {0, 0}, 0.0f, WHITE);
 
+            BeginMode2D(camera);
                 for (int i = -1000; i < 1000; i += 50) DrawText("A", i, 0, 14, ORANGE);
                 DrawRectangleRec(player, RED);
             EndMode2D();
-            DrawText(fpsText, 5, 5, 14, BLACK);
+            if (snapshot != NULL) {
+                memory_stats_t memory = snapshot->memory;
+                sprintf(fpsText, "%d - %d p - %d u - tick %.1f ms\0", fps, snapshot->updatedParticles,
+                        snapshot->actuallyUpdatedParticles, snapshot->tickMs);
+                DrawText(fpsText, 5, 5, 14, BLACK);
+                DrawText(TextFormat("%.1f MB particles - %.1f MB packed in %d chunks - %.1f MB grid",
+                                    memory.particleBytes / (1024.0f * 1024.0f), memory.packedBytes / (1024.0f * 1024.0f),
+                                    memory.packedChunks, memory.gridBytes / (1024.0f * 1024.0f)), 5, 22, 14, BLACK);
+                DrawText(TextFormat("brush %d - %d%% - %s", brushRadius, (int)(brushDensity * 100.0f + 0.5f),
+                                    brushPolicyNames[brushPolicy]), 5, 73, 14, BLACK);
+                if (runUntilSettled || fastForward > 0) {
+                    DrawText(TextFormat("%s - %d ticks per frame - %d chunks awake", runUntilSettled ? "settling" : "fast forward",
+                                        snapshot->frameTicks, snapshot->awakeChunks), 5, 90, 14, BLACK);
+                }
+                if (settings.frameBudget > 0.0f) {
+                    budget_stats_t budget = snapshot->budget;
+                    DrawText(TextFormat("budget %.1f / %.1f ms - %d chunks run - %d put off (%d ticks owed, longest %d frames)",
+                                        budget.usedMs, settings.frameBudget, budget.ranChunks, budget.deferredChunks,
+                                        budget.owedTicks, budget.maxWait), 5, 56, 14, BLACK);
+                }
+                if (rewindSeconds > 0.0f) {
+                    rewind_stats_t rewind = snapshot->rewind;
+                    DrawText(TextFormat("rewind %.1f / %.1f s - tick %u (%d) - %.1f MB", rewind.seconds, rewindSeconds,
+                                        rewind.tick, (int)(rewind.tick - rewind.lastTick), rewind.bytes / (1024.0f * 1024.0f)),
+                             5, 107, 14, BLACK);
+                }
+                if (snapshot->replay.playing) {
+                    DrawText(TextFormat("replay %u / %u steps", snapshot->replay.step, snapshot->replay.steps), 5, 124, 14, BLACK);
+                }
+                else if (snapshot->replay.recording) {
+                    DrawText(TextFormat("recording - %u steps", snapshot->replay.step), 5, 124, 14, BLACK);
+                }
+                if (snapshot->lockstep.active) {
+                    lockstep_stats_t shared = snapshot->lockstep;
+                    DrawText(TextFormat("player %d of %d - tick %u - delay %d - %.1f KB/s in, %.1f out - %u stalls - %u desyncs, %u chunks resent",
+                                        shared.player + 1, shared.players, shared.tick, shared.inputDelay, shared.inKBps, shared.outKBps,
+                                        shared.stalls, shared.desyncs, shared.resyncedChunks), 5, 141, 14, BLACK);
+                }
+                if (useStreaming) {
+                    stream_stats_t stream = snapshot->stream;
+                    DrawText(TextFormat("chunk %d, %d - %u in - %u out - %u stalls - %u read ahead (%.1f MB)",
+                                        snapshot->originX, snapshot->originY, stream.pageIns, stream.pageOuts, stream.stalls,
+                                        stream.readAheads, stream.readAheadBytes / (1024.0f * 1024.0f)), 5, 39, 14, BLACK);
+                }
+            }
         EndDrawing();
-
-        updatedParticles = 0;
-        actuallyUpdatedParticles = 0;
     }
 #endif
 
@@ -382,6 +827,29 @@ int main(void)
     //--------------------------------------------------------------------------------------
     //
     UnloadRenderTexture(target);
+    UnloadRenderTexture(noBloom);
+    UnloadRenderTexture(bloomTarget);
+    UnloadSimThread();
+    UnloadReplay();
+    UnloadLockstep();
+    UnloadPartition();
+    UnloadAutosave(grid);
+    UnloadWorldExport();
+    UnloadTemperature();
+    UnloadGasField();
+    UnloadLiquidPressure();
+    UnloadMargolus();
+    UnloadDoubleBuffer();
+    UnloadWorkers();
+    UnloadStreaming();
+    UnloadWorldFile();
+    UnloadWorldImage();
+    UnloadCompression();
+    UnloadEdits();
+    UnloadHistory();
+    UnloadRewind();
+    free(grid);
+    UnloadWorld();
 
     UnloadShader(shader);
 
@@ -394,44 +862,85 @@ int main(void)
 }
 
 
-static int GetIndex(int x, int y) {
-    return y * WIDTH + x;
-}
-
-static particle_t* GetParticle(particle_t* grid[HEIGHT * WIDTH], int x, int y) {
-    return grid[y * WIDTH + x];
-}
-
-static void SpawnParticles(particle_t** grid, Vector2 from, Vector2 to, particle_mat_t mat) {
+// One tick of the whole world, view is the visible part of it in cells and dt the time it covers
+void TickWorld(particle_t** grid, Rectangle view, float dt) {
+    sim->frameCounter = (sim->frameCounter + 1) % INT_MAX;
+    sim->updatedParticles = 0;
+    sim->actuallyUpdatedParticles = 0;
+
+    int start, end, step;
+    if (sim->frameCounter % 2 == 0) { // Left to right on even ticks
+        start = 0;
+        end = WIDTH;
+        step = 1;
+    } else { // Right to left on odd ticks
+        start = WIDTH - 1;
+        end = -1;
+        step = -1;
+    }
 
-    if (props[mat].type != SOLID_STUCK) {
+    BeginWorldTick();
+    UpdateCompression(grid);
+    ScheduleChunks(view);
 
-        FillGapsWithParticle(grid, from.x, from.y, to.x, to.y, mat);
-        /*
-		for (int i = -15; i < 16; i++) {
-			for (int j = -15; j < 16; j++) {
-				if (Vector2Distance((Vector2){from.x + i, from.y + j}, (Vector2){to.x, to.y}) < 8) {
-                    //fprintf
-					FillGapsWithParticle(grid, to.x + i, to.y + j, from.x + i, from.y + j, mat);
-				}
-			}
-		}
-        */ 
+    if (sim->backend == BACKEND_MARGOLUS) {
+        UpdateMargolus(grid);
+    }
+    else if (sim->backend == BACKEND_DOUBLE_BUFFER) {
+        UpdateDoubleBuffer(grid);
+    }
+    else if (sim->frameBudget <= 0.0f) {
+        for (int x = start; x != end; x += step) {
+            // Same column order as a full sweep, chunks that don't run this tick are skipped
+            for (int cy = sim->chunksY - 1; cy >= 0; cy--) {
+                int c = cy * sim->chunksX + (x >> CHUNK_SHIFT);
+                if (!sim->chunkRun[c]) continue;
+                sim->sweepSteps = sim->chunkRun[c];
+                sim->sweepDt = dt * sim->sweepSteps;
+
+                for (int y = (cy + 1) * CHUNK_SIZE - 1; y >= cy * CHUNK_SIZE; y--) {
+                    UpdateParticle(grid, x, y);
+                }
+            }
+        }
     }
     else {
-		for (int i = -10; i < 10; i++) {
-			for (int j = -10; j < 10; j++) {
+        // Chunk by chunk in priority order until the frame budget is spent
+        BeginChunkBudget();
+
+        int cx, cy;
+        while (NextBudgetChunk(&cx, &cy)) {
+            sim->sweepSteps = sim->chunkRun[cy * sim->chunksX + cx];
+            sim->sweepDt = dt * sim->sweepSteps;
+
+            for (int n = 0; n < CHUNK_SIZE; n++) {
+                int x = cx * CHUNK_SIZE + ((step > 0) ? n : CHUNK_SIZE - 1 - n);
+                for (int y = (cy + 1) * CHUNK_SIZE - 1; y >= cy * CHUNK_SIZE; y--) {
+                    UpdateParticle(grid, x, y);
+                }
+            }
+        }
+    }
 
-				if (Vector2Distance({to.x + i, to.y + j}, {from.x + i, from.y + j}) < 8) {
-					FillGapsWithParticle(grid, from.x + i, from.y + j, to.x + i, to.y + j, mat);
-					//grid[(y + j) * WIDTH + x + i] = CreateParticle(mat);
-				}
-			}
-		}
+    if (sim->useTemperature) {
+        UpdateTemperature(grid, dt);
     }
+    if (sim->useGasField) {
+        UpdateGasField(grid, dt);
+    }
+    if (sim->useLiquidPressure) {
+        UpdateLiquidPressure(grid);
+    }
+
+    EndWorldTick(grid);
+    EndRewindTick(grid, dt);
 }
 
-static particle_t* CreateParticle(particle_mat_t material) {
+particle_t* GetParticle(particle_t** grid, int x, int y) {
+    return grid[GetIndex(x, y)];
+}
+
+particle_t* CreateParticle(particle_mat_t material) {
 
     particle_t* newParticle = (particle_t*) malloc(sizeof(particle_t));
 
@@ -439,23 +948,29 @@ static particle_t* CreateParticle(particle_mat_t material) {
         perror("Failed to allocate memory for new particle");
         exit(1);
     }
+    InitParticle(newParticle, material);
+    return newParticle;
+}
+
+// Reset a particle to a fresh one of the given material, edits reuse particles this way
+void InitParticle(particle_t* newParticle, particle_mat_t material) {
     newParticle->mat = material;
-    if (props[material].decaying) {
-        newParticle->lifeTime = props[material].initLifeTime;
+    if (sim->props[material].decaying) {
+        newParticle->lifeTime = sim->props[material].initLifeTime;
     }
     newParticle->hasBeenUpdated = false;
-    if ((props[material].type == SOLID_STUCK || props[material].type == SOLID) && material != FIRE) {
+    if ((sim->props[material].type == SOLID_STUCK || sim->props[material].type == SOLID) && material != FIRE) {
         // Scramble colors a bit
-        newParticle->color = props[material].initialColor;
-        int num = rand();
+        newParticle->color = sim->props[material].initialColor;
+        int num = SimRandom();
         newParticle->color.b += (-10 + num % 20);
         newParticle->color.g += (-10 + num % 20);
         newParticle->color.r += (-10 + num % 20);
     }
     else {
-        newParticle->color = props[material].initialColor;
+        newParticle->color = sim->props[material].initialColor;
     }
-    if (props[material].type == LIQUID) {
+    if (sim->props[material].type == LIQUID) {
 		newParticle->velocity.x = 0.0f;
 		newParticle->velocity.y = 3.0f;
     }
@@ -464,10 +979,28 @@ static particle_t* CreateParticle(particle_mat_t material) {
 		newParticle->velocity.y = 0.0f;
     }
     newParticle->stuck = false;
-    return newParticle;
 }
 
-static void SwapParticles(particle_t* grid[HEIGHT * WIDTH], int x1, int y1, int x2, int y2) {
+// Xorshift, the simulation's own so its state can be saved and restored
+int SimRandom(void) {
+    sim->randomState ^= sim->randomState << 13;
+    sim->randomState ^= sim->randomState >> 17;
+    sim->randomState ^= sim->randomState << 5;
+    return (int)(sim->randomState >> 1);
+}
+
+// Smoke goes into the gas field when it is enabled, otherwise it becomes a particle
+static void EmitSmoke(particle_t** grid, int x, int y) {
+    if (sim->useGasField) {
+        AddGasDensity(x, y, 1.0f);
+    }
+    else {
+        grid[GetIndex(x, y)] = CreateParticle(SMOKE);
+        WakeCell(x, y);
+    }
+}
+
+static void SwapParticles(particle_t** grid, int x1, int y1, int x2, int y2) {
     int i = GetIndex(x2, y2);
     int j = GetIndex(x1, y1);
     grid[i]->hasBeenUpdated = true;
@@ -476,45 +1009,7 @@ static void SwapParticles(particle_t* grid[HEIGHT * WIDTH], int x1, int y1, int
     grid[i] = grid[j];
     grid[j] = tmp;
     tmp->velocity.y = -0.1;
-    tmp->velocity.x = (x1 < x2) ? props[tmp->mat].maxX : -props[tmp->mat].maxX;
-}
-
-static void FillGapsWithParticle(particle_t** grid, int x0, int y0, int x1, int y1, particle_mat_t mat) {
-
-    int x = x0, ax = x0;
-    int y = y0, ay = y0;
-
-	int dx =  abs (x1 - x0), sx = (x0 < x1) ? 1 : -1;
-	int dy = -abs (y1 - y0), sy = (y0 <= y1) ? 1 : -1; 
-	int err = dx + dy, e2; /* error value e_xy */
-
-    for (;;) {
-
-		if (x == x1 && y == y1) break;
-		e2 = 2 * err;
-
-		if (x != x1 && e2 >= dy) { 
-            err += dy;
-            x += sx;
-			// If not blocked, continue
-			if (x < 0 || x >= WIDTH) {
-				break;
-			}
-			ax = x;
-            grid[GetIndex(x, y)] = CreateParticle(mat);
-        } /* e_xy+e_x > 0 */
-
-	    if (y != y1 && e2 <= dx) {
-            err += dx;
-            y += sy;
-			// If not blocked, continue
-			if (y < 0 || y >= HEIGHT ) {
-                break;
-            }
-			ay = y;
-            grid[GetIndex(x, y)] = CreateParticle(mat);
-        } /* e_xy+e_y < 0 */
-	}
+    tmp->velocity.x = (x1 < x2) ? sim->props[tmp->mat].maxX : -sim->props[tmp->mat].maxX;
 }
 
 static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y0, int dx, int dy, mat_prop_t* mat) {
@@ -529,7 +1024,7 @@ static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y
     dy = -abs(dy);
 	int err = dx + dy, e2 = 0; /* error value e_xy */
 
-    for (int a = 0; a < 5; a++) {  /* loop */
+    for (int a = 0; a < 5 * sim->sweepSteps; a++) {  /* loop */
 
         // Found target
         if (x == tx && y == ty) {
@@ -547,7 +1042,7 @@ static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y
 			}
             else if (GetParticle(grid, x, y) != NULL) {
                 // Liquids should move through gasses
-                if (props[GetParticle(grid, x, y)->mat].type > mat->type) {
+                if (sim->props[GetParticle(grid, x, y)->mat].type > mat->type) {
                     // Fall through
                     SwapParticles(grid, ax, y, x, y);
                 }
@@ -563,7 +1058,7 @@ static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y
 						grid[GetIndex(ax, ay)] = NULL;
 					}
                     // Check if the particle was a of a gas type
-					else if(props[grid[GetIndex(x, y)]->mat].type > mat->type) {
+					else if(sim->props[grid[GetIndex(x, y)]->mat].type > mat->type) {
 						// Check if we can move in y dir before breaking
 						SwapParticles(grid, ax, ay, x, y);
                     }
@@ -591,7 +1086,7 @@ static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y
                 break;
             }
             else if (grid[GetIndex(x, y)] != NULL) {
-                if (props[grid[GetIndex(x,y)]->mat].type > mat->type) {
+                if (sim->props[grid[GetIndex(x,y)]->mat].type > mat->type) {
                     // Fall through
                     SwapParticles(grid, x, ay, x, y);
                 }
@@ -607,7 +1102,7 @@ static Vector2Int TranslateParticleWithMaterial(particle_t** grid, int x0, int y
 						grid[GetIndex(ax, ay)] = NULL;
 						ax = x;
 					}
-					else if(props[grid[GetIndex(x, y)]->mat].type > mat->type) {
+					else if(sim->props[grid[GetIndex(x, y)]->mat].type > mat->type) {
 						// Check if we can move in x dir before breaking
 						SwapParticles(grid, ax, ay, x, y);
 						ax = x;
@@ -714,15 +1209,15 @@ static Vector2Int TranslateParticle(particle_t** grid, int x, int y, int x1, int
     return { ax, ay };
 }
 
-static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, int y) {
+static void UpdateSolidStuckParticle(particle_t** grid, int x, int y) {
     particle_t* p = GetParticle(grid, x, y);
 
     if (p == NULL || p->hasBeenUpdated) return;
 
-    float dt = GetFrameTime();
-    mat_prop_t mat = props[p->mat];
+    float dt = sim->sweepDt;
+    mat_prop_t mat = sim->props[p->mat];
 
-    int randNum = rand();
+    int randNum = SimRandom();
 
     if (mat.decaying && randNum % 10 < 4) {
 		p->lifeTime -= dt;
@@ -734,7 +1229,7 @@ static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, in
 		if (p->lifeTime <= 0) {
 			grid[GetIndex(x, y)] = NULL;
             if (p->mat == FIRE) {
-                grid[GetIndex(x, y)] = CreateParticle(SMOKE);
+                EmitSmoke(grid, x, y);
             }
 			free(p);
 
@@ -742,22 +1237,22 @@ static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, in
 		}
     }
 
-    if (mat.acting) {
+    if (mat.acting && !sim->useTemperature) {
         if (p->mat == FIRE) {
             // Look for flammable stuff
 
             int i = GetIndex(x, y);
 
-            if (grid[i + WIDTH] != NULL && props[grid[i + WIDTH]->mat].flammable && randNum % 100 < props[grid[i + WIDTH]->mat].flammableProbability) {
+            if (grid[i + STRIDE] != NULL && sim->props[grid[i + STRIDE]->mat].flammable && randNum % 100 < sim->props[grid[i + STRIDE]->mat].flammableProbability) {
                 particle_mat_t someMat = grid[GetIndex(x, y + 1)]->mat;
 
                 if (someMat != WATER) {
-                    free(grid[i + WIDTH]);
-                    grid[i + WIDTH] = CreateParticle(FIRE);
+                    free(grid[i + STRIDE]);
+                    grid[i + STRIDE] = CreateParticle(FIRE);
                 }
             }
-            else if (grid[i - WIDTH] != NULL && props[grid[i - WIDTH]->mat].flammable && randNum % 100 < props[grid[i - WIDTH]->mat].flammableProbability) {
-                int temp = i - WIDTH;
+            else if (grid[i - STRIDE] != NULL && sim->props[grid[i - STRIDE]->mat].flammable && randNum % 100 < sim->props[grid[i - STRIDE]->mat].flammableProbability) {
+                int temp = i - STRIDE;
                 particle_mat_t someMat = grid[temp]->mat;
 
                 if (someMat == WATER) {
@@ -771,7 +1266,7 @@ static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, in
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            else if (grid[i + 1] != NULL && props[grid[i + 1]->mat].flammable && randNum % 100 < props[grid[i + 1]->mat].flammableProbability) {
+            else if (grid[i + 1] != NULL && sim->props[grid[i + 1]->mat].flammable && randNum % 100 < sim->props[grid[i + 1]->mat].flammableProbability) {
                 int temp = i + 1;
                 particle_mat_t someMat = grid[temp]->mat;
 
@@ -786,7 +1281,7 @@ static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, in
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            else if (grid[i - 1] != NULL && props[grid[i - 1]->mat].flammable && randNum % 100 < props[grid[i - 1]->mat].flammableProbability) {
+            else if (grid[i - 1] != NULL && sim->props[grid[i - 1]->mat].flammable && randNum % 100 < sim->props[grid[i - 1]->mat].flammableProbability) {
                 int temp = i - 1;
                 particle_mat_t someMat = grid[temp]->mat;
 
@@ -801,12 +1296,46 @@ static void UpdateSolidStuckParticle(particle_t* grid[HEIGHT * WIDTH], int x, in
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            else if (randNum % 15 == 0 && grid[i - WIDTH] == NULL) {
+            else if (randNum % 15 == 0 && grid[i - STRIDE] == NULL) {
                 // Emit smoke
-                grid[i - WIDTH] = CreateParticle(SMOKE);
+                EmitSmoke(grid, x, y - 1);
             }
         }
     }
+    else if (mat.acting && p->mat == FIRE) {
+        // Ignition is handled by the temperature field, fire only has to smoke
+        int i = GetIndex(x, y);
+        if (y > 0 && randNum % 15 == 0 && grid[i - STRIDE] == NULL) {
+            EmitSmoke(grid, x, y - 1);
+        }
+    }
+}
+
+static void UpdateParticle(particle_t** grid, int x, int y) {
+    particle_t* p = GetParticle(grid, x, y);
+    if (p == NULL) return;
+
+    // Burning and decaying particles change every tick on their own
+    if (sim->props[p->mat].decaying || sim->props[p->mat].acting) {
+        WakeCell(x, y);
+    }
+
+    switch (sim->props[p->mat].type) {
+    case SOLID:
+        UpdateSolidParticle(grid, x, y);
+        break;
+    case LIQUID:
+        // Interior cells of a pool are left to the pressure solver
+        if (sim->useLiquidPressure && IsPressureLiquid(p->mat) && IsInteriorLiquid(grid, x, y)) break;
+        UpdateLiquidParticle(grid, x, y);
+        break;
+    case GAS:
+        UpdateGasParticle(grid, x, y);
+        break;
+    case SOLID_STUCK:
+        UpdateSolidStuckParticle(grid, x, y);
+        break;
+    }
 }
 
 static void UpdateSolidParticle(particle_t** grid, int x, int y) {
@@ -815,44 +1344,38 @@ static void UpdateSolidParticle(particle_t** grid, int x, int y) {
 
     if (p == NULL || p->hasBeenUpdated) return;
 
-    int i = GetIndex(x, y);
-
-    float dt = GetFrameTime();
-    mat_prop_t mat = props[p->mat];
+    float dt = sim->sweepDt;
+    mat_prop_t mat = sim->props[p->mat];
     
     if (y < HEIGHT - 1) {
         p->stuck = false;
-        int temp = i + WIDTH;
         Vector2Int v = {x, y};
 
-        if (grid[temp] == NULL || props[grid[temp]->mat].type > SOLID) {
+        int mask = NeighbourMask(grid, x, y, SOLID, NB_DOWN_LEFT | NB_DOWN | NB_DOWN_RIGHT);
+        int move = solidMoves[mask][p->velocity.x < 0];
+
+        switch (move & ~MOVE_BOTH_OPEN) {
+        case MOVE_DOWN:
             p->velocity.x = Clamp(p->velocity.x * (dt * 5), -mat.maxX, mat.maxX);
-            p->velocity.y = Clamp(p->velocity.y + (gravity * dt), -mat.maxY, mat.maxY);
-            v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x, p->velocity.y, &mat);
-        }
-        // Down Right
-        else if (x < WIDTH - 1 && (grid[temp + 1] == NULL || props[grid[temp + 1]->mat].type > SOLID)) {
-            // Down Left
-            if (x > 0 && grid[temp - 1] == NULL || props[grid[temp-1]->mat].type > SOLID) {
-                // Boost x velocity
-                p->velocity.y *= 0.8; // Makes sure that we don't end up with a bunch of large tips
-                p->velocity.x = Clamp(p->velocity.x + (2.0f * dt * (p->velocity.x < 0 ? -1 : 1)), -mat.maxX, mat.maxX);
-                v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x, p->velocity.y, &mat);
-            }
-            else {
-                //p->velocity.y *= 0.8;
-                p->velocity.x = Clamp(p->velocity.x + (2.0f * dt), 0, mat.maxX);
-                v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x, p->velocity.y, &mat);
-            }
-        }
-        // Left
-        else if (x > 0 && (grid[temp - 1] == NULL || props[grid[temp-1]->mat].type > SOLID)) {
-            //p->velocity.y *= 0.8;
+            p->velocity.y = Clamp(p->velocity.y + (sim->gravity * dt), -mat.maxY, mat.maxY);
+            break;
+        case MOVE_DOWN_RIGHT:
+            if (move & MOVE_BOTH_OPEN) p->velocity.y *= 0.8; // Makes sure that we don't end up with a bunch of large tips
+            p->velocity.x = Clamp(p->velocity.x + (2.0f * dt), 0, mat.maxX);
+            break;
+        case MOVE_DOWN_LEFT:
+            if (move & MOVE_BOTH_OPEN) p->velocity.y *= 0.8;
             p->velocity.x = Clamp(p->velocity.x + (-2.0f * dt), -mat.maxX, 0);
-            v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x, p->velocity.y, &mat);
+            break;
+        default:
+            return;
         }
+
+        v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x * sim->sweepSteps, p->velocity.y * sim->sweepSteps, &mat);
         if (v.x != x || v.y != y) {
             p->hasBeenUpdated = true;
+            WakeCell(x, y);
+            WakeCell(v.x, v.y);
         }
     }
 }
@@ -862,12 +1385,12 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
 
     if (p == NULL || p->hasBeenUpdated) return;
 
-    updatedParticles++;
+    sim->updatedParticles++;
 
-    float dt = GetFrameTime();
-    int randNum = rand();
+    float dt = sim->sweepDt;
+    int randNum = SimRandom();
 
-    mat_prop_t mat = props[p->mat];
+    mat_prop_t mat = sim->props[p->mat];
 
     /*
     if (randNum % 10 < 4) {
@@ -894,33 +1417,33 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
     }
     */
 
-    p->velocity.y = Clamp(p->velocity.y + (0.8f * gravity * dt), -mat.maxY, mat.maxY);
+    p->velocity.y = Clamp(p->velocity.y + (0.8f * sim->gravity * dt), -mat.maxY, mat.maxY);
     if (y < HEIGHT) {
         p->stuck = false;
         Vector2Int v = {x, y};
 
+        int mask = NeighbourMask(grid, x, y, LIQUID, NB_DOWN | NB_LEFT | NB_RIGHT);
+
 		// Check down
-		if (CheckValidMove(grid, x, y + 1, LIQUID)) {
+		if (mask & NB_DOWN) {
 		    //p->velocity.y = Clamp(p->velocity.y + (gravity * dt), -mat.maxY, -mat.maxY);
             p->velocity.x -= 0.2f * dt * mat.modX * (p->velocity.x < 0 ? -1 : 1);
 		}
 		else {
             p->velocity.y -= dt * 10 * (p->velocity.y < 0 ? -1 : 1);
 			// Check right and left
-			if (CheckValidMove(grid, x - 1, y, LIQUID)) {
-                if (CheckValidMove(grid, x + 1, y, LIQUID)) {
-                    // Both are fine
-					p->velocity.y = 0.5;
-					p->velocity.x = Clamp(p->velocity.x + (mat.modX * dt * (p->velocity.x < 0 ? -1 : 1)), -mat.maxX, mat.maxX);
-                }
-                else {
-                    // Left
-					p->velocity.y = 0.25;
-				    p->velocity.x = Clamp(p->velocity.x + (-mat.modX * dt), -mat.maxX, -1);
-                }
-			}
-			else if (CheckValidMove(grid, x + 1, y, LIQUID)) {
-				// Right
+            int move = spreadMoves[(mask & (NB_LEFT | NB_RIGHT)) >> 3][p->velocity.x < 0];
+
+            if (move & MOVE_BOTH_OPEN) {
+                // Both are fine, keep going the way we were
+				p->velocity.y = 0.5;
+				p->velocity.x = Clamp(p->velocity.x + (mat.modX * dt * (move == (MOVE_LEFT | MOVE_BOTH_OPEN) ? -1 : 1)), -mat.maxX, mat.maxX);
+            }
+            else if (move == MOVE_LEFT) {
+				p->velocity.y = 0.25;
+			    p->velocity.x = Clamp(p->velocity.x + (-mat.modX * dt), -mat.maxX, -1);
+            }
+			else if (move == MOVE_RIGHT) {
 				p->velocity.y = 0.25;
 				p->velocity.x = Clamp(p->velocity.x + (mat.modX * dt), 1, mat.maxX);
 			}
@@ -930,7 +1453,7 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
 			}
             if (y + 1 < HEIGHT) {
 				particle_t* pn = GetParticle(grid, x, y + 1);
-				if (props[pn->mat].type != mat.type) {
+				if (sim->props[pn->mat].type != mat.type) {
 					p->velocity.x *= 0.8;
 				}
             }
@@ -939,23 +1462,25 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
             }
 		}
 
-		v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x, p->velocity.y, &mat);
+		v = TranslateParticleWithMaterial(grid, x, y, p->velocity.x * sim->sweepSteps, p->velocity.y * sim->sweepSteps, &mat);
 
 		if (v.x != x || v.y != y) {
 			p->hasBeenUpdated = true;
+			WakeCell(x, y);
+			WakeCell(v.x, v.y);
 			x = v.x;
 			y = v.y;
 		}
     }
 
 
-    if (mat.acting) {
+    if (mat.acting && !sim->useTemperature) {
         int i = GetIndex(x, y);
         if (p->mat == LAVA) {
             // Look for flammable stuff
 
-            if (y + 1 < HEIGHT && grid[i + WIDTH] != NULL && props[grid[i + WIDTH]->mat].flammable && randNum % 100 < props[grid[i + WIDTH]->mat].flammableProbability) {
-                int temp = i + WIDTH;
+            if (y + 1 < HEIGHT && grid[i + STRIDE] != NULL && sim->props[grid[i + STRIDE]->mat].flammable && randNum % 100 < sim->props[grid[i + STRIDE]->mat].flammableProbability) {
+                int temp = i + STRIDE;
                 particle_mat_t someMat = grid[temp]->mat;
 
                 if (someMat == WATER) {
@@ -974,8 +1499,8 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
                 }
             }
 
-            if (y + 1 > 0 && grid[i - WIDTH] != NULL && props[grid[i - WIDTH]->mat].flammable && randNum % 100 < props[grid[i - WIDTH]->mat].flammableProbability) {
-                int temp = i - WIDTH;
+            if (y + 1 > 0 && grid[i - STRIDE] != NULL && sim->props[grid[i - STRIDE]->mat].flammable && randNum % 100 < sim->props[grid[i - STRIDE]->mat].flammableProbability) {
+                int temp = i - STRIDE;
                 particle_mat_t someMat = grid[temp]->mat;
                 if (someMat == WATER) {
                     if (randNum % 2) {
@@ -992,7 +1517,7 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            else if (x < WIDTH - 1 && grid[i + 1] != NULL && props[grid[i + 1]->mat].flammable && randNum % 100 < props[grid[i + 1]->mat].flammableProbability) {
+            else if (x < WIDTH - 1 && grid[i + 1] != NULL && sim->props[grid[i + 1]->mat].flammable && randNum % 100 < sim->props[grid[i + 1]->mat].flammableProbability) {
                 int temp = i + 1;
                 particle_mat_t someMat = grid[temp]->mat;
                 if (someMat == WATER) {
@@ -1010,7 +1535,7 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            else if (i > 0 && grid[i - 1] != NULL && props[grid[i - 1]->mat].flammable && randNum % 100 < props[grid[i - 1]->mat].flammableProbability) {
+            else if (i > 0 && grid[i - 1] != NULL && sim->props[grid[i - 1]->mat].flammable && randNum % 100 < sim->props[grid[i - 1]->mat].flammableProbability) {
                 int temp = i - 1;
                 particle_mat_t someMat = grid[temp]->mat;
                 if (someMat == WATER) {
@@ -1028,12 +1553,18 @@ static void UpdateLiquidParticle(particle_t** grid, int x, int y) {
                     grid[temp] = CreateParticle(FIRE);
                 }
             }
-            if (grid[i - WIDTH] == NULL && randNum % 100 < 2) {
-                grid[i - WIDTH] = CreateParticle(SMOKE);
+            if (grid[i - STRIDE] == NULL && randNum % 100 < 2) {
+                EmitSmoke(grid, x, y - 1);
                 // Top layer of lava should continue to move around and emit smoke
             }
         }
     }
+    else if (mat.acting && p->mat == LAVA) {
+        int i = GetIndex(x, y);
+        if (y > 0 && grid[i - STRIDE] == NULL && randNum % 100 < 2) {
+            EmitSmoke(grid, x, y - 1);
+        }
+    }
 }
 
 static void UpdateGasParticle(particle_t** grid, int x, int y) {
@@ -1041,10 +1572,10 @@ static void UpdateGasParticle(particle_t** grid, int x, int y) {
 
     if (p == NULL || p->hasBeenUpdated) return;
 
-    float dt = GetFrameTime();
+    float dt = sim->sweepDt;
     int i = GetIndex(x, y);
 
-    int randNum = rand();
+    int randNum = SimRandom();
     if (randNum % 10 < 4) {
 		p->lifeTime -= dt;
         if (p->lifeTime < 1) {
@@ -1059,13 +1590,13 @@ static void UpdateGasParticle(particle_t** grid, int x, int y) {
 
     Vector2Int v = { x, y };
 
-    p->velocity.y = Clamp(p->velocity.y + (gravity * dt * -1.5f), -10.0, 10.0);
+    p->velocity.y = Clamp(p->velocity.y + (sim->gravity * dt * -1.5f), -10.0, 10.0);
     int vy = p->velocity.y;
     p->velocity.x = Clamp(p->velocity.x + (0.1f * dt * (randNum % 2 ? 0.5f : -0.5f)), -5.0, 5.0);
     int vx = grid[i]->velocity.x;
 
     // Straight up
-	if (grid[i - WIDTH] == NULL) {
+	if (y > 0 && grid[i - STRIDE] == NULL) {
         // Add some variance because it looks kinda cool and seems to solve some issues
 	    v = TranslateParticle(grid, x, y, x + (randNum % 2 ? 1 : -1), y + vy);
 	}
@@ -1143,6 +1674,8 @@ static void UpdateGasParticle(particle_t** grid, int x, int y) {
 
 	if (v.x != x || v.y != y) {
 		p->hasBeenUpdated = true;
+		WakeCell(x, y);
+		WakeCell(v.x, v.y);
 		x = v.x;
 		y = v.y;
 	}
@@ -1152,7 +1685,135 @@ bool CheckValidMove(particle_t** grid, int x, int y, particle_state_t particleSt
     if (!withinBounds(x, y)) {
         return false;
     }
-    return (grid[GetIndex(x, y)] == NULL || props[grid[GetIndex(x, y)]->mat].type > particleState);
+    return (grid[GetIndex(x, y)] == NULL || sim->props[grid[GetIndex(x, y)]->mat].type > particleState);
+}
+
+// The simulation owns the grid, so files are saved and loaded on its side between ticks
+static void SubmitFileCommand(sim_command_type_t type, const char* path, bool compress, int originX, int originY) {
+    sim_command_t command = { type, originX, originY };
+    command.file.path = (char*) malloc(strlen(path) + 1);
+    strcpy(command.file.path, path);
+    command.file.compress = compress;
+    SubmitSimCommand(&command);
+}
+
+// Checkpoints, undo and redo, each stroke starts a checkpoint so it undoes as one
+static void SubmitHistoryCommand(sim_command_type_t type, int originX, int originY) {
+    sim_command_t command = { type, originX, originY };
+    SubmitSimCommand(&command);
+}
+
+sim_world_t DefaultWorld(void) {
+    sim_world_t world = { 0 };
+    memcpy(world.props, defaultProps, sizeof(defaultProps));
+    world.gravity = 10.0f;
+    world.randomState = 2463534242u;
+    world.sweepSteps = 1;
+    world.useTemperature = true;
+    world.useGasField = true;
+    world.useLiquidPressure = true;
+    world.backend = BACKEND_SWEEP;
+    world.useLod = true;
+    world.useWorkers = true;
+    return world;
+}
+
+void InitMoveTables(void) {
+    for (int state = 0; state <= GAS; state++) {
+        sim->displaceable[state][0] = true;
+        for (int m = 0; m < MATERIAL_COUNT; m++) {
+            sim->displaceable[state][m + 1] = sim->props[m].type > state;
+        }
+    }
+}
+
+// Gather the wanted neighbours into one mask, cells outside the world are never free
+static int NeighbourMask(particle_t** grid, int x, int y, particle_state_t particleState, int wanted) {
+    const bool* canMove = sim->displaceable[particleState];
+    int i = GetIndex(x, y);
+    int mask = 0;
+
+    #define CELL_FREE(j) canMove[grid[j] != NULL ? grid[j]->mat + 1 : 0]
+
+    if ((wanted & NB_LEFT) && x > 0 && CELL_FREE(i - 1)) mask |= NB_LEFT;
+    if ((wanted & NB_RIGHT) && x < WIDTH - 1 && CELL_FREE(i + 1)) mask |= NB_RIGHT;
+
+    if (y < HEIGHT - 1) {
+        int below = i + STRIDE;
+        if ((wanted & NB_DOWN) && CELL_FREE(below)) mask |= NB_DOWN;
+        if ((wanted & NB_DOWN_LEFT) && x > 0 && CELL_FREE(below - 1)) mask |= NB_DOWN_LEFT;
+        if ((wanted & NB_DOWN_RIGHT) && x < WIDTH - 1 && CELL_FREE(below + 1)) mask |= NB_DOWN_RIGHT;
+    }
+
+    #undef CELL_FREE
+    return mask;
+}
+
+// Shows the frames of a partitioned world and how each worker splits its time, or logs the
+// split once a second when headless. Runs until the window closes or the workers are gone
+static int RunCoordinator(int port, int workers, const char* worldFile, int width, int height, bool headless,
+                          int screenWidth, int screenHeight) {
+    if (!CoordinatePartition(port, workers, width, height, worldFile)) return 1;
+
+    int frameWidth, frameHeight, scale;
+    const Color* pixels = GetPartitionFrame(&frameWidth, &frameHeight, &scale);
+
+    Texture2D texture = { 0 };
+    if (!headless) {
+        SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+        InitWindow(screenWidth, screenHeight, "PixelPhysics - coordinator");
+        SetTargetFPS(60);
+        Image image = GenImageColor(frameWidth, frameHeight, BLANK);
+        texture = LoadTextureFromImage(image);
+        UnloadImage(image);
+    }
+
+    double lastLog = GetTime();
+    while (UpdateCoordinator()) {
+        if (headless) {
+            WaitTime(1.0 / 60.0);
+            if (GetTime() - lastLog < 1.0) continue;
+            lastLog = GetTime();
+            for (int w = 0; w < GetPartitionWorkers(); w++) {
+                partition_stats_t stats = GetPartitionStats(w);
+                TraceLog(LOG_INFO, "PARTITION: Worker %d - tick %u - %.2f ms compute, %.2f ms exchange - %.1f KB/s - %u crossings, %u conflicts, %u lost",
+                         w, stats.tick, stats.computeMs, stats.exchangeMs, stats.haloKBps, stats.crossings, stats.conflicts, stats.lost);
+            }
+            continue;
+        }
+        if (WindowShouldClose()) break;
+
+        UpdateTexture(texture, pixels);
+
+        // Fit the whole world, slab edges marked
+        float zoom = MinFloat((float)GetScreenWidth() / frameWidth, (float)GetScreenHeight() / frameHeight);
+        Rectangle dest = { 0, 0, frameWidth * zoom, frameHeight * zoom };
+
+        BeginDrawing();
+            ClearBackground(BLACK);
+            DrawTexturePro(texture, { 0, 0, (float)frameWidth, (float)frameHeight }, dest, { 0, 0 }, 0.0f, WHITE);
+            for (int w = 0; w < GetPartitionWorkers(); w++) {
+                partition_stats_t stats = GetPartitionStats(w);
+                float y = stats.firstRow / (float)scale * zoom;
+                if (w > 0) DrawLine(0, (int)y, (int)dest.width, (int)y, RED);
+
+                float busy = stats.computeMs + stats.exchangeMs;
+                DrawText(TextFormat("worker %d%s - tick %u - %.2f ms compute, %.2f ms exchange (%d%%) - %.1f KB/s - %u crossings, %u conflicts, %u lost",
+                                    w, stats.connected ? "" : " gone", stats.tick, stats.computeMs, stats.exchangeMs,
+                                    busy > 0.0f ? (int)(stats.exchangeMs * 100.0f / busy + 0.5f) : 0, stats.haloKBps,
+                                    stats.crossings, stats.conflicts, stats.lost), 5, (int)y + 5, 14, RAYWHITE);
+            }
+            DrawText(TextFormat("%d - %d workers - %d cells a pixel", GetFPS(), GetPartitionWorkers(), scale),
+                     5, GetScreenHeight() - 19, 14, RAYWHITE);
+        EndDrawing();
+    }
+
+    if (!headless) {
+        UnloadTexture(texture);
+        CloseWindow();
+    }
+    UnloadPartition();
+    return 0;
 }
 
 static float MinFloat(float a, float b) {
@@ -1173,7 +1834,7 @@ bool withinBounds(int x, int y) {
     return x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT;
 }
 // Function to check if all surrounding coordinates are taken
-float isSurroundedByType(particle_t* grid[WIDTH * HEIGHT], int x, int y, particle_mat_t mat) {
+float isSurroundedByType(particle_t** grid, int x, int y, particle_mat_t mat) {
     int dx[] = { -1, 0, 1, -1, 1, -1, 0, 1 };
     int dy[] = { -1, -1, -1, 0, 0, 1, 1, 1 };
 
@@ -0,0 +1,509 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Replays
+*
+*   Records a session so it can be played back exactly, in the window or as fast as it
+*   runs without one. Everything from outside reaches the simulation as commands (see
+*   sim_thread.cpp), so a recording is the commands it applied, in order, with every step
+*   written down as the view and the number of ticks it actually ran. Fast forwarding,
+*   running until settled and frames folded together on a busy thread all come out as a
+*   plain count of ticks, and material picks and pauses only show in the edits and the
+*   ticks. Everything else in a tick is down to the random state and the tick counter.
+*
+*   Recording starts by saving the world to the file and loading it back, so the session
+*   and every replay of it start from the same state, with the fields at rest and every
+*   chunk packed. The log follows the world data, so the file still loads as a world:
+*     header       u32 magic "PPRP", u16 version, u16 flags, f32 rewind seconds
+*     records      u8 sim_command_type_t, then by type:
+*                    SIM_FRAME       u8 flags, f32 x, y, width, height of the view when
+*                                    REPLAY_VIEW is set, f32 dt when REPLAY_DT is set,
+*                                    varint ticks
+*                    SIM_EDIT        edit_t
+*                    SIM_SETTINGS    sim_settings_t
+*                    SIM_LOAD        u16 length, path
+*                    SIM_REWIND      i32 ticks
+*                    others          nothing
+*                  REPLAY_REPEAT and a varint count stands for that many more copies of
+*                  the frame before, so an idle or steadily running session costs a few
+*                  bytes a second. Commands go over the network the same way
+*
+*   The log is flushed after every record, so a session that crashed replays up to the
+*   crash. Saves aren't recorded, loads read the same path again when played back.
+*   Streamed worlds and the frame budget depend on more than the commands and can't be
+*   recorded.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define REPLAY_MAGIC 0x50525050         // "PPRP" read as a little endian u32
+#define REPLAY_VERSION 1
+#define REPLAY_REPEAT 0x80              // Record type, the frame before again
+#define REPLAY_VIEW 0x01                // Frame flags, what changed since the frame before
+#define REPLAY_DT 0x02
+#define REPLAY_REPEAT_FLUSH 60          // Repeated frames held back before they are written
+
+typedef struct replay_header_t {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short flags;
+    float rewindSeconds;
+} replay_header_t;
+
+// Where a pass over the log is, and the frame repeats refer to
+typedef struct replay_reader_t {
+    size_t pos;
+    sim_command_t frame;
+    unsigned int repeats;
+} replay_reader_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static particle_t** replayGrid = NULL;
+static char* replayPath = NULL;
+
+// Recording
+static FILE* recordFile = NULL;
+static sim_command_t lastFrame = { SIM_FRAME };
+static bool commandSinceFrame = true;
+static unsigned int pendingRepeats = 0;
+static unsigned int recordedSteps = 0;
+static unsigned int recordedTicks = 0;
+
+// Playing back
+static unsigned char* replayLog = NULL;
+static size_t replayLogSize = 0;
+static replay_reader_t reader = { 0 };
+static bool replaying = false;
+static unsigned int replayedSteps = 0;
+static unsigned int replayedTicks = 0;
+static unsigned int replaySteps = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool ReadRecord(replay_reader_t* from, sim_command_t* command);
+static bool ReadBytes(replay_reader_t* from, void* dst, size_t size);
+static bool ReadVarint(replay_reader_t* from, unsigned int* value);
+static void WriteVarint(unsigned int value);
+static void FlushRepeats(void);
+static size_t WorldDataEnd(FILE* file);
+
+//----------------------------------------------------------------------------------
+// Replay Functions Definition
+//----------------------------------------------------------------------------------
+
+// Save the world to path and start logging the commands the simulation applies after it.
+// Call once the world is loaded and before the simulation runs
+bool StartRecording(particle_t** grid, const char* path, float rewindSeconds) {
+    if (!SaveWorldFile(grid, path, true) || !LoadWorldFile(grid, path)) return false;
+
+    recordFile = fopen(path, "ab");
+    if (recordFile == NULL) {
+        TraceLog(LOG_WARNING, "REPLAY: Could not write %s", path);
+        return false;
+    }
+
+    replayGrid = grid;
+    replayPath = strdup(path);
+
+    replay_header_t header = { REPLAY_MAGIC, REPLAY_VERSION, 0, rewindSeconds };
+    fwrite(&header, sizeof(header), 1, recordFile);
+
+    // Settings the session starts with, later changes come as commands
+    sim_command_t settings = { SIM_SETTINGS };
+    settings.settings = { sim->useTemperature, sim->useGasField, sim->useLiquidPressure, sim->backend, sim->useLod, sim->frameBudget };
+    RecordSimCommand(&settings);
+
+    TraceLog(LOG_INFO, "REPLAY: Recording to %s", path);
+    return true;
+}
+
+bool IsRecording(void) {
+    return recordFile != NULL;
+}
+
+// Simulation thread. A command as it is applied, before the frame it goes with
+void RecordSimCommand(const sim_command_t* command) {
+    if (recordFile == NULL || command->type == SIM_SAVE || command->type == SIM_EXPORT || command->type == SIM_FRAME) return;
+
+    FlushRepeats();
+    unsigned char record[SIM_COMMAND_MAX_BYTES];
+    fwrite(record, 1, WriteSimCommand(command, record), recordFile);
+
+    commandSinceFrame = true;
+    fflush(recordFile);
+}
+
+// A command as a record of the log, also how commands go over the network. Returns the
+// bytes written, at most SIM_COMMAND_MAX_BYTES, or 0 for frames, saves and exports
+int WriteSimCommand(const sim_command_t* command, unsigned char* out) {
+    if (command->type == SIM_FRAME || command->type == SIM_SAVE || command->type == SIM_EXPORT) return 0;
+
+    int size = 0;
+    out[size++] = (unsigned char)command->type;
+
+    switch (command->type) {
+    case SIM_EDIT:
+        memcpy(out + size, &command->edit, sizeof(edit_t));
+        size += sizeof(edit_t);
+        break;
+    case SIM_SETTINGS:
+        memcpy(out + size, &command->settings, sizeof(sim_settings_t));
+        size += sizeof(sim_settings_t);
+        break;
+    case SIM_LOAD: {
+        size_t length = strlen(command->file.path);
+        unsigned short stored = (unsigned short)((length < SIM_PATH_MAX) ? length : SIM_PATH_MAX);
+        memcpy(out + size, &stored, sizeof(stored));
+        memcpy(out + size + sizeof(stored), command->file.path, stored);
+        size += sizeof(stored) + stored;
+    } break;
+    case SIM_REWIND:
+        memcpy(out + size, &command->rewindTicks, sizeof(int));
+        size += sizeof(int);
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+
+// Read back a command written by WriteSimCommand, loads get a path of their own. Returns the
+// bytes read, or 0 when the data is cut short or isn't a command
+int ReadSimCommand(const unsigned char* data, int size, sim_command_t* command) {
+    if (size < 1) return 0;
+
+    memset(command, 0, sizeof(*command));
+    command->type = (sim_command_type_t)data[0];
+    int used = 1;
+
+    switch (data[0]) {
+    case SIM_EDIT:
+        if (size < used + (int)sizeof(edit_t)) return 0;
+        memcpy(&command->edit, data + used, sizeof(edit_t));
+        return used + sizeof(edit_t);
+    case SIM_SETTINGS:
+        if (size < used + (int)sizeof(sim_settings_t)) return 0;
+        memcpy(&command->settings, data + used, sizeof(sim_settings_t));
+        return used + sizeof(sim_settings_t);
+    case SIM_LOAD: {
+        unsigned short length;
+        if (size < used + (int)sizeof(length)) return 0;
+        memcpy(&length, data + used, sizeof(length));
+        used += sizeof(length);
+        if (size < used + length) return 0;
+        command->file.path = (char*) malloc(length + 1);
+        memcpy(command->file.path, data + used, length);
+        command->file.path[length] = '\0';
+        return used + length;
+    }
+    case SIM_REWIND:
+        if (size < used + (int)sizeof(int)) return 0;
+        memcpy(&command->rewindTicks, data + used, sizeof(int));
+        return used + sizeof(int);
+    case SIM_CHECKPOINT:
+    case SIM_UNDO:
+    case SIM_REDO:
+        return used;
+    default:
+        return 0;
+    }
+}
+
+// Simulation thread. A step that ran ticks ticks of dt with view, in window cells
+void RecordSimFrame(Rectangle view, float dt, int ticks) {
+    if (recordFile == NULL) return;
+
+    recordedSteps++;
+    recordedTicks += ticks;
+
+    unsigned char flags = 0;
+    if (memcmp(&view, &lastFrame.frame.view, sizeof(Rectangle)) != 0) flags |= REPLAY_VIEW;
+    if (dt != lastFrame.frame.dt) flags |= REPLAY_DT;
+
+    if (flags == 0 && !commandSinceFrame && ticks == lastFrame.frame.ticks) {
+        if (++pendingRepeats >= REPLAY_REPEAT_FLUSH) FlushRepeats();
+        return;
+    }
+
+    FlushRepeats();
+    fputc(SIM_FRAME, recordFile);
+    fputc(flags, recordFile);
+    if (flags & REPLAY_VIEW) fwrite(&view, sizeof(Rectangle), 1, recordFile);
+    if (flags & REPLAY_DT) fwrite(&dt, sizeof(float), 1, recordFile);
+    WriteVarint((unsigned int)ticks);
+
+    lastFrame.frame.view = view;
+    lastFrame.frame.dt = dt;
+    lastFrame.frame.ticks = ticks;
+    commandSinceFrame = false;
+    fflush(recordFile);
+}
+
+// Read the world size and the settings a recording was made with, before the world is set up
+bool OpenReplay(const char* path, replay_info_t* info) {
+    if (!PeekWorldFile(path, &info->width, &info->height)) return false;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    size_t start = WorldDataEnd(file);
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+
+    replay_header_t header = { 0 };
+    bool ok = (start > 0 && end > 0 && (size_t)end >= start + sizeof(header));
+    if (ok) {
+        fseek(file, (long)start, SEEK_SET);
+        ok = (fread(&header, sizeof(header), 1, file) == 1 && header.magic == REPLAY_MAGIC && header.version == REPLAY_VERSION);
+    }
+    if (!ok) {
+        TraceLog(LOG_WARNING, "REPLAY: %s is not a recording", path);
+        fclose(file);
+        return false;
+    }
+
+    replayLogSize = (size_t)end - start - sizeof(header);
+    replayLog = (unsigned char*) malloc(replayLogSize > 0 ? replayLogSize : 1);
+    ok = (fread(replayLog, 1, replayLogSize, file) == replayLogSize);
+    fclose(file);
+    if (!ok) {
+        TraceLog(LOG_WARNING, "REPLAY: Could not read %s", path);
+        UnloadReplay();
+        return false;
+    }
+
+    // Count the steps for the progress shown, a log cut short ends at its last whole record
+    replay_reader_t count = { 0 };
+    sim_command_t command;
+    while (ReadRecord(&count, &command)) {
+        if (command.type == SIM_FRAME) replaySteps++;
+        if (command.type == SIM_LOAD) free(command.file.path);
+    }
+
+    info->rewindSeconds = header.rewindSeconds;
+    replayPath = strdup(path);
+    return true;
+}
+
+// Load the world the recording starts from, the simulation plays it from its next step
+bool StartReplay(particle_t** grid) {
+    if (replayLog == NULL || !LoadWorldFile(grid, replayPath)) return false;
+
+    replayGrid = grid;
+    memset(&reader, 0, sizeof(reader));
+    replaying = true;
+    TraceLog(LOG_INFO, "REPLAY: Playing %s, %u steps", replayPath, replaySteps);
+    return true;
+}
+
+bool IsReplaying(void) {
+    return replaying;
+}
+
+// Simulation thread. The next recorded command, each step ends in a SIM_FRAME asking for
+// exactly the ticks it ran. False once the recording is over
+bool ReadReplayCommand(sim_command_t* command) {
+    if (!replaying) return false;
+
+    if (!ReadRecord(&reader, command)) {
+        replaying = false;
+        TraceLog(LOG_INFO, "REPLAY: Finished %s, %u steps and %u ticks - world hash %08x", replayPath,
+                 replayedSteps, replayedTicks, HashWorld(replayGrid));
+        return false;
+    }
+
+    // Streamed worlds aren't recorded, the window always starts where it is
+    command->originX = sim->chunkOriginX;
+    command->originY = sim->chunkOriginY;
+
+    if (command->type == SIM_FRAME) {
+        replayedSteps++;
+        replayedTicks += command->frame.ticks;
+    }
+    return true;
+}
+
+// Play the whole recording back to back on this thread, with nothing drawn, and log how
+// long it took. Needs the simulation without its thread
+void RunReplay(void) {
+    sim_command_t frame = { SIM_FRAME };
+    frame.frame.ticks = 1;              // One recorded step per frame
+    double start = GetTime(), slowest = 0.0;
+
+    while (replaying) {
+        double stepStart = GetTime();
+        SubmitSimCommand(&frame);
+        double stepTime = GetTime() - stepStart;
+        if (stepTime > slowest) slowest = stepTime;
+    }
+
+    double seconds = GetTime() - start;
+    TraceLog(LOG_INFO, "REPLAY: %u steps and %u ticks in %.2f s - %.3f ms per tick - slowest step %.2f ms",
+             replayedSteps, replayedTicks, seconds, replayedTicks > 0 ? seconds * 1000.0 / replayedTicks : 0.0, slowest * 1000.0);
+}
+
+replay_stats_t GetReplayStats(void) {
+    replay_stats_t stats = { 0 };
+    stats.recording = (recordFile != NULL);
+    stats.playing = replaying;
+    stats.step = replaying ? replayedSteps : recordedSteps;
+    stats.steps = replaySteps;
+    return stats;
+}
+
+// A checksum of every cell of the chunk as the packed format keeps it, the same whether
+// the chunk is packed or not. Simulation thread only, or once it stopped
+unsigned int HashChunk(particle_t** grid, int cx, int cy) {
+    static chunk_cell_t cells[CHUNK_SIZE * CHUNK_SIZE];
+    unsigned int hash = 2166136261u;
+
+    GatherChunk(grid, cx, cy, cells);
+    for (int n = 0; n < CHUNK_SIZE * CHUNK_SIZE; n++) {
+        const chunk_cell_t* cell = &cells[n];
+        unsigned int value = cell->mat;
+        if (cell->mat != NOTHING) {
+            value = value * 31 + ((unsigned int)cell->color.r | cell->color.g << 8 | cell->color.b << 16 | (unsigned int)cell->color.a << 24);
+            // Particles that don't decay keep whatever lifeTime they were allocated with
+            if (sim->props[cell->mat].decaying) {
+                unsigned int bits;
+                memcpy(&bits, &cell->lifeTime, sizeof(bits));
+                value = value * 31 + bits;
+            }
+        }
+        hash = (hash ^ value) * 16777619u;
+    }
+    return hash;
+}
+
+// Combine chunk hashes, row by row, with the tick and random state into a world hash
+unsigned int CombineChunkHashes(const unsigned int* chunkHashes) {
+    unsigned int hash = 2166136261u;
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) hash = (hash ^ chunkHashes[c]) * 16777619u;
+    hash = (hash ^ sim->frameCounter) * 16777619u;
+    return (hash ^ sim->randomState) * 16777619u;
+}
+
+// Two runs that hash the same went the same way
+unsigned int HashWorld(particle_t** grid) {
+    unsigned int* chunkHashes = (unsigned int*) malloc(sim->chunksX * sim->chunksY * sizeof(unsigned int));
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) chunkHashes[cy * sim->chunksX + cx] = HashChunk(grid, cx, cy);
+    }
+
+    unsigned int hash = CombineChunkHashes(chunkHashes);
+    free(chunkHashes);
+    return hash;
+}
+
+// Finish the recording or drop the replay, logging the hash a replay should end on
+void UnloadReplay(void) {
+    if (recordFile != NULL) {
+        FlushRepeats();
+        fclose(recordFile);
+        recordFile = NULL;
+        TraceLog(LOG_INFO, "REPLAY: Recorded %u steps and %u ticks to %s - world hash %08x", recordedSteps,
+                 recordedTicks, replayPath, HashWorld(replayGrid));
+    }
+
+    free(replayLog);
+    replayLog = NULL;
+    replayLogSize = 0;
+    replaying = false;
+    free(replayPath);
+    replayPath = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static bool ReadRecord(replay_reader_t* from, sim_command_t* command) {
+    if (from->repeats > 0) {
+        from->repeats--;
+        *command = from->frame;
+        return true;
+    }
+
+    unsigned char type;
+    if (!ReadBytes(from, &type, 1)) return false;
+
+    switch (type) {
+    case REPLAY_REPEAT:
+        if (!ReadVarint(from, &from->repeats) || from->repeats == 0) return false;
+        from->repeats--;
+        *command = from->frame;
+        return true;
+    case SIM_FRAME: {
+        unsigned char flags;
+        unsigned int ticks;
+        if (!ReadBytes(from, &flags, 1)) return false;
+        if ((flags & REPLAY_VIEW) && !ReadBytes(from, &from->frame.frame.view, sizeof(Rectangle))) return false;
+        if ((flags & REPLAY_DT) && !ReadBytes(from, &from->frame.frame.dt, sizeof(float))) return false;
+        if (!ReadVarint(from, &ticks)) return false;
+        from->frame.type = SIM_FRAME;
+        from->frame.frame.ticks = (int)ticks;
+        *command = from->frame;
+        return true;
+    }
+    default: {
+        int used = ReadSimCommand(replayLog + from->pos - 1, (int)(replayLogSize - from->pos + 1), command);
+        if (used == 0) return false;
+        from->pos += used - 1;
+        return true;
+    }
+    }
+}
+
+static bool ReadBytes(replay_reader_t* from, void* dst, size_t size) {
+    if (from->pos + size > replayLogSize) return false;
+    memcpy(dst, replayLog + from->pos, size);
+    from->pos += size;
+    return true;
+}
+
+// Seven bits at a time, low bits first, the top bit set on every byte but the last
+static bool ReadVarint(replay_reader_t* from, unsigned int* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned char byte;
+        if (!ReadBytes(from, &byte, 1)) return false;
+        *value |= (unsigned int)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static void WriteVarint(unsigned int value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, recordFile);
+        value >>= 7;
+    }
+    fputc(value, recordFile);
+}
+
+static void FlushRepeats(void) {
+    if (pendingRepeats == 0) return;
+    fputc(REPLAY_REPEAT, recordFile);
+    WriteVarint(pendingRepeats);
+    pendingRepeats = 0;
+    fflush(recordFile);
+}
+
+// The log starts right after the last chunk of the world file in front of it
+static size_t WorldDataEnd(FILE* file) {
+    world_header_t header = { 0 };
+    if (fread(&header, sizeof(header), 1, file) != 1) return 0;
+
+    size_t end = sizeof(header) + (size_t)header.chunkCount * sizeof(world_chunk_entry_t);
+    for (unsigned int c = 0; c < header.chunkCount; c++) {
+        world_chunk_entry_t entry;
+        if (fread(&entry, sizeof(entry), 1, file) != 1) return 0;
+        if (entry.codec != CODEC_EMPTY && entry.offset + entry.size > end) end = (size_t)(entry.offset + entry.size);
+    }
+    return end;
+}
@@ -0,0 +1,515 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Rewind
+*
+*   Keeps the last few seconds of ticks so a physics glitch can be scrubbed back to and run
+*   again. Every REWIND_KEYFRAME_TICKS ticks a keyframe holds every chunk in the packed format
+*   of compression.cpp, and every tick in between only holds the cells that changed.
+*
+*   Which chunks to look at comes from the chunk activity in world.cpp: a chunk that was
+*   neither awake nor woken during a tick can't have changed. EndWorldTick hands each chunk
+*   that could have to RecordRewindChunk instead of walking its particles itself, which
+*   compares it cell by cell with a shadow copy of what it held at the last recorded tick,
+*   so the particles are only fetched once. The cells that differ go into the tick's delta
+*   and the shadow. Shadows are only made for
+*   chunks that ran, from the keyframe and the deltas since, and are let go again once a
+*   chunk sat still through a whole keyframe interval. A keyframe reuses the blob of the one
+*   before for every chunk that didn't change in between, so a settled world costs nothing
+*   past the first keyframe.
+*
+*   Delta format, per changed chunk:
+*     u16 window chunk index, u16 changed cells, u16 bytes of cell data that follow
+*     per changed cell: u16 cell index in the chunk, u8 material, then for non empty cells
+*     the shade byte (or SHADE_RAW and r, g, b, a) and f32 lifeTime for decaying materials,
+*     as in the packed format
+*
+*   Jumping to a tick rebuilds the chunks that differ between it and the tick the world
+*   holds, from the keyframe before it and the deltas after that, and installs them as
+*   packed chunks. The tick counter and random state go back with them. The ticks after it
+*   stay until the simulation runs again, so scrubbing can go forward as well, and are
+*   dropped on the next recorded tick. Groups of ticks from the oldest keyframe on are
+*   dropped once the rest still cover the seconds asked for.
+*
+*   Only cells come back, the temperature and gas fields carry on as they are. Unpacking
+*   the restored chunks draws on the random state, so a rerun can drift from the original.
+*   Moving the streaming window or loading a world starts over.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+#include <deque>
+#include <vector>
+
+#define REWIND_KEYFRAME_TICKS 120
+#define SHADE_RAW 0x80
+#define DELTA_HEADER_BYTES 6
+#define DELTA_CELL_MAX_BYTES 12         // Index, material, raw colour and lifeTime
+
+// A keyframe chunk, shared by every keyframe the chunk didn't change between
+typedef struct rewind_blob_t {
+    chunk_blob_t blob;
+    int refs;
+} rewind_blob_t;
+
+typedef struct rewind_frame_t {
+    unsigned int tick;                  // frameCounter after the tick
+    unsigned int randomState;
+    double time;                        // Simulated seconds since recording started
+    rewind_blob_t** keyframe;           // Per window chunk, NULL unless this is a keyframe
+    unsigned char* delta;               // Cells changed since the frame before
+    int deltaSize;
+} rewind_frame_t;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static std::deque<rewind_frame_t> frames;
+static float keepSeconds = 0.0f;        // 0 when nothing is recorded
+static int position = -1;               // Frame the world holds
+static size_t rewindBytes = 0;
+
+// Per window chunk
+static chunk_cell_t** shadows = NULL;       // Cells as of the frame at position, NULL until needed
+static unsigned char* changedSinceKey = NULL;
+static unsigned char* building = NULL;      // Chunks BuildChunks is rebuilding
+static int rewindOriginX = 0;
+static int rewindOriginY = 0;
+
+static unsigned char* deltaBuffer = NULL;    // Delta of the tick being recorded
+static int deltaSize = 0;
+static int deltaCapacity = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool SyncOrigin(void);
+static int PutCell(unsigned char* out, int i, const chunk_cell_t* cell);
+static void AddKeyframe(particle_t** grid, rewind_frame_t* frame);
+static int FindKeyframe(int index);
+static void BuildChunks(int index, const int* chunks, int count);
+static void ApplyDelta(const rewind_frame_t* frame);
+static void MarkChunks(const rewind_frame_t* frame, std::vector<int>* list);
+static void DropNewer(void);
+static void TrimFrames(void);
+static void FreeFrame(rewind_frame_t* frame);
+static void FreeShadow(int c);
+
+//----------------------------------------------------------------------------------
+// Rewind Functions Definition
+//----------------------------------------------------------------------------------
+
+// Keep seconds of simulated time, nothing is recorded when it is 0
+void InitRewind(float seconds) {
+    keepSeconds = seconds;
+    if (keepSeconds <= 0.0f) return;
+
+    shadows = (chunk_cell_t**) calloc(sim->chunksX * sim->chunksY, sizeof(chunk_cell_t*));
+    changedSinceKey = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    building = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    rewindOriginX = sim->chunkOriginX;
+    rewindOriginY = sim->chunkOriginY;
+}
+
+void UnloadRewind(void) {
+    ClearRewind();
+    free(shadows);
+    free(changedSinceKey);
+    free(building);
+    free(deltaBuffer);
+    shadows = NULL;
+    changedSinceKey = NULL;
+    building = NULL;
+    deltaBuffer = NULL;
+    deltaCapacity = 0;
+    keepSeconds = 0.0f;
+}
+
+// Called by EndWorldTick before it walks the chunks that were awake or woken. True when
+// they are to be handed to RecordRewindChunk, only ever for the main world
+bool BeginRewindTick(void) {
+    if (keepSeconds <= 0.0f || sim != &mainWorld) return false;
+    SyncOrigin();
+
+    // Rewound and running again, what came after is no longer what happens
+    if (position < (int)frames.size() - 1) DropNewer();
+
+    deltaSize = 0;
+    return !frames.empty();
+}
+
+// Compare the chunk with its shadow, adding the cells that differ to this tick's delta.
+// Every particle gets looked at, so this resets them for the next tick as well
+void RecordRewindChunk(particle_t** grid, int cx, int cy) {
+    int c = cy * sim->chunksX + cx;
+    if (shadows[c] == NULL) BuildChunks(position, &c, 1);
+    chunk_cell_t* shadow = shadows[c];
+
+    int needed = deltaSize + DELTA_HEADER_BYTES + CHUNK_SIZE * CHUNK_SIZE * DELTA_CELL_MAX_BYTES;
+    if (needed > deltaCapacity) {
+        deltaCapacity = needed * 2;
+        deltaBuffer = (unsigned char*) realloc(deltaBuffer, deltaCapacity);
+    }
+
+    unsigned char* header = deltaBuffer + deltaSize;
+    int start = deltaSize + DELTA_HEADER_BYTES;
+    int end = start;
+    int count = 0;
+
+    // Packed chunks only get written into, gathering them takes care of the placeholders
+    static chunk_cell_t packed[CHUNK_SIZE * CHUNK_SIZE];
+    bool isPacked = GetPackedChunk(cx, cy) != NULL;
+    if (isPacked) GatherChunk(grid, cx, cy, packed);
+
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, cy * CHUNK_SIZE + y);
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            int i = y * CHUNK_SIZE + x;
+            particle_t* p = row[x];
+            chunk_cell_t* old = &shadow[i];
+            chunk_cell_t cell = { 0 };
+
+            if (p != NULL) p->hasBeenUpdated = false;
+
+            if (isPacked) {
+                if (packed[i].mat != NOTHING) cell = packed[i];
+            }
+            else if (p == NULL) {
+                if (old->mat == NOTHING) continue;
+            }
+            else {
+                // Most cells are as they were, that is checked before anything else
+                if (old->mat == p->mat && old->lifeTime == p->lifeTime && memcmp(&old->color, &p->color, sizeof(Color)) == 0) continue;
+                cell.mat = (unsigned char)p->mat;
+                cell.color = p->color;
+                cell.lifeTime = p->lifeTime;
+            }
+            if (cell.mat != NOTHING && !sim->props[cell.mat].decaying) cell.lifeTime = sim->props[cell.mat].initLifeTime;
+
+            if (cell.mat == old->mat && (cell.mat == NOTHING ||
+                (memcmp(&cell.color, &old->color, sizeof(Color)) == 0 && cell.lifeTime == old->lifeTime))) continue;
+
+            *old = cell;
+            end += PutCell(deltaBuffer + end, i, &cell);
+            count++;
+        }
+    }
+    if (count == 0) return;
+
+    unsigned short fields[3] = { (unsigned short)c, (unsigned short)count, (unsigned short)(end - start) };
+    memcpy(header, fields, DELTA_HEADER_BYTES);
+    changedSinceKey[c] = 1;
+    deltaSize = end;
+}
+
+// Called by TickWorld once the tick is over, dt being the one it was run with
+void EndRewindTick(particle_t** grid, float dt) {
+    if (keepSeconds <= 0.0f || sim != &mainWorld) return;
+
+    rewind_frame_t frame = { 0 };
+    frame.tick = sim->frameCounter;
+    frame.randomState = sim->randomState;
+
+    if (!frames.empty()) {
+        frame.time = frames.back().time + dt;
+        if (deltaSize > 0) {
+            frame.delta = (unsigned char*) malloc(deltaSize);
+            memcpy(frame.delta, deltaBuffer, deltaSize);
+            frame.deltaSize = deltaSize;
+            rewindBytes += deltaSize;
+        }
+    }
+
+    if (frames.empty() || (int)frames.size() - FindKeyframe((int)frames.size() - 1) >= REWIND_KEYFRAME_TICKS) {
+        AddKeyframe(grid, &frame);
+    }
+
+    frames.push_back(frame);
+    position = (int)frames.size() - 1;
+    TrimFrames();
+}
+
+// Put the world back the way it was after tick. False when the tick isn't kept
+bool RewindTo(particle_t** grid, unsigned int tick) {
+    if (frames.empty() || SyncOrigin()) return false;
+
+    unsigned int offset = tick - frames.front().tick;
+    if (offset >= frames.size()) return false;
+    int target = (int)offset;
+
+    // Chunks that differ between the two frames, and any changed since the last recorded tick
+    std::vector<int> list;
+    int first = (target < position) ? target : position;
+    int last = (target < position) ? position : target;
+    for (int n = first + 1; n <= last; n++) MarkChunks(&frames[n], &list);
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (!building[c] && IsChunkAwake(cx, cy)) {
+                building[c] = 1;
+                list.push_back(c);
+            }
+        }
+    }
+    for (int c : list) building[c] = 0;
+
+    BuildChunks(target, list.data(), (int)list.size());
+
+    for (int c : list) {
+        int cx = c % sim->chunksX, cy = c / sim->chunksX;
+        DiscardChunk(grid, cx, cy);
+
+        chunk_blob_t blob = EncodeCells(shadows[c]);
+        if (IsEmptyBlob(blob) || !AdoptPackedChunk(grid, cx, cy, blob, false)) free(blob.data);
+
+        // The corners wake the chunk and its neighbours, whatever borders it may react
+        int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+        WakeCell(x0, y0);
+        WakeCell(x0 + CHUNK_SIZE - 1, y0);
+        WakeCell(x0, y0 + CHUNK_SIZE - 1);
+        WakeCell(x0 + CHUNK_SIZE - 1, y0 + CHUNK_SIZE - 1);
+    }
+
+    sim->frameCounter = frames[target].tick;
+    sim->randomState = frames[target].randomState;
+    position = target;
+    return true;
+}
+
+rewind_stats_t GetRewindStats(void) {
+    rewind_stats_t stats = { 0 };
+    if (frames.empty()) return stats;
+
+    stats.firstTick = frames.front().tick;
+    stats.lastTick = frames.back().tick;
+    stats.tick = frames[position].tick;
+    stats.seconds = (float)(frames.back().time - frames.front().time);
+    stats.bytes = rewindBytes;
+    return stats;
+}
+
+// Forget every tick, for when the whole world was replaced
+void ClearRewind(void) {
+    for (rewind_frame_t& frame : frames) FreeFrame(&frame);
+    frames.clear();
+    position = -1;
+
+    if (shadows != NULL) {
+        for (int c = 0; c < sim->chunksX * sim->chunksY; c++) FreeShadow(c);
+        memset(changedSinceKey, 0, sim->chunksX * sim->chunksY);
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Frames are by window chunk, moving the window throws them all away. True when it did
+static bool SyncOrigin(void) {
+    if (sim->chunkOriginX == rewindOriginX && sim->chunkOriginY == rewindOriginY) return false;
+
+    ClearRewind();
+    rewindOriginX = sim->chunkOriginX;
+    rewindOriginY = sim->chunkOriginY;
+    return true;
+}
+
+static int PutCell(unsigned char* out, int i, const chunk_cell_t* cell) {
+    unsigned short index = (unsigned short)i;
+    memcpy(out, &index, 2);
+    out[2] = cell->mat;
+    if (cell->mat == NOTHING) return 3;
+
+    // Same shading as the packed format, most cells only differ from the base by one byte
+    int size = 3;
+    Color base = sim->props[cell->mat].initialColor;
+    unsigned char shade = (unsigned char)(cell->color.r - base.r);
+    bool shaded = (unsigned char)(base.g + shade) == cell->color.g && (unsigned char)(base.b + shade) == cell->color.b &&
+                  cell->color.a == base.a && shade != SHADE_RAW;
+
+    out[size++] = shaded ? shade : SHADE_RAW;
+    if (!shaded) {
+        memcpy(out + size, &cell->color, 4);
+        size += 4;
+    }
+    if (sim->props[cell->mat].decaying) {
+        memcpy(out + size, &cell->lifeTime, 4);
+        size += 4;
+    }
+    return size;
+}
+
+// Every chunk as it is after the tick. Chunks that didn't change since the keyframe before
+// share its blob, the rest are encoded from their shadows, which are up to date. Shadows of
+// chunks that sat still through the whole interval are let go
+static void AddKeyframe(particle_t** grid, rewind_frame_t* frame) {
+    const rewind_frame_t* previous = frames.empty() ? NULL : &frames[FindKeyframe((int)frames.size() - 1)];
+    frame->keyframe = (rewind_blob_t**) calloc(sim->chunksX * sim->chunksY, sizeof(rewind_blob_t*));
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+
+            if (previous != NULL && !changedSinceKey[c]) {
+                frame->keyframe[c] = previous->keyframe[c];
+                frame->keyframe[c]->refs++;
+                FreeShadow(c);
+                continue;
+            }
+
+            rewind_blob_t* blob = (rewind_blob_t*) calloc(1, sizeof(rewind_blob_t));
+            blob->blob = (shadows[c] != NULL) ? EncodeCells(shadows[c]) : EncodeChunk(grid, cx, cy);
+            blob->refs = 1;
+            rewindBytes += blob->blob.size;
+            frame->keyframe[c] = blob;
+        }
+    }
+    memset(changedSinceKey, 0, sim->chunksX * sim->chunksY);
+}
+
+// The keyframe at or before the frame
+static int FindKeyframe(int index) {
+    while (frames[index].keyframe == NULL) index--;
+    return index;
+}
+
+// Set the shadows of the chunks to what they held after the frame at index
+static void BuildChunks(int index, const int* chunks, int count) {
+    int key = FindKeyframe(index);
+
+    for (int n = 0; n < count; n++) {
+        int c = chunks[n];
+        if (shadows[c] == NULL) {
+            shadows[c] = (chunk_cell_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t));
+            rewindBytes += CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t);
+        }
+        const chunk_blob_t* blob = &frames[key].keyframe[c]->blob;
+        DecodeCells(blob->data, blob->size, shadows[c]);
+        building[c] = 1;
+    }
+
+    for (int n = key + 1; n <= index; n++) ApplyDelta(&frames[n]);
+
+    for (int n = 0; n < count; n++) building[chunks[n]] = 0;
+}
+
+// Write the cells of a delta into the shadows of the chunks being built
+static void ApplyDelta(const rewind_frame_t* frame) {
+    const unsigned char* data = frame->delta;
+    int at = 0;
+
+    while (at < frame->deltaSize) {
+        unsigned short fields[3];
+        memcpy(fields, data + at, DELTA_HEADER_BYTES);
+        at += DELTA_HEADER_BYTES;
+
+        int c = fields[0];
+        int end = at + fields[2];
+        if (!building[c]) {
+            at = end;
+            continue;
+        }
+
+        chunk_cell_t* shadow = shadows[c];
+        while (at < end) {
+            unsigned short i;
+            memcpy(&i, data + at, 2);
+            chunk_cell_t* cell = &shadow[i];
+            memset(cell, 0, sizeof(chunk_cell_t));
+            cell->mat = data[at + 2];
+            at += 3;
+            if (cell->mat == NOTHING) continue;
+
+            Color base = sim->props[cell->mat].initialColor;
+            unsigned char shade = data[at++];
+            if (shade == SHADE_RAW) {
+                memcpy(&cell->color, data + at, 4);
+                at += 4;
+            }
+            else {
+                cell->color = { (unsigned char)(base.r + shade), (unsigned char)(base.g + shade), (unsigned char)(base.b + shade), base.a };
+            }
+            if (sim->props[cell->mat].decaying) {
+                memcpy(&cell->lifeTime, data + at, 4);
+                at += 4;
+            }
+            else {
+                cell->lifeTime = sim->props[cell->mat].initLifeTime;
+            }
+        }
+    }
+}
+
+// Add the chunks a delta changed to the list, once each. They stay marked in building
+static void MarkChunks(const rewind_frame_t* frame, std::vector<int>* list) {
+    int at = 0;
+    while (at < frame->deltaSize) {
+        unsigned short fields[3];
+        memcpy(fields, frame->delta + at, DELTA_HEADER_BYTES);
+        at += DELTA_HEADER_BYTES + fields[2];
+
+        if (building[fields[0]]) continue;
+        building[fields[0]] = 1;
+        list->push_back(fields[0]);
+    }
+}
+
+// Throw away the frames after the one the world holds. The chunks changed since its
+// keyframe are found again from the deltas
+static void DropNewer(void) {
+    while ((int)frames.size() - 1 > position) {
+        FreeFrame(&frames.back());
+        frames.pop_back();
+    }
+
+    std::vector<int> list;
+    for (int n = FindKeyframe(position) + 1; n <= position; n++) MarkChunks(&frames[n], &list);
+
+    memset(changedSinceKey, 0, sim->chunksX * sim->chunksY);
+    for (int c : list) {
+        changedSinceKey[c] = 1;
+        building[c] = 0;
+    }
+}
+
+// Drop the oldest keyframe and the ticks up to the next one while the rest still cover
+// keepSeconds
+static void TrimFrames(void) {
+    while (true) {
+        int next = 1;
+        while (next < (int)frames.size() && frames[next].keyframe == NULL) next++;
+        if (next >= (int)frames.size() || frames.back().time - frames[next].time < keepSeconds) break;
+
+        for (int n = 0; n < next; n++) {
+            FreeFrame(&frames.front());
+            frames.pop_front();
+        }
+        position -= next;
+    }
+}
+
+static void FreeFrame(rewind_frame_t* frame) {
+    rewindBytes -= frame->deltaSize;
+    free(frame->delta);
+
+    if (frame->keyframe != NULL) {
+        for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+            rewind_blob_t* blob = frame->keyframe[c];
+            if (--blob->refs > 0) continue;
+            rewindBytes -= blob->blob.size;
+            free(blob->blob.data);
+            free(blob);
+        }
+        free(frame->keyframe);
+    }
+    *frame = { 0 };
+}
+
+static void FreeShadow(int c) {
+    if (shadows[c] == NULL) return;
+    free(shadows[c]);
+    shadows[c] = NULL;
+    rewindBytes -= CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t);
+}
@@ -0,0 +1,145 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Shared memory
+*
+*   POSIX shared memory, or a named file mapping on Windows. Names are given the POSIX way,
+*   "/name", and the slash is added or dropped to suit the platform. Segments are created
+*   for reading and writing and opened read only, a reader can never disturb the writer.
+*
+**********************************************************************************************/
+
+#include "shared_memory.h"
+#include "stdio.h"
+#include "string.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void NativeName(const char* name, char* buffer);
+
+//----------------------------------------------------------------------------------
+// Shared Memory Functions Definition
+//----------------------------------------------------------------------------------
+
+// A segment of size bytes, zeroed. Whatever had the name before is replaced
+bool CreateSharedMemory(const char* name, size_t size, shared_memory_t* memory) {
+    memset(memory, 0, sizeof(*memory));
+    memory->handle = -1;
+    NativeName(name, memory->name);
+    const char* native = memory->name;
+
+#if defined(_WIN32)
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFF), native);
+    if (mapping == NULL) return false;
+    void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        return false;
+    }
+    memset(data, 0, size);
+    memory->handle = (long long)(size_t)mapping;
+#else
+    shm_unlink(native);
+    int fd = shm_open(native, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(native);
+        return false;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        shm_unlink(native);
+        return false;
+    }
+    memory->handle = fd;
+#endif
+
+    memory->data = data;
+    memory->size = size;
+    memory->owner = true;
+    return true;
+}
+
+// Map a segment someone else created, read only
+bool OpenSharedMemory(const char* name, shared_memory_t* memory) {
+    memset(memory, 0, sizeof(*memory));
+    memory->handle = -1;
+    NativeName(name, memory->name);
+    const char* native = memory->name;
+
+#if defined(_WIN32)
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, native);
+    if (mapping == NULL) return false;
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        return false;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(data, &info, sizeof(info));
+    memory->handle = (long long)(size_t)mapping;
+    memory->size = info.RegionSize;
+#else
+    int fd = shm_open(native, O_RDONLY, 0);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    memory->handle = fd;
+    memory->size = (size_t)info.st_size;
+#endif
+
+    memory->data = data;
+    return true;
+}
+
+// Readers that still have it mapped keep it until they close it as well
+void CloseSharedMemory(shared_memory_t* memory) {
+    if (memory->data == NULL) return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(memory->data);
+    CloseHandle((HANDLE)(size_t)memory->handle);
+#else
+    munmap(memory->data, memory->size);
+    close((int)memory->handle);
+    if (memory->owner) shm_unlink(memory->name);
+#endif
+
+    memory->data = NULL;
+    memory->size = 0;
+    memory->handle = -1;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void NativeName(const char* name, char* buffer) {
+#if defined(_WIN32)
+    while (*name == '/') name++;
+    snprintf(buffer, SHARED_MEMORY_NAME_MAX, "Local\\%s", name);
+#else
+    snprintf(buffer, SHARED_MEMORY_NAME_MAX, "%s%s", (name[0] == '/') ? "" : "/", name);
+#endif
+}
@@ -0,0 +1,33 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Shared memory
+*
+*   Named shared memory segments for world_export.cpp and the programs that read what it
+*   exports. Kept apart from simulation.h for the same reason as sockets.h, the Windows
+*   headers clash with raylib's
+*
+**********************************************************************************************/
+
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <stddef.h>
+
+#define SHARED_MEMORY_NAME_MAX 256
+
+typedef struct shared_memory_t {
+    void* data;
+    size_t size;
+    long long handle;                   // File descriptor or mapping handle, -1 when closed
+    bool owner;                         // Created it, so removes the name when closing
+    char name[SHARED_MEMORY_NAME_MAX];  // As the platform knows it
+} shared_memory_t;
+
+//----------------------------------------------------------------------------------
+// Shared Memory Functions Declaration (shared_memory.cpp)
+//----------------------------------------------------------------------------------
+bool CreateSharedMemory(const char* name, size_t size, shared_memory_t* memory);
+bool OpenSharedMemory(const char* name, shared_memory_t* memory);
+void CloseSharedMemory(shared_memory_t* memory);
+
+#endif // SHARED_MEMORY_H
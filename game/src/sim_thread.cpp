@@ -0,0 +1,386 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Simulation thread
+*
+*   Runs the simulation on its own thread so a frame costs the longer of a tick and a draw
+*   instead of both. The render thread never touches the grid:
+*     - Edits, settings and the camera for each frame go through a single producer, single
+*       consumer ring of commands that neither side locks
+*     - After every step the simulation captures a render snapshot into the spare one of
+*       three buffers and swaps it into the middle slot. The render thread swaps the middle
+*       slot with the buffer it holds whenever a fresh one is waiting, so neither side ever
+*       waits on the other and a snapshot is never written while it is being drawn
+*
+*   Commands carry the window origin the render thread saw, so edits and the camera land on
+*   the right cells even when streaming moved the window in between.
+*
+*   A frame command can ask for several ticks, a fixed number or as many as fit in a time
+*   budget, to fast forward. Only the last of them is captured, so ticks in between cost no
+*   rendering work at all.
+*
+*   Without a thread every frame command runs its step right away, through the same
+*   commands and snapshots.
+*
+*   While a recording plays back (see replay.cpp) commands from the render thread are
+*   dropped, and each frame plays as many recorded steps as it asked for ticks. In a
+*   lockstep session (see lockstep.cpp) they go to the other players instead, and each
+*   frame runs the ticks everyone's commands are in for, whatever it asked for.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "string.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define COMMAND_QUEUE_SIZE 1024         // Must be a power of two
+#define SNAPSHOT_FRESH 4                // Set on the middle slot until the render thread takes it
+#define MEMORY_STATS_STEPS 60           // Steps between walks of the grid for the memory line
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static particle_t** simGrid = NULL;
+static bool threaded = false;
+
+// Written by the render thread at the head, read by the simulation at the tail
+static sim_command_t commands[COMMAND_QUEUE_SIZE];
+static std::atomic<unsigned int> commandHead(0);
+static std::atomic<unsigned int> commandTail(0);
+
+static render_snapshot_t snapshots[3];
+static std::atomic<int> middleSnapshot(1);
+static std::atomic<unsigned int> drawnTick(0);      // Tick of the snapshot last handed out
+
+// Render thread only
+static int frontSnapshot = 0;
+static bool frontValid = false;
+
+// Simulation thread only
+static int backSnapshot = 2;
+static unsigned int steps = 0;
+static unsigned int ticks = 0;
+static float tickMs = 0.0f;
+static unsigned int frameId = 0;
+static int frameTicks = 0;
+static memory_stats_t memoryStats = { 0 };
+
+// Lets the simulation sleep until the next frame command
+static std::thread simThread;
+static std::mutex wakeMutex;
+static std::condition_variable wakeSignal;
+static std::atomic<bool> running(false);
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void SimLoop(void);
+static void StepSimulation(void);
+static void ApplyCommand(const sim_command_t* command);
+static void RunFrame(const sim_command_t* frame, int tickCount, float fastForwardMs);
+static void ReplayStep(unsigned int id);
+static void PublishSnapshot(Rectangle view);
+static Vector2 OriginOffset(const sim_command_t* command);
+
+//----------------------------------------------------------------------------------
+// Simulation Thread Functions Definition
+//----------------------------------------------------------------------------------
+
+// Everything else has to be initialized first, the thread starts stepping right away
+void InitSimThread(particle_t** grid, bool useThread) {
+    simGrid = grid;
+    threaded = useThread;
+    memset(snapshots, 0, sizeof(snapshots));
+    for (int n = 0; n < 3; n++) {
+        snapshots[n].gasPixels = (Color*) calloc(GetGasFieldCells(), sizeof(Color));
+    }
+
+    running = true;
+    if (threaded) simThread = std::thread(SimLoop);
+}
+
+// Render thread only. Waits for room when the simulation has fallen far behind
+void SubmitSimCommand(const sim_command_t* command) {
+    unsigned int head = commandHead.load(std::memory_order_relaxed);
+    while (head - commandTail.load(std::memory_order_acquire) >= COMMAND_QUEUE_SIZE) {
+        if (threaded) std::this_thread::yield();
+        else StepSimulation();
+    }
+
+    commands[head & (COMMAND_QUEUE_SIZE - 1)] = *command;
+    commandHead.store(head + 1, std::memory_order_release);
+
+    if (command->type != SIM_FRAME) return;
+
+    if (threaded) {
+        // Taking the lock orders this against the check in SimLoop, so no wake up is lost
+        { std::lock_guard<std::mutex> lock(wakeMutex); }
+        wakeSignal.notify_one();
+    }
+    else {
+        StepSimulation();
+    }
+}
+
+// Render thread only. The newest published snapshot, NULL until the first one. It stays
+// valid and unchanged until the next call
+const render_snapshot_t* AcquireSnapshot(void) {
+    if (middleSnapshot.load(std::memory_order_relaxed) & SNAPSHOT_FRESH) {
+        frontSnapshot = middleSnapshot.exchange(frontSnapshot, std::memory_order_acq_rel) & 3;
+        frontValid = true;
+        drawnTick.store(snapshots[frontSnapshot].tick, std::memory_order_release);
+    }
+    return frontValid ? &snapshots[frontSnapshot] : NULL;
+}
+
+// Stops the thread, call before unloading the modules it steps
+void UnloadSimThread(void) {
+    if (threaded) {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running = false;
+        }
+        wakeSignal.notify_one();
+        simThread.join();
+    }
+    running = false;
+
+    for (int n = 0; n < 3; n++) {
+        free(snapshots[n].pixels);
+        free(snapshots[n].dirty);
+        free(snapshots[n].gasPixels);
+    }
+    memset(snapshots, 0, sizeof(snapshots));
+    frontValid = false;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void SimLoop(void) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeSignal.wait_for(lock, std::chrono::milliseconds(2), [] {
+                return !running || commandHead.load() != commandTail.load();
+            });
+            if (!running) break;
+        }
+        StepSimulation();
+    }
+}
+
+// Apply everything queued, then run the ticks the newest frame asked for and publish them.
+// Frames the simulation fell behind on are folded in, running as many ticks as the largest
+static void StepSimulation(void) {
+    sim_command_t frame = { SIM_FRAME };
+    bool haveFrame = false;
+    int tickCount = 0;
+    float fastForwardMs = 0.0f;
+    bool replay = IsReplaying();
+    UpdateLockstep();
+
+    unsigned int tail = commandTail.load(std::memory_order_relaxed);
+    unsigned int head = commandHead.load(std::memory_order_acquire);
+
+    for (; tail != head; tail++) {
+        const sim_command_t* command = &commands[tail & (COMMAND_QUEUE_SIZE - 1)];
+
+        if (command->type == SIM_FRAME) {
+            frame = *command;
+            haveFrame = true;
+            if (command->frame.ticks > tickCount) tickCount = command->frame.ticks;
+            if (command->frame.fastForwardMs > fastForwardMs) fastForwardMs = command->frame.fastForwardMs;
+        }
+        else if (useLockstep && command->type != SIM_SAVE && command->type != SIM_EXPORT) {
+            QueueLockstepCommand(command);
+        }
+        else if (!replay) {
+            ApplyCommand(command);
+        }
+        else if (command->type == SIM_SAVE || command->type == SIM_LOAD || command->type == SIM_EXPORT) {
+            // Nothing but the recording changes the world while it plays
+            free(command->file.path);
+        }
+    }
+    commandTail.store(tail, std::memory_order_release);
+
+    // Between ticks, and before streaming can move the window the edits were placed in
+    ApplyEdits(simGrid);
+
+    if (!haveFrame) return;
+
+    if (useLockstep) {
+        frame.frame.untilSettled = false;
+        RunFrame(&frame, LockstepTicksDue(), 0.0f);
+        return;
+    }
+    if (!replay) {
+        RunFrame(&frame, tickCount, fastForwardMs);
+        return;
+    }
+
+    // Recorded steps stand in for the frame, one for every tick it asked for
+    double replayStart = GetTime();
+    for (int n = 0; IsReplaying() && (n < tickCount || fastForwardMs > 0.0f); n++) {
+        ReplayStep(frame.frame.id);
+        if (fastForwardMs > 0.0f && (GetTime() - replayStart) * 1000.0 >= fastForwardMs) break;
+    }
+}
+
+// Everything but frames, in the order the render thread sent them
+static void ApplyCommand(const sim_command_t* command) {
+    RecordSimCommand(command);
+
+    switch (command->type) {
+    case SIM_EDIT: {
+        Vector2 offset = OriginOffset(command);
+        edit_t edit = command->edit;
+        edit.x0 += (int)offset.x;
+        edit.y0 += (int)offset.y;
+        edit.x1 += (int)offset.x;
+        edit.y1 += (int)offset.y;
+        QueueEdit(&edit);
+    } break;
+    case SIM_SAVE:
+    case SIM_LOAD:
+        // Edits queued before it belong to the world being saved or replaced
+        ApplyEdits(simGrid);
+        if (command->type == SIM_SAVE) SaveWorldFile(simGrid, command->file.path, command->file.compress);
+        else if (LoadWorldFile(simGrid, command->file.path)) {
+            RestartAutosave();
+            ClearHistory();
+            ClearRewind();
+        }
+        free(command->file.path);
+        break;
+    case SIM_EXPORT:
+        ApplyEdits(simGrid);
+        ExportWorldImage(simGrid, command->file.path);
+        free(command->file.path);
+        break;
+    case SIM_CHECKPOINT:
+    case SIM_UNDO:
+    case SIM_REDO:
+        // Edits queued before it belong to the checkpoint before
+        ApplyEdits(simGrid);
+        if (command->type == SIM_CHECKPOINT) BeginCheckpoint();
+        else if (command->type == SIM_UNDO) UndoCheckpoint(simGrid);
+        else RedoCheckpoint(simGrid);
+        break;
+    case SIM_REWIND: {
+        // Edits since the last tick are thrown away with the rest
+        ApplyEdits(simGrid);
+        rewind_stats_t rewind = GetRewindStats();
+        int back = (int)(rewind.tick - rewind.firstTick), ahead = (int)(rewind.lastTick - rewind.tick);
+        int ticks = command->rewindTicks;
+        if (ticks < -back) ticks = -back;
+        if (ticks > ahead) ticks = ahead;
+        RewindTo(simGrid, rewind.tick + ticks);
+    } break;
+    case SIM_SETTINGS:
+        sim->useTemperature = command->settings.useTemperature;
+        sim->useGasField = command->settings.useGasField;
+        sim->useLiquidPressure = command->settings.useLiquidPressure;
+        sim->backend = command->settings.backend;
+        sim->useLod = command->settings.useLod;
+        sim->frameBudget = command->settings.frameBudget;
+        break;
+    case SIM_FRAME:
+        break;
+    }
+}
+
+// Run the ticks of a frame, edits have to be applied already
+static void RunFrame(const sim_command_t* frame, int tickCount, float fastForwardMs) {
+    Vector2 offset = OriginOffset(frame);
+    Rectangle view = { frame->frame.view.x + offset.x, frame->frame.view.y + offset.y,
+                       frame->frame.view.width, frame->frame.view.height };
+
+    if (useStreaming) {
+        Vector2 focus = { frame->frame.focus.x + offset.x, frame->frame.focus.y + offset.y };
+        Vector2Int shift = UpdateStreaming(simGrid, focus, frame->frame.velocity);
+        view.x -= shift.x;
+        view.y -= shift.y;
+    }
+
+    double stepStart = GetTime();
+    frameTicks = 0;
+    while (frameTicks < tickCount || fastForwardMs > 0.0f) {
+        if (frame->frame.untilSettled && CountAwakeChunks() == 0) break;
+
+        // Every player's commands for the tick, in player order
+        if (useLockstep) {
+            sim_command_t command;
+            while (NextLockstepCommand(&command)) ApplyCommand(&command);
+            ApplyEdits(simGrid);
+        }
+
+        double start = GetTime();
+        TickWorld(simGrid, view, frame->frame.dt);
+        tickMs = (float)((GetTime() - start) * 1000.0);
+        ticks++;
+        frameTicks++;
+        if (useLockstep) EndLockstepTick();
+
+        if (fastForwardMs > 0.0f && (GetTime() - stepStart) * 1000.0 >= fastForwardMs) break;
+    }
+    frameId = frame->frame.id;
+    RecordSimFrame(view, frame->frame.dt, frameTicks);
+
+    if (steps++ % MEMORY_STATS_STEPS == 0) memoryStats = GetMemoryStats(simGrid);
+    PublishSnapshot(view);
+    UpdateAutosave(simGrid);
+    UpdateWorldExport(simGrid);
+}
+
+// One recorded step, the commands the simulation took in for it and then its ticks
+static void ReplayStep(unsigned int id) {
+    sim_command_t command;
+    while (ReadReplayCommand(&command)) {
+        if (command.type != SIM_FRAME) {
+            ApplyCommand(&command);
+            continue;
+        }
+        ApplyEdits(simGrid);
+        command.frame.id = id;
+        RunFrame(&command, command.frame.ticks, 0.0f);
+        return;
+    }
+    ApplyEdits(simGrid);
+}
+
+static void PublishSnapshot(Rectangle view) {
+    render_snapshot_t* snapshot = &snapshots[backSnapshot];
+
+    CaptureWorld(simGrid, snapshot, view, drawnTick.load(std::memory_order_acquire));
+    snapshot->gasField = sim->useGasField;
+    if (sim->useGasField) CaptureGasField(snapshot->gasPixels);
+
+    snapshot->simTick = ticks;
+    snapshot->frameId = frameId;
+    snapshot->frameTicks = frameTicks;
+    snapshot->awakeChunks = CountAwakeChunks();
+    snapshot->updatedParticles = sim->updatedParticles;
+    snapshot->actuallyUpdatedParticles = sim->actuallyUpdatedParticles;
+    snapshot->tickMs = tickMs;
+    snapshot->memory = memoryStats;
+    snapshot->budget = GetBudgetStats();
+    if (useStreaming) snapshot->stream = GetStreamingStats();
+    snapshot->rewind = GetRewindStats();
+    snapshot->replay = GetReplayStats();
+    snapshot->lockstep = GetLockstepStats();
+    snapshot->view = view;
+
+    backSnapshot = middleSnapshot.exchange(backSnapshot | SNAPSHOT_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+// Cells to add to a command's positions to bring them into the current window
+static Vector2 OriginOffset(const sim_command_t* command) {
+    return { (float)((command->originX - sim->chunkOriginX) * CHUNK_SIZE), (float)((command->originY - sim->chunkOriginY) * CHUNK_SIZE) };
+}
@@ -0,0 +1,726 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Simulation shared declarations
+*
+*   Particle types, material table and the functions shared between simulation modules
+*
+**********************************************************************************************/
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "raylib.h"
+#include "stddef.h"
+#include "stdio.h"
+
+// World size is chosen at startup, see InitWorld. Rows are STRIDE cells apart so indexing
+// is a shift, and both dimensions are rounded up to whole chunks
+#define WIDTH (sim->width)
+#define HEIGHT (sim->height)
+#define STRIDE (sim->stride)
+
+// Plain thread locals, C++ thread_local goes through a wrapper call on every use of sim
+#if defined(_MSC_VER)
+    #define SIM_THREAD_LOCAL __declspec(thread)
+#else
+    #define SIM_THREAD_LOCAL __thread
+#endif
+
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MAX_BYTES (8 + CHUNK_SIZE * CHUNK_SIZE * 11)     // Largest packed chunk, see compression.cpp
+#define LZ_MAX_BYTES(size) ((size) + (size) / 255 + 16)         // Worst case of CompressLz
+
+// How a chunk is stored in a world file
+#define CODEC_EMPTY 0
+#define CODEC_PACKED 1
+#define CODEC_LZ 2
+
+#define SIM_PATH_MAX 1024               // Longest path a command keeps once written out
+#define SIM_COMMAND_MAX_BYTES (3 + SIM_PATH_MAX)   // Largest WriteSimCommand output
+
+#define LOCKSTEP_MAX_PLAYERS 8
+#define LOCKSTEP_DEFAULT_DELAY 4        // Ticks between a command being made and applied
+
+#define PARTITION_MAX_WORKERS 64
+
+#define EDIT_EMPTY (1u << NOTHING)      // Edit target bit for empty cells, other bits are 1 << material
+#define EDIT_ANY 0xFFFFFFFFu
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct Vector2Int {
+    int x;
+    int y;
+} Vector2Int;
+
+typedef enum particle_state_t {
+    SOLID_STUCK,
+    SOLID,
+    LIQUID,
+    GAS,
+} particle_state_t;
+
+typedef enum particle_mat_t {
+    NOTHING,
+    SAND,
+    WATER,
+    SMOKE,
+    WOOD,
+    LAVA,
+    STONE,
+    FIRE,
+    OIL,
+    STEAM,
+    MATERIAL_COUNT,
+} particle_mat_t;
+
+typedef enum sim_backend_t {
+    BACKEND_SWEEP,              // In place sweep over every particle, the reference behaviour
+    BACKEND_MARGOLUS,           // 2x2 block automaton, order independent and multithreaded
+    BACKEND_DOUBLE_BUFFER,      // Reads the last state, writes the next, order independent and multithreaded
+} sim_backend_t;
+
+typedef struct mat_prop_t {
+    float modX;
+    float modY;
+    float maxX;
+    float maxY;
+    int flammableProbability;
+    float initLifeTime;
+    bool decaying;
+    bool acting;
+    bool flammable;
+    particle_state_t type;
+    Color initialColor;
+    float heatTarget;           // Temperature the material pulls its cell towards
+    float heatRate;             // How fast it does so (per second), 0 for a plain conductor
+    float hotTemperature;       // Turns into hotMat at or above this temperature
+    particle_mat_t hotMat;      // NOTHING when the material has no hot transition
+    float coldTemperature;      // Turns into coldMat when cooling through this temperature
+    particle_mat_t coldMat;     // NOTHING when the material has no cold transition
+} mat_prop_t;
+
+typedef struct particle_t {
+    unsigned int id;
+    float lifeTime;
+    Vector2 velocity;
+    Color color;
+    bool hasBeenUpdated;
+    bool stuck;
+    particle_mat_t mat;
+    float xThreshold;
+    float yThreshold;
+} particle_t;
+
+typedef struct chunk_blob_t {
+    unsigned char* data;
+    int size;
+    unsigned int version;               // Page out count of the chunk when it was captured
+} chunk_blob_t;
+
+// What the packed chunk format keeps of a cell
+typedef struct chunk_cell_t {
+    Color color;
+    float lifeTime;
+    unsigned char mat;                  // NOTHING for an empty cell, nothing else is set then
+} chunk_cell_t;
+
+// World file layout, see world_file.cpp
+typedef struct world_header_t {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short flags;
+    int width;
+    int height;
+    int chunkSize;
+    int originX;
+    int originY;
+    unsigned int materialHash;
+    unsigned int randomState;
+    unsigned int tick;
+    unsigned int chunkCount;
+    unsigned int generation;            // Autosave journal that goes with the file, 0 for none
+} world_header_t;
+
+typedef struct world_chunk_entry_t {
+    unsigned long long offset;
+    unsigned int size;                  // Bytes in the file
+    unsigned int packedSize;            // Bytes once decompressed
+    unsigned char codec;
+    unsigned char awake;
+    unsigned char padding[6];
+} world_chunk_entry_t;
+
+// What goes in a world file header besides the world size and material table
+typedef struct world_file_info_t {
+    int originX;
+    int originY;
+    unsigned int randomState;
+    unsigned int tick;
+    unsigned int generation;
+} world_file_info_t;
+
+// A chunk handed to WriteWorldFile. A NULL blob is an empty chunk, owned ones are freed
+typedef struct world_chunk_t {
+    chunk_blob_t blob;
+    bool owned;
+    bool awake;
+} world_chunk_t;
+
+typedef world_chunk_t (*world_chunk_source_t)(int cx, int cy, void* user);
+
+typedef struct memory_stats_t {
+    size_t gridBytes;
+    size_t particleBytes;
+    size_t packedBytes;
+    int packedChunks;
+} memory_stats_t;
+
+typedef struct budget_stats_t {
+    float usedMs;
+    int ranChunks;
+    int deferredChunks;
+    int owedTicks;                      // Chunk ticks put off to later frames
+    int maxWait;                        // Frames the longest waiting chunk has been put off
+} budget_stats_t;
+
+typedef struct stream_stats_t {
+    unsigned int pageIns;
+    unsigned int pageOuts;
+    unsigned int stalls;                // Page ins that had to read the disk on the spot
+    unsigned int readAheads;
+    unsigned int readAheadBytes;        // Chunks read ahead and waiting to be paged in
+} stream_stats_t;
+
+typedef struct rewind_stats_t {
+    unsigned int firstTick;             // Oldest tick that can be jumped to
+    unsigned int lastTick;
+    unsigned int tick;                  // Tick the world holds, lastTick unless it was rewound
+    float seconds;                      // Simulated time between firstTick and lastTick
+    size_t bytes;
+} rewind_stats_t;
+
+typedef struct replay_stats_t {
+    bool recording;
+    bool playing;
+    unsigned int step;                  // Steps recorded or played back so far
+    unsigned int steps;                 // In the recording being played back
+} replay_stats_t;
+
+// What a recording needs set up before the world is, see replay.cpp
+typedef struct replay_info_t {
+    int width;
+    int height;
+    float rewindSeconds;
+} replay_info_t;
+
+typedef struct lockstep_stats_t {
+    bool active;
+    int player;
+    int players;
+    int inputDelay;
+    unsigned int tick;                  // Ticks run since the session started
+    unsigned int stalls;                // Steps that waited for another player's commands
+    unsigned int desyncs;               // Hashes that didn't match the host's, host only
+    unsigned int resyncedChunks;
+    float inKBps;
+    float outKBps;
+} lockstep_stats_t;
+
+// What joining a lockstep session needs set up before the world is, see lockstep.cpp
+typedef struct lockstep_info_t {
+    int width;
+    int height;
+    float rewindSeconds;
+    int player;
+    int players;
+    unsigned int worldBytes;            // Of the world file the host sends
+} lockstep_info_t;
+
+// A worker of a partitioned world as the coordinator last heard from it, see partition.cpp
+typedef struct partition_stats_t {
+    bool connected;
+    int firstRow;                       // Rows of the world the worker owns
+    int rows;
+    unsigned int tick;
+    float computeMs;                    // Per tick, averaged since the frame before
+    float exchangeMs;                   // Crossings and halos, waiting for the neighbours included
+    float haloKBps;                     // Sent to the neighbours
+    unsigned int crossings;             // Totals since the start
+    unsigned int conflicts;
+    unsigned int lost;
+} partition_stats_t;
+
+// What a worker needs set up before the world is
+typedef struct partition_info_t {
+    int worker;
+    int workers;
+    int width;                          // Of the worker's world, its slab and halos
+    int height;
+    int firstRow;                       // Row of the whole world that is row 0 of the worker's
+} partition_info_t;
+
+typedef enum edit_type_t {
+    EDIT_LINE,
+    EDIT_CIRCLE,
+    EDIT_RECT,
+    EDIT_FLOOD,
+} edit_type_t;
+
+// A change to the world from outside the simulation, see edits.cpp
+typedef struct edit_t {
+    edit_type_t type;
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    int radius;
+    particle_mat_t mat;                 // NOTHING erases
+    unsigned int targets;               // Materials that may be overwritten, see EDIT_EMPTY
+    float density;                      // Chance each cell is written, 1 for all of them
+    unsigned int seed;                  // Picks the cells a spray writes
+} edit_t;
+
+// Switches the simulation reads every tick, the render thread keeps its own copy
+typedef struct sim_settings_t {
+    bool useTemperature;
+    bool useGasField;
+    bool useLiquidPressure;
+    sim_backend_t backend;
+    bool useLod;
+    float frameBudget;
+} sim_settings_t;
+
+typedef enum sim_command_type_t {
+    SIM_FRAME,                          // Camera for the next tick, and whether to run it
+    SIM_EDIT,
+    SIM_SETTINGS,
+    SIM_SAVE,                           // Write the world to a file, see world_file.cpp
+    SIM_LOAD,                           // Replace the world with one from a file
+    SIM_CHECKPOINT,                     // Edits after it undo together, see history.cpp
+    SIM_UNDO,
+    SIM_REDO,
+    SIM_REWIND,                         // Jump by a number of ticks, see rewind.cpp
+    SIM_EXPORT,                         // Write the world to an image, see image_file.cpp
+} sim_command_type_t;
+
+// Positions are in window cells as the render thread saw them, against chunk originX, originY
+typedef struct sim_command_t {
+    sim_command_type_t type;
+    int originX;
+    int originY;
+    union {
+        struct {
+            Rectangle view;
+            Vector2 focus;
+            Vector2 velocity;           // Of the focus, in cells per second
+            float dt;
+            unsigned int id;            // Echoed in the snapshots taken after it
+            int ticks;                  // Ticks to run, 0 to only publish
+            float fastForwardMs;        // Above 0, keep ticking until this much time is spent
+            bool untilSettled;          // Stop ticking once no chunk is awake
+        } frame;
+        edit_t edit;
+        sim_settings_t settings;
+        struct {
+            char* path;                 // Allocated by the sender, freed once handled
+            bool compress;
+        } file;
+        int rewindTicks;                // Negative goes back, clamped to the ticks kept
+    };
+} sim_command_t;
+
+// Slice first to last of a pass RunParallel splits between threads, see workers.cpp
+typedef void (*parallel_job_t)(int first, int last, int worker, void* user);
+
+// State modules keep per world behind a pointer of their own
+typedef struct compression_t compression_t;
+typedef struct temperature_field_t temperature_field_t;
+typedef struct gas_field_t gas_field_t;
+typedef struct liquid_pressure_t liquid_pressure_t;
+typedef struct margolus_t margolus_t;
+typedef struct double_buffer_t double_buffer_t;
+
+// Everything the simulation of one world keeps, so several worlds can run side by side, one
+// to a thread. Code reaches the world of its thread through sim. Edits, undo, rewind,
+// streaming, autosave and the rest of what the game does around the simulation only ever
+// work on mainWorld
+typedef struct sim_world_t {
+    int width;
+    int height;
+    int stride;
+    int shift;                          // Of the row stride, see GetIndex
+    int chunksX;
+    int chunksY;
+    int chunkOriginX;                   // World chunk shown by the window's top left chunk
+    int chunkOriginY;
+
+    // Per chunk, see world.cpp
+    unsigned char* chunkAwake;          // Chunks the sweep visits this tick
+    unsigned char* chunkRun;            // Ticks each chunk covers this tick, 0 when it waits
+    unsigned char* chunkPacked;         // Chunks whose cells point at shared placeholders
+    unsigned char* chunkWake;           // Chunks something changed in during this tick
+    unsigned char* chunkIdle;           // Ticks since the chunk was last woken
+    unsigned char* chunkElapsed;        // Ticks since the chunk last ran
+    unsigned char* chunkLevel;          // Reduced rate level picked this tick, 0 near the view
+    unsigned char* chunkOverdue;        // Frames the chunk has been put off by the budget
+    unsigned int* chunkChanged;         // Capture the chunk last changed in
+    unsigned int lodTick;
+    unsigned int captureTick;
+    int* budgetOrder;
+    unsigned short* budgetPriority;
+    int budgetCount;
+    int budgetNext;
+    double budgetStart;
+    budget_stats_t budgetStats;
+
+    // Materials and particles, see raylib_game.cpp
+    mat_prop_t props[MATERIAL_COUNT];
+    // Can a particle of a given state displace a cell, indexed by material + 1 so empty is 0
+    bool displaceable[GAS + 1][MATERIAL_COUNT + 1];
+    float gravity;
+    unsigned int frameCounter;
+    unsigned int randomState;           // Of SimRandom, saved with the world
+    unsigned int updatedParticles;
+    unsigned int actuallyUpdatedParticles;
+    // Ticks covered by the chunk being swept and its time step, both larger for chunks running
+    // at a reduced rate so falling particles cover the same distance as they would every tick
+    int sweepSteps;
+    float sweepDt;
+
+    bool useTemperature;
+    bool useGasField;
+    bool useLiquidPressure;
+    sim_backend_t backend;
+    bool useLod;
+    float frameBudget;                  // Milliseconds per frame for the sweep, 0 for no limit
+    bool useWorkers;                    // Passes are split over the worker threads, see workers.cpp
+
+    // World file loaded last, packed chunks may point into it. See world_file.cpp
+    unsigned char* fileData;
+    size_t fileSize;
+    bool fileMapped;
+
+    // NULL until the module's Init
+    compression_t* compression;
+    temperature_field_t* temperatureField;
+    gas_field_t* gasField;
+    liquid_pressure_t* liquidPressure;
+    margolus_t* margolus;
+    double_buffer_t* doubleBuffer;
+} sim_world_t;
+
+// What the render thread draws, never written once published. Pixels cover the chunks
+// around the view, dirty lists the chunks that changed since the render thread last drew
+typedef struct render_snapshot_t {
+    Color* pixels;                      // width x height, row by row
+    int capacity;                       // Cells pixels has room for
+    int x, y, width, height;            // In window cells, whole chunks
+    Rectangle view;                     // The view captured for, in window cells
+    int originX;
+    int originY;
+    unsigned int tick;                  // Capture count, newer snapshots have higher ticks
+    int* dirty;                         // Chunk indices
+    int dirtyCount;
+    Color* gasPixels;                   // Gas field, valid when gasField is set
+    bool gasField;
+
+    unsigned int simTick;
+    unsigned int frameId;               // Newest frame command applied
+    int frameTicks;                     // Ticks run for it
+    int awakeChunks;                    // Chunks that still run, 0 once the world settled
+    unsigned int updatedParticles;
+    unsigned int actuallyUpdatedParticles;
+    float tickMs;
+    memory_stats_t memory;
+    budget_stats_t budget;
+    stream_stats_t stream;
+    rewind_stats_t rewind;
+    replay_stats_t replay;
+    lockstep_stats_t lockstep;
+} render_snapshot_t;
+
+//----------------------------------------------------------------------------------
+// Global Variables Declaration (shared by simulation modules)
+//----------------------------------------------------------------------------------
+extern sim_world_t mainWorld;           // The world the game shows
+extern SIM_THREAD_LOCAL sim_world_t* sim; // The world of the calling thread, mainWorld unless set
+extern const char* materialNames[MATERIAL_COUNT];
+extern bool useStreaming;
+extern bool useLockstep;                // Players share the world, the view must not change it
+
+//----------------------------------------------------------------------------------
+// World Functions Declaration (world.cpp)
+//----------------------------------------------------------------------------------
+void InitWorld(int width, int height);
+void UnloadWorld(void);
+void WakeCell(int x, int y);
+void WakeCellIn(unsigned char* wake, int x, int y);
+void MergeWakes(const unsigned char* wake);
+void BeginWorldTick(void);
+void ScheduleChunks(Rectangle view);
+void BeginChunkBudget(void);
+bool NextBudgetChunk(int* cx, int* cy);
+budget_stats_t GetBudgetStats(void);
+int CountAwakeChunks(void);
+bool IsChunkAwake(int cx, int cy);
+unsigned int GetChunkActivity(int cx, int cy);
+void ResetChunkActivity(void);
+unsigned int GetChangeStamp(void);
+bool ChunkChangedSince(int cx, int cy, unsigned int stamp);
+void EndWorldTick(particle_t** grid);
+void CaptureWorld(particle_t** grid, render_snapshot_t* snapshot, Rectangle view, unsigned int drawnTick);
+void DrawWorld(const render_snapshot_t* snapshot);
+void ShiftCells(void* data, int elemSize, int width, int height, int pitch, int dx, int dy, const void* fill);
+void ShiftChunks(int dcx, int dcy);
+
+inline int GetIndex(int x, int y) {
+    return (y << sim->shift) + x;
+}
+
+inline bool IsCellAwake(int x, int y) {
+    return sim->chunkAwake[(y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT)] != 0;
+}
+
+inline bool IsCellRunning(int x, int y) {
+    return sim->chunkRun[(y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT)] != 0;
+}
+
+inline bool IsCellPacked(int x, int y) {
+    return sim->chunkPacked[(y >> CHUNK_SHIFT) * sim->chunksX + (x >> CHUNK_SHIFT)] != 0;
+}
+
+//----------------------------------------------------------------------------------
+// Particle Functions Declaration (raylib_game.cpp)
+//----------------------------------------------------------------------------------
+sim_world_t DefaultWorld(void);         // Empty until InitWorld, with the game's materials and switches
+void InitMoveTables(void);              // After props changes, see displaceable
+particle_t* GetParticle(particle_t** grid, int x, int y);
+particle_t* CreateParticle(particle_mat_t mat);
+void InitParticle(particle_t* particle, particle_mat_t mat);
+int SimRandom(void);
+bool withinBounds(int x, int y);
+void TickWorld(particle_t** grid, Rectangle view, float dt);
+
+//----------------------------------------------------------------------------------
+// Temperature Field Functions Declaration (temperature.cpp)
+//----------------------------------------------------------------------------------
+void InitTemperature(void);
+void UpdateTemperature(particle_t** grid, float dt);
+float GetTemperature(int x, int y);
+void ShiftTemperature(int dx, int dy);
+void ResetTemperature(void);
+void UnloadTemperature(void);
+
+//----------------------------------------------------------------------------------
+// Gas Field Functions Declaration (gas_field.cpp)
+//----------------------------------------------------------------------------------
+void InitGasField(void);
+void UpdateGasField(particle_t** grid, float dt);
+void AddGasDensity(int x, int y, float amount);
+void ShiftGasField(int dx, int dy);
+void ResetGasField(void);
+int GetGasFieldCells(void);
+void CaptureGasField(Color* pixels);
+void DrawGasField(const Color* pixels);
+void UnloadGasField(void);
+
+//----------------------------------------------------------------------------------
+// Liquid Pressure Functions Declaration (liquid_pressure.cpp)
+//----------------------------------------------------------------------------------
+void InitLiquidPressure(void);
+void UpdateLiquidPressure(particle_t** grid);
+bool IsPressureLiquid(particle_mat_t mat);
+void LimitLiquidPressure(int top, int bottom);
+bool IsInteriorLiquid(particle_t** grid, int x, int y);
+void UnloadLiquidPressure(void);
+
+//----------------------------------------------------------------------------------
+// Worker Functions Declaration (workers.cpp)
+//----------------------------------------------------------------------------------
+int GetWorkerCount(void);
+void RunParallel(int count, parallel_job_t job, void* user);
+void UnloadWorkers(void);
+
+//----------------------------------------------------------------------------------
+// Margolus Backend Functions Declaration (margolus.cpp)
+//----------------------------------------------------------------------------------
+void InitMargolus(void);
+void UpdateMargolus(particle_t** grid);
+void UnloadMargolus(void);
+
+//----------------------------------------------------------------------------------
+// Double Buffer Backend Functions Declaration (double_buffer.cpp)
+//----------------------------------------------------------------------------------
+void InitDoubleBuffer(void);
+void UpdateDoubleBuffer(particle_t** grid);
+void UnloadDoubleBuffer(void);
+
+//----------------------------------------------------------------------------------
+// Compression Functions Declaration (compression.cpp)
+//----------------------------------------------------------------------------------
+void InitCompression(void);
+void UpdateCompression(particle_t** grid);
+void UnpackChunk(particle_t** grid, int cx, int cy);
+void UnpackRegion(particle_t** grid, int x0, int y0, int x1, int y1);
+void ShiftCompression(int dcx, int dcy);
+memory_stats_t GetMemoryStats(particle_t** grid);
+chunk_blob_t EncodeChunk(particle_t** grid, int cx, int cy);
+void GatherChunk(particle_t** grid, int cx, int cy, chunk_cell_t* cells);
+chunk_blob_t EncodeCells(const chunk_cell_t* cells);
+bool DecodeCells(const unsigned char* data, int size, chunk_cell_t* cells);
+bool DecodeChunk(particle_t** grid, int cx, int cy, const unsigned char* data, int size);
+const chunk_blob_t* GetPackedChunk(int cx, int cy);
+bool IsValidBlob(chunk_blob_t blob);
+bool IsPlaceholder(const particle_t* p);
+int GetChunkQuiet(int cx, int cy);
+bool AdoptPackedChunk(particle_t** grid, int cx, int cy, chunk_blob_t blob, bool borrowed);
+void DiscardChunk(particle_t** grid, int cx, int cy);
+void OwnBorrowedChunks(void);
+void ClearPackedChunks(void);
+void UnloadCompression(void);
+
+//----------------------------------------------------------------------------------
+// Streaming Functions Declaration (streaming.cpp)
+//----------------------------------------------------------------------------------
+void InitStreaming(const char* directory, int budgetMB);
+Vector2Int UpdateStreaming(particle_t** grid, Vector2 focus, Vector2 velocity);
+stream_stats_t GetStreamingStats(void);
+void UnloadStreaming(void);
+
+//----------------------------------------------------------------------------------
+// Edit Buffer Functions Declaration (edits.cpp)
+//----------------------------------------------------------------------------------
+void InitEdits(void);
+void QueueEdit(const edit_t* edit);
+void ApplyEdits(particle_t** grid);
+void UnloadEdits(void);
+
+//----------------------------------------------------------------------------------
+// Undo History Functions Declaration (history.cpp)
+//----------------------------------------------------------------------------------
+void InitHistory(void);
+void BeginCheckpoint(void);
+void CheckpointChunk(particle_t** grid, int cx, int cy);
+bool UndoCheckpoint(particle_t** grid);
+bool RedoCheckpoint(particle_t** grid);
+void ClearHistory(void);
+void UnloadHistory(void);
+
+//----------------------------------------------------------------------------------
+// World File Functions Declaration (world_file.cpp)
+//----------------------------------------------------------------------------------
+bool PeekWorldFile(const char* path, int* width, int* height);
+bool SaveWorldFile(particle_t** grid, const char* path, bool compress);
+bool LoadWorldFile(particle_t** grid, const char* path);
+bool LoadWorldRows(particle_t** grid, const char* path, int firstRow, int localRow, int rows);
+void UnloadWorldFile(void);
+void ClearGrid(particle_t** grid);
+bool WriteWorldFile(const char* path, const world_file_info_t* info, world_chunk_source_t source, void* user,
+                    bool compress, world_chunk_entry_t* directory);
+bool SyncWorldFile(FILE* file);
+bool IsEmptyBlob(chunk_blob_t blob);
+int CompressLz(const unsigned char* src, int size, unsigned char* dst);
+int DecompressLz(const unsigned char* src, int size, unsigned char* dst, int capacity);
+
+//----------------------------------------------------------------------------------
+// World Image Functions Declaration (image_file.cpp)
+//----------------------------------------------------------------------------------
+void InitWorldImage(const char* palettePath);
+bool PeekWorldImage(const char* path, int* width, int* height);
+bool ImportWorldImage(particle_t** grid, const char* path);
+bool ExportWorldImage(particle_t** grid, const char* path);
+void UnloadWorldImage(void);
+
+//----------------------------------------------------------------------------------
+// Autosave Functions Declaration (autosave.cpp)
+//----------------------------------------------------------------------------------
+void InitAutosave(const char* path, float intervalSeconds);
+bool UpdateAutosave(particle_t** grid);
+void RestartAutosave(void);
+bool ReplayAutosave(particle_t** grid, const char* path, unsigned int generation);
+void UnloadAutosave(particle_t** grid);
+
+//----------------------------------------------------------------------------------
+// World Export Functions Declaration (world_export.cpp)
+//----------------------------------------------------------------------------------
+bool InitWorldExport(const char* name, bool withColors);
+void UpdateWorldExport(particle_t** grid);
+void UnloadWorldExport(void);
+
+//----------------------------------------------------------------------------------
+// Batch Functions Declaration (batch.cpp)
+//----------------------------------------------------------------------------------
+bool SetMaterialValue(const char* setting);
+int RunBatch(const char* sweepPath, const char* outPath, int jobs);
+
+//----------------------------------------------------------------------------------
+// Rewind Functions Declaration (rewind.cpp)
+//----------------------------------------------------------------------------------
+void InitRewind(float seconds);
+bool BeginRewindTick(void);
+void RecordRewindChunk(particle_t** grid, int cx, int cy);
+void EndRewindTick(particle_t** grid, float dt);
+bool RewindTo(particle_t** grid, unsigned int tick);
+rewind_stats_t GetRewindStats(void);
+void ClearRewind(void);
+void UnloadRewind(void);
+
+//----------------------------------------------------------------------------------
+// Replay Functions Declaration (replay.cpp)
+//----------------------------------------------------------------------------------
+bool StartRecording(particle_t** grid, const char* path, float rewindSeconds);
+bool IsRecording(void);
+void RecordSimCommand(const sim_command_t* command);
+void RecordSimFrame(Rectangle view, float dt, int ticks);
+int WriteSimCommand(const sim_command_t* command, unsigned char* out);
+int ReadSimCommand(const unsigned char* data, int size, sim_command_t* command);
+bool OpenReplay(const char* path, replay_info_t* info);
+bool StartReplay(particle_t** grid);
+bool IsReplaying(void);
+bool ReadReplayCommand(sim_command_t* command);
+void RunReplay(void);
+replay_stats_t GetReplayStats(void);
+unsigned int HashChunk(particle_t** grid, int cx, int cy);
+unsigned int CombineChunkHashes(const unsigned int* chunkHashes);
+unsigned int HashWorld(particle_t** grid);
+void UnloadReplay(void);
+
+//----------------------------------------------------------------------------------
+// Lockstep Functions Declaration (lockstep.cpp)
+//----------------------------------------------------------------------------------
+bool HostLockstep(particle_t** grid, int port, int players, int delay, float rewindSeconds);
+bool ConnectLockstep(const char* address, lockstep_info_t* info);
+bool JoinLockstep(particle_t** grid, const lockstep_info_t* info);
+void QueueLockstepCommand(const sim_command_t* command);
+void UpdateLockstep(void);
+int LockstepTicksDue(void);
+bool NextLockstepCommand(sim_command_t* command);
+void EndLockstepTick(void);
+lockstep_stats_t GetLockstepStats(void);
+void UnloadLockstep(void);
+
+//----------------------------------------------------------------------------------
+// Partition Functions Declaration (partition.cpp)
+//----------------------------------------------------------------------------------
+bool CoordinatePartition(int port, int workers, int width, int height, const char* worldFile);
+bool UpdateCoordinator(void);
+const Color* GetPartitionFrame(int* width, int* height, int* scale);
+int GetPartitionWorkers(void);
+partition_stats_t GetPartitionStats(int worker);
+bool ConnectPartition(const char* address, partition_info_t* info);
+bool JoinPartition(particle_t** grid);
+void RunPartitionWorker(float dt);
+void UnloadPartition(void);
+
+//----------------------------------------------------------------------------------
+// Simulation Thread Functions Declaration (sim_thread.cpp)
+//----------------------------------------------------------------------------------
+void InitSimThread(particle_t** grid, bool useThread);
+void SubmitSimCommand(const sim_command_t* command);
+const render_snapshot_t* AcquireSnapshot(void);
+void UnloadSimThread(void);
+
+#endif // SIMULATION_H
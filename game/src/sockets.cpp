@@ -0,0 +1,160 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Sockets
+*
+*   TCP over BSD sockets or Winsock. Every socket handed out is non blocking with Nagle's
+*   algorithm off, lockstep sends small messages every tick and can't wait for them to be
+*   batched. Sends and receives return the bytes moved, 0 when the socket isn't ready and
+*   -1 once the connection is gone.
+*
+**********************************************************************************************/
+
+#include "sockets.h"
+#include "stdio.h"
+#include "string.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #if defined(_MSC_VER)
+        #pragma comment(lib, "ws2_32.lib")
+    #endif
+    typedef SOCKET native_socket_t;
+    #define NATIVE_INVALID INVALID_SOCKET
+    #define WOULD_BLOCK(error) ((error) == WSAEWOULDBLOCK)
+    #define LAST_ERROR WSAGetLastError()
+    #define CloseNative closesocket
+#else
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    typedef int native_socket_t;
+    #define NATIVE_INVALID (-1)
+    #define WOULD_BLOCK(error) ((error) == EWOULDBLOCK || (error) == EAGAIN)
+    #define LAST_ERROR errno
+    #define CloseNative close
+    #if !defined(MSG_NOSIGNAL)
+        #define MSG_NOSIGNAL 0          // macOS, SO_NOSIGPIPE is set on the socket instead
+    #endif
+#endif
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static net_socket_t Prepare(native_socket_t s);
+
+//----------------------------------------------------------------------------------
+// Socket Functions Definition
+//----------------------------------------------------------------------------------
+
+bool InitSockets(void) {
+#if defined(_WIN32)
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return true;
+#endif
+}
+
+// Listen on every interface, INVALID_NET_SOCKET when the port is taken
+net_socket_t ListenSocket(int port) {
+    native_socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == NATIVE_INVALID) return INVALID_NET_SOCKET;
+
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+
+    if (bind(s, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(s, 8) != 0) {
+        CloseNative(s);
+        return INVALID_NET_SOCKET;
+    }
+    return Prepare(s);
+}
+
+// A waiting connection, INVALID_NET_SOCKET when there is none
+net_socket_t AcceptSocket(net_socket_t listener) {
+    native_socket_t s = accept((native_socket_t)listener, NULL, NULL);
+    if (s == NATIVE_INVALID) return INVALID_NET_SOCKET;
+    return Prepare(s);
+}
+
+// Connects before returning, the socket is non blocking from then on
+net_socket_t ConnectSocket(const char* host, int port) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &found) != 0 || found == NULL) return INVALID_NET_SOCKET;
+
+    native_socket_t s = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    if (s != NATIVE_INVALID && connect(s, found->ai_addr, (int)found->ai_addrlen) != 0) {
+        CloseNative(s);
+        s = NATIVE_INVALID;
+    }
+    freeaddrinfo(found);
+
+    if (s == NATIVE_INVALID) return INVALID_NET_SOCKET;
+    return Prepare(s);
+}
+
+int SendSocket(net_socket_t socket, const void* data, int size) {
+#if defined(_WIN32)
+    int sent = send((native_socket_t)socket, (const char*)data, size, 0);
+#else
+    int sent = (int)send((native_socket_t)socket, data, size, MSG_NOSIGNAL);
+#endif
+    if (sent >= 0) return sent;
+    return WOULD_BLOCK(LAST_ERROR) ? 0 : -1;
+}
+
+int ReceiveSocket(net_socket_t socket, void* data, int size) {
+    int received = (int)recv((native_socket_t)socket, (char*)data, size, 0);
+    if (received > 0) return received;
+    if (received == 0) return -1;       // Closed by the other side
+    return WOULD_BLOCK(LAST_ERROR) ? 0 : -1;
+}
+
+void CloseSocket(net_socket_t socket) {
+    if (socket != INVALID_NET_SOCKET) CloseNative((native_socket_t)socket);
+}
+
+void UnloadSockets(void) {
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static net_socket_t Prepare(native_socket_t s) {
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+#if defined(SO_NOSIGPIPE)
+    int noSignal = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+    return (net_socket_t)s;
+}
@@ -0,0 +1,29 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Sockets
+*
+*   Just enough non blocking TCP for lockstep.cpp. Kept apart from simulation.h because
+*   the Windows socket headers pull in windows.h, whose names clash with raylib's
+*
+**********************************************************************************************/
+
+#ifndef SOCKETS_H
+#define SOCKETS_H
+
+#define INVALID_NET_SOCKET (-1)
+
+typedef long long net_socket_t;
+
+//----------------------------------------------------------------------------------
+// Socket Functions Declaration (sockets.cpp)
+//----------------------------------------------------------------------------------
+bool InitSockets(void);
+net_socket_t ListenSocket(int port);
+net_socket_t AcceptSocket(net_socket_t listener);
+net_socket_t ConnectSocket(const char* host, int port);
+int SendSocket(net_socket_t socket, const void* data, int size);
+int ReceiveSocket(net_socket_t socket, void* data, int size);
+void CloseSocket(net_socket_t socket);
+void UnloadSockets(void);
+
+#endif // SOCKETS_H
@@ -0,0 +1,372 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Streaming world
+*
+*   Turns the fixed size grid into a window onto an unbounded world. When the camera gets
+*   close to an edge of the window, the window moves by whole chunks. Chunks falling off the
+*   far side are encoded and handed to a background thread that writes them to the chunk
+*   store on disk. Chunks coming in are decoded from whatever that thread read ahead along
+*   the camera's velocity. When a chunk was not read ahead in time it is read on the spot,
+*   which is counted as a stall.
+*
+*   Each chunk is one file holding the packed format described in compression.cpp.
+*
+*   The store is scratch space for the running session: only chunks paged out since startup
+*   are ever read back, files left by an earlier session are simply overwritten. Velocities
+*   are not stored, chunks only page out far away from the camera.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+
+#define STREAM_LOOKAHEAD 0.75f          // Seconds of camera travel that are read ahead
+
+typedef struct stream_job_t {
+    long long key;
+    bool write;
+    chunk_blob_t blob;                  // Owned by the job when writing
+} stream_job_t;
+
+//----------------------------------------------------------------------------------
+// Global Variables Definition
+//----------------------------------------------------------------------------------
+bool useStreaming = false;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static char storeDirectory[256] = { 0 };
+static size_t budget = 0;
+static stream_stats_t stats = { 0 };
+
+// Shared with the I/O thread, guarded by ioMutex
+static std::thread ioThread;
+static std::mutex ioMutex;
+static std::condition_variable ioWake;
+static std::deque<stream_job_t> jobs;
+static std::unordered_map<long long, chunk_blob_t> pending;     // Paged out, not on disk yet
+static std::unordered_map<long long, chunk_blob_t> readAhead;   // Read, not paged in yet
+static size_t readAheadBytes = 0;
+static bool running = false;
+
+// Simulation thread only
+static std::unordered_map<long long, unsigned int> versions;    // Every chunk ever paged out
+static std::unordered_map<long long, unsigned int> requested;   // Reads handed to the thread
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static long long ChunkKey(int cx, int cy);
+static void GetWindowShift(Vector2 focus, int* dcx, int* dcy);
+static void MoveWindow(particle_t** grid, int dcx, int dcy);
+static void PageOut(particle_t** grid, int cx, int cy);
+static void PageIn(particle_t** grid, int cx, int cy);
+static void RequestReadAhead(int dcx, int dcy);
+static void TrimReadAhead(void);
+static chunk_blob_t ReadChunkFile(long long key);
+static void WriteChunkFile(long long key, chunk_blob_t blob);
+static void StreamWorker(void);
+
+//----------------------------------------------------------------------------------
+// Streaming Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitStreaming(const char* directory, int budgetMB) {
+    snprintf(storeDirectory, sizeof(storeDirectory), "%s", directory);
+    MakeDirectory(storeDirectory);
+
+    budget = (size_t)budgetMB * 1024 * 1024;
+    useStreaming = true;
+    running = true;
+    ioThread = std::thread(StreamWorker);
+}
+
+// Finishes every queued write before returning, the store is complete afterwards
+void UnloadStreaming(void) {
+    if (!useStreaming) return;
+
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+        running = false;
+    }
+    ioWake.notify_one();
+    ioThread.join();
+
+    for (auto& entry : readAhead) free(entry.second.data);
+    readAhead.clear();
+    readAheadBytes = 0;
+    useStreaming = false;
+}
+
+stream_stats_t GetStreamingStats(void) {
+    std::lock_guard<std::mutex> lock(ioMutex);
+    stats.readAheadBytes = (unsigned int)readAheadBytes;
+    return stats;
+}
+
+// Keep the window around the focus point (the camera target, in cells). Returns how far the
+// window moved in cells, anything in window coordinates has to be moved back by as much
+Vector2Int UpdateStreaming(particle_t** grid, Vector2 focus, Vector2 velocity) {
+    int dcx = 0, dcy = 0;
+    GetWindowShift(focus, &dcx, &dcy);
+    if (dcx != 0 || dcy != 0) MoveWindow(grid, dcx, dcy);
+
+    // Read ahead whatever the next move would bring in if the camera keeps going this way
+    Vector2 ahead = {
+        focus.x - dcx * CHUNK_SIZE + velocity.x * STREAM_LOOKAHEAD,
+        focus.y - dcy * CHUNK_SIZE + velocity.y * STREAM_LOOKAHEAD
+    };
+    int nextX = 0, nextY = 0;
+    GetWindowShift(ahead, &nextX, &nextY);
+    if (nextX != 0 || nextY != 0) RequestReadAhead(nextX, nextY);
+
+    TrimReadAhead();
+
+    return { dcx * CHUNK_SIZE, dcy * CHUNK_SIZE };
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static long long ChunkKey(int cx, int cy) {
+    return (long long)(((unsigned long long)(unsigned int)cy << 32) | (unsigned int)cx);
+}
+
+// Recenter on the focus once it gets within a quarter of the window from an edge
+static void GetWindowShift(Vector2 focus, int* dcx, int* dcy) {
+    int marginX = (sim->chunksX / 4 > 1) ? sim->chunksX / 4 : 1;
+    int marginY = (sim->chunksY / 4 > 1) ? sim->chunksY / 4 : 1;
+    int fx = (int)floorf(focus.x / CHUNK_SIZE);
+    int fy = (int)floorf(focus.y / CHUNK_SIZE);
+
+    *dcx = (fx < marginX || fx >= sim->chunksX - marginX) ? fx - sim->chunksX / 2 : 0;
+    *dcy = (fy < marginY || fy >= sim->chunksY - marginY) ? fy - sim->chunksY / 2 : 0;
+}
+
+static void MoveWindow(particle_t** grid, int dcx, int dcy) {
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int nx = cx - dcx, ny = cy - dcy;
+            if (nx < 0 || nx >= sim->chunksX || ny < 0 || ny >= sim->chunksY) PageOut(grid, cx, cy);
+        }
+    }
+
+    ShiftCells(grid, sizeof(particle_t*), WIDTH, HEIGHT, STRIDE, dcx * CHUNK_SIZE, dcy * CHUNK_SIZE, NULL);
+    ShiftChunks(dcx, dcy);
+    ShiftCompression(dcx, dcy);
+    ShiftTemperature(dcx * CHUNK_SIZE, dcy * CHUNK_SIZE);
+    ShiftGasField(dcx * CHUNK_SIZE, dcy * CHUNK_SIZE);
+    sim->chunkOriginX += dcx;
+    sim->chunkOriginY += dcy;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int ox = cx + dcx, oy = cy + dcy;
+            if (ox < 0 || ox >= sim->chunksX || oy < 0 || oy >= sim->chunksY) PageIn(grid, cx, cy);
+        }
+    }
+}
+
+static void PageOut(particle_t** grid, int cx, int cy) {
+    long long key = ChunkKey(sim->chunkOriginX + cx, sim->chunkOriginY + cy);
+    UnpackChunk(grid, cx, cy);
+    chunk_blob_t blob = EncodeChunk(grid, cx, cy);
+
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            free(row[x]);
+            row[x] = NULL;
+        }
+    }
+
+    // An empty chunk that never reached the disk needs no file at all
+    bool empty = IsEmptyBlob(blob);
+    if (empty && versions.find(key) == versions.end()) {
+        free(blob.data);
+        return;
+    }
+
+    blob.version = ++versions[key];
+    stats.pageOuts++;
+
+    std::lock_guard<std::mutex> lock(ioMutex);
+    pending[key] = blob;
+    jobs.push_back({ key, true, blob });
+    ioWake.notify_one();
+}
+
+static void PageIn(particle_t** grid, int cx, int cy) {
+    int wx = sim->chunkOriginX + cx, wy = sim->chunkOriginY + cy;
+    long long key = ChunkKey(wx, wy);
+
+    auto known = versions.find(key);
+    if (known == versions.end()) return;        // Never been here, stays empty
+
+    chunk_blob_t blob = { 0 };
+    {
+        std::lock_guard<std::mutex> lock(ioMutex);
+
+        auto queued = pending.find(key);
+        auto ahead = readAhead.find(key);
+        if (queued != pending.end()) {
+            blob.size = queued->second.size;
+            blob.data = (unsigned char*) malloc(blob.size);
+            memcpy(blob.data, queued->second.data, blob.size);
+        }
+        if (ahead != readAhead.end()) {
+            readAheadBytes -= ahead->second.size;
+            if (blob.data == NULL && ahead->second.version == known->second) blob = ahead->second;
+            else free(ahead->second.data);
+            readAhead.erase(ahead);
+        }
+    }
+    requested.erase(key);
+
+    if (blob.data == NULL) {
+        blob = ReadChunkFile(key);
+        stats.stalls++;
+    }
+
+    if (blob.data == NULL || !DecodeChunk(grid, cx, cy, blob.data, blob.size)) {
+        TraceLog(LOG_WARNING, "STREAM: Chunk %i, %i could not be loaded", wx, wy);
+    }
+    free(blob.data);
+
+    stats.pageIns++;
+    for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y += CHUNK_SIZE - 1) {
+        for (int x = cx * CHUNK_SIZE; x < (cx + 1) * CHUNK_SIZE; x += CHUNK_SIZE - 1) WakeCell(x, y);
+    }
+}
+
+// Ask the thread for every stored chunk a move by dcx, dcy would bring in
+static void RequestReadAhead(int dcx, int dcy) {
+    std::lock_guard<std::mutex> lock(ioMutex);
+    if (readAheadBytes >= budget) return;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int ox = cx + dcx, oy = cy + dcy;
+            if (ox >= 0 && ox < sim->chunksX && oy >= 0 && oy < sim->chunksY) continue;
+
+            long long key = ChunkKey(sim->chunkOriginX + ox, sim->chunkOriginY + oy);
+            auto known = versions.find(key);
+            if (known == versions.end() || pending.count(key) != 0) continue;
+
+            auto asked = requested.find(key);
+            if (asked != requested.end() && asked->second == known->second) continue;
+
+            requested[key] = known->second;
+            jobs.push_back({ key, false, { NULL, 0, known->second } });
+            stats.readAheads++;
+        }
+    }
+    ioWake.notify_one();
+}
+
+// Over budget, drop the read ahead chunks furthest from the window first
+static void TrimReadAhead(void) {
+    std::lock_guard<std::mutex> lock(ioMutex);
+
+    while (readAheadBytes > budget && !readAhead.empty()) {
+        auto furthest = readAhead.begin();
+        long long furthestDistance = -1;
+
+        for (auto it = readAhead.begin(); it != readAhead.end(); ++it) {
+            long long dx = (int)(unsigned int)(it->first & 0xFFFFFFFF) - (sim->chunkOriginX + sim->chunksX / 2);
+            long long dy = (int)(unsigned int)(it->first >> 32) - (sim->chunkOriginY + sim->chunksY / 2);
+            if (dx * dx + dy * dy > furthestDistance) {
+                furthestDistance = dx * dx + dy * dy;
+                furthest = it;
+            }
+        }
+
+        requested.erase(furthest->first);
+        readAheadBytes -= furthest->second.size;
+        free(furthest->second.data);
+        readAhead.erase(furthest);
+    }
+}
+
+static chunk_blob_t ReadChunkFile(long long key) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/chunk_%i_%i.bin", storeDirectory, (int)(unsigned int)(key & 0xFFFFFFFF), (int)(unsigned int)(key >> 32));
+
+    chunk_blob_t blob = { 0 };
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return blob;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size > 0 && size <= CHUNK_MAX_BYTES) {
+        blob.data = (unsigned char*) malloc(size);
+        blob.size = (int)fread(blob.data, 1, size, file);
+    }
+    fclose(file);
+    return blob;
+}
+
+static void WriteChunkFile(long long key, chunk_blob_t blob) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/chunk_%i_%i.bin", storeDirectory, (int)(unsigned int)(key & 0xFFFFFFFF), (int)(unsigned int)(key >> 32));
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return;
+    fwrite(blob.data, 1, blob.size, file);
+    fclose(file);
+}
+
+// Runs jobs in order, so a read queued after a write of the same chunk sees the new file
+static void StreamWorker(void) {
+    std::unique_lock<std::mutex> lock(ioMutex);
+
+    for (;;) {
+        ioWake.wait(lock, [] { return !jobs.empty() || !running; });
+        if (jobs.empty()) break;
+
+        stream_job_t job = jobs.front();
+        jobs.pop_front();
+        lock.unlock();
+
+        if (job.write) {
+            WriteChunkFile(job.key, job.blob);
+
+            lock.lock();
+            auto it = pending.find(job.key);
+            if (it != pending.end() && it->second.data == job.blob.data) pending.erase(it);
+            lock.unlock();
+
+            free(job.blob.data);
+        }
+        else {
+            chunk_blob_t blob = ReadChunkFile(job.key);
+            blob.version = job.blob.version;
+
+            lock.lock();
+            if (blob.data != NULL) {
+                auto it = readAhead.find(job.key);
+                if (it != readAhead.end()) {
+                    readAheadBytes -= it->second.size;
+                    free(it->second.data);
+                }
+                readAhead[job.key] = blob;
+                readAheadBytes += blob.size;
+            }
+            lock.unlock();
+        }
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,299 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Temperature field
+*
+*   A float temperature grid that lives next to the particle grid. Every tick each cell is
+*   pulled towards the heat target of the material occupying it (fire and lava are sources,
+*   water a sink) and the field is diffused with a 5-point stencil. Ignition, extinguishing
+*   and phase changes are then driven by threshold crossings instead of random probing.
+*
+*   A fire cell pulls itself back to its heat target faster than anything next to it cools
+*   it, so it never cools through its own transition to smoke. Water does the putting out
+*   instead: water boiling off turns the fire it touches into smoke.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "raymath.h"
+#include "stdlib.h"
+#include "float.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define TEMPERATURE_SIMD
+#endif
+
+// Particles per temperature cell along each axis, doubled until the field fits in
+// TEMPERATURE_MAX_SIZE so large worlds run it at a coarser resolution
+#define TEMPERATURE_SCALE (sim->temperatureField->temperatureScale)
+#define TEMPERATURE_MAX_SIZE 512
+
+#define TEMPERATURE_WIDTH (WIDTH / TEMPERATURE_SCALE)
+#define TEMPERATURE_HEIGHT (HEIGHT / TEMPERATURE_SCALE)
+
+#define AMBIENT_TEMPERATURE 20.0f
+#define DIFFUSION 0.2f          // Must stay below 0.25 for the explicit stencil to be stable
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+// Kept per world, see sim_world_t
+typedef struct temperature_field_t {
+    int temperatureScale;
+    float* temperature;
+    float* temperatureNext;
+    float* heatTarget;
+    float* heatRate;                    // Per second, scaled by dt when diffusing
+    float* hotThreshold;                // Lowest hot transition of the materials in the cell
+    float* coldThreshold;               // Highest cold transition of the materials in the cell
+} temperature_field_t;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void GatherHeatSources(particle_t** grid);
+static void DiffuseRow(int y, float dt);
+static void ApplyTransitions(particle_t** grid, int tx, int ty);
+static void QuenchFire(particle_t** grid, int x, int y);
+
+//----------------------------------------------------------------------------------
+// Temperature Field Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitTemperature(void) {
+    temperature_field_t* field = (temperature_field_t*) calloc(1, sizeof(temperature_field_t));
+    sim->temperatureField = field;
+    int size = (WIDTH > HEIGHT) ? WIDTH : HEIGHT;
+    field->temperatureScale = 1;
+    while (size / field->temperatureScale > TEMPERATURE_MAX_SIZE) field->temperatureScale *= 2;
+
+    int count = TEMPERATURE_WIDTH * TEMPERATURE_HEIGHT;
+
+    field->temperature = (float*) malloc(count * sizeof(float));
+    field->temperatureNext = (float*) malloc(count * sizeof(float));
+    field->heatTarget = (float*) malloc(count * sizeof(float));
+    field->heatRate = (float*) malloc(count * sizeof(float));
+    field->hotThreshold = (float*) malloc(count * sizeof(float));
+    field->coldThreshold = (float*) malloc(count * sizeof(float));
+
+    ResetTemperature();
+}
+
+// Back to ambient everywhere, as for an empty world. Sleeping chunks keep these until
+// something wakes them
+void ResetTemperature(void) {
+    temperature_field_t* field = sim->temperatureField;
+    int count = TEMPERATURE_WIDTH * TEMPERATURE_HEIGHT;
+    for (int i = 0; i < count; i++) {
+        field->temperature[i] = AMBIENT_TEMPERATURE;
+        field->temperatureNext[i] = AMBIENT_TEMPERATURE;
+        field->heatTarget[i] = sim->props[NOTHING].heatTarget;
+        field->heatRate[i] = sim->props[NOTHING].heatRate;
+        field->hotThreshold[i] = FLT_MAX;
+        field->coldThreshold[i] = -FLT_MAX;
+    }
+}
+
+void UnloadTemperature(void) {
+    temperature_field_t* field = sim->temperatureField;
+    free(field->temperature);
+    free(field->temperatureNext);
+    free(field->heatTarget);
+    free(field->heatRate);
+    free(field->hotThreshold);
+    free(field->coldThreshold);
+    free(field);
+    sim->temperatureField = NULL;
+}
+
+// Follow a window shift of dx, dy particles, cells coming in start at ambient temperature
+void ShiftTemperature(int dx, int dy) {
+    temperature_field_t* field = sim->temperatureField;
+    float ambient = AMBIENT_TEMPERATURE, none = 0, hot = FLT_MAX, cold = -FLT_MAX;
+    int tx = dx / TEMPERATURE_SCALE, ty = dy / TEMPERATURE_SCALE;
+
+    ShiftCells(field->temperature, sizeof(float), TEMPERATURE_WIDTH, TEMPERATURE_HEIGHT, TEMPERATURE_WIDTH, tx, ty, &ambient);
+    ShiftCells(field->heatTarget, sizeof(float), TEMPERATURE_WIDTH, TEMPERATURE_HEIGHT, TEMPERATURE_WIDTH, tx, ty, &ambient);
+    ShiftCells(field->heatRate, sizeof(float), TEMPERATURE_WIDTH, TEMPERATURE_HEIGHT, TEMPERATURE_WIDTH, tx, ty, &none);
+    ShiftCells(field->hotThreshold, sizeof(float), TEMPERATURE_WIDTH, TEMPERATURE_HEIGHT, TEMPERATURE_WIDTH, tx, ty, &hot);
+    ShiftCells(field->coldThreshold, sizeof(float), TEMPERATURE_WIDTH, TEMPERATURE_HEIGHT, TEMPERATURE_WIDTH, tx, ty, &cold);
+}
+
+float GetTemperature(int x, int y) {
+    return sim->temperatureField->temperature[(y / TEMPERATURE_SCALE) * TEMPERATURE_WIDTH + x / TEMPERATURE_SCALE];
+}
+
+void UpdateTemperature(particle_t** grid, float dt) {
+    temperature_field_t* field = sim->temperatureField;
+    GatherHeatSources(grid);
+
+    for (int y = 0; y < TEMPERATURE_HEIGHT; y++) {
+        DiffuseRow(y, dt);
+    }
+
+    // Only cells whose new temperature is past one of their thresholds are looked at again
+    for (int y = 0; y < TEMPERATURE_HEIGHT; y++) {
+        int row = y * TEMPERATURE_WIDTH;
+        int x = 0;
+#if defined(TEMPERATURE_SIMD)
+        for (; x + 4 <= TEMPERATURE_WIDTH; x += 4) {
+            __m128 t0 = _mm_loadu_ps(field->temperature + row + x);
+            __m128 t1 = _mm_loadu_ps(field->temperatureNext + row + x);
+            __m128 hot = _mm_cmpge_ps(t1, _mm_loadu_ps(field->hotThreshold + row + x));
+            __m128 cold = _mm_loadu_ps(field->coldThreshold + row + x);
+            __m128 cooled = _mm_and_ps(_mm_cmpgt_ps(t0, cold), _mm_cmple_ps(t1, cold));
+            int mask = _mm_movemask_ps(_mm_or_ps(hot, cooled));
+
+            if (mask == 0) continue;
+
+            for (int bit = 0; bit < 4; bit++) {
+                if (mask & (1 << bit)) ApplyTransitions(grid, x + bit, y);
+            }
+        }
+#endif
+        for (; x < TEMPERATURE_WIDTH; x++) {
+            int i = row + x;
+            float t1 = field->temperatureNext[i];
+            if (t1 >= field->hotThreshold[i] || (field->temperature[i] > field->coldThreshold[i] && t1 <= field->coldThreshold[i])) {
+                ApplyTransitions(grid, x, y);
+            }
+        }
+    }
+
+    float* tmp = field->temperature;
+    field->temperature = field->temperatureNext;
+    field->temperatureNext = tmp;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Fold the material table into per-cell source terms and thresholds. Cells in sleeping
+// chunks have not changed since they were last gathered and are skipped
+static void GatherHeatSources(particle_t** grid) {
+    temperature_field_t* field = sim->temperatureField;
+    for (int ty = 0; ty < TEMPERATURE_HEIGHT; ty++) {
+        for (int tx = 0; tx < TEMPERATURE_WIDTH; tx++) {
+            if (!IsCellAwake(tx * TEMPERATURE_SCALE, ty * TEMPERATURE_SCALE)) continue;
+
+            float rate = 0, weighted = 0;
+            float hot = FLT_MAX, cold = -FLT_MAX;
+
+            for (int sy = 0; sy < TEMPERATURE_SCALE; sy++) {
+                for (int sx = 0; sx < TEMPERATURE_SCALE; sx++) {
+                    particle_t* p = grid[GetIndex(tx * TEMPERATURE_SCALE + sx, ty * TEMPERATURE_SCALE + sy)];
+                    mat_prop_t* mat = &sim->props[p != NULL ? p->mat : NOTHING];
+
+                    rate += mat->heatRate;
+                    weighted += mat->heatRate * mat->heatTarget;
+                    if (mat->hotMat != NOTHING && mat->hotTemperature < hot) hot = mat->hotTemperature;
+                    if (mat->coldMat != NOTHING && mat->coldTemperature > cold) cold = mat->coldTemperature;
+                }
+            }
+
+            int i = ty * TEMPERATURE_WIDTH + tx;
+            field->heatTarget[i] = (rate > 0) ? weighted / rate : AMBIENT_TEMPERATURE;
+            field->heatRate[i] = rate / (TEMPERATURE_SCALE * TEMPERATURE_SCALE);
+            field->hotThreshold[i] = hot;
+            field->coldThreshold[i] = cold;
+        }
+    }
+}
+
+// One row of: t' = t + k*(up + down + left + right - 4t) + r*(target - t), r = min(rate*dt, 1)
+// Edges are insulated, a missing neighbour counts as the cell itself
+static void DiffuseRow(int y, float dt) {
+    temperature_field_t* field = sim->temperatureField;
+    const float* t = field->temperature + y * TEMPERATURE_WIDTH;
+    const float* up = (y > 0) ? t - TEMPERATURE_WIDTH : t;
+    const float* down = (y < TEMPERATURE_HEIGHT - 1) ? t + TEMPERATURE_WIDTH : t;
+    const float* target = field->heatTarget + y * TEMPERATURE_WIDTH;
+    const float* rate = field->heatRate + y * TEMPERATURE_WIDTH;
+    float* out = field->temperatureNext + y * TEMPERATURE_WIDTH;
+
+    int last = TEMPERATURE_WIDTH - 1;
+    out[0] = t[0] + DIFFUSION * (up[0] + down[0] + t[1] - 3 * t[0]) + fminf(rate[0] * dt, 1.0f) * (target[0] - t[0]);
+
+    int x = 1;
+#if defined(TEMPERATURE_SIMD)
+    const __m128 k = _mm_set1_ps(DIFFUSION);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 step = _mm_set1_ps(dt);
+    for (; x + 4 <= last; x += 4) {
+        __m128 c = _mm_loadu_ps(t + x);
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x)),
+                                _mm_add_ps(_mm_loadu_ps(t + x - 1), _mm_loadu_ps(t + x + 1)));
+        __m128 lap = _mm_sub_ps(sum, _mm_mul_ps(four, c));
+        __m128 r = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(rate + x), step), one);
+        __m128 src = _mm_mul_ps(r, _mm_sub_ps(_mm_loadu_ps(target + x), c));
+        _mm_storeu_ps(out + x, _mm_add_ps(c, _mm_add_ps(_mm_mul_ps(k, lap), src)));
+    }
+#endif
+    for (; x < last; x++) {
+        out[x] = t[x] + DIFFUSION * (up[x] + down[x] + t[x - 1] + t[x + 1] - 4 * t[x]) + fminf(rate[x] * dt, 1.0f) * (target[x] - t[x]);
+    }
+
+    out[last] = t[last] + DIFFUSION * (up[last] + down[last] + t[last - 1] - 3 * t[last]) + fminf(rate[last] * dt, 1.0f) * (target[last] - t[last]);
+}
+
+// Turn the particles under a temperature cell into whatever their thresholds say
+static void ApplyTransitions(particle_t** grid, int tx, int ty) {
+    temperature_field_t* field = sim->temperatureField;
+    int ti = ty * TEMPERATURE_WIDTH + tx;
+    float before = field->temperature[ti];
+    float after = field->temperatureNext[ti];
+
+    // Heat reaches sleeping chunks too, placeholders must never be freed
+    if (IsCellPacked(tx * TEMPERATURE_SCALE, ty * TEMPERATURE_SCALE)) {
+        UnpackChunk(grid, (tx * TEMPERATURE_SCALE) >> CHUNK_SHIFT, (ty * TEMPERATURE_SCALE) >> CHUNK_SHIFT);
+    }
+
+    for (int sy = 0; sy < TEMPERATURE_SCALE; sy++) {
+        for (int sx = 0; sx < TEMPERATURE_SCALE; sx++) {
+            int i = GetIndex(tx * TEMPERATURE_SCALE + sx, ty * TEMPERATURE_SCALE + sy);
+            particle_t* p = grid[i];
+            if (p == NULL) continue;
+
+            mat_prop_t* mat = &sim->props[p->mat];
+            particle_mat_t next = NOTHING;
+
+            if (mat->hotMat != NOTHING && after >= mat->hotTemperature) {
+                next = mat->hotMat;
+            }
+            else if (mat->coldMat != NOTHING && before > mat->coldTemperature && after <= mat->coldTemperature) {
+                next = mat->coldMat;
+            }
+
+            if (next != NOTHING) {
+                bool boiled = (p->mat == WATER);
+                int x = tx * TEMPERATURE_SCALE + sx, y = ty * TEMPERATURE_SCALE + sy;
+
+                free(p);
+                grid[i] = CreateParticle(next);
+                WakeCell(x, y);
+                if (boiled) QuenchFire(grid, x, y);
+            }
+        }
+    }
+}
+
+// Fire next to the cell goes out, as its own cold transition would have it
+static void QuenchFire(particle_t** grid, int x, int y) {
+    static const int offsetX[4] = { 0, 0, -1, 1 };
+    static const int offsetY[4] = { -1, 1, 0, 0 };
+
+    for (int n = 0; n < 4; n++) {
+        int nx = x + offsetX[n], ny = y + offsetY[n];
+        if (nx < 0 || ny < 0 || nx >= WIDTH || ny >= HEIGHT) continue;
+
+        int i = GetIndex(nx, ny);
+        particle_t* p = grid[i];
+        if (p == NULL || p->mat != FIRE || IsPlaceholder(p)) continue;
+
+        free(p);
+        grid[i] = (sim->props[FIRE].coldMat != NOTHING) ? CreateParticle(sim->props[FIRE].coldMat) : NULL;
+        WakeCell(nx, ny);
+    }
+}
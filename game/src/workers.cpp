@@ -0,0 +1,142 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Worker threads
+*
+*   One set of threads for the simulation passes that split rows between threads, started
+*   the first time a pass needs them and left waiting in between. Starting threads for every
+*   pass cost more than many passes take, at several passes a tick and 60 ticks a second.
+*
+*   RunParallel splits a range into one slice per thread, takes the first slice on the
+*   calling thread and returns once every slice is done. Passes come from the simulation
+*   thread one at a time, nothing else calls it while one runs. Workers run each pass on the
+*   world of the thread that started it. Worlds with useWorkers off, one of several run side
+*   by side, keep their passes on their own thread and never touch the pool.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static std::thread* threads = NULL;
+static int threadCount = 0;                 // Workers, the calling thread included
+static std::mutex poolMutex;
+static std::condition_variable passStart;
+static std::condition_variable passEnd;
+static unsigned int generation = 0;         // Passes started, workers wait for the next one
+static int pending = 0;                     // Workers still on the current pass
+static bool stopping = false;
+
+// The current pass, set before generation moves on
+static parallel_job_t passJob = NULL;
+static void* passUser = NULL;
+static sim_world_t* passWorld = NULL;
+static int passCount = 0;
+static int passSlice = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void StartWorkers(void);
+static void WorkerLoop(int worker, unsigned int seen);
+
+//----------------------------------------------------------------------------------
+// Worker Functions Definition
+//----------------------------------------------------------------------------------
+
+// Threads a pass is split between, for passes keeping something of their own per worker
+int GetWorkerCount(void) {
+    if (!sim->useWorkers) return 1;
+    StartWorkers();
+    return threadCount;
+}
+
+// Run job over first to last slices of 0 to count, worker 0 on this thread
+void RunParallel(int count, parallel_job_t job, void* user) {
+    if (count <= 0) return;
+    if (GetWorkerCount() == 1) {
+        job(0, count, 0, user);
+        return;
+    }
+
+    int slice = (count + threadCount - 1) / threadCount;
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        passJob = job;
+        passUser = user;
+        passWorld = sim;
+        passCount = count;
+        passSlice = slice;
+        pending = threadCount - 1;
+        generation++;
+    }
+    passStart.notify_all();
+
+    job(0, (slice < count) ? slice : count, 0, user);
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    passEnd.wait(lock, []() { return pending == 0; });
+}
+
+void UnloadWorkers(void) {
+    if (threads == NULL) return;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopping = true;
+    }
+    passStart.notify_all();
+
+    for (int t = 0; t < threadCount - 1; t++) threads[t].join();
+    delete[] threads;
+    threads = NULL;
+    threadCount = 0;
+    stopping = false;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void StartWorkers(void) {
+    if (threadCount > 0) return;
+
+    // Waiting workers keep the condition variables from being destroyed at exit, so they're
+    // stopped first on the paths that return without UnloadWorkers
+    static bool stopAtExit = false;
+    if (!stopAtExit) atexit(UnloadWorkers);
+    stopAtExit = true;
+
+    threadCount = (int)std::thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > 1) threads = new std::thread[threadCount - 1];
+    for (int t = 1; t < threadCount; t++) threads[t - 1] = std::thread(WorkerLoop, t, generation);
+}
+
+// seen is the pass before the first one this worker takes part in
+static void WorkerLoop(int worker, unsigned int seen) {
+    std::unique_lock<std::mutex> lock(poolMutex);
+
+    while (true) {
+        passStart.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+
+        parallel_job_t job = passJob;
+        void* user = passUser;
+        sim = passWorld;
+        int first = worker * passSlice;
+        int last = (first + passSlice < passCount) ? first + passSlice : passCount;
+
+        lock.unlock();
+        if (first < last) job(first, last, worker, user);
+        lock.lock();
+
+        if (--pending == 0) passEnd.notify_one();
+    }
+}
@@ -0,0 +1,487 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World layout and chunk activity
+*
+*   The world size is picked at startup. The grid is stored row by row with a power of two
+*   row stride (padding cells past WIDTH stay NULL), and is split into CHUNK_SIZE square
+*   chunks that are only swept while something in or right next to them changes. A chunk
+*   that stays unchanged for CHUNK_SLEEP_TICKS ticks falls asleep until it is woken again.
+*
+*   Awake chunks further from the view than LOD_MARGIN chunks run at a reduced rate, every
+*   2nd, 4th or 8th tick depending on distance, and cover the ticks they skipped with a
+*   longer time step. Chunks at one rate are spread over its ticks by position, so the
+*   load stays even from tick to tick.
+*
+*   With a frame budget set, the chunks due in a tick are swept in priority order until the
+*   budget runs out: chunks put off for BUDGET_MAX_WAIT frames, then visible chunks, then
+*   chunks that changed last tick, then the rest. Whatever is left over waits for the next
+*   frame and covers the extra ticks when it does run.
+*
+*   The simulation thread captures the chunks around the view into a render snapshot. Every
+*   chunk that was awake or woken is stamped with the capture it changes in, so a snapshot
+*   buffer being reused only copies what changed since it was last filled, and the render
+*   thread only uploads what changed since the snapshot it drew last.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "raymath.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+
+#define WORLD_MAX_SIZE 16384
+#define CHUNK_SLEEP_TICKS 8
+#define LOD_LEVELS 4                // Every tick, every 2nd, 4th and 8th tick
+#define LOD_MARGIN 1                // Chunks around the view that always run every tick
+#define BUDGET_MAX_WAIT 4           // Frames a chunk can be put off before it goes first
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+// Distance from the view in chunks past which each reduced rate starts
+static const int lodDistance[LOD_LEVELS - 1] = { LOD_MARGIN, 4, 8 };
+
+// Packed chunks drawn from their blob in lockstep, see CaptureWorld
+static chunk_cell_t packedCells[CHUNK_SIZE * CHUNK_SIZE];
+
+// Render thread only, what the view texture currently holds
+static Texture2D viewTexture = { 0 };
+static int drawnX = 0, drawnY = 0, drawnWidth = 0, drawnHeight = 0;
+static int drawnOriginX = 0, drawnOriginY = 0;
+static unsigned int textureTick = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static int CompareBudgetPriority(const void* a, const void* b);
+
+//----------------------------------------------------------------------------------
+// World Functions Definition
+//----------------------------------------------------------------------------------
+
+void InitWorld(int width, int height) {
+    width = (int)Clamp((float)width, CHUNK_SIZE, WORLD_MAX_SIZE);
+    height = (int)Clamp((float)height, CHUNK_SIZE, WORLD_MAX_SIZE);
+
+    sim->width = (width + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    sim->height = (height + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+
+    sim->shift = CHUNK_SHIFT;
+    while ((1 << sim->shift) < sim->width) sim->shift++;
+    sim->stride = 1 << sim->shift;
+
+    sim->chunksX = sim->width / CHUNK_SIZE;
+    sim->chunksY = sim->height / CHUNK_SIZE;
+    sim->chunkAwake = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkWake = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkIdle = (unsigned char*) malloc(sim->chunksX * sim->chunksY * sizeof(unsigned char));
+    memset(sim->chunkIdle, CHUNK_SLEEP_TICKS, sim->chunksX * sim->chunksY);
+    sim->chunkRun = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkElapsed = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkLevel = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkOverdue = (unsigned char*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned char));
+    sim->chunkChanged = (unsigned int*) calloc(sim->chunksX * sim->chunksY, sizeof(unsigned int));
+    sim->budgetOrder = (int*) malloc(sim->chunksX * sim->chunksY * sizeof(int));
+    sim->budgetPriority = (unsigned short*) malloc(sim->chunksX * sim->chunksY * sizeof(unsigned short));
+}
+
+void UnloadWorld(void) {
+    if (sim == &mainWorld && viewTexture.id != 0) {
+        UnloadTexture(viewTexture);
+        viewTexture = { 0 };
+    }
+    free(sim->chunkAwake);
+    free(sim->chunkWake);
+    free(sim->chunkIdle);
+    free(sim->chunkRun);
+    free(sim->chunkElapsed);
+    free(sim->chunkLevel);
+    free(sim->chunkOverdue);
+    free(sim->chunkChanged);
+    free(sim->budgetOrder);
+    free(sim->budgetPriority);
+    sim->chunkAwake = NULL;
+    sim->chunkRun = NULL;
+}
+
+// Something changed at x, y. Its chunk runs next tick, and so does any chunk bordering
+// the cell, since whatever sits on the other side of the border may react to it
+void WakeCell(int x, int y) {
+    WakeCellIn(sim->chunkWake, x, y);
+}
+
+// WakeCell into wake flags of the caller's own, chunksX * chunksY of them, for threads that
+// each keep theirs and merge them once all are done
+void WakeCellIn(unsigned char* wake, int x, int y) {
+    int cx = x >> CHUNK_SHIFT, cy = y >> CHUNK_SHIFT;
+    int lx = x & (CHUNK_SIZE - 1), ly = y & (CHUNK_SIZE - 1);
+
+    int x0 = (lx == 0 && cx > 0) ? cx - 1 : cx;
+    int x1 = (lx == CHUNK_SIZE - 1 && cx < sim->chunksX - 1) ? cx + 1 : cx;
+    int y0 = (ly == 0 && cy > 0) ? cy - 1 : cy;
+    int y1 = (ly == CHUNK_SIZE - 1 && cy < sim->chunksY - 1) ? cy + 1 : cy;
+
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            wake[j * sim->chunksX + i] = 1;
+        }
+    }
+}
+
+void MergeWakes(const unsigned char* wake) {
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) sim->chunkWake[c] |= wake[c];
+}
+
+void BeginWorldTick(void) {
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        // A chunk that was not run last tick had no chance to change, so it doesn't age
+        if (sim->chunkWake[c]) sim->chunkIdle[c] = 0;
+        else if (sim->chunkRun[c] && sim->chunkIdle[c] < CHUNK_SLEEP_TICKS) sim->chunkIdle[c]++;
+
+        sim->chunkAwake[c] = sim->chunkIdle[c] < CHUNK_SLEEP_TICKS;
+        sim->chunkWake[c] = 0;
+    }
+}
+
+// Pick the awake chunks that run this tick, view is the visible part of the world in cells.
+// chunkRun holds how many ticks each of them covers, 0 for chunks that wait
+void ScheduleChunks(Rectangle view) {
+    int vx0 = (int)floorf(view.x) >> CHUNK_SHIFT;
+    int vy0 = (int)floorf(view.y) >> CHUNK_SHIFT;
+    int vx1 = (int)floorf(view.x + view.width) >> CHUNK_SHIFT;
+    int vy1 = (int)floorf(view.y + view.height) >> CHUNK_SHIFT;
+    sim->lodTick++;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (!sim->chunkAwake[c]) {
+                sim->chunkElapsed[c] = 0;
+                sim->chunkOverdue[c] = 0;
+                sim->chunkRun[c] = 0;
+                continue;
+            }
+            if (sim->chunkElapsed[c] < (1 << (LOD_LEVELS - 1))) sim->chunkElapsed[c]++;
+
+            int level = 0;
+            if (sim->useLod) {
+                int dx = (cx < vx0) ? vx0 - cx : (cx > vx1) ? cx - vx1 : 0;
+                int dy = (cy < vy0) ? vy0 - cy : (cy > vy1) ? cy - vy1 : 0;
+                int d = (dx > dy) ? dx : dy;
+                while (level < LOD_LEVELS - 1 && d > lodDistance[level]) level++;
+            }
+
+            // Chunks next to each other get different phases, so each tick runs an even share.
+            // Chunks the budget put off don't wait for their phase
+            int period = 1 << level;
+            bool runs = sim->chunkOverdue[c] || ((sim->lodTick + cx + cy * 3) & (period - 1)) == 0;
+
+            sim->chunkLevel[c] = (unsigned char)level;
+            sim->chunkRun[c] = runs ? sim->chunkElapsed[c] : 0;
+        }
+    }
+}
+
+// Order the chunks due this tick by priority and start the clock on the frame budget
+void BeginChunkBudget(void) {
+    sim->budgetStart = GetTime();
+    sim->budgetStats = { 0 };
+    sim->budgetCount = 0;
+    sim->budgetNext = 0;
+
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if (!sim->chunkRun[c]) continue;
+
+        // Class first, then put off chunks before the ones on time, longest waiting first
+        int cls = (sim->chunkOverdue[c] >= BUDGET_MAX_WAIT) ? 0 : (sim->chunkLevel[c] == 0) ? 1 : (sim->chunkIdle[c] == 0) ? 2 : 3;
+        sim->budgetPriority[c] = (unsigned short)((cls << 8) | (255 - sim->chunkOverdue[c]));
+        sim->budgetOrder[sim->budgetCount++] = c;
+    }
+
+    qsort(sim->budgetOrder, sim->budgetCount, sizeof(int), CompareBudgetPriority);
+}
+
+// Hand out the next chunk to sweep, or false once everything ran or the budget is spent.
+// The first chunk always runs so a tiny budget still makes progress
+bool NextBudgetChunk(int* cx, int* cy) {
+    if (sim->budgetNext < sim->budgetCount && (sim->budgetNext == 0 || (GetTime() - sim->budgetStart) * 1000.0 < sim->frameBudget)) {
+        int c = sim->budgetOrder[sim->budgetNext++];
+        *cx = c % sim->chunksX;
+        *cy = c / sim->chunksX;
+        return true;
+    }
+
+    // Out of time, the rest waits for next frame and piles up ticks meanwhile
+    sim->budgetStats.usedMs = (float)((GetTime() - sim->budgetStart) * 1000.0);
+    sim->budgetStats.ranChunks = sim->budgetNext;
+    for (; sim->budgetNext < sim->budgetCount; sim->budgetNext++) {
+        int c = sim->budgetOrder[sim->budgetNext];
+        sim->chunkRun[c] = 0;
+        if (sim->chunkOverdue[c] < 255) sim->chunkOverdue[c]++;
+
+        sim->budgetStats.deferredChunks++;
+        sim->budgetStats.owedTicks += sim->chunkElapsed[c];
+        if (sim->chunkOverdue[c] > sim->budgetStats.maxWait) sim->budgetStats.maxWait = sim->chunkOverdue[c];
+    }
+    return false;
+}
+
+budget_stats_t GetBudgetStats(void) {
+    return sim->budgetStats;
+}
+
+// Chunks that run next tick unless woken, 0 once everything has gone to sleep
+int CountAwakeChunks(void) {
+    int count = 0;
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) count += IsChunkAwake(cx, cy);
+    }
+    return count;
+}
+
+// Will the chunk run next tick without being woken again
+bool IsChunkAwake(int cx, int cy) {
+    int c = cy * sim->chunksX + cx;
+    int idle = sim->chunkRun[c] ? sim->chunkIdle[c] + 1 : sim->chunkIdle[c];
+    return sim->chunkWake[c] || idle < CHUNK_SLEEP_TICKS;
+}
+
+// Ticks since the chunk was woken, and whether it was woken this tick in bit 8. With the
+// packing state this is what decides when a chunk runs, sleeps and gets packed
+unsigned int GetChunkActivity(int cx, int cy) {
+    int c = cy * sim->chunksX + cx;
+    return sim->chunkIdle[c] | (sim->chunkWake[c] ? 0x100 : 0);
+}
+
+// Put every chunk to sleep and mark it changed, for when the whole grid was replaced
+void ResetChunkActivity(void) {
+    int count = sim->chunksX * sim->chunksY;
+    memset(sim->chunkAwake, 0, count);
+    memset(sim->chunkWake, 0, count);
+    memset(sim->chunkIdle, CHUNK_SLEEP_TICKS, count);
+    memset(sim->chunkRun, 0, count);
+    memset(sim->chunkElapsed, 0, count);
+    memset(sim->chunkOverdue, 0, count);
+    for (int c = 0; c < count; c++) sim->chunkChanged[c] = sim->captureTick + 1;
+}
+
+// Stamp to compare chunks against later. Everything that changes after it is taken counts
+// as changed, and so may anything since the last capture
+unsigned int GetChangeStamp(void) {
+    return sim->captureTick;
+}
+
+// Has anything in the chunk changed since the capture the stamp was taken after. Edits
+// since the last tick are only known through the chunks they woke
+bool ChunkChangedSince(int cx, int cy, unsigned int stamp) {
+    int c = cy * sim->chunksX + cx;
+    return sim->chunkChanged[c] > stamp || sim->chunkWake[c];
+}
+
+// Move a width x height block of cells by dx, dy so that cell (x, y) ends up holding what
+// (x + dx, y + dy) held. Cells with no source are set to fill, or zeroed when fill is NULL
+void ShiftCells(void* data, int elemSize, int width, int height, int pitch, int dx, int dy, const void* fill) {
+    unsigned char* base = (unsigned char*)data;
+    int rowBytes = pitch * elemSize;
+
+    // Walk rows away from the side being overwritten so no source row is clobbered first
+    for (int n = 0; n < height; n++) {
+        int y = (dy >= 0) ? n : height - 1 - n;
+        int sy = y + dy;
+        unsigned char* dst = base + (size_t)y * rowBytes;
+
+        int first = 0, last = width;        // Destination cells that have a source
+        if (sy < 0 || sy >= height) last = 0;
+        else if (dx > 0) last = width - dx;
+        else first = -dx;
+        if (first > width) first = width;
+        if (last < 0) last = 0;
+
+        if (first < last) memmove(dst + first * elemSize, base + (size_t)sy * rowBytes + (first + dx) * elemSize, (last - first) * elemSize);
+        else first = last = width;
+
+        for (int x = 0; x < width; x++) {
+            if (x == first) x = last;
+            if (x >= width) break;
+
+            if (fill != NULL) memcpy(dst + x * elemSize, fill, elemSize);
+            else memset(dst + x * elemSize, 0, elemSize);
+        }
+    }
+}
+
+// The window moved by whole chunks, chunks coming in start awake so everything regathers
+void ShiftChunks(int dcx, int dcy) {
+    unsigned char awake = 1, idle = 0;
+    ShiftCells(sim->chunkAwake, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &awake);
+    ShiftCells(sim->chunkIdle, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &idle);
+    ShiftCells(sim->chunkWake, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &awake);
+    ShiftCells(sim->chunkRun, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &awake);
+    ShiftCells(sim->chunkElapsed, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &idle);
+    ShiftCells(sim->chunkLevel, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &idle);
+    ShiftCells(sim->chunkOverdue, 1, sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &idle);
+    ShiftCells(sim->chunkChanged, sizeof(unsigned int), sim->chunksX, sim->chunksY, sim->chunksX, dcx, dcy, &sim->captureTick);
+}
+
+// Particles only get flagged inside chunks that were awake or woken, so only those are reset.
+// Recording for rewind looks at every particle of those chunks anyway and resets them itself
+void EndWorldTick(particle_t** grid) {
+    bool record = BeginRewindTick();
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (!sim->chunkAwake[c] && !sim->chunkWake[c]) continue;
+
+            // Chunks that ran have caught up, the rest keep counting
+            if (sim->chunkRun[c]) {
+                sim->chunkElapsed[c] = 0;
+                sim->chunkOverdue[c] = 0;
+            }
+            sim->chunkChanged[c] = sim->captureTick + 1;
+
+            if (record) {
+                RecordRewindChunk(grid, cx, cy);
+                continue;
+            }
+
+            for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+                particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    if (row[x] != NULL) row[x]->hasBeenUpdated = false;
+                }
+            }
+        }
+    }
+}
+
+// Fill a snapshot with the chunks around view, the visible part of the world in cells.
+// drawnTick is the tick of the snapshot the render thread drew last
+void CaptureWorld(particle_t** grid, render_snapshot_t* snapshot, Rectangle view, unsigned int drawnTick) {
+    int cx0 = (int)Clamp((float)(((int)floorf(view.x) >> CHUNK_SHIFT) - 1), 0, sim->chunksX - 1);
+    int cy0 = (int)Clamp((float)(((int)floorf(view.y) >> CHUNK_SHIFT) - 1), 0, sim->chunksY - 1);
+    int cx1 = (int)Clamp((float)(((int)floorf(view.x + view.width) >> CHUNK_SHIFT) + 1), 0, sim->chunksX - 1);
+    int cy1 = (int)Clamp((float)(((int)floorf(view.y + view.height) >> CHUNK_SHIFT) + 1), 0, sim->chunksY - 1);
+    int x0 = cx0 * CHUNK_SIZE, y0 = cy0 * CHUNK_SIZE;
+    int w = (cx1 + 1) * CHUNK_SIZE - x0, h = (cy1 + 1) * CHUNK_SIZE - y0;
+
+    // Placeholders only carry the base colour, anything drawn comes from real particles.
+    // Unpacking draws on the random state, so in lockstep packed chunks are drawn from
+    // their blob instead and what is on screen can't change the simulation
+    if (!useLockstep) UnpackRegion(grid, x0, y0, x0 + w, y0 + h);
+
+    // Edits since the last tick are only known through the chunks they woke
+    sim->captureTick++;
+    for (int c = 0; c < sim->chunksX * sim->chunksY; c++) {
+        if (sim->chunkWake[c]) sim->chunkChanged[c] = sim->captureTick;
+    }
+
+    // Anything but the same area of the same window was never copied into this buffer
+    unsigned int since = snapshot->tick;
+    if (snapshot->x != x0 || snapshot->y != y0 || snapshot->width != w || snapshot->height != h ||
+        snapshot->originX != sim->chunkOriginX || snapshot->originY != sim->chunkOriginY) since = 0;
+
+    if (w * h > snapshot->capacity) {
+        free(snapshot->pixels);
+        free(snapshot->dirty);
+        snapshot->pixels = (Color*) malloc(w * h * sizeof(Color));
+        snapshot->dirty = (int*) malloc(sim->chunksX * sim->chunksY * sizeof(int));
+        snapshot->capacity = w * h;
+        since = 0;
+    }
+
+    snapshot->x = x0;
+    snapshot->y = y0;
+    snapshot->width = w;
+    snapshot->height = h;
+    snapshot->originX = sim->chunkOriginX;
+    snapshot->originY = sim->chunkOriginY;
+    snapshot->tick = sim->captureTick;
+    snapshot->dirtyCount = 0;
+
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * sim->chunksX + cx;
+            if (sim->chunkChanged[c] > drawnTick) snapshot->dirty[snapshot->dirtyCount++] = c;
+            if (since != 0 && sim->chunkChanged[c] <= since) continue;
+
+            if (useLockstep && sim->chunkPacked[c]) {
+                GatherChunk(grid, cx, cy, packedCells);
+                for (int y = 0; y < CHUNK_SIZE; y++) {
+                    Color* out = snapshot->pixels + (cy * CHUNK_SIZE + y - y0) * w + cx * CHUNK_SIZE - x0;
+                    const chunk_cell_t* cell = packedCells + y * CHUNK_SIZE;
+                    for (int x = 0; x < CHUNK_SIZE; x++) out[x] = (cell[x].mat != NOTHING) ? cell[x].color : BLANK;
+                }
+                continue;
+            }
+
+            for (int y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE; y++) {
+                particle_t** row = grid + GetIndex(cx * CHUNK_SIZE, y);
+                Color* out = snapshot->pixels + (y - y0) * w + cx * CHUNK_SIZE - x0;
+                for (int x = 0; x < CHUNK_SIZE; x++) {
+                    out[x] = (row[x] != NULL) ? row[x]->color : BLANK;
+                }
+            }
+        }
+    }
+}
+
+// Draw a snapshot, must be called inside BeginMode2D with the camera the view was taken from.
+// Only rows holding dirty chunks are uploaded unless the snapshot covers a different area
+void DrawWorld(const render_snapshot_t* snapshot) {
+    int w = snapshot->width, h = snapshot->height;
+
+    if (w > viewTexture.width || h > viewTexture.height) {
+        int tw = (w > viewTexture.width) ? w : viewTexture.width;
+        int th = (h > viewTexture.height) ? h : viewTexture.height;
+
+        if (viewTexture.id != 0) UnloadTexture(viewTexture);
+        Color* pixels = (Color*) calloc(tw * th, sizeof(Color));
+        Image image = { pixels, tw, th, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        viewTexture = LoadTextureFromImage(image);
+        free(pixels);
+        drawnWidth = 0;
+    }
+
+    bool sameArea = snapshot->x == drawnX && snapshot->y == drawnY && w == drawnWidth && h == drawnHeight &&
+                    snapshot->originX == drawnOriginX && snapshot->originY == drawnOriginY;
+
+    if (!sameArea) {
+        UpdateTextureRec(viewTexture, { 0, 0, (float)w, (float)h }, snapshot->pixels);
+    }
+    else if (snapshot->tick != textureTick && snapshot->dirtyCount > 0) {
+        int row0 = h, row1 = 0;
+        for (int n = 0; n < snapshot->dirtyCount; n++) {
+            int y = (snapshot->dirty[n] / sim->chunksX) * CHUNK_SIZE - snapshot->y;
+            if (y < row0) row0 = y;
+            if (y + CHUNK_SIZE > row1) row1 = y + CHUNK_SIZE;
+        }
+        UpdateTextureRec(viewTexture, { 0, (float)row0, (float)w, (float)(row1 - row0) }, snapshot->pixels + row0 * w);
+    }
+
+    drawnX = snapshot->x;
+    drawnY = snapshot->y;
+    drawnWidth = w;
+    drawnHeight = h;
+    drawnOriginX = snapshot->originX;
+    drawnOriginY = snapshot->originY;
+    textureTick = snapshot->tick;
+
+    DrawRectangle(snapshot->x, snapshot->y, w, h, BLACK);
+    DrawTexturePro(viewTexture,
+                   { 0, 0, (float)w, (float)h },
+                   { (float)snapshot->x, (float)snapshot->y, (float)w, (float)h },
+                   { 0, 0 }, 0.0f, WHITE);
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Lower first, chunk index breaks ties so the order is the same every run
+static int CompareBudgetPriority(const void* a, const void* b) {
+    int ca = *(const int*)a, cb = *(const int*)b;
+    if (sim->budgetPriority[ca] != sim->budgetPriority[cb]) return sim->budgetPriority[ca] - sim->budgetPriority[cb];
+    return ca - cb;
+}
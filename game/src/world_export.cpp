@@ -0,0 +1,173 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World export
+*
+*   Publishes the world's cells in shared memory, laid out as in world_export.h, so viewers,
+*   metrics exporters and recorders outside the game can watch it without asking the
+*   simulation for anything. Readers only ever map the segment, the simulation never waits
+*   on them and doesn't know how many there are.
+*
+*   A publish follows every captured snapshot, on the simulation thread, and only rewrites
+*   the chunks that changed since the last one, going by the same change stamps autosave
+*   uses. Packed chunks are read from their blob, so nothing gets unpacked for the export
+*   and the random state is left alone. Moving the streaming window rewrites everything.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "shared_memory.h"
+#include "world_export.h"
+#include "stdlib.h"
+#include "string.h"
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static shared_memory_t segment = { 0 };
+static world_export_header_t* header = NULL;
+static unsigned char* materials = NULL;
+static Color* colors = NULL;
+static unsigned int* dirty = NULL;
+static unsigned int* chunkFrames = NULL;
+static unsigned int changeStamp = 0;
+static bool needFull = true;
+static chunk_cell_t cells[CHUNK_SIZE * CHUNK_SIZE];
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void ExportChunk(particle_t** grid, int cx, int cy);
+
+//----------------------------------------------------------------------------------
+// World Export Functions Definition
+//----------------------------------------------------------------------------------
+
+// Create the segment under name, with the colour of every cell as well when withColors
+bool InitWorldExport(const char* name, bool withColors) {
+    int chunkCount = sim->chunksX * sim->chunksY;
+    unsigned int cellCount = (unsigned int)(WIDTH * HEIGHT);
+    unsigned int offset = (sizeof(world_export_header_t) + 63) & ~63u;
+
+    world_export_header_t layout = { 0 };
+    layout.materials = offset;
+    offset += (cellCount + 63) & ~63u;
+    if (withColors) {
+        layout.colors = offset;
+        offset += cellCount * sizeof(Color);
+    }
+    layout.dirty = offset;
+    offset += ((chunkCount + 31) / 32) * sizeof(unsigned int);
+    layout.chunkFrames = offset;
+    offset += chunkCount * sizeof(unsigned int);
+    layout.bytes = offset;
+
+    if (!CreateSharedMemory(name, layout.bytes, &segment)) {
+        TraceLog(LOG_WARNING, "EXPORT: Couldn't create shared memory %s", name);
+        return false;
+    }
+
+    unsigned char* base = (unsigned char*)segment.data;
+    header = (world_export_header_t*)base;
+    materials = base + layout.materials;
+    colors = withColors ? (Color*)(base + layout.colors) : NULL;
+    dirty = (unsigned int*)(base + layout.dirty);
+    chunkFrames = (unsigned int*)(base + layout.chunkFrames);
+
+    header->magic = WORLD_EXPORT_MAGIC;
+    header->version = WORLD_EXPORT_VERSION;
+    header->flags = withColors ? WORLD_EXPORT_COLORS : 0;
+    header->width = WIDTH;
+    header->height = HEIGHT;
+    header->chunkSize = CHUNK_SIZE;
+    header->chunksX = sim->chunksX;
+    header->chunksY = sim->chunksY;
+    header->materialCount = MATERIAL_COUNT;
+    header->materials = layout.materials;
+    header->colors = layout.colors;
+    header->dirty = layout.dirty;
+    header->chunkFrames = layout.chunkFrames;
+    header->bytes = layout.bytes;
+    header->sequence.store(0, std::memory_order_release);
+
+    needFull = true;
+    TraceLog(LOG_INFO, "EXPORT: Sharing the world as %s (%.1f MB)", name, layout.bytes / (1024.0f * 1024.0f));
+    return true;
+}
+
+// Simulation thread, right after a snapshot was captured so the change stamps line up
+void UpdateWorldExport(particle_t** grid) {
+    if (header == NULL) return;
+    if (header->originX != sim->chunkOriginX || header->originY != sim->chunkOriginY) needFull = true;
+
+    int chunkCount = sim->chunksX * sim->chunksY;
+    unsigned int frame = header->frame + 1;
+
+    // Odd from here until the publish is whole, readers drop whatever they read meanwhile
+    unsigned int sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memset(dirty, 0, ((chunkCount + 31) / 32) * sizeof(unsigned int));
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            if (!needFull && !ChunkChangedSince(cx, cy, changeStamp)) continue;
+
+            int c = cy * sim->chunksX + cx;
+            ExportChunk(grid, cx, cy);
+            dirty[c >> 5] |= 1u << (c & 31);
+            chunkFrames[c] = frame;
+        }
+    }
+
+    header->originX = sim->chunkOriginX;
+    header->originY = sim->chunkOriginY;
+    header->tick = (unsigned int)sim->frameCounter;
+    header->frame = frame;
+    header->sequence.store(sequence + 2, std::memory_order_release);
+
+    changeStamp = GetChangeStamp();
+    needFull = false;
+}
+
+// The name goes with the segment, readers that have it mapped keep their copy
+void UnloadWorldExport(void) {
+    if (header == NULL) return;
+    CloseSharedMemory(&segment);
+    header = NULL;
+    materials = NULL;
+    colors = NULL;
+    dirty = NULL;
+    chunkFrames = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static void ExportChunk(particle_t** grid, int cx, int cy) {
+    int x0 = cx * CHUNK_SIZE, y0 = cy * CHUNK_SIZE;
+
+    if (GetPackedChunk(cx, cy) != NULL) {
+        GatherChunk(grid, cx, cy, cells);
+        for (int y = 0; y < CHUNK_SIZE; y++) {
+            const chunk_cell_t* cell = cells + y * CHUNK_SIZE;
+            unsigned char* mat = materials + (y0 + y) * WIDTH + x0;
+            for (int x = 0; x < CHUNK_SIZE; x++) mat[x] = cell[x].mat;
+            if (colors == NULL) continue;
+
+            Color* color = colors + (y0 + y) * WIDTH + x0;
+            for (int x = 0; x < CHUNK_SIZE; x++) color[x] = (cell[x].mat != NOTHING) ? cell[x].color : BLANK;
+        }
+        return;
+    }
+
+    for (int y = y0; y < y0 + CHUNK_SIZE; y++) {
+        particle_t** row = grid + GetIndex(x0, y);
+        unsigned char* mat = materials + y * WIDTH + x0;
+        for (int x = 0; x < CHUNK_SIZE; x++) mat[x] = (row[x] != NULL) ? (unsigned char)row[x]->mat : (unsigned char)NOTHING;
+        if (colors == NULL) continue;
+
+        Color* color = colors + y * WIDTH + x0;
+        for (int x = 0; x < CHUNK_SIZE; x++) color[x] = (row[x] != NULL) ? row[x]->color : BLANK;
+    }
+}
@@ -0,0 +1,61 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World export layout
+*
+*   What world_export.cpp puts in shared memory, for programs outside the game to read.
+*   Needs nothing but the standard library, tools include it on its own.
+*
+*   The segment starts with world_export_header_t, then at the offsets it gives:
+*     - materials: u8 material per cell, rows of width cells top to bottom
+*     - colors: r, g, b, a per cell laid out the same, when WORLD_EXPORT_COLORS is set
+*     - dirty: a bit per chunk, bit c % 32 of u32 word c / 32 for chunk c = cy * chunksX + cx,
+*       set for the chunks written by the latest publish
+*     - chunk frames: u32 per chunk, the publish that last wrote it, so a reader that missed
+*       publishes still knows what it has to read again
+*
+*   The header's sequence is a seqlock. The writer makes it odd before it touches anything
+*   and even again once it is done. A reader takes the sequence, reads what it wants if it
+*   was even, and keeps what it read only if the sequence is still the same afterwards:
+*
+*       unsigned int before = header->sequence.load(std::memory_order_acquire);
+*       if (before & 1) retry;
+*       ... read cells, dirty bits, tick ...
+*       std::atomic_thread_fence(std::memory_order_acquire);
+*       if (header->sequence.load(std::memory_order_relaxed) != before) retry;
+*
+**********************************************************************************************/
+
+#ifndef WORLD_EXPORT_H
+#define WORLD_EXPORT_H
+
+#include <atomic>
+
+#define WORLD_EXPORT_MAGIC 0x58455050   // "PPEX"
+#define WORLD_EXPORT_VERSION 1
+#define WORLD_EXPORT_COLORS 1           // Flag, the colour of every cell is exported as well
+
+typedef struct world_export_header_t {
+    unsigned int magic;
+    unsigned int version;
+    std::atomic<unsigned int> sequence;
+    unsigned int flags;
+    int width;                          // Cells
+    int height;
+    int chunkSize;
+    int chunksX;
+    int chunksY;
+    int originX;                        // World chunk at the top left, moves with streaming
+    int originY;
+    unsigned int tick;                  // Simulation tick the cells are from
+    unsigned int frame;                 // Publishes so far, the first one writes every chunk
+    unsigned int materialCount;
+    unsigned int materials;             // Byte offsets from the start of the segment
+    unsigned int colors;                // 0 without WORLD_EXPORT_COLORS
+    unsigned int dirty;
+    unsigned int chunkFrames;
+    unsigned int bytes;                 // Whole segment
+} world_export_header_t;
+
+static_assert(std::atomic<unsigned int>::is_always_lock_free, "the seqlock has to work across processes");
+
+#endif // WORLD_EXPORT_H
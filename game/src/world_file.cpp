@@ -0,0 +1,570 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World files
+*
+*   Saves the world to a single file and loads it back. Little endian throughout:
+*     header       u32 magic "PPWF", u16 version, u16 flags, i32 width, height, chunk size,
+*                  i32 chunk originX, originY, u32 material table hash, u32 random state,
+*                  u32 tick, u32 chunk count, u32 autosave generation (see autosave.cpp)
+*     directory    per chunk, row by row: u64 offset, u32 size, u32 packed size, u8 codec,
+*                  u8 awake, u8 padding[6]. Empty chunks have no data
+*     chunk data   each chunk in the packed format described in compression.cpp, per row
+*                  runs of materials followed by what each cell adds. Stored as is, or
+*                  with WORLD_LZ through a small LZ4 style compressor when that is smaller
+*
+*   Writing streams chunk by chunk from a source callback and never holds more than one
+*   encoded chunk. Saving the world uses the grid as the source, chunks that are packed
+*   already are written straight from their blob. Files are flushed to the disk before they
+*   are closed.
+*
+*   Loading doesn't allocate particles. Every chunk is installed as a packed chunk whose
+*   cells point at shared placeholders, and it only gets real particles once it wakes or
+*   comes into view. On POSIX systems the file is mapped, and chunks stored as is are used
+*   straight from the mapping, so opening a large world costs little more than walking the
+*   material runs of its non empty chunks. The mapping stays until the next save or load.
+*   A slice of rows can be loaded on its own, which is how partition.cpp hands each worker
+*   its part of a world.
+*
+*   Velocities and the temperature and gas fields are not saved, they start from rest.
+*   With streaming only the window is saved.
+*
+**********************************************************************************************/
+
+#include "simulation.h"
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define WORLD_MMAP
+#else
+    #include <io.h>
+#endif
+
+#define WORLD_MAGIC 0x46575050          // "PPWF" read as a little endian u32
+#define WORLD_VERSION 1
+#define WORLD_LZ 1                      // Header flag, some chunks may be compressed
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5              // Always end in literals, as LZ4 does
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static world_chunk_t GridChunk(int cx, int cy, void* user);
+static bool ReadHeader(FILE* file, world_header_t* header, const char* path);
+static bool ReadHeaderFile(const char* path, world_header_t* header);
+static bool LoadChunkRows(particle_t** grid, const char* path, const world_header_t* header, int firstRow, int localRow, int rows);
+static bool OpenFileData(const char* path);
+static unsigned int MaterialHash(void);
+static unsigned int HashValue(unsigned int hash, unsigned int value);
+static unsigned int HashFloat(unsigned int hash, float value);
+static int PutLength(unsigned char* dst, int out, int length);
+
+//----------------------------------------------------------------------------------
+// World File Functions Definition
+//----------------------------------------------------------------------------------
+
+// Size of the world in a file, so the world can be created to match before loading it
+bool PeekWorldFile(const char* path, int* width, int* height) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "WORLD: Could not open %s", path);
+        return false;
+    }
+
+    world_header_t header = { 0 };
+    bool ok = ReadHeader(file, &header, path);
+    fclose(file);
+
+    if (ok) {
+        *width = header.width;
+        *height = header.height;
+    }
+    return ok;
+}
+
+bool SaveWorldFile(particle_t** grid, const char* path, bool compress) {
+    // The file may be the one packed chunks are borrowed from
+    UnloadWorldFile();
+
+    world_file_info_t info = { sim->chunkOriginX, sim->chunkOriginY, sim->randomState, sim->frameCounter, 0 };
+    return WriteWorldFile(path, &info, GridChunk, grid, compress, NULL);
+}
+
+// Write a world file of the current world size, asking source for every chunk row by row.
+// Fills directory, when given, with where each chunk ended up. Safe on any thread as long
+// as source is
+bool WriteWorldFile(const char* path, const world_file_info_t* info, world_chunk_source_t source, void* user,
+                    bool compress, world_chunk_entry_t* directory) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "WORLD: Could not write %s", path);
+        return false;
+    }
+
+    world_header_t header = { 0 };
+    header.magic = WORLD_MAGIC;
+    header.version = WORLD_VERSION;
+    header.flags = compress ? WORLD_LZ : 0;
+    header.width = WIDTH;
+    header.height = HEIGHT;
+    header.chunkSize = CHUNK_SIZE;
+    header.originX = info->originX;
+    header.originY = info->originY;
+    header.materialHash = MaterialHash();
+    header.randomState = info->randomState;
+    header.tick = info->tick;
+    header.chunkCount = sim->chunksX * sim->chunksY;
+    header.generation = info->generation;
+
+    // The directory goes in once every chunk's place is known
+    world_chunk_entry_t* entries = (directory != NULL) ? directory : (world_chunk_entry_t*) malloc(header.chunkCount * sizeof(world_chunk_entry_t));
+    memset(entries, 0, header.chunkCount * sizeof(world_chunk_entry_t));
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries, sizeof(world_chunk_entry_t), header.chunkCount, file);
+
+    unsigned long long offset = sizeof(header) + (unsigned long long)header.chunkCount * sizeof(world_chunk_entry_t);
+    unsigned char* lz = compress ? (unsigned char*) malloc(LZ_MAX_BYTES(CHUNK_MAX_BYTES)) : NULL;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            world_chunk_entry_t* entry = &entries[cy * sim->chunksX + cx];
+            world_chunk_t chunk = source(cx, cy, user);
+            entry->awake = chunk.awake;
+
+            if (chunk.blob.data != NULL && !IsEmptyBlob(chunk.blob)) {
+                const unsigned char* data = chunk.blob.data;
+                int size = chunk.blob.size;
+                entry->codec = CODEC_PACKED;
+
+                if (compress) {
+                    int lzSize = CompressLz(chunk.blob.data, chunk.blob.size, lz);
+                    if (lzSize < chunk.blob.size) {
+                        data = lz;
+                        size = lzSize;
+                        entry->codec = CODEC_LZ;
+                    }
+                }
+
+                fwrite(data, 1, size, file);
+                entry->offset = offset;
+                entry->size = size;
+                entry->packedSize = chunk.blob.size;
+                offset += size;
+            }
+
+            if (chunk.owned) free(chunk.blob.data);
+        }
+    }
+
+    fseek(file, sizeof(header), SEEK_SET);
+    fwrite(entries, sizeof(world_chunk_entry_t), header.chunkCount, file);
+
+    bool ok = SyncWorldFile(file);
+    if (fclose(file) != 0) ok = false;
+    if (directory == NULL) free(entries);
+    free(lz);
+
+    if (ok) TraceLog(LOG_INFO, "WORLD: Saved %s (%.1f MB)", path, offset / (1024.0f * 1024.0f));
+    else TraceLog(LOG_WARNING, "WORLD: Failed writing %s", path);
+    return ok;
+}
+
+// Replace the world with the one in the file, which has to be the same size. The world is
+// left as it was when the file can't be used
+bool LoadWorldFile(particle_t** grid, const char* path) {
+    world_header_t header = { 0 };
+    if (!ReadHeaderFile(path, &header)) return false;
+
+    if (header.width != WIDTH || header.height != HEIGHT) {
+        TraceLog(LOG_WARNING, "WORLD: %s is %ix%i, the world is %ix%i", path, header.width, header.height, WIDTH, HEIGHT);
+        return false;
+    }
+    if (!LoadChunkRows(grid, path, &header, 0, 0, sim->chunksY)) return false;
+
+    // Autosaves carry a journal of the chunks saved since the file was written
+    if (header.generation != 0) ReplayAutosave(grid, path, header.generation);
+
+    TraceLog(LOG_INFO, "WORLD: Loaded %s", path);
+    return true;
+}
+
+// Replace the world with rows of chunks from the file, which has to be as wide. Chunk rows
+// firstRow to firstRow + rows of the file go to chunk rows localRow on, everything else is
+// left empty. The autosave journal is not applied
+bool LoadWorldRows(particle_t** grid, const char* path, int firstRow, int localRow, int rows) {
+    world_header_t header = { 0 };
+    if (!ReadHeaderFile(path, &header)) return false;
+
+    if (header.width != WIDTH || firstRow < 0 || localRow < 0 || rows < 0 ||
+        firstRow + rows > header.height / CHUNK_SIZE || localRow + rows > sim->chunksY) {
+        TraceLog(LOG_WARNING, "WORLD: %s is %ix%i, chunk rows %i to %i of it don't fit the world", path, header.width,
+                 header.height, firstRow, firstRow + rows);
+        return false;
+    }
+    if (!LoadChunkRows(grid, path, &header, firstRow, localRow, rows)) return false;
+
+    if (header.generation != 0) TraceLog(LOG_WARNING, "WORLD: Leaving out the chunks of %s saved since it was last written whole", path);
+    TraceLog(LOG_INFO, "WORLD: Loaded chunk rows %i to %i of %s", firstRow, firstRow + rows, path);
+    return true;
+}
+
+// Let go of the last loaded file, packed chunks still borrowing from it get their own copy
+void UnloadWorldFile(void) {
+    if (sim->fileData == NULL) return;
+    OwnBorrowedChunks();
+
+#if defined(WORLD_MMAP)
+    if (sim->fileMapped) munmap(sim->fileData, sim->fileSize);
+    else free(sim->fileData);
+#else
+    free(sim->fileData);
+#endif
+    sim->fileData = NULL;
+    sim->fileSize = 0;
+    sim->fileMapped = false;
+}
+
+// Free every particle and forget every packed chunk, the fields go back to rest
+void ClearGrid(particle_t** grid) {
+    // Packed chunks may hold real particles in their empty cells, only placeholders stay
+    for (int y = 0; y < HEIGHT; y++) {
+        particle_t** row = grid + GetIndex(0, y);
+        for (int x = 0; x < WIDTH; x++) {
+            if (!IsPlaceholder(row[x])) free(row[x]);
+            row[x] = NULL;
+        }
+    }
+
+    ClearPackedChunks();
+    ResetChunkActivity();
+    ResetTemperature();
+    ResetGasField();
+}
+
+// Flush a file and wait for the data to reach the disk, false when anything failed to write
+bool SyncWorldFile(FILE* file) {
+    bool ok = (fflush(file) == 0) && !ferror(file);
+#if defined(_WIN32)
+    if (ok) ok = (_commit(_fileno(file)) == 0);
+#else
+    if (ok) ok = (fsync(fileno(file)) == 0);
+#endif
+    return ok;
+}
+
+// A blob whose every row is one run of empty cells
+bool IsEmptyBlob(chunk_blob_t blob) {
+    if (blob.size != 8 + CHUNK_SIZE * 2) return false;
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        if (blob.data[9 + y * 2] != NOTHING) return false;
+    }
+    return true;
+}
+
+// LZ4 style block: a token with the literal count in the high nibble and the match length
+// minus LZ_MIN_MATCH in the low one, both extended with extra bytes when they reach 15, then
+// the literals and a u16 offset back to the match. The last sequence is literals only.
+// dst needs room for LZ_MAX_BYTES(size)
+int CompressLz(const unsigned char* src, int size, unsigned char* dst) {
+    int table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    int out = 0, anchor = 0, i = 0;
+    while (i + LZ_MIN_MATCH + LZ_LAST_LITERALS <= size) {
+        unsigned int sequence = 0;
+        memcpy(&sequence, src + i, 4);
+        int h = (int)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+        int candidate = table[h];
+        table[h] = i;
+
+        if (candidate < 0 || i - candidate > 0xFFFF || memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+
+        int length = LZ_MIN_MATCH;
+        while (i + length < size - LZ_LAST_LITERALS && src[candidate + length] == src[i + length]) length++;
+
+        int literals = i - anchor;
+        int matchCode = length - LZ_MIN_MATCH;
+        dst[out++] = (unsigned char)(((literals < 15) ? literals : 15) << 4 | ((matchCode < 15) ? matchCode : 15));
+        if (literals >= 15) out = PutLength(dst, out, literals - 15);
+        memcpy(dst + out, src + anchor, literals);
+        out += literals;
+
+        int distance = i - candidate;
+        dst[out++] = (unsigned char)(distance & 0xFF);
+        dst[out++] = (unsigned char)(distance >> 8);
+        if (matchCode >= 15) out = PutLength(dst, out, matchCode - 15);
+
+        i += length;
+        anchor = i;
+    }
+
+    int literals = size - anchor;
+    dst[out++] = (unsigned char)(((literals < 15) ? literals : 15) << 4);
+    if (literals >= 15) out = PutLength(dst, out, literals - 15);
+    memcpy(dst + out, src + anchor, literals);
+    return out + literals;
+}
+
+// Returns the decompressed size, -1 when the data doesn't fit or is broken
+int DecompressLz(const unsigned char* src, int size, unsigned char* dst, int capacity) {
+    int in = 0, out = 0;
+    while (in < size) {
+        int token = src[in++];
+
+        int literals = token >> 4;
+        if (literals == 15) {
+            int extra = 255;
+            while (extra == 255 && in < size) {
+                extra = src[in++];
+                literals += extra;
+            }
+        }
+        if (in + literals > size || out + literals > capacity) return -1;
+        memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+        if (in == size) break;
+
+        if (in + 2 > size) return -1;
+        int distance = src[in] | (src[in + 1] << 8);
+        in += 2;
+
+        int length = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            int extra = 255;
+            while (extra == 255 && in < size) {
+                extra = src[in++];
+                length += extra;
+            }
+        }
+        if (distance == 0 || distance > out || out + length > capacity) return -1;
+
+        // Byte by byte, matches may overlap what they produce
+        for (int n = 0; n < length; n++, out++) dst[out] = dst[out - distance];
+    }
+    return out;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Packed chunks as they are, everything else encoded from its particles
+static world_chunk_t GridChunk(int cx, int cy, void* user) {
+    particle_t** grid = (particle_t**)user;
+    world_chunk_t chunk = { 0 };
+    const chunk_blob_t* packed = GetPackedChunk(cx, cy);
+
+    chunk.blob = (packed != NULL) ? *packed : EncodeChunk(grid, cx, cy);
+    chunk.owned = (packed == NULL);
+    chunk.awake = IsChunkAwake(cx, cy);
+    return chunk;
+}
+
+static bool ReadHeader(FILE* file, world_header_t* header, const char* path) {
+    if (fread(header, sizeof(world_header_t), 1, file) != 1 || header->magic != WORLD_MAGIC) {
+        TraceLog(LOG_WARNING, "WORLD: %s is not a world file", path);
+        return false;
+    }
+    if (header->version != WORLD_VERSION || header->chunkSize != CHUNK_SIZE) {
+        TraceLog(LOG_WARNING, "WORLD: %s is version %i with %i cell chunks, only version %i with %i cell chunks can be read",
+                 path, header->version, header->chunkSize, WORLD_VERSION, CHUNK_SIZE);
+        return false;
+    }
+    if (header->materialHash != MaterialHash()) {
+        TraceLog(LOG_WARNING, "WORLD: %s was saved with a different material table", path);
+        return false;
+    }
+    if (header->width <= 0 || header->height <= 0 || header->width % CHUNK_SIZE != 0 || header->height % CHUNK_SIZE != 0 ||
+        header->chunkCount != (unsigned int)(header->width / CHUNK_SIZE) * (unsigned int)(header->height / CHUNK_SIZE)) {
+        TraceLog(LOG_WARNING, "WORLD: %s has a broken header", path);
+        return false;
+    }
+    return true;
+}
+
+static bool ReadHeaderFile(const char* path, world_header_t* header) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "WORLD: Could not open %s", path);
+        return false;
+    }
+    bool ok = ReadHeader(file, header, path);
+    fclose(file);
+    return ok;
+}
+
+// Install chunk rows of the file as packed chunks, see LoadWorldRows
+static bool LoadChunkRows(particle_t** grid, const char* path, const world_header_t* header, int firstRow, int localRow, int rows) {
+    UnloadWorldFile();
+    if (!OpenFileData(path)) return false;
+
+    int fileChunksX = header->width / CHUNK_SIZE;
+    size_t directoryEnd = sizeof(world_header_t) + (size_t)header->chunkCount * sizeof(world_chunk_entry_t);
+    if (sim->fileSize < directoryEnd) {
+        TraceLog(LOG_WARNING, "WORLD: %s is cut short", path);
+        UnloadWorldFile();
+        return false;
+    }
+
+    // Every chunk is read and checked before the world is touched, so a file with a broken
+    // chunk leaves the world as it was
+    int count = rows * sim->chunksX;
+    chunk_blob_t* blobs = (chunk_blob_t*) calloc(count > 0 ? count : 1, sizeof(chunk_blob_t));
+    world_chunk_entry_t* entries = (world_chunk_entry_t*) calloc(count > 0 ? count : 1, sizeof(world_chunk_entry_t));
+
+    int broken = 0;
+    for (int row = 0; row < rows; row++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            int c = row * sim->chunksX + cx;
+            world_chunk_entry_t* entry = &entries[c];
+            memcpy(entry, sim->fileData + sizeof(world_header_t) + ((firstRow + row) * fileChunksX + cx) * sizeof(*entry), sizeof(*entry));
+            if (entry->codec == CODEC_EMPTY) continue;
+
+            bool fits = entry->offset <= sim->fileSize && entry->size <= sim->fileSize - entry->offset && entry->packedSize <= CHUNK_MAX_BYTES;
+            if (!fits || (entry->codec != CODEC_PACKED && entry->codec != CODEC_LZ) ||
+                (entry->codec == CODEC_PACKED && entry->size != entry->packedSize)) {
+                broken++;
+                continue;
+            }
+
+            chunk_blob_t blob = { sim->fileData + entry->offset, (int)entry->size, 0 };
+            if (entry->codec == CODEC_LZ) {
+                blob.data = (unsigned char*) malloc(entry->packedSize > 0 ? entry->packedSize : 1);
+                blob.size = DecompressLz(sim->fileData + entry->offset, entry->size, blob.data, entry->packedSize);
+            }
+
+            if (blob.size != (int)entry->packedSize || !IsValidBlob(blob)) {
+                if (entry->codec == CODEC_LZ) free(blob.data);
+                broken++;
+                continue;
+            }
+            blobs[c] = blob;
+        }
+    }
+
+    if (broken > 0) {
+        TraceLog(LOG_WARNING, "WORLD: %i chunks of %s could not be read, the world is left as it was", broken, path);
+        for (int c = 0; c < count; c++) {
+            if (entries[c].codec == CODEC_LZ) free(blobs[c].data);
+        }
+        free(blobs);
+        free(entries);
+        UnloadWorldFile();
+        return false;
+    }
+
+    ClearGrid(grid);
+
+    for (int c = 0; c < count; c++) {
+        if (blobs[c].data == NULL) continue;
+
+        int cx = c % sim->chunksX, cy = localRow + c / sim->chunksX;
+        AdoptPackedChunk(grid, cx, cy, blobs[c], entries[c].codec == CODEC_PACKED);
+
+        // A cell inside the chunk wakes it and none of its neighbours
+        if (entries[c].awake) WakeCell(cx * CHUNK_SIZE + 1, cy * CHUNK_SIZE + 1);
+    }
+
+    sim->frameCounter = header->tick;
+    sim->randomState = header->randomState;
+
+    free(blobs);
+    free(entries);
+    return true;
+}
+
+// Map the whole file where possible, read it otherwise
+static bool OpenFileData(const char* path) {
+#if defined(WORLD_MMAP)
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            sim->fileData = (unsigned char*) mapped;
+            sim->fileSize = (size_t)info.st_size;
+            sim->fileMapped = true;
+            close(fd);
+            return true;
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        TraceLog(LOG_WARNING, "WORLD: Could not open %s", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    sim->fileData = (unsigned char*) malloc(size > 0 ? size : 1);
+    sim->fileSize = (size > 0 && fread(sim->fileData, 1, size, file) == (size_t)size) ? (size_t)size : 0;
+    sim->fileMapped = false;
+    fclose(file);
+    return sim->fileSize > 0;
+}
+
+// FNV-1a over the material table, so files only load into a build whose materials match.
+// Field by field in a fixed byte order, so padding and the size of enums don't change it
+static unsigned int MaterialHash(void) {
+    unsigned int hash = 2166136261u;
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+        const mat_prop_t* p = &sim->props[m];
+        hash = HashFloat(hash, p->modX);
+        hash = HashFloat(hash, p->modY);
+        hash = HashFloat(hash, p->maxX);
+        hash = HashFloat(hash, p->maxY);
+        hash = HashValue(hash, (unsigned int)p->flammableProbability);
+        hash = HashFloat(hash, p->initLifeTime);
+        hash = HashValue(hash, p->decaying);
+        hash = HashValue(hash, p->acting);
+        hash = HashValue(hash, p->flammable);
+        hash = HashValue(hash, (unsigned int)p->type);
+        hash = HashValue(hash, p->initialColor.r | p->initialColor.g << 8 | p->initialColor.b << 16 | (unsigned int)p->initialColor.a << 24);
+        hash = HashFloat(hash, p->heatTarget);
+        hash = HashFloat(hash, p->heatRate);
+        hash = HashFloat(hash, p->hotTemperature);
+        hash = HashValue(hash, (unsigned int)p->hotMat);
+        hash = HashFloat(hash, p->coldTemperature);
+        hash = HashValue(hash, (unsigned int)p->coldMat);
+    }
+    return hash;
+}
+
+// Four bytes of a value into the hash, lowest first
+static unsigned int HashValue(unsigned int hash, unsigned int value) {
+    for (int b = 0; b < 4; b++) {
+        hash ^= (value >> (b * 8)) & 0xFF;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned int HashFloat(unsigned int hash, float value) {
+    unsigned int bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return HashValue(hash, bits);
+}
+
+static int PutLength(unsigned char* dst, int out, int length) {
+    while (length >= 255) {
+        dst[out++] = 255;
+        length -= 255;
+    }
+    dst[out++] = (unsigned char)length;
+    return out;
+}
@@ -0,0 +1,32 @@
+-- Tests of the game's modules, a console program that returns 0 when they pass. It builds
+-- against the game's sources, raylib_game.cpp comes in through tests.cpp's own #include.
+
+baseName = path.getbasename(os.getcwd());
+
+project (baseName)
+    kind "ConsoleApp"
+    location "./"
+    targetdir "../bin/%{cfg.buildcfg}"
+
+    filter "action:vs*"
+        debugdir "$(SolutionDir)"
+    filter {}
+
+    vpaths 
+    {
+        ["Header Files/*"] = { "src/**.h", "../game/src/**.h" },
+        ["Source Files/*"] = { "src/**.cpp", "../game/src/**.cpp" },
+    }
+    files {"src/**.cpp", "src/**.h", "../game/src/**.cpp", "../game/src/**.h"}
+    removefiles {"../game/src/raylib_game.cpp"}
+
+    includedirs { "src" }
+    includedirs { "../game/src" }
+
+    link_raylib()
+
+    filter "system:windows"
+        links {"ws2_32"}
+    filter "system:linux"
+        links {"rt"}
+    filter {}
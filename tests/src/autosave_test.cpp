@@ -0,0 +1,123 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Autosave test
+*
+*   Repaints the whole world round after round until the journal outgrows the world file
+*   and gets compacted into a new generation, then changes a corner for a few more rounds
+*   that only reach the journal. Loading the autosave has to give back the world as it was
+*   left, colours included, and loading the world file without its journal must not.
+*
+**********************************************************************************************/
+
+#include "tests.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define AUTOSAVE_PATH "autosave_test.ppw"
+#define JOURNAL_PATH AUTOSAVE_PATH ".log"
+#define REPAINT_ROUNDS_MAX 60
+#define CORNER_ROUNDS 3
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void Repaint(particle_t** grid, int width, int height);
+static void SaveRound(particle_t** grid);
+static unsigned int ReadGeneration(const char* path);
+static unsigned int HashCells(particle_t** grid);
+
+bool TestAutosave(particle_t** grid) {
+    remove(AUTOSAVE_PATH);
+    remove(JOURNAL_PATH);
+    InitAutosave(AUTOSAVE_PATH, 0.0f);
+
+    // The first round writes the world file, every later one goes to the journal until it
+    // gets too long
+    Repaint(grid, WIDTH, HEIGHT);
+    SaveRound(grid);
+    unsigned int first = 0;
+    int rounds = 0;
+    while (rounds < REPAINT_ROUNDS_MAX) {
+        Repaint(grid, WIDTH, HEIGHT);
+        SaveRound(grid);
+        rounds++;
+
+        unsigned int generation = ReadGeneration(AUTOSAVE_PATH);
+        if (first == 0) first = generation;
+        else if (generation != first) break;
+    }
+    bool compacted = rounds < REPAINT_ROUNDS_MAX;
+
+    for (int n = 0; n < CORNER_ROUNDS; n++) {
+        Repaint(grid, CHUNK_SIZE, CHUNK_SIZE);
+        SaveRound(grid);
+    }
+    UnloadAutosave(grid);
+    unsigned int saved = HashCells(grid);
+
+    ClearGrid(grid);
+    bool replayed = LoadWorldFile(grid, AUTOSAVE_PATH) && HashCells(grid) == saved;
+
+    remove(JOURNAL_PATH);
+    ClearGrid(grid);
+    bool journalNeeded = LoadWorldFile(grid, AUTOSAVE_PATH) && HashCells(grid) != saved;
+
+    UnloadWorldFile();
+    remove(AUTOSAVE_PATH);
+
+    printf("AUTOSAVE: compacted after %d rounds %d, replayed %d, journal needed %d\n", rounds, compacted, replayed, journalNeeded);
+    return compacted && replayed && journalNeeded;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// New sand in every cell of the top left width x height, each with a fresh shade
+static void Repaint(particle_t** grid, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = GetIndex(x, y);
+            if (grid[i] != NULL && !IsPlaceholder(grid[i])) free(grid[i]);
+            grid[i] = NULL;
+        }
+    }
+    for (int cy = 0; cy < height / CHUNK_SIZE; cy++) {
+        for (int cx = 0; cx < width / CHUNK_SIZE; cx++) DiscardChunk(grid, cx, cy);
+    }
+    FillRect(grid, 0, 0, width - 1, height - 1, SAND);
+}
+
+// Rounds are only taken while the writer is idle
+static void SaveRound(particle_t** grid) {
+    while (!UpdateAutosave(grid)) WaitTime(0.001);
+}
+
+static unsigned int ReadGeneration(const char* path) {
+    world_header_t header = { 0 };
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    if (fread(&header, sizeof(header), 1, file) != 1) header.generation = 0;
+    fclose(file);
+    return header.generation;
+}
+
+// FNV-1a over the material and colour of every cell as the packed format keeps them
+static unsigned int HashCells(particle_t** grid) {
+    chunk_cell_t* cells = (chunk_cell_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(chunk_cell_t));
+    unsigned int hash = 2166136261u;
+
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) {
+            GatherChunk(grid, cx, cy, cells);
+            for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+                unsigned char bytes[5] = { cells[i].mat, cells[i].color.r, cells[i].color.g, cells[i].color.b, cells[i].color.a };
+                if (cells[i].mat == NOTHING) memset(bytes + 1, 0, 4);
+                for (int b = 0; b < 5; b++) hash = (hash ^ bytes[b]) * 16777619u;
+            }
+        }
+    }
+
+    free(cells);
+    return hash;
+}
@@ -0,0 +1,63 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Undo history test
+*
+*   Two strokes over a stone floor, a block of sand across several chunks and a line that
+*   erases through it. Undoing both has to give back each step cell for cell, colours
+*   included, redoing both has to give back the strokes, and a new stroke after an undo has
+*   to drop what could still be redone.
+*
+**********************************************************************************************/
+
+#include "tests.h"
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static void Stroke(particle_t** grid, edit_type_t type, int x0, int y0, int x1, int y1, int radius, particle_mat_t mat);
+static unsigned int HashCells(particle_t** grid);
+
+bool TestHistory(particle_t** grid) {
+    // Not part of any checkpoint, undo stops at it
+    FillRect(grid, 0, 200, WIDTH - 1, 200, STONE);
+    unsigned int floor = HashCells(grid);
+
+    Stroke(grid, EDIT_RECT, 40, 100, 150, 180, 0, SAND);
+    unsigned int sand = HashCells(grid);
+    Stroke(grid, EDIT_LINE, 30, 90, 160, 190, 8, NOTHING);
+    unsigned int erased = HashCells(grid);
+
+    bool undone = UndoCheckpoint(grid) && HashCells(grid) == sand &&
+                  UndoCheckpoint(grid) && HashCells(grid) == floor && !UndoCheckpoint(grid);
+    bool redone = RedoCheckpoint(grid) && HashCells(grid) == sand &&
+                  RedoCheckpoint(grid) && HashCells(grid) == erased && !RedoCheckpoint(grid);
+
+    // Back to the sand and draw over it instead, the erase can't come back on top
+    bool dropped = UndoCheckpoint(grid);
+    Stroke(grid, EDIT_CIRCLE, 300, 150, 0, 0, 10, WATER);
+    dropped = dropped && !RedoCheckpoint(grid) && UndoCheckpoint(grid) && HashCells(grid) == sand;
+
+    printf("HISTORY: undone %d, redone %d, redo dropped by a new stroke %d\n", undone, redone, dropped);
+    return undone && redone && dropped;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// One edit as its own checkpoint, the way the brush sends a stroke
+static void Stroke(particle_t** grid, edit_type_t type, int x0, int y0, int x1, int y1, int radius, particle_mat_t mat) {
+    edit_t edit = { type, x0, y0, x1, y1, radius, mat, EDIT_ANY, 1.0f, 0 };
+    BeginCheckpoint();
+    QueueEdit(&edit);
+    ApplyEdits(grid);
+}
+
+// The cells alone, HashWorld also takes in the random state the strokes moved on
+static unsigned int HashCells(particle_t** grid) {
+    unsigned int hash = 2166136261u;
+    for (int cy = 0; cy < sim->chunksY; cy++) {
+        for (int cx = 0; cx < sim->chunksX; cx++) hash = (hash ^ HashChunk(grid, cx, cy)) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,42 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Quench test
+*
+*   Two fires on a stone floor, one against a pool of water and one on its own. The one
+*   against the water has to go out within a few ticks while the other one still burns, so
+*   it was the water that put it out and not the fire burning down.
+*
+**********************************************************************************************/
+
+#include "tests.h"
+
+#define FLOOR_Y 200
+#define QUENCH_TICKS 10
+
+bool TestQuench(particle_t** grid) {
+    FillRect(grid, 0, FLOOR_Y, WIDTH - 1, FLOOR_Y, STONE);
+
+    // Walls on either side keep the pool against the first fire
+    FillRect(grid, 99, FLOOR_Y - 20, 99, FLOOR_Y - 1, STONE);
+    FillRect(grid, 141, FLOOR_Y - 20, 141, FLOOR_Y - 1, STONE);
+    FillRect(grid, 100, FLOOR_Y - 1, 100, FLOOR_Y - 1, FIRE);
+    FillRect(grid, 101, FLOOR_Y - 10, 140, FLOOR_Y - 1, WATER);
+
+    FillRect(grid, 300, FLOOR_Y - 1, 300, FLOOR_Y - 1, FIRE);
+
+    int ticks = 0;
+    particle_t* wet = grid[GetIndex(100, FLOOR_Y - 1)];
+    while (ticks < QUENCH_TICKS && wet != NULL && wet->mat == FIRE) {
+        RunTicks(grid, 1);
+        wet = grid[GetIndex(100, FLOOR_Y - 1)];
+        ticks++;
+    }
+
+    particle_t* dry = grid[GetIndex(300, FLOOR_Y - 1)];
+    bool quenched = (wet == NULL || wet->mat != FIRE);
+    bool burning = (dry != NULL && dry->mat == FIRE);
+
+    printf("QUENCH: fire against water %s after %d ticks, fire on its own %s\n",
+           quenched ? "out" : "still burning", ticks, burning ? "still burning" : "out");
+    return quenched && burning;
+}
@@ -0,0 +1,34 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Streaming test
+*
+*   Pages a chunk out to the store and back in, and checks nothing of it went missing. The
+*   chunk is water under an empty top row, which packs plain and used to be taken for an
+*   empty chunk and thrown away. The store is removed once the test is done.
+*
+**********************************************************************************************/
+
+#include "tests.h"
+
+#define STORE_DIRECTORY "streaming_test_store"
+
+bool TestStreaming(particle_t** grid) {
+    InitStreaming(STORE_DIRECTORY, 64);
+
+    // Chunk 0, 0: the top row empty, every row under it water
+    FillRect(grid, 0, 1, CHUNK_SIZE - 1, CHUNK_SIZE - 1, WATER);
+    int before = CountMaterial(grid, WATER);
+
+    // Near the right edge the window moves 3 chunks right, chunk 0 falls off and pages out.
+    // Near the left edge it moves back and the chunk pages in again
+    Vector2Int moved = UpdateStreaming(grid, { 7.5f * CHUNK_SIZE, 4.5f * CHUNK_SIZE }, { 0, 0 });
+    int away = CountMaterial(grid, WATER);
+    Vector2Int back = UpdateStreaming(grid, { 1.5f * CHUNK_SIZE, 4.5f * CHUNK_SIZE }, { 0, 0 });
+    int after = CountMaterial(grid, WATER);
+
+    UnloadStreaming();
+    RemoveTestDirectory(STORE_DIRECTORY);
+
+    printf("STREAMING: %d water cells, %d while away, %d back\n", before, away, after);
+    return moved.x == 3 * CHUNK_SIZE && back.x == -3 * CHUNK_SIZE && away == 0 && after == before;
+}
@@ -0,0 +1,120 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Test runner
+*
+*   Sets up the world once, runs every test on it and returns how many failed, 0 when they
+*   all passed.
+*
+**********************************************************************************************/
+
+// The game's translation unit brings the material table and the particle functions along,
+// its main is kept out of the way
+#define main GameMain
+#include "raylib_game.cpp"
+#undef main
+
+#include "tests.h"
+
+#if defined(_WIN32)
+    #include <direct.h>
+    #define rmdir _rmdir
+#else
+    #include <unistd.h>
+#endif
+
+typedef bool (*test_t)(particle_t** grid);
+
+typedef struct test_entry_t {
+    const char* name;
+    test_t run;
+} test_entry_t;
+
+static const test_entry_t tests[] = {
+    { "quench", TestQuench },
+    { "world file", TestWorldFile },
+    { "autosave", TestAutosave },
+    { "history", TestHistory },
+    { "streaming", TestStreaming },
+};
+
+//----------------------------------------------------------------------------------
+// Program main entry point
+//----------------------------------------------------------------------------------
+int main(void) {
+    SetTraceLogLevel(LOG_WARNING);
+    InitWorld(TEST_CHUNKS * CHUNK_SIZE, TEST_CHUNKS * CHUNK_SIZE);
+    particle_t** grid = (particle_t**) calloc(STRIDE * HEIGHT, sizeof(particle_t*));
+    InitMoveTables();
+    InitTemperature();
+    InitGasField();
+    InitLiquidPressure();
+    InitCompression();
+    InitEdits();
+    InitHistory();
+
+    int failed = 0;
+    for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        ClearGrid(grid);
+        ClearHistory();
+        sim->frameCounter = 0;
+
+        bool passed = tests[t].run(grid);
+        printf("TEST: %s - %s\n", tests[t].name, passed ? "passed" : "FAILED");
+        if (!passed) failed++;
+    }
+
+    ClearGrid(grid);
+    UnloadTemperature();
+    UnloadGasField();
+    UnloadLiquidPressure();
+    UnloadWorldFile();
+    UnloadCompression();
+    UnloadEdits();
+    UnloadHistory();
+    UnloadWorkers();
+    free(grid);
+    UnloadWorld();
+    return failed;
+}
+
+//----------------------------------------------------------------------------------
+// Helper Functions Definition
+//----------------------------------------------------------------------------------
+
+// Packed cells point at a placeholder of their material, so they count as well
+int CountMaterial(particle_t** grid, particle_mat_t material) {
+    int count = 0;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            particle_t* p = grid[GetIndex(x, y)];
+            if (p != NULL && p->mat == material) count++;
+        }
+    }
+    return count;
+}
+
+// New particles in every empty cell of the rectangle, inclusive, waking their chunks
+void FillRect(particle_t** grid, int x0, int y0, int x1, int y1, particle_mat_t material) {
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            int i = GetIndex(x, y);
+            if (grid[i] != NULL) continue;
+            grid[i] = CreateParticle(material);
+            WakeCell(x, y);
+        }
+    }
+}
+
+// Ticks of the whole world in view at the fixed time step
+void RunTicks(particle_t** grid, int ticks) {
+    Rectangle view = { 0, 0, (float)WIDTH, (float)HEIGHT };
+    for (int n = 0; n < ticks; n++) TickWorld(grid, view, FIXED_DT);
+}
+
+// A directory of files and the directory itself
+void RemoveTestDirectory(const char* directory) {
+    FilePathList files = LoadDirectoryFiles(directory);
+    for (unsigned int i = 0; i < files.count; i++) remove(files.paths[i]);
+    UnloadDirectoryFiles(files);
+    rmdir(directory);
+}
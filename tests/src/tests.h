@@ -0,0 +1,35 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - Tests
+*
+*   Every test gets the same world of TEST_CHUNKS x TEST_CHUNKS chunks, emptied before it
+*   runs, and returns whether it passed after printing a line about what it saw. Files go
+*   to the working directory and are removed again by the test that wrote them.
+*
+**********************************************************************************************/
+
+#ifndef TESTS_H
+#define TESTS_H
+
+#include "simulation.h"
+
+#define TEST_CHUNKS 8
+
+//----------------------------------------------------------------------------------
+// Test Functions Declaration
+//----------------------------------------------------------------------------------
+bool TestQuench(particle_t** grid);             // quench_test.cpp
+bool TestWorldFile(particle_t** grid);          // world_file_test.cpp
+bool TestAutosave(particle_t** grid);           // autosave_test.cpp
+bool TestHistory(particle_t** grid);            // history_test.cpp
+bool TestStreaming(particle_t** grid);          // streaming_test.cpp
+
+//----------------------------------------------------------------------------------
+// Helper Functions Declaration (tests.cpp)
+//----------------------------------------------------------------------------------
+int CountMaterial(particle_t** grid, particle_mat_t material);
+void FillRect(particle_t** grid, int x0, int y0, int x1, int y1, particle_mat_t material);
+void RunTicks(particle_t** grid, int ticks);
+void RemoveTestDirectory(const char* directory);
+
+#endif // TESTS_H
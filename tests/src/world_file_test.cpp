@@ -0,0 +1,63 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World file test
+*
+*   Saves a world stored as is and compressed, loads both back over an empty world and
+*   compares every cell. Then breaks a chunk's directory entry and checks the load is
+*   refused with the world left as it was.
+*
+**********************************************************************************************/
+
+#include "tests.h"
+
+#define PLAIN_PATH "world_file_test.ppw"
+#define PACKED_PATH "world_file_test_lz.ppw"
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool BreakChunkEntry(const char* path, int chunk);
+
+bool TestWorldFile(particle_t** grid) {
+    // Sand, water and stone, and chunks left empty in between
+    FillRect(grid, 0, 0, WIDTH - 1, 63, SAND);
+    FillRect(grid, 128, 200, 383, 300, WATER);
+    FillRect(grid, 0, HEIGHT - 8, WIDTH - 1, HEIGHT - 1, STONE);
+    unsigned int saved = HashWorld(grid);
+
+    bool written = SaveWorldFile(grid, PLAIN_PATH, false) && SaveWorldFile(grid, PACKED_PATH, true);
+
+    ClearGrid(grid);
+    bool plainLoaded = LoadWorldFile(grid, PLAIN_PATH) && HashWorld(grid) == saved;
+    ClearGrid(grid);
+    bool packedLoaded = LoadWorldFile(grid, PACKED_PATH) && HashWorld(grid) == saved;
+
+    // A chunk whose data runs past the end of the file spoils the whole load
+    bool refused = BreakChunkEntry(PLAIN_PATH, 1) && !LoadWorldFile(grid, PLAIN_PATH);
+    bool kept = HashWorld(grid) == saved;
+
+    UnloadWorldFile();
+    remove(PLAIN_PATH);
+    remove(PACKED_PATH);
+
+    printf("WORLD FILE: written %d, loaded as is %d, compressed %d, broken refused %d, world kept %d\n",
+           written, plainLoaded, packedLoaded, refused, kept);
+    return written && plainLoaded && packedLoaded && refused && kept;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+static bool BreakChunkEntry(const char* path, int chunk) {
+    FILE* file = fopen(path, "r+b");
+    if (file == NULL) return false;
+
+    world_chunk_entry_t entry;
+    long at = (long)(sizeof(world_header_t) + chunk * sizeof(world_chunk_entry_t));
+    bool ok = fseek(file, at, SEEK_SET) == 0 && fread(&entry, sizeof(entry), 1, file) == 1;
+    entry.size = 0x7FFFFFFF;
+    ok = ok && fseek(file, at, SEEK_SET) == 0 && fwrite(&entry, sizeof(entry), 1, file) == 1;
+    fclose(file);
+    return ok && entry.codec != CODEC_EMPTY;
+}
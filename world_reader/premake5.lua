@@ -0,0 +1,28 @@
+-- Reference reader for the world the game shares with --share, see game/src/world_export.h.
+-- Needs nothing of raylib, only the shared memory code of the game.
+
+baseName = path.getbasename(os.getcwd());
+
+project (baseName)
+    kind "ConsoleApp"
+    location "./"
+    targetdir "../bin/%{cfg.buildcfg}"
+
+    filter "action:vs*"
+        debugdir "$(SolutionDir)"
+    filter {}
+
+    vpaths 
+    {
+        ["Header Files/*"] = { "src/**.h", "../game/src/world_export.h", "../game/src/shared_memory.h" },
+        ["Source Files/*"] = { "src/**.cpp", "../game/src/shared_memory.cpp" },
+    }
+    files {"src/**.cpp", "src/**.h", "../game/src/shared_memory.cpp", "../game/src/shared_memory.h", "../game/src/world_export.h"}
+
+    includedirs { "src" }
+    includedirs { "../game/src" }
+
+    -- shm_open lives in librt on older glibc
+    filter "system:linux"
+        links {"rt"}
+    filter {}
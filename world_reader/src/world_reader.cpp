@@ -0,0 +1,160 @@
+/**********************************************************************************************
+*
+*   PixelPhysics - World reader
+*
+*   Reference reader for the world a running game shares with --share <name>. Keeps a copy
+*   of the materials, brought up to date with only the chunks each publish rewrote, and
+*   prints how many cells of each material there are once a second.
+*
+*   Usage: world_reader <name> [--seconds <n>]
+*
+*   Reads follow the seqlock in world_export.h: the chunks that changed are copied while
+*   the sequence stays even and the same, and copied again when the game published in the
+*   middle of it. The game never waits for a reader.
+*
+**********************************************************************************************/
+
+#include "shared_memory.h"
+#include "world_export.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#define POLL_MS 5                       // Between looks at the sequence
+#define OPEN_SECONDS 30                 // Waiting for the game to create the segment
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static std::vector<unsigned char> cells;            // Copy of the materials
+static std::vector<unsigned int> seenFrames;        // Publish each chunk was last copied from
+static unsigned int seenSequence = 0;
+
+//----------------------------------------------------------------------------------
+// Local Functions Declaration
+//----------------------------------------------------------------------------------
+static bool ReadFrame(const world_export_header_t* header, unsigned int* tick, int* copied);
+static void PrintCounts(const world_export_header_t* header, unsigned int tick, int publishes, int copied);
+
+//----------------------------------------------------------------------------------
+// Program main entry point
+//----------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: %s <name> [--seconds <n>]\n", argv[0]);
+        return 1;
+    }
+    const char* name = argv[1];
+    double seconds = 0.0;
+    for (int a = 2; a < argc - 1; a++) {
+        if (strcmp(argv[a], "--seconds") == 0) seconds = atof(argv[a + 1]);
+    }
+
+    shared_memory_t segment;
+    int waited = 0;
+    while (!OpenSharedMemory(name, &segment)) {
+        if (waited++ >= OPEN_SECONDS) {
+            printf("READER: Nothing shared as %s\n", name);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    const world_export_header_t* header = (const world_export_header_t*)segment.data;
+    if (segment.size < sizeof(world_export_header_t) || header->magic != WORLD_EXPORT_MAGIC ||
+        header->version != WORLD_EXPORT_VERSION || segment.size < header->bytes) {
+        printf("READER: %s isn't a world export this reader knows\n", name);
+        CloseSharedMemory(&segment);
+        return 1;
+    }
+
+    printf("READER: %s is %d x %d cells in %d x %d chunks%s\n", name, header->width, header->height,
+           header->chunksX, header->chunksY, (header->flags & WORLD_EXPORT_COLORS) ? ", with colours" : "");
+    cells.assign((size_t)header->width * header->height, 0);
+    seenFrames.assign((size_t)header->chunksX * header->chunksY, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastPrint = start;
+    int publishes = 0, copied = 0;
+    unsigned int tick = 0;
+
+    while (seconds <= 0.0 || std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds) {
+        int chunks = 0;
+        if (ReadFrame(header, &tick, &chunks)) {
+            publishes++;
+            copied += chunks;
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPrint >= std::chrono::seconds(1)) {
+            PrintCounts(header, tick, publishes, copied);
+            lastPrint = now;
+            publishes = 0;
+            copied = 0;
+        }
+    }
+
+    CloseSharedMemory(&segment);
+    return 0;
+}
+
+//----------------------------------------------------------------------------------
+// Local Functions Definition
+//----------------------------------------------------------------------------------
+
+// Copy the chunks written since they were last copied. False when nothing new was published
+// or the game was publishing, so it's worth trying again shortly
+static bool ReadFrame(const world_export_header_t* header, unsigned int* tick, int* copied) {
+    unsigned int before = header->sequence.load(std::memory_order_acquire);
+    if ((before & 1) || before == seenSequence) return false;
+
+    const unsigned char* base = (const unsigned char*)header;
+    const unsigned char* materials = base + header->materials;
+    const unsigned int* chunkFrames = (const unsigned int*)(base + header->chunkFrames);
+    int size = header->chunkSize, chunksX = header->chunksX, chunksY = header->chunksY, width = header->width;
+
+    // Marked as copied only once the sequence says the copies are whole
+    static std::vector<int> list;
+    static std::vector<unsigned int> frames;
+    list.clear();
+    frames.clear();
+
+    for (int c = 0; c < chunksX * chunksY; c++) {
+        unsigned int frame = chunkFrames[c];
+        if (frame == seenFrames[c]) continue;
+
+        int x0 = (c % chunksX) * size, y0 = (c / chunksX) * size;
+        for (int y = y0; y < y0 + size; y++) memcpy(&cells[(size_t)y * width + x0], materials + (size_t)y * width + x0, size);
+        list.push_back(c);
+        frames.push_back(frame);
+    }
+    unsigned int publishedTick = header->tick;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->sequence.load(std::memory_order_relaxed) != before) return false;
+
+    for (size_t n = 0; n < list.size(); n++) seenFrames[list[n]] = frames[n];
+    seenSequence = before;
+    *tick = publishedTick;
+    *copied = (int)list.size();
+    return true;
+}
+
+static void PrintCounts(const world_export_header_t* header, unsigned int tick, int publishes, int copied) {
+    unsigned int count = (header->materialCount < 256) ? header->materialCount : 256;
+    std::vector<unsigned long long> totals(256, 0);
+    for (unsigned char mat : cells) totals[mat]++;
+
+    printf("READER: Tick %u - %d publishes, %d chunks copied -", tick, publishes, copied);
+    for (unsigned int m = 1; m < count; m++) {
+        if (totals[m] > 0) printf(" %u:%llu", m, totals[m]);
+    }
+    printf("\n");
+    fflush(stdout);
+}